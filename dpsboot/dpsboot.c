@@ -36,7 +36,6 @@
 #include <flash.h>
 #include "tick.h"
 #include "hw.h"
-#include "ringbuf.h"
 #include "past.h"
 #include "pastunits.h"
 #include "uframe.h"
@@ -49,8 +48,8 @@
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 #endif
 
-#define RX_BUF_SIZE  (16)
 #define MAX_CHUNK_SIZE (2*1024)
+#define FLASH_PAGE_SIZE (1024)
 
 /** Our parameter storage */
 static past_t past;
@@ -63,14 +62,10 @@ extern uint32_t *_past_end;
 extern uint32_t *_bootcom_start;
 extern uint32_t *_bootcom_end;
 
-/** UART RX FIFO */
-static ringbuf_t rx_buf;
-static uint8_t buffer[2*RX_BUF_SIZE];
-
-/** UART frame buffer */
-static uint8_t frame_buffer[FRAME_OVERHEAD(MAX_CHUNK_SIZE)];
-static uint32_t rx_idx = 0;
-static bool receiving_frame = false;
+/** Received payloads are unescaped into this buffer as they arrive. One frame
+  * type byte and a chunk, plus one byte as the flash writes read whole words */
+static uint8_t frame_buffer[UFRAME_RX_SIZE(1 + MAX_CHUNK_SIZE) + 1];
+static frame_rx_t frame_rx;
 
 /** For keeping track of flash writing */
 static uint16_t chunk_size;
@@ -79,8 +74,20 @@ static uint16_t fw_crc16;
 
 static upgrade_reason_t reason = reason_unknown;
 
-static void handle_frame(uint8_t *payload, uint32_t length);
+static void handle_frame(payload_t *payload);
 static void send_frame(const frame_t *frame);
+static void send_response(command_t cmd, uint8_t success);
+static inline bool flash_write32(uint32_t address, uint32_t data);
+
+/**
+  * @brief Prepare for receiving an image from the start
+  * @retval None
+  */
+static void reset_upgrade(void)
+{
+    cur_flash_address = (uint32_t) &_app_start;
+}
+
 
 /**
   * @brief Send ack to upgrade start and do some book keeping
@@ -89,6 +96,7 @@ static void send_frame(const frame_t *frame);
 static void send_start_response(void)
 {
     frame_t frame;
+    reset_upgrade();
     set_frame_header(&frame);
     pack8(&frame, cmd_response | cmd_upgrade_start);
     pack8(&frame, upgrade_continue);
@@ -97,7 +105,6 @@ static void send_start_response(void)
     end_frame(&frame);
     uint32_t setting = 1;
     (void) past_write_unit(&past, past_upgrade_started, (void*) &setting, sizeof(setting));
-    cur_flash_address = (uint32_t) &_app_start;
     send_frame(&frame);
 }
 
@@ -112,19 +119,15 @@ static void handle_upgrade(void)
         send_start_response();
     }
 
+    uframe_rx_init(&frame_rx, frame_buffer, sizeof(frame_buffer) - 1);
     while(1) {
-        uint16_t b;
-        if (ringbuf_get(&rx_buf, &b)) {
-            if (b == _SOF) {
-                receiving_frame = true;
-                rx_idx = 0;
-            }
-            if (receiving_frame && rx_idx < sizeof(frame_buffer)) {
-                frame_buffer[rx_idx++] = b;
-                if (b == _EOF) {
-                    handle_frame(frame_buffer, rx_idx);
-                    receiving_frame = false;
-                }
+        uint8_t b;
+        if (hw_usart_get(&b)) {
+            int32_t payload_len = uframe_rx_add(&frame_rx, b);
+            if (payload_len > 0) {
+                payload_t payload;
+                uframe_rx_payload(&payload, &frame_rx, payload_len);
+                handle_frame(&payload);
             }
         }
     }
@@ -140,6 +143,7 @@ static bool start_app(void)
     uint32_t *app_start = (uint32_t*) (4 + (uint32_t) &_app_start);
     /** Is there something there we can branch to? */
     if (((*app_start) & 0xffff0000) == 0x08000000) {
+        hw_usart_rx_stop();
         /** Initialize stack pointer of user app */
         volatile uint32_t *sp = (volatile uint32_t*) &_app_start;
         __asm (
@@ -180,85 +184,140 @@ static void send_frame(const frame_t *frame)
         usart_send_blocking(USART1, frame->buffer[i]);
 }
 
+/**
+  * @brief Send a plain response
+  * @param cmd the command responded to
+  * @param success the status of the response
+  * @retval None
+  */
+static void send_response(command_t cmd, uint8_t success)
+{
+    frame_t frame;
+    protocol_create_response(&frame, cmd, success);
+    send_frame(&frame);
+}
+
+/**
+  * @brief Write the next chunk to flash, erasing pages as they are reached
+  * @param data chunk data, readable up to the next word boundary
+  * @param length length of chunk
+  * @retval upgrade_continue if the chunk was written
+  */
+static upgrade_status_t write_chunk(const uint8_t *data, uint32_t length)
+{
+    if (cur_flash_address + length > (uint32_t) &_app_end) {
+        return upgrade_overflow_error;
+    }
+    for (uint32_t i = 0; i < length; i+=4) {
+        uint32_t address = cur_flash_address + i;
+        if (address % FLASH_PAGE_SIZE == 0) {
+            flash_erase_page(address);
+            if (!(FLASH_SR_EOP & flash_get_status_flags())) {
+                return upgrade_erase_error;
+            }
+        }
+        uint32_t word = data[i+3] << 24 | data[i+2] << 16 | data[i+1] << 8 | data[i];
+        /** @todo: Handle binaries not size aliged to 4 bytes */
+        if (!flash_write32(address, word)) {
+            return upgrade_flash_error;
+        }
+    }
+    cur_flash_address += length;
+    return upgrade_continue;
+}
+
+
+/**
+  * @brief Check the crc of the flashed app
+  * @retval upgrade_success if the crc matches the one given at upgrade start
+  */
+static upgrade_status_t verify_upgrade(void)
+{
+    uint32_t length = cur_flash_address - (uint32_t) &_app_start;
+    uint16_t calc_crc = crc16((uint8_t*) &_app_start, length);
+    return fw_crc16 == calc_crc ? upgrade_success : upgrade_crc_error;
+}
+
+/**
+  * @brief Add a chunk of upgrade data, the last one being shorter than the
+  *        chunk size
+  * @param data upgrade data, readable up to the next word boundary
+  * @param length length of data
+  * @retval upgrade_continue if more data is expected, upgrade_success if the
+  *         upgrade is complete and verified, else an error
+  */
+static upgrade_status_t add_chunk(const uint8_t *data, uint32_t length)
+{
+    upgrade_status_t status = write_chunk(data, length);
+    if (status == upgrade_continue) {
+        if (length < chunk_size) {
+            status = verify_upgrade();
+        }
+    }
+    return status;
+}
+
+/**
+  * @brief Respond to upgrade data and start the app if the upgrade is done
+  * @param cmd the command responded to
+  * @param status upgrade status
+  * @retval None
+  */
+static void send_upgrade_status(command_t cmd, upgrade_status_t status)
+{
+    frame_t frame;
+    set_frame_header(&frame);
+    pack8(&frame, cmd_response | cmd);
+    pack8(&frame, status);
+    end_frame(&frame);
+    send_frame(&frame);
+    if (status == upgrade_success) {
+        usart_wait_send_ready(USART1); /** make sure FIFO is empty */
+        (void) past_erase_unit(&past, past_upgrade_started);
+        cur_flash_address = 0;
+        lock_flash();
+        if (!start_app()) {
+            handle_upgrade(); /** Try again... */
+        }
+    }
+}
+
+
 /**
   * @brief Handle a receved frame
-  * @param frame the received frame
-  * @param length length of frame
+  * @param payload payload of the received frame, the command comes first
   * @retval None
   */
-static void handle_frame(uint8_t *payload, uint32_t length)
+static void handle_frame(payload_t *payload)
 {
     command_t cmd = cmd_response;
     upgrade_status_t status;
-    frame_t frame;
-    int32_t payload_len = uframe_extract_payload(&frame, payload, length);
+    int32_t payload_len = payload->length;
+    const uint8_t *data = payload->data;
 
     if (payload_len > 0) {
-        cmd = frame.buffer[0];
+        cmd = data[0];
         switch(cmd) {
             case cmd_upgrade_start:
             {
-                {
-                    start_frame_unpacking(&frame);
-                    unpack8(&frame, &cmd);
-                    unpack16(&frame, &chunk_size);
-                    chunk_size = MIN(MAX_CHUNK_SIZE, chunk_size);
-                    unpack16(&frame, &fw_crc16);
-                }
+                (void) protocol_unpack_upgrade_start(payload, &chunk_size, &fw_crc16);
+                chunk_size = MIN(MAX_CHUNK_SIZE, chunk_size);
                 send_start_response();
                 break;
             }
             case cmd_upgrade_data:
                 if (!cur_flash_address || !fw_crc16) {
                     status = upgrade_protocol_error;
-                } else if (payload_len < 0) {
-                    status = upgrade_crc_error;
-                } else if (cur_flash_address >= (uint32_t) &_app_end) {
-                    status = upgrade_overflow_error;
                 } else {
-                    status = upgrade_continue; /** think positive thoughts */
-                    uint32_t chunk_length = payload_len - 1; /** frame type of the payload occupies 1 byte, the rest is upgrade data */
-                    if (chunk_length > 0) {
-                        flash_erase_page(cur_flash_address);
-                        if (!(FLASH_SR_EOP & flash_get_status_flags())) {
-                            status = upgrade_erase_error;
-                        } else {
-                            uint32_t word;
-                            status = upgrade_continue; // Think positive
-                            /** Note, payload contains 1 frame type byte and N bytes data */
-                            for (uint32_t i = 0; i < (uint32_t) chunk_length; i+=4) {
-                                word = payload[i+4] << 24 | payload[i+3] << 16 | payload[i+2] << 8 | payload[i+1];
-                                /** @todo: Handle binaries not size aliged to 4 bytes */
-                                if (!flash_write32(cur_flash_address+i, word)) {
-                                    status = upgrade_flash_error;
-                                    break;
-                                }
-                            }
-                            cur_flash_address += chunk_length;
-                        }
-                    }
-                    if (chunk_length < chunk_size) { /** @todo verify code for even kb binaries */
-                        uint16_t calc_crc = crc16((uint8_t*) &_app_start, cur_flash_address - (uint32_t) &_app_start);
-                        status = fw_crc16 == calc_crc ? upgrade_success : upgrade_crc_error;
-                    }
-                }
-                {
-                    frame_t frame_resp;
-                    set_frame_header(&frame_resp);
-                    pack8(&frame_resp, cmd_response | cmd_upgrade_data);
-                    pack8(&frame_resp, status);
-                    end_frame(&frame_resp);
-                    send_frame(&frame_resp);
-                    if (status == upgrade_success) {
-                        usart_wait_send_ready(USART1); /** make sure FIFO is empty */
-                        (void) past_erase_unit(&past, past_upgrade_started);
-                        cur_flash_address = 0;
-                        lock_flash();
-                        if (!start_app()) {
-                            handle_upgrade(); /** Try again... */
-                        }
-                    }
+                    /** frame type of the payload occupies 1 byte, the rest is upgrade data */
+                    status = add_chunk(&data[1], payload_len - 1);
                 }
+                send_upgrade_status(cmd_upgrade_data, status);
+                break;
+            case cmd_set_baudrate:
+                /** Refuse, we only follow the baudrate the app stored in past
+                  * and the host carries on at the current one */
+                send_response(cmd_set_baudrate, 0);
                 break;
             default:
                 break;
@@ -278,8 +337,7 @@ int main(void)
     void *data;
     uint32_t length;
 
-    ringbuf_init(&rx_buf, (uint8_t*) buffer, sizeof(buffer));
-    hw_init(&rx_buf);
+    hw_init();
 
     do {
         if (hw_check_forced_upgrade()) {
@@ -290,8 +348,9 @@ int main(void)
             break;
         }
 
-        past.blocks[0] = past_start;
-        past.blocks[1] = past_start + 1024;
+        for (uint32_t i = 0; i < PAST_NUM_BLOCKS; i++) {
+            past.blocks[i] = past_start + i * PAST_BLOCK_SIZE;
+        }
         if (!past_init(&past)) {
             /** Not much we can do */
             enter_upgrade = true;
@@ -300,27 +359,23 @@ int main(void)
         }
 
 #ifdef GIT_VERSION
-        /** Update boot git hash in past if needed */
-        char *ver = 0;
-        bool exists = past_read_unit(&past, past_boot_git_hash, (const void**) &ver, &length);
-
-        if (!exists) /** If hash isn't stored in past then write it in */
-        {
-            if (!past_write_unit(&past, past_boot_git_hash, (void*) &GIT_VERSION, strlen(GIT_VERSION))) {
-                /** @todo Handle past write errors */
-            }
+        /** Update boot git hash in past if needed, an unchanged hash is not
+          * rewritten */
+        if (!past_write_unit(&past, past_boot_git_hash, (void*) &GIT_VERSION, strlen(GIT_VERSION))) {
+            /** @todo Handle past write errors */
         }
-        else if (strncmp(ver, GIT_VERSION, length) != 0) /** Else if hash is stored in past but is different then update it */
-        {
-            if (!past_write_unit(&past, past_boot_git_hash, (void*) &GIT_VERSION, strlen(GIT_VERSION))) {
-                /** @todo Handle past write errors */
+#endif // GIT_VERSION
+
+        if (past_read_unit(&past, past_baudrate, (const void**) &data, &length)) {
+            /** The user chose another baudrate for both the app and us */
+            if (length == sizeof(uint32_t)) {
+                (void) hw_set_baudrate(*(uint32_t*) data);
             }
         }
-#endif // GIT_VERSION
 
         if (bootcom_get(&magic, &temp) && magic == 0xfedebeda) {
             /** We got invoked by the app */
-            chunk_size = temp >> 16;
+            chunk_size = MIN(MAX_CHUNK_SIZE, temp >> 16);
             fw_crc16 = temp & 0xffff;
             enter_upgrade = true;
             reason = reason_bootcom;
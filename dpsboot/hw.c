@@ -30,24 +30,28 @@
 #include <gpio.h>
 #include <nvic.h>
 #include <usart.h>
+#include <dma.h>
 #include <stdio.h>
 #include "tick.h"
 #include "hw.h"
-#include "ringbuf.h"
+#include "protocol.h"
 
 static void clock_init(void);
 static void usart_init(void);
 static void gpio_init(void);
 
-static ringbuf_t *rx_buf;
+/** USART1 RX is received by DMA1 channel 5 into this ring, which keeps
+  * receiving while the CPU stalls on flash erase and programming. Data is
+  * lost if the ring overflows. */
+static uint8_t rx_ring[USART_RX_RING_SIZE];
+static uint32_t rx_tail;
 
 /**
   * @brief Initialize the hardware
   * @retval None
   */
-void hw_init(ringbuf_t *usart_rx_buf)
+void hw_init(void)
 {
-    rx_buf = usart_rx_buf;
     clock_init();
     systick_init();
     gpio_init();
@@ -71,21 +75,67 @@ bool hw_check_forced_upgrade(void)
     return gpio_get(BUTTON_SEL_PORT, BUTTON_SEL_PIN) != BUTTON_SEL_PIN;
 }
 
-void usart1_isr(void)
+/**
+  * @brief Check if USART1 can run at a baudrate
+  * @param baudrate the baudrate
+  * @retval true if the baudrate is in range and can be generated within 2%
+  */
+bool hw_baudrate_valid(uint32_t baudrate)
+{
+    if (baudrate < BAUDRATE_MIN || baudrate > BAUDRATE_MAX) {
+        return false;
+    }
+    /** Same rounding as usart_set_baudrate(...) */
+    uint32_t brr = (2 * rcc_apb2_frequency + baudrate) / (2 * baudrate);
+    uint32_t actual = rcc_apb2_frequency / brr;
+    uint32_t error = actual > baudrate ? actual - baudrate : baudrate - actual;
+    return error <= baudrate / 50;
+}
+
+/**
+  * @brief Change the USART1 baudrate once the transmitter is idle
+  * @param baudrate the new baudrate
+  * @retval false if the baudrate is not valid, the baudrate is then left
+  *         unchanged
+  */
+bool hw_set_baudrate(uint32_t baudrate)
+{
+    if (!hw_baudrate_valid(baudrate)) {
+        return false;
+    }
+    usart_wait_send_ready(USART1);
+    while ((USART_SR(USART1) & USART_SR_TC) == 0) {
+    }
+    usart_disable(USART1);
+    usart_set_baudrate(USART1, baudrate);
+    usart_enable(USART1);
+    return true;
+}
+
+/**
+  * @brief Get a received byte
+  * @param b the received byte
+  * @retval false if nothing was received
+  */
+bool hw_usart_get(uint8_t *b)
 {
-    if ((USART_CR1(USART1) & USART_CR1_RXNEIE) != 0 &&
-        (USART_SR(USART1) & USART_SR_RXNE) != 0) {
-        uint16_t ch = usart_recv(USART1);
-        if ((USART_SR(USART1) & USART_SR_ORE) == 0 &&
-            (USART_SR(USART1) & USART_SR_FE) == 0 &&
-            (USART_SR(USART1) & USART_SR_PE) == 0) {
-            if (!ringbuf_put(rx_buf, ch)) {
-                //printf("ASSERT:usart1_isr:%d\n", __LINE__);
-            }
-        } else {
-            //printf("ASSERT:usart1_isr:%d\n", __LINE__);
-        }
+    uint32_t head = USART_RX_RING_SIZE - DMA_CNDTR(DMA1, DMA_CHANNEL5);
+    if (rx_tail == head) {
+        return false;
     }
+    *b = rx_ring[rx_tail];
+    rx_tail = (rx_tail + 1) % USART_RX_RING_SIZE;
+    return true;
+}
+
+/**
+  * @brief Stop receiving by DMA
+  * @retval None
+  */
+void hw_usart_rx_stop(void)
+{
+    USART_CR3(USART1) &= ~USART_CR3_DMAR;
+    DMA_CCR(DMA1, DMA_CHANNEL5) &= ~DMA_CCR_EN;
 }
 
 /**
@@ -113,7 +163,6 @@ static void usart_init(void)
     gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART1_TX);
     gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOAT, GPIO_USART1_RX);
 
-    nvic_enable_irq(NVIC_USART1_IRQ);
     usart_set_baudrate(USART1, CONFIG_BAUDRATE); /** Baudrate set in makefile */
     usart_set_databits(USART1, 8);
     usart_set_stopbits(USART1, USART_STOPBITS_1);
@@ -121,8 +170,15 @@ static void usart_init(void)
     usart_set_parity(USART1, USART_PARITY_NONE);
     usart_set_flow_control(USART1, USART_FLOWCONTROL_NONE);
 
-    // Enable USART1 Receive interrupt.
-    USART_CR1(USART1) |= USART_CR1_RXNEIE;
+    /** Set up by register, the dma_* calls take a few hundred bytes of the
+      * bootloader for what is a handful of stores. The channel is in its reset
+      * state here. */
+    rcc_periph_clock_enable(RCC_DMA1);
+    DMA_CPAR(DMA1, DMA_CHANNEL5) = (uint32_t)&USART_DR(USART1);
+    DMA_CMAR(DMA1, DMA_CHANNEL5) = (uint32_t)rx_ring;
+    DMA_CNDTR(DMA1, DMA_CHANNEL5) = USART_RX_RING_SIZE;
+    DMA_CCR(DMA1, DMA_CHANNEL5) = DMA_CCR_MINC | DMA_CCR_PSIZE_8BIT | DMA_CCR_MSIZE_8BIT | DMA_CCR_CIRC | DMA_CCR_EN;
+    USART_CR3(USART1) |= USART_CR3_DMAR;
 
     usart_enable(USART1);
 }
@@ -25,18 +25,35 @@
 #ifndef __HW_H__
 #define __HW_H__
 
-#include "ringbuf.h"
+#include <stdint.h>
+#include <stdbool.h>
 
 #define BUTTON_SEL_PORT GPIOA
 #define BUTTON_SEL_PIN  GPIO2
 
+/** The host waits for each frame to be answered, this only needs to cover
+  * bytes arriving while a frame is handled */
+#define USART_RX_RING_SIZE (256)
 
 /**
   * @brief Initialize the hardware
-  * @param usart_rx_buf pointer to the USART RX ringbuffer
   * @retval None
   */
-void hw_init(ringbuf_t *usart_rx_buf);
+void hw_init(void);
+
+/**
+  * @brief Get a received byte
+  * @param b the received byte
+  * @retval false if nothing was received
+  */
+bool hw_usart_get(uint8_t *b);
+
+/**
+  * @brief Stop receiving by DMA, the app receives by interrupt into RAM that
+  *        is ours until we branch to it
+  * @retval None
+  */
+void hw_usart_rx_stop(void);
 
 /**
   * @brief Check if we are to enter forced upgrade
@@ -44,4 +61,19 @@ void hw_init(ringbuf_t *usart_rx_buf);
   */
 bool hw_check_forced_upgrade(void);
 
+/**
+  * @brief Check if USART1 can run at a baudrate
+  * @param baudrate the baudrate
+  * @retval true if the baudrate is in range and can be generated within 2%
+  */
+bool hw_baudrate_valid(uint32_t baudrate);
+
+/**
+  * @brief Change the USART1 baudrate once the transmitter is idle
+  * @param baudrate the new baudrate
+  * @retval false if the baudrate is not valid, the baudrate is then left
+  *         unchanged
+  */
+bool hw_set_baudrate(uint32_t baudrate);
+
 #endif // __HW_H__
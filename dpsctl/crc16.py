@@ -0,0 +1,114 @@
+"""
+The MIT License (MIT)
+
+Copyright (c) 2017 Johan Kanflo (github.com/kanflo)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+"""
+
+"""
+Table driven CRC-16/XMODEM (polynomial 0x1021, initial value 0) as used by
+uframes and the firmware upgrade. This module also generates the table of the
+firmware, in the opendps directory run:
+
+  python ../dpsctl/crc16.py -o crc16_table
+"""
+
+import argparse
+import sys
+
+POLYNOMIAL = 0x1021
+
+
+def make_table(bits=8):
+    """
+    Return the CRC of each possible value of the top bits of the CRC register,
+    a byte for the table used here or a nibble for the firmware's small table
+    """
+    table = []
+    for i in range(1 << bits):
+        crc = i << (16 - bits)
+        for _ in range(bits):
+            crc = (crc << 1) ^ POLYNOMIAL if crc & 0x8000 else crc << 1
+        table.append(crc & 0xffff)
+    return table
+
+
+_table = make_table()
+
+
+def crc16_add(crc, byte):
+    """
+    Add a byte to the CRC calculated so far, start with crc=0
+    """
+    return ((crc << 8) & 0xffff) ^ _table[(crc >> 8) ^ byte]
+
+
+def crc16xmodem(data, crc=0):
+    """
+    Calculate the CRC of data, a bytes like object
+    """
+    for b in bytearray(data):
+        crc = ((crc << 8) & 0xffff) ^ _table[(crc >> 8) ^ b]
+    return crc
+
+
+def generate_c(output_filename):
+    """
+    Generate a pair of .c/.h files holding the byte and the nibble table
+    """
+    print("Generating CRC16 table as %s.c/.h" % (output_filename))
+    header_filename = "%s.h" % (output_filename)
+    guard = "__%s_H__" % (output_filename.upper())
+
+    with open("%s.c" % (output_filename), "w") as f:
+        f.write("/** CRC16 table generated from `%s` */\n\n" % (" ".join(sys.argv)))
+        f.write("#include \"%s\"\n\n" % (header_filename))
+        f.write("const uint16_t crc16_table[256] = {")
+        for i, value in enumerate(make_table()):
+            if not (i % 8):  # Place a new line every 8 values
+                f.write("\n   ")
+            f.write(" 0x%04x," % (value))
+        f.write("\n};\n\n")
+        f.write("const uint16_t crc16_nibble_table[16] = {")
+        for i, value in enumerate(make_table(4)):
+            if not (i % 8):
+                f.write("\n   ")
+            f.write(" 0x%04x," % (value))
+        f.write("\n};\n")
+
+    with open(header_filename, "w") as f:
+        f.write("/** CRC16 table generated from `%s` */\n\n" % (" ".join(sys.argv)))
+        f.write("#ifndef %s\n" % (guard))
+        f.write("#define %s\n\n" % (guard))
+        f.write("#include <stdint.h>\n\n")
+        f.write("extern const uint16_t crc16_table[256];\n")
+        f.write("extern const uint16_t crc16_nibble_table[16];\n\n")
+        f.write("#endif // %s\n" % (guard))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate the CRC16 lookup table for the OpenDPS firmware')
+    parser.add_argument('-o', '--output', type=str, required=True, help="The output file name")
+    args = parser.parse_args()
+    generate_c(args.output)
+
+
+if __name__ == "__main__":
+    main()
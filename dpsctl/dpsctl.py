@@ -40,32 +40,36 @@ from __future__ import division
 
 import argparse
 import codecs
+import collections
+import copy
 import json
 import os
 import socket
+import struct
 import sys
 import threading
 import time
 import math
+try:
+    import queue
+except ImportError:
+    import Queue as queue
 
 calibration_debug_plotting = False  # Change this to True to enable plotting of the calibration graphs during dpsctl -C
 if calibration_debug_plotting:
     import matplotlib.pyplot as plt
 
+import crc16
 import protocol
 import uframe
 from protocol import (create_cmd, create_enable_output, create_lock, create_set_calibration,
                       create_set_function, create_set_parameter, create_temperature, create_set_brightness,
+                      create_set_adc_filter, create_energy, create_set_baudrate,
                       create_upgrade_data, create_upgrade_start, create_change_screen,
-                      unpack_cal_report, unpack_query_response, unpack_version_response)
+                      create_stream_start, create_set_waveform, create_set_program, unpack_cal_report, unpack_query_response,
+                      unpack_energy_response, unpack_stream_data, unpack_stream_start_response,
+                      unpack_version_response)
 
-try:
-    import crc16
-except ImportError:
-    print("Missing dependency crc16:")
-    print(" sudo pip{} install crc16"
-          .format("3" if sys.version_info.major == 3 else ""))
-    raise SystemExit()
 try:
     import serial
 except ImportError:
@@ -76,6 +80,10 @@ except ImportError:
 
 parameters = []
 
+# Commands in flight per session. The app queues received bytes in a small
+# event queue, so keep a burst of frames well within it.
+SESSION_WINDOW = 4
+
 
 class comm_interface(object):
     """
@@ -99,6 +107,9 @@ class comm_interface(object):
     def read(self):
         return bytearray()
 
+    def set_baudrate(self, baudrate):
+        return False
+
     def name(self):
         return self._if_name
 
@@ -132,6 +143,17 @@ class tty_interface(comm_interface):
         self._port_handle.write(bytes_)
         return True
 
+    def set_baudrate(self, baudrate):
+        if self._port_handle:
+            self._port_handle.flush()  # Let pending data out at the old baudrate
+            self._port_handle.baudrate = baudrate
+            self._port_handle.reset_input_buffer()
+        self._baudrate = baudrate
+        return True
+
+    def baudrate(self):
+        return self._baudrate
+
     def read(self):
         bytes_ = bytearray()
         sof = False
@@ -163,11 +185,14 @@ class tcp_interface(comm_interface):
         self._if_name = if_name
 
     def open(self):
+        if self._socket:
+            return True
         try:
             self._socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
             self._socket.settimeout(1.0)
             self._socket.connect((self._if_name, 5005))
         except socket.error:
+            self._socket = None
             return False
         return True
 
@@ -199,6 +224,27 @@ class tcp_interface(comm_interface):
         return bytes_
 
 
+class unix_interface(tcp_interface):
+    """
+    A class that describes a Unix socket, as served by dpsd.py
+    """
+
+    def open(self):
+        if self._socket:
+            return True
+        try:
+            self._socket = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            self._socket.settimeout(1.0)
+            self._socket.connect(self._if_name)
+        except socket.error:
+            self._socket = None
+            return False
+        return True
+
+    def name(self):
+        return "unix:" + self._if_name
+
+
 class udp_interface(comm_interface):
     """
     A class that describes a UDP interface
@@ -212,6 +258,8 @@ class udp_interface(comm_interface):
         self._if_name = if_name
 
     def open(self):
+        if self._socket:
+            return True
         try:
             self._socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
             self._socket.settimeout(1.0)
@@ -244,6 +292,104 @@ class udp_interface(comm_interface):
         return reply
 
 
+class session(object):
+    """
+    Keeps the interface to a device open across commands and lets up to
+    window commands be in flight. Commands are tagged with sequence numbers
+    on the host, the device answers them in order with one response each, so
+    a response belongs to the oldest command in flight with the same command
+    byte. Commands passed over that way got no response.
+    """
+
+    def __init__(self, comms, args, window=SESSION_WINDOW):
+        self._comms = comms
+        self._args = args
+        self._window = window
+        self._next_seq = 0
+        self._in_flight = collections.deque()  # (seq, command, quiet)
+        self._results = {}
+        if not comms.open():
+            fail("could not open {}".format(comms.name()))
+        if args.verbose:
+            print("Communicating with {}".format(comms.name()))
+
+    def submit(self, frame, quiet=False):
+        """
+        Send a command, waiting for room in the window, and return its
+        sequence number
+        """
+        while len(self._in_flight) >= self._window:
+            self._receive()
+        bytes_ = frame.get_frame()
+        if self._args.verbose:
+            print("TX {:2d} bytes [{}]".format(len(bytes_), " ".join("{:02x}".format(b) for b in bytes_)))
+        if not self._comms.write(bytes_):
+            fail("write failed on {}".format(self._comms.name()))
+        seq = self._next_seq
+        self._next_seq += 1
+        self._in_flight.append((seq, bytes_[1], quiet))
+        return seq
+
+    def result(self, seq):
+        """
+        Return what handle_response(...) made of the response to a command
+        """
+        while seq not in self._results:
+            if not self._in_flight:
+                fail("no command {:d} in flight".format(seq))
+            self._receive()
+        ret_dict = self._results.pop(seq)
+        if ret_dict is None:
+            fail("no response from device {}".format(self._comms.name()))
+        return ret_dict
+
+    def request(self, frame, quiet=False):
+        return self.result(self.submit(frame, quiet))
+
+    def _receive(self):
+        """
+        Read a frame and hand it to the command it answers
+        """
+        try:
+            resp = self._comms.read()
+        except socket.timeout:
+            resp = bytearray()
+        if len(resp) == 0:
+            fail("timeout talking to device {}".format(self._comms.name()))
+        if self._args.verbose:
+            print("RX {:2d} bytes [{}]\n".format(len(resp), " ".join("{:02x}".format(b) for b in resp)))
+        f = uframe.uFrame()
+        res = f.set_frame(resp)
+        if res < 0:
+            fail("protocol error ({:d})".format(res))
+        command = f.get_frame()[0]
+        if not command & protocol.CMD_RESPONSE:
+            return  # Not a response, eg. stream data
+        command ^= protocol.CMD_RESPONSE
+        if command not in [c for _, c, _ in self._in_flight]:
+            return  # A late response to a command given up on
+        while True:
+            seq, sent_command, quiet = self._in_flight.popleft()
+            if sent_command == command:
+                break
+            self._results[seq] = None
+        self._results[seq] = handle_response(sent_command, f, self._args, quiet)
+
+    def close(self):
+        self._comms.close()
+
+
+def get_session(comms, args):
+    """
+    Return the session kept open on comms
+    """
+    if not comms:
+        fail("no communication interface specified")
+    if getattr(comms, "session", None) is None:
+        comms.session = session(comms, args)
+    return comms.session
+
+
 def fail(message):
     """
     Print error message and exit with error
@@ -308,7 +454,9 @@ def handle_response(command, frame, args, quiet=False):
         success = frame.get_frame()[1]
         if resp_command != command:
             print("Warning: sent command {:02x}, response was {:02x}.".format(command, resp_command))
-        if resp_command != protocol.CMD_UPGRADE_START and resp_command != protocol.CMD_UPGRADE_DATA and not success:
+        # These report the failure themselves
+        if resp_command not in (protocol.CMD_UPGRADE_START, protocol.CMD_UPGRADE_DATA, protocol.CMD_SET_PARAMETERS,
+                                protocol.CMD_SET_PROGRAM, protocol.CMD_STREAM_START, protocol.CMD_SET_BAUDRATE) and not success:
             fail("command failed according to device")
 
     if args.json:
@@ -340,12 +488,14 @@ def handle_response(command, frame, args, quiet=False):
                 print("{:<10} : {:.1f}".format('temp2', data['temp2']))
 
     elif resp_command == protocol.CMD_UPGRADE_START:
-        #  *  DPS BL: [cmd_response | cmd_upgrade_start] [<upgrade_status_t>] [<chunk_size:16>]
+        #  *  DPS BL: [cmd_response | cmd_upgrade_start] [<upgrade_status_t>] [<chunk_size:16>] [<upgrade_reason_t:8>]
         cmd = frame.unpack8()
         status = frame.unpack8()
-        chunk_size = frame.unpack16()
         ret_dict["status"] = status
-        ret_dict["chunk_size"] = chunk_size
+        # Apps refusing the upgrade start send a plain response
+        ret_dict["chunk_size"] = frame.unpack16() if not frame.eof() else None
+        if not frame.eof():
+            ret_dict["reason"] = frame.unpack8()
     elif resp_command == protocol.CMD_UPGRADE_DATA:
         cmd = frame.unpack8()
         status = frame.unpack8()
@@ -381,13 +531,15 @@ def handle_response(command, frame, args, quiet=False):
                     print("Selected OpenDPS supports the {} functions.".format(temp))
     elif resp_command == protocol.CMD_SET_PARAMETERS:
         cmd = frame.unpack8()
-        status = frame.unpack8()
+        applied = frame.unpack8()
         for p in args.parameter:
             status = frame.unpack8()
             parts = p.split("=")
             # TODO: handle json output
             if not quiet:
                 print("{}: {}".format(parts[0], "ok" if status == 0 else "unknown parameter" if status == 1 else "out of range" if status == 2 else "unsupported parameter" if status == 3 else "unknown error {:d}".format(status)))
+        if not applied:
+            fail("parameters rejected, none were applied")
     elif resp_command == protocol.CMD_SET_CALIBRATION:
         cmd = frame.unpack8()
         status = frame.unpack8()
@@ -444,6 +596,31 @@ def handle_response(command, frame, args, quiet=False):
         pass
     elif resp_command == protocol.CMD_SET_BRIGHTNESS:
         pass
+    elif resp_command == protocol.CMD_SET_ADC_FILTER:
+        pass
+    elif resp_command == protocol.CMD_SET_BAUDRATE:
+        frame.unpack8()
+        ret_dict["status"] = frame.unpack8()
+    elif resp_command == protocol.CMD_ENERGY:
+        data = unpack_energy_response(frame)
+        runtime_s = data['runtime'] // 1000
+        if args.json:
+            _json = data
+        elif not quiet:
+            print("{:<10} : {:.3f} Ah".format('Charge', data['charge'] / 1000000))
+            print("{:<10} : {:.3f} Wh".format('Energy', data['energy'] / 1000000))
+            print("{:<10} : {:d}:{:02d}:{:02d}".format('Runtime', runtime_s // 3600, runtime_s // 60 % 60, runtime_s % 60))
+        ret_dict = data
+    elif resp_command == protocol.CMD_STREAM_START:
+        ret_dict = unpack_stream_start_response(frame)
+    elif resp_command == protocol.CMD_STREAM_STOP:
+        pass
+    elif resp_command == protocol.CMD_SET_WAVEFORM:
+        frame.unpack8()
+        ret_dict["status"] = frame.unpack8()
+    elif resp_command == protocol.CMD_SET_PROGRAM:
+        frame.unpack8()
+        ret_dict["status"] = frame.unpack8()
     else:
         print("Unknown response {:d} from device.".format(resp_command))
 
@@ -453,38 +630,20 @@ def handle_response(command, frame, args, quiet=False):
     return ret_dict
 
 
-def communicate(comms, frame, args, quiet=False):
+def communicate(comms, frame, args, quiet=False, reply_baudrate=None):
     """
-    Communicate with the DPS device according to the user's wishes
+    Communicate with the DPS device according to the user's wishes. If
+    reply_baudrate is given, the serial port switches to it before reading
+    the response.
     """
-    bytes_ = frame.get_frame()
+    s = get_session(comms, args)
+    seq = s.submit(frame, quiet)
+    if reply_baudrate:
+        comms.set_baudrate(reply_baudrate)
+    return s.result(seq)
 
-    if not comms:
-        fail("no communication interface specified")
-    if not comms.open():
-        fail("could not open {}".format(comms.name()))
-    if args.verbose:
-        print("Communicating with {}".format(comms.name()))
-        print("TX {:2d} bytes [{}]".format(len(bytes_), " ".join("{:02x}".format(b) for b in bytes_)))
-    if not comms.write(bytes_):
-        fail("write failed on {}".format(comms.name()))
-    resp = comms.read()
-    if len(resp) == 0:
-        fail("timeout talking to device {}".format(comms._if_name))
-    elif args.verbose:
-        print("RX {:2d} bytes [{}]\n".format(len(resp), " ".join("{:02x}".format(b) for b in resp)))
-    if not comms.close:
-        print("Warning: could not close {}".format(comms.name()))
 
-    f = uframe.uFrame()
-    res = f.set_frame(resp)
-    if res < 0:
-        fail("protocol error ({:d})".format(res))
-    else:
-        return handle_response(frame.get_frame()[1], f, args, quiet)
-
-
-def handle_commands(args):
+def handle_commands(args, comms=None):
     """
     Communicate with the DPS device according to the user's wishes
     """
@@ -492,7 +651,11 @@ def handle_commands(args):
         uhej_scan()
         return
 
-    comms = create_comms(args)
+    if not comms:
+        comms = create_comms(args)
+
+    if args.set_baudrate:
+        change_baudrate(comms, args.set_baudrate, args.persist_baudrate, args)
 
     if args.ping:
         communicate(comms, create_cmd(protocol.CMD_PING), args)
@@ -511,6 +674,10 @@ def handle_commands(args):
     if args.list_parameters:
         communicate(comms, create_cmd(protocol.CMD_LIST_PARAMETERS), args)
 
+    # Before enabling the output as the sequencer refuses new programs while running
+    if args.program:
+        upload_program(comms, args)
+
     if args.function:
         communicate(comms, create_set_function(args.function), args)
 
@@ -582,6 +749,25 @@ def handle_commands(args):
         else:
             fail("brightness must be between 0 and 100")
 
+    if args.adc_filter is not None:
+        if args.adc_filter >= 0 and args.adc_filter <= 10:
+            communicate(comms, create_set_adc_filter(args.adc_filter), args)
+        else:
+            fail("ADC filter depth must be between 0 and 10")
+
+    if args.energy or args.energy_reset:
+        communicate(comms, create_energy(args.energy_reset), args)
+
+    if args.waveform:
+        upload_waveform(comms, args)
+
+    if args.stream:
+        run_stream(comms, args)
+
+    if args.set_baudrate and not args.persist_baudrate and comms.baudrate() != args.baudrate:
+        # Leave the device where the next dpsctl invocation expects it
+        change_baudrate(comms, args.baudrate, False, args)
+
 
 
 def is_ip_address(if_name):
@@ -595,16 +781,53 @@ def is_ip_address(if_name):
         return False
 
 
-def chunk_from_file(filename, chunk_size):
-    # Darn beautiful, from SO: https://stackoverflow.com/a/1035456
+def change_baudrate(comms, baudrate, persist, args):
+    """
+    Switch the device and the serial port to another baudrate. The device
+    falls back to the old baudrate unless it is pinged at the new one within
+    BAUDRATE_SWITCH_TIMEOUT_MS.
+    """
+    if not isinstance(comms, tty_interface):
+        fail("the baudrate can only be changed on serial connections")
+    if baudrate < protocol.BAUDRATE_MIN or baudrate > protocol.BAUDRATE_MAX:
+        fail("baudrate must be between {:d} and {:d}".format(protocol.BAUDRATE_MIN, protocol.BAUDRATE_MAX))
+    old_baudrate = comms.baudrate()
+    ret_dict = communicate(comms, create_set_baudrate(baudrate, persist), args, quiet=True)
+    if not ret_dict["status"]:
+        fail("device refused to switch to {:d} baud".format(baudrate))
+    comms.set_baudrate(baudrate)
+    comms.write(create_cmd(protocol.CMD_PING).get_frame())
+    f = uframe.uFrame()
+    resp = comms.read()
+    if len(resp) == 0 or f.set_frame(resp) < 0 or f.get_frame()[0] != protocol.CMD_RESPONSE | protocol.CMD_PING:
+        comms.set_baudrate(old_baudrate)
+        time.sleep(protocol.BAUDRATE_SWITCH_TIMEOUT_MS / 1000)
+        fail("device did not answer at {:d} baud, it is back at {:d} baud".format(baudrate, old_baudrate))
+    if args.verbose:
+        print("Switched to {:d} baud".format(baudrate))
 
-    with open(filename, "rb") as f:
-        while True:
-            chunk = f.read(chunk_size)
-            if chunk:
-                yield bytearray(chunk)
-            else:
-                break
+
+def check_upgrade_status(status):
+    """
+    Fail on upgrade error statuses, return True when the upgrade is done
+    """
+    if status == protocol.UPGRADE_CONTINUE:
+        return False
+    print("")
+    if status == protocol.UPGRADE_SUCCESS:
+        return True
+    elif status == protocol.UPGRADE_CRC_ERROR:
+        fail("device reported CRC error")
+    elif status == protocol.UPGRADE_ERASE_ERROR:
+        fail("device reported erasing error")
+    elif status == protocol.UPGRADE_FLASH_ERROR:
+        fail("device reported flashing error")
+    elif status == protocol.UPGRADE_OVERFLOW_ERROR:
+        fail("device reported firmware overflow error")
+    elif status == protocol.UPGRADE_PROTOCOL_ERROR:
+        fail("device reported protocol error")
+    else:
+        fail("device reported an unknown error ({:d})".format(status))
 
 
 def run_upgrade(comms, fw_file_name, args):
@@ -614,47 +837,232 @@ def run_upgrade(comms, fw_file_name, args):
     with open(fw_file_name, mode='rb') as file:
         # crc = binascii.crc32(file.read()) % (1<<32)
         content = file.read()
-        if codecs.encode(content, 'hex')[6:8] != b'20' and not args.force:
-            fail("The firmware file does not seem valid, use --force to force upgrade")
-        crc = crc16.crc16xmodem(content)
+    if codecs.encode(content, 'hex')[6:8] != b'20' and not args.force:
+        fail("The firmware file does not seem valid, use --force to force upgrade")
+    crc = crc16.crc16xmodem(content)
     chunk_size = 1024
-    ret_dict = communicate(comms, create_upgrade_start(chunk_size, crc), args)
-    if ret_dict["status"] == protocol.UPGRADE_CONTINUE:
+    # The app reboots into the bootloader which starts out at the baudrate
+    # stored in past or the default one
+    boot_baudrate = None
+    if isinstance(comms, tty_interface):
+        boot_baudrate = args.set_baudrate if args.set_baudrate and args.persist_baudrate else args.baudrate
+    ret_dict = communicate(comms, create_upgrade_start(chunk_size, crc), args, reply_baudrate=boot_baudrate)
+    if ret_dict["status"] == protocol.UPGRADE_CONTINUE and ret_dict["chunk_size"] is not None:
+        if args.set_baudrate and boot_baudrate != args.set_baudrate:
+            # The bootloader only follows a persisted baudrate
+            print("Upgrading at {:d} baud".format(boot_baudrate))
         if chunk_size != ret_dict["chunk_size"]:
             print("Device selected chunk size {:d}".format(ret_dict["chunk_size"]))
             chunk_size = ret_dict["chunk_size"]
         counter = 0
-        for chunk in chunk_from_file(fw_file_name, chunk_size):
+        # The bootloader knows it is done by a short chunk, empty if need be
+        for pos in range(0, len(content) + 1, chunk_size):
+            chunk = bytearray(content[pos:pos + chunk_size])
             counter += len(chunk)
-            sys.stdout.write("\rDownload progress: {:d}% ".format(int(counter / len(content) * 100)))
+            sys.stdout.write("\rDownload progress: {:d}% ".format(int(counter / max(len(content), 1) * 100)))
             sys.stdout.flush()
             # print(" {:d} bytes".format(counter))
 
             ret_dict = communicate(comms, create_upgrade_data(chunk), args)
-            status = ret_dict["status"]
-            if status == protocol.UPGRADE_CONTINUE:
-                pass
-            elif status == protocol.UPGRADE_CRC_ERROR:
-                print("")
-                fail("device reported CRC error")
-            elif status == protocol.UPGRADE_ERASE_ERROR:
-                print("")
-                fail("device reported erasing error")
-            elif status == protocol.UPGRADE_FLASH_ERROR:
-                print("")
-                fail("device reported flashing error")
-            elif status == protocol.UPGRADE_OVERFLOW_ERROR:
-                print("")
-                fail("device reported firmware overflow error")
-            elif status == protocol.UPGRADE_SUCCESS:
-                print("")
-            else:
-                print("")
-                fail("device reported an unknown error ({:d})".format(status))
+            if check_upgrade_status(ret_dict["status"]):
+                break
+        if boot_baudrate:
+            comms.set_baudrate(boot_baudrate)  # The new app starts at the boot baudrate
     else:
         fail("Device rejected firmware upgrade")
 
 
+def read_stream_frame(comms):
+    """
+    Read one frame while streaming, return None on timeout or framing errors
+    """
+    try:
+        resp = comms.read()
+    except socket.timeout:
+        return None
+    if len(resp) == 0:
+        return None
+    f = uframe.uFrame()
+    if f.set_frame(resp) < 0:
+        return None
+    return f
+
+
+def upload_waveform(comms, args):
+    """
+    Upload one period of a waveform to the function generator's fourth
+    function. The file holds any number of whitespace or comma separated
+    values that are resampled to the device's points and scaled so the
+    smallest value is 0V and the largest the voltage setting.
+    """
+    try:
+        with open(args.waveform) as f:
+            values = [float(v) for v in f.read().replace(",", " ").split()]
+    except (IOError, ValueError) as e:
+        fail("could not read waveform: {}".format(e))
+    if len(values) < 2:
+        fail("a waveform needs at least two values")
+    low, high = min(values), max(values)
+    scale = 255.0 / (high - low) if high > low else 0
+    points = []
+    for i in range(protocol.WAVEFORM_POINTS):
+        pos = i * len(values) / protocol.WAVEFORM_POINTS
+        j = int(pos)
+        v = values[j] + (values[(j + 1) % len(values)] - values[j]) * (pos - j)
+        points.append(int(round((v - low) * scale)))
+    for offset in range(0, protocol.WAVEFORM_POINTS, protocol.WAVEFORM_CHUNK_SIZE):
+        chunk = points[offset:offset + protocol.WAVEFORM_CHUNK_SIZE]
+        ret_dict = communicate(comms, create_set_waveform(offset, chunk), args, quiet=True)
+        if not ret_dict or not ret_dict["status"]:
+            fail("device does not support waveform upload")
+    print("Waveform uploaded, select it with -p func=3")
+
+
+def parse_program(text):
+    """
+    Parse a sequencer program, one step per line:
+
+        set_v <mV>                  set_i <mA>
+        ramp_v <mV> <ms>            ramp_i <mA> <ms>
+        dwell <ms>                  end
+        loop <step> [<times>]       (jump back <times> times, forever if left out)
+        wait <cond> <mV|mA> [<ms>]  (cond is v_above, v_below, i_above or i_below,
+                                     the output is cut if <ms> pass first)
+
+    Steps are numbered from 0, a line holding '<label>:' names the step after
+    it for use by loop. Everything after a '#' is a comment.
+    Returns a list of (op, cond, value, time) tuples.
+    """
+    ops = {"set_v": protocol.SEQ_OP_SET_V, "set_i": protocol.SEQ_OP_SET_I,
+           "ramp_v": protocol.SEQ_OP_RAMP_V, "ramp_i": protocol.SEQ_OP_RAMP_I,
+           "dwell": protocol.SEQ_OP_DWELL, "loop": protocol.SEQ_OP_LOOP,
+           "wait": protocol.SEQ_OP_WAIT, "end": protocol.SEQ_OP_END}
+    conds = {"v_above": protocol.SEQ_COND_V_ABOVE, "v_below": protocol.SEQ_COND_V_BELOW,
+             "i_above": protocol.SEQ_COND_I_ABOVE, "i_below": protocol.SEQ_COND_I_BELOW}
+    # Whether each op takes a value, a time and if the time may be left out
+    shapes = {protocol.SEQ_OP_SET_V: (True, False, False), protocol.SEQ_OP_SET_I: (True, False, False),
+              protocol.SEQ_OP_RAMP_V: (True, True, False), protocol.SEQ_OP_RAMP_I: (True, True, False),
+              protocol.SEQ_OP_DWELL: (False, True, False), protocol.SEQ_OP_LOOP: (True, True, True),
+              protocol.SEQ_OP_WAIT: (True, True, True), protocol.SEQ_OP_END: (False, False, False)}
+    lines = []
+    labels = {}
+    for num, line in enumerate(text.splitlines(), 1):
+        words = line.split("#")[0].split()
+        if len(words) == 1 and words[0].endswith(":"):
+            labels[words[0][:-1]] = len(lines)
+        elif words:
+            lines.append((num, words))
+    steps = []
+    for num, words in lines:
+        try:
+            op = ops[words[0]]
+            args = words[1:]
+            cond = 0
+            if op == protocol.SEQ_OP_WAIT:
+                cond = conds[args.pop(0)]
+            elif op == protocol.SEQ_OP_LOOP:
+                args[0] = str(labels.get(args[0], args[0]))
+            numbers = [int(a) for a in args]
+            takes_value, takes_time, time_optional = shapes[op]
+            value = numbers.pop(0) if takes_value else 0
+            time = numbers.pop(0) if takes_time and (numbers or not time_optional) else 0
+            if numbers:
+                raise ValueError
+        except (KeyError, IndexError, ValueError):
+            fail("program line {:d}: cannot make sense of '{}'".format(num, " ".join(words)))
+        if not 0 <= value <= 0xffff or not 0 <= time <= 0xffffffff:
+            fail("program line {:d}: value out of range".format(num))
+        if op == protocol.SEQ_OP_LOOP and value >= len(lines):
+            fail("program line {:d}: there is no step {:d}".format(num, value))
+        steps.append((op, cond, value, time))
+    if len(steps) < protocol.SEQ_MAX_STEPS:
+        steps.append((protocol.SEQ_OP_END, 0, 0, 0))
+    if len(steps) > protocol.SEQ_MAX_STEPS:
+        fail("a program has at most {:d} steps".format(protocol.SEQ_MAX_STEPS))
+    return steps
+
+
+def upload_program(comms, args):
+    """
+    Upload a program for the sequencer function from a file, see
+    parse_program(...) for the syntax
+    """
+    try:
+        with open(args.program) as f:
+            steps = parse_program(f.read())
+    except IOError as e:
+        fail("could not read program: {}".format(e))
+    for offset in range(0, len(steps), protocol.SEQ_CHUNK_STEPS):
+        chunk = steps[offset:offset + protocol.SEQ_CHUNK_STEPS]
+        ret_dict = communicate(comms, create_set_program(offset, chunk), args, quiet=True)
+        if not ret_dict or not ret_dict["status"]:
+            fail("device refused the program, the sequencer may be running or not built in")
+    print("Program uploaded, run it with -f seq -o on")
+
+
+def run_stream(comms, args):
+    """
+    Stream measurements from the device to a CSV or binary log.
+    CSV rows are 'time,v_in,v_out,i_out' in s, mV, mV, mA. Binary records are
+    little endian '<dHHH' with the same fields.
+    """
+    if args.stream < 1 or args.stream > 0xffff:
+        fail("decimation must be between 1 and 65535")
+    ret_dict = communicate(comms, create_stream_start(args.stream), args, quiet=True)
+    if not ret_dict or not ret_dict["status"]:
+        fail("device does not support streaming")
+    if ret_dict["decimation"] != args.stream:
+        print("Device selected decimation {:d}".format(ret_dict["decimation"]), file=sys.stderr)
+    interval = ret_dict["decimation"] / ret_dict["sample_rate"]
+    print("Streaming at {:.2f} samples/s, press ctrl-c to stop".format(1 / interval), file=sys.stderr)
+
+    binary = args.stream_format == "bin"
+    if args.stream_file:
+        log = open(args.stream_file, "wb" if binary else "w")
+    elif binary:
+        log = getattr(sys.stdout, "buffer", sys.stdout)
+    else:
+        log = sys.stdout
+    if not binary:
+        log.write("time,v_in,v_out,i_out\n")
+
+    sample_count = 0
+    lost = 0
+    next_seq = None
+    start_time = time.time()
+    try:
+        while args.stream_time == 0 or time.time() - start_time < args.stream_time:
+            f = read_stream_frame(comms)
+            if not f or f.get_frame()[0] != protocol.CMD_STREAM_DATA:
+                continue
+            data = unpack_stream_data(f)
+            if next_seq is not None and data['seq'] != next_seq:
+                lost += (data['seq'] - next_seq) & 0xffff
+            next_seq = (data['seq'] + 1) & 0xffff
+            for v_in, v_out, i_out in data['samples']:
+                t = sample_count * interval
+                if binary:
+                    log.write(struct.pack("<dHHH", t, v_in, v_out, i_out))
+                else:
+                    log.write("{:.6f},{:d},{:d},{:d}\n".format(t, v_in, v_out, i_out))
+                sample_count += 1
+    except KeyboardInterrupt:
+        pass
+    finally:
+        comms.write(create_cmd(protocol.CMD_STREAM_STOP).get_frame())
+        # Drain frames in flight until the stop is acknowledged
+        for _ in range(10):
+            f = read_stream_frame(comms)
+            if f and f.get_frame()[0] == protocol.CMD_RESPONSE | protocol.CMD_STREAM_STOP:
+                break
+        if args.stream_file:
+            log.close()
+        else:
+            log.flush()
+
+    print("{:d} samples received, {:d} batches lost".format(sample_count, lost), file=sys.stderr)
+
+
 def best_fit(X, Y):
     """
     Calculate linear line of best fit coefficients (y = kx + c)
@@ -679,9 +1087,9 @@ def get_average_calibration_result(comms, variable, num_samples=20):
     """
     Get an averaged reading of 'variable' from a calibration report
     """
-    data = []
-    for _ in range(num_samples):
-        data.append(communicate(comms, create_cmd(protocol.CMD_CAL_REPORT), args, quiet=True))
+    s = get_session(comms, args)
+    seqs = [s.submit(create_cmd(protocol.CMD_CAL_REPORT), quiet=True) for _ in range(num_samples)]
+    data = [s.result(seq) for seq in seqs]
     return sum(d[variable] for d in data) / num_samples
 
 
@@ -702,6 +1110,8 @@ def create_comms(args):
             comms = udp_interface(if_name)
         elif if_name[0:4] == "tcp:":
             comms = tcp_interface(if_name[4:])
+        elif if_name[0:5] == "unix:":
+            comms = unix_interface(if_name[5:])
         else:
             comms = tty_interface(if_name, args.baudrate)
     else:
@@ -1085,6 +1495,143 @@ def do_calibration(comms, args):
     print("To restore the device to the OpenDPS defaults use dpsctl.py --calibration_reset")
 
 
+class fleet_output(object):
+    """
+    Stands in for sys.stdout while running on a fleet, collecting what each
+    worker thread prints
+    """
+
+    def __init__(self, stdout):
+        self._stdout = stdout
+        self._local = threading.local()
+
+    def capture(self):
+        self._local.lines = []
+
+    def captured(self):
+        return "".join(self._local.lines)
+
+    def write(self, text):
+        if hasattr(self._local, "lines"):
+            self._local.lines.append(text)
+        else:
+            self._stdout.write(text)
+
+    def flush(self):
+        self._stdout.flush()
+
+
+class countdown(object):
+    """
+    Lets threads wait until a number of them are ready
+    """
+
+    def __init__(self, count):
+        self._count = count
+        self._cond = threading.Condition()
+
+    def ready_and_wait(self):
+        with self._cond:
+            self._count -= 1
+            self._cond.notify_all()
+            while self._count > 0:
+                self._cond.wait()
+
+
+def run_on_device(device, args, output, start):
+    """
+    Run the commands given for one device of a fleet and return the outcome
+    """
+    dev_args = copy.copy(args)
+    dev_args.device = device
+    output.capture()
+    result = {"device": device, "success": False}
+    ready = False
+    t = time.time()
+    try:
+        comms = create_comms(dev_args)
+        get_session(comms, dev_args)
+        ready = True
+        if start:
+            start.ready_and_wait()
+        t = time.time()
+        handle_commands(dev_args, comms)
+        result["success"] = True
+    except SystemExit:
+        pass  # fail(...) printed why
+    except Exception as e:
+        print("Error: {}.".format(e))
+    finally:
+        if start and not ready:
+            start.ready_and_wait()
+    result["elapsed"] = round(time.time() - t, 3)
+    text = output.captured()
+    errors = [line for line in text.splitlines() if line.startswith("Error: ")]
+    if errors:
+        result["error"] = errors[-1][len("Error: "):].rstrip(".")
+    if args.json:
+        # Each response was printed as a JSON object
+        result["responses"] = []
+        decoder = json.JSONDecoder()
+        pos = text.find("{")
+        while pos >= 0:
+            try:
+                obj, end = decoder.raw_decode(text, pos)
+                result["responses"].append(obj)
+                pos = text.find("{", end)
+            except ValueError:
+                pos = text.find("{", pos + 1)
+    else:
+        result["output"] = text.replace("\r", "\n").strip()
+    return result
+
+
+def run_fleet(args):
+    """
+    Run the commands given on each device of the fleet, at most args.workers
+    devices at a time, and print the outcome per device as JSON. When every
+    device gets a worker, all connect before any command is sent so the
+    commands go out together.
+    """
+    devices = list(args.fleet or [])
+    if args.fleet_scan:
+        devices += [d for d in uhej_scan(quiet=True) if d not in devices]
+    if not devices:
+        fail("no devices in the fleet")
+    if args.calibrate:
+        fail("calibration is interactive and cannot be run on a fleet")
+    num_workers = max(1, min(args.workers, len(devices)))
+    start = countdown(len(devices)) if num_workers == len(devices) else None
+    pending = queue.Queue()
+    for device in devices:
+        pending.put(device)
+    results = {}
+    output = fleet_output(sys.stdout)
+
+    def worker():
+        while True:
+            try:
+                device = pending.get_nowait()
+            except queue.Empty:
+                return
+            results[device] = run_on_device(device, args, output, start)
+
+    sys.stdout = output
+    try:
+        threads = [threading.Thread(target=worker) for _ in range(num_workers)]
+        for t in threads:
+            t.daemon = True
+            t.start()
+        for t in threads:
+            while t.is_alive():
+                t.join(0.1)  # Stay responsive to ctrl-c
+    finally:
+        sys.stdout = output._stdout
+    print(json.dumps([results[d] for d in devices], indent=4, sort_keys=True))
+    if not all(r["success"] for r in results.values()):
+        sys.exit(1)
+
+
 def uhej_worker_thread():
     """
     The worker thread used by uHej for service discovery
@@ -1108,8 +1655,9 @@ def uhej_worker_thread():
                         key = "{}:{}:{}".format(f["source"], s["port"], s["type"])
                         if key not in discovery_list:
                             if s["service_name"] == "opendps":
-                                discovery_list[key] = True  # Keep track of which hosts we have seen
-                                print("{}".format(f["source"]))
+                                discovery_list[key] = f["source"]  # Keep track of which hosts we have seen
+                                if not discovery_quiet:
+                                    print("{}".format(f["source"]))
                                 # print("{:>16}:{:<5d}  {:<8} {}".format(f["source"], s["port"], types[s["type"]], s["service_name"]))
             except uhej.IllegalFrameException as e:
                 pass
@@ -1117,14 +1665,16 @@ def uhej_worker_thread():
             print('Exception', e)
 
 
-def uhej_scan():
+def uhej_scan(quiet=False):
     """
-    Scan for OpenDPS devices on the local network
+    Scan for OpenDPS devices on the local network, return their addresses
     """
     from uhej import uhej
     global discovery_list
+    global discovery_quiet
     global sock
     discovery_list = {}
+    discovery_quiet = quiet
 
     ANY = "0.0.0.0"
     sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
@@ -1155,12 +1705,15 @@ def uhej_scan():
         time.sleep(1)
 
     num_found = len(discovery_list)
-    if num_found == 0:
+    if quiet:
+        pass
+    elif num_found == 0:
         print("No OpenDPS devices found")
     elif num_found == 1:
         print("1 OpenDPS device found")
     else:
         print("{:d} OpenDPS devices found".format(num_found))
+    return sorted(set(discovery_list.values()))
 
 
 def main():
@@ -1171,9 +1724,12 @@ def main():
     testing = '--testing' in sys.argv
     parser = argparse.ArgumentParser(description='Instrument an OpenDPS device')
 
-    parser.add_argument('-d', '--device', help="OpenDPS device to connect to. Can be a /dev/tty device, IP address for UDP protocol or tcp:IP for TCP protocol. If omitted, dpsctl.py will try the environment variable DPSIF", default='')
+    parser.add_argument('-d', '--device', help="OpenDPS device to connect to. Can be a /dev/tty device, IP address for UDP protocol, tcp:IP for TCP protocol or unix:PATH for a dpsd.py socket. If omitted, dpsctl.py will try the environment variable DPSIF", default='')
     parser.add_argument('-b', '--baudrate', type=int, dest="baudrate", help="Set baudrate used for serial communications", default=9600)
+    parser.add_argument('--set-baudrate', type=int, dest="set_baudrate", metavar='BAUDRATE', help="Switch device and serial port to BAUDRATE for this session, the device returns to --baudrate when done")
+    parser.add_argument('--persist-baudrate', action='store_true', dest="persist_baudrate", help="Keep the baudrate set with --set-baudrate across reboots, use it with --baudrate from then on")
     parser.add_argument('-B', '--brightness', type=int, help="Set display brightness (0..100)")
+    parser.add_argument('--adc-filter', type=int, dest="adc_filter", metavar='DEPTH', help="Average displayed and queried measurements over 2^DEPTH ADC samples (0..10)")
     parser.add_argument('-S', '--scan', action="store_true", help="Scan for OpenDPS wifi devices")
     parser.add_argument('-f', '--function', nargs='?', help="Set active function")
     parser.add_argument('-F', '--list-functions', action='store_true', help="List available functions")
@@ -1188,19 +1744,33 @@ def main():
     parser.add_argument('-L', '--lock', action='store_true', help="Lock device keys")
     parser.add_argument('-l', '--unlock', action='store_true', help="Unlock device keys")
     parser.add_argument('-q', '--query', action='store_true', help="Query device settings and measurements")
+    parser.add_argument('--energy', action='store_true', help="Read the charge and energy delivered while the output was enabled")
+    parser.add_argument('--energy-reset', action='store_true', dest="energy_reset", help="Read and restart the charge and energy counters")
     parser.add_argument('-j', '--json', action='store_true', help="Output parameters as JSON")
     parser.add_argument('-v', '--verbose', action='store_true', help="Verbose communications")
     parser.add_argument('-V', '--version', action='store_true', help="Get firmware version information")
     parser.add_argument('-U', '--upgrade', type=str, dest="firmware", help="Perform upgrade of OpenDPS firmware")
     parser.add_argument('--screen', type=str, dest="switch_screen", help="Switch to 'settings' or 'main' screen")
     parser.add_argument('--force', action='store_true', help="Force upgrade even if dpsctl complains about the firmware")
+    parser.add_argument('--waveform', type=str, help="Upload a waveform for the function generator from a file of values")
+    parser.add_argument('--program', type=str, help="Upload a program for the sequencer function from a file")
+    parser.add_argument('--stream', type=int, metavar='DECIMATION', help="Stream measurements averaged over DECIMATION ADC samples")
+    parser.add_argument('--stream-file', type=str, dest="stream_file", help="Write streamed measurements to this file instead of stdout")
+    parser.add_argument('--stream-format', choices=['csv', 'bin'], default='csv', dest="stream_format", help="Stream log format, 'csv' or 'bin'")
+    parser.add_argument('--stream-time', type=float, default=0, dest="stream_time", help="Stop streaming after this many seconds (default: until ctrl-c)")
+    parser.add_argument('--fleet', nargs='+', metavar='DEVICE', help="Run the commands given on all these devices in parallel and report the outcome as JSON")
+    parser.add_argument('--fleet-scan', action='store_true', dest="fleet_scan", help="Add the OpenDPS wifi devices found by scanning to the fleet")
+    parser.add_argument('--workers', type=int, default=16, help="Number of fleet devices to talk to at once")
     if testing:
         parser.add_argument('-t', '--temperature', type=str, dest="temperature", help="Send temperature report (for testing)")
 
     args, unknown = parser.parse_known_args()
 
     try:
-        handle_commands(args)
+        if args.fleet or args.fleet_scan:
+            run_fleet(args)
+        else:
+            handle_commands(args)
     except KeyboardInterrupt:
         print("")
 
@@ -0,0 +1,245 @@
+#!/usr/bin/env python
+
+"""
+The MIT License (MIT)
+
+Copyright (c) 2017 Johan Kanflo (github.com/kanflo)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+
+dpsd holds the connection to an OpenDPS device so that any number of local
+clients can share it through a Unix socket. Clients talk uframes to the
+socket just as they would to the device, dpsctl.py does so when given
+-d unix:<socket>. Commands from all clients are queued and sent to the device
+one at a time. Queries arriving while another query is queued or in flight
+share its response, and queries arriving within --max-age of the last
+response are answered from it. Frames the device sends unasked, like stream
+data, go to all clients.
+
+  dpsd.py -d /dev/tty.usbserial -s /tmp/dpsd.sock
+
+"""
+
+from __future__ import print_function
+
+import argparse
+import os
+import socket
+import sys
+import threading
+import time
+
+try:
+    import socketserver
+except ImportError:
+    import SocketServer as socketserver
+try:
+    import queue
+except ImportError:
+    import Queue as queue
+
+import dpsctl
+import protocol
+import uframe
+
+# How long to wait for the device to answer a command
+RESPONSE_TIMEOUT = 2.0
+
+
+class request(object):
+    """
+    A command waiting for its response, shared by all clients asking it
+    """
+
+    def __init__(self, frame):
+        self.frame = frame
+        self.command = frame[1]
+        self.response = None
+        self.done = threading.Event()
+
+
+class device(object):
+    """
+    Owns the device interface, sends queued commands one at a time and hands
+    responses back to their requests
+    """
+
+    def __init__(self, comms, max_age, verbose):
+        self._comms = comms
+        self._max_age = max_age
+        self._verbose = verbose
+        self._requests = queue.Queue()
+        self._responses = queue.Queue()
+        self._lock = threading.Lock()
+        self._pending_query = None
+        self._telemetry = None  # (time, response) of the last query
+        self._clients = set()
+        if not comms.open():
+            dpsctl.fail("could not open {}".format(comms.name()))
+
+    def start(self):
+        for target in (self._reader, self._writer):
+            t = threading.Thread(target=target)
+            t.daemon = True
+            t.start()
+
+    def add_client(self, client):
+        with self._lock:
+            self._clients.add(client)
+
+    def remove_client(self, client):
+        with self._lock:
+            self._clients.discard(client)
+
+    def execute(self, frame):
+        """
+        Send a command and return the response frame, None on timeout
+        """
+        with self._lock:
+            if frame[1] == protocol.CMD_QUERY:
+                if self._telemetry and time.time() - self._telemetry[0] <= self._max_age:
+                    return self._telemetry[1]
+                if self._pending_query is None:
+                    self._pending_query = request(frame)
+                    self._requests.put(self._pending_query)
+                req = self._pending_query
+            else:
+                req = request(frame)
+                self._requests.put(req)
+        req.done.wait()
+        return req.response
+
+    def _writer(self):
+        while True:
+            req = self._requests.get()
+            while not self._responses.empty():  # Late responses to commands given up on
+                self._responses.get()
+            self._comms.write(req.frame)
+            deadline = time.time() + RESPONSE_TIMEOUT
+            while True:
+                try:
+                    resp = self._responses.get(timeout=max(deadline - time.time(), 0))
+                except queue.Empty:
+                    if self._verbose:
+                        print("No response to command {:d}".format(req.command))
+                    break
+                if resp[1] == protocol.CMD_RESPONSE | req.command:
+                    req.response = resp
+                    break
+            with self._lock:
+                if req is self._pending_query:
+                    self._pending_query = None
+                    if req.response:
+                        self._telemetry = (time.time(), req.response)
+            req.done.set()
+
+    def _reader(self):
+        while True:
+            try:
+                resp = self._comms.read()
+            except socket.timeout:
+                continue
+            f = uframe.uFrame()
+            if len(resp) == 0 or f.set_frame(resp) < 0:
+                continue
+            if f.get_frame()[0] & protocol.CMD_RESPONSE:
+                self._responses.put(bytes(resp))
+            else:
+                with self._lock:
+                    clients = list(self._clients)
+                for client in clients:
+                    client.send(bytes(resp))
+
+
+class client_handler(socketserver.BaseRequestHandler):
+    """
+    Serves one client, forwarding each frame it sends to the device
+    """
+
+    def setup(self):
+        self._send_lock = threading.Lock()
+        self.server.device.add_client(self)
+
+    def finish(self):
+        self.server.device.remove_client(self)
+
+    def send(self, data):
+        with self._send_lock:
+            try:
+                self.request.sendall(data)
+            except socket.error:
+                pass
+
+    def handle(self):
+        buf = bytearray()
+        while True:
+            try:
+                data = self.request.recv(1024)
+            except socket.error:
+                return
+            if not data:
+                return
+            buf += bytearray(data)
+            while uframe._EOF in buf:
+                end = buf.index(uframe._EOF) + 1
+                frame, buf = buf[:end], buf[end:]
+                if uframe._SOF not in frame:
+                    continue
+                frame = bytes(frame[frame.index(uframe._SOF):])
+                if len(frame) < 4:
+                    continue
+                resp = self.server.device.execute(frame)
+                if resp:
+                    self.send(resp)
+
+
+class server(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Share an OpenDPS device between local clients')
+    parser.add_argument('-d', '--device', help="OpenDPS device to connect to, as for dpsctl.py", default='')
+    parser.add_argument('-b', '--baudrate', type=int, dest="baudrate", help="Set baudrate used for serial communications", default=9600)
+    parser.add_argument('-s', '--socket', type=str, default="/tmp/dpsd.sock", help="The Unix socket to serve clients on")
+    parser.add_argument('-a', '--max-age', type=int, dest="max_age", default=100, help="Answer queries from the last response if it is at most this many ms old")
+    parser.add_argument('-v', '--verbose', action='store_true', help="Verbose communications")
+    args = parser.parse_args()
+
+    comms = dpsctl.create_comms(args)
+    if comms.name().startswith("unix:"):
+        dpsctl.fail("dpsd cannot connect to itself")
+    dev = device(comms, args.max_age / 1000.0, args.verbose)
+    if os.path.exists(args.socket):
+        os.unlink(args.socket)
+    srv = server(args.socket, client_handler)
+    srv.device = dev
+    dev.start()
+    if args.verbose:
+        print("Serving {} on {}".format(comms.name(), args.socket))
+    try:
+        srv.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        os.unlink(args.socket)
+
+
+if __name__ == "__main__":
+    main()
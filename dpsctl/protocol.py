@@ -50,6 +50,14 @@ CMD_SET_CALIBRATION = 19
 CMD_CLEAR_CALIBRATION = 20
 CMD_CHANGE_SCREEN = 21
 CMD_SET_BRIGHTNESS = 22
+CMD_STREAM_START = 23
+CMD_STREAM_STOP = 24
+CMD_STREAM_DATA = 25
+CMD_SET_WAVEFORM = 26
+CMD_SET_ADC_FILTER = 27
+CMD_ENERGY = 28
+CMD_SET_BAUDRATE = 29
+CMD_SET_PROGRAM = 30
 CMD_RESPONSE = 0x80
 
 # wifi_status_t
@@ -66,8 +74,41 @@ UPGRADE_CRC_ERROR = 2
 UPGRADE_ERASE_ERROR = 3
 UPGRADE_FLASH_ERROR = 4
 UPGRADE_OVERFLOW_ERROR = 5
+UPGRADE_PROTOCOL_ERROR = 6
 UPGRADE_SUCCESS = 16
 
+# Marks an absolute value in place of a delta in cmd_stream_data frames
+STREAM_DELTA_ESCAPE = 0x80
+
+# cmd_set_baudrate, the device falls back unless pinged this soon after switching
+BAUDRATE_MIN = 1200
+BAUDRATE_MAX = 1000000
+BAUDRATE_SWITCH_TIMEOUT_MS = 1000
+
+# function generator user waveform
+WAVEFORM_POINTS = 64
+WAVEFORM_CHUNK_SIZE = 32
+
+# sequencer program, steps are (op, cond, value, time)
+SEQ_MAX_STEPS = 24
+SEQ_CHUNK_STEPS = 4
+
+# seq_op_t
+SEQ_OP_END = 0
+SEQ_OP_SET_V = 1
+SEQ_OP_SET_I = 2
+SEQ_OP_RAMP_V = 3
+SEQ_OP_RAMP_I = 4
+SEQ_OP_DWELL = 5
+SEQ_OP_LOOP = 6
+SEQ_OP_WAIT = 7
+
+# seq_cond_t
+SEQ_COND_V_ABOVE = 0
+SEQ_COND_V_BELOW = 1
+SEQ_COND_I_ABOVE = 2
+SEQ_COND_I_BELOW = 3
+
 # options for cmd_change_screen
 CHANGE_SCREEN_MAIN = 0
 CHANGE_SCREEN_SETTINGS = 1
@@ -220,6 +261,60 @@ def create_set_brightness(brightness):
     return f
 
 
+def create_set_adc_filter(depth):
+    f = uFrame()
+    f.pack8(CMD_SET_ADC_FILTER)
+    f.pack8(depth)
+    f.end()
+    return f
+
+
+def create_energy(reset):
+    f = uFrame()
+    f.pack8(CMD_ENERGY)
+    f.pack8(1 if reset else 0)
+    f.end()
+    return f
+
+
+def create_set_baudrate(baudrate, persist):
+    f = uFrame()
+    f.pack8(CMD_SET_BAUDRATE)
+    f.pack32(baudrate)
+    f.pack8(1 if persist else 0)
+    f.end()
+    return f
+
+
+def create_stream_start(decimation):
+    f = uFrame()
+    f.pack8(CMD_STREAM_START)
+    f.pack16(decimation)
+    f.end()
+    return f
+
+def create_set_waveform(offset, points):
+    f = uFrame()
+    f.pack8(CMD_SET_WAVEFORM)
+    f.pack8(offset)
+    for p in points:
+        f.pack8(p)
+    f.end()
+    return f
+
+def create_set_program(offset, steps):
+    f = uFrame()
+    f.pack8(CMD_SET_PROGRAM)
+    f.pack8(offset)
+    for (op, cond, value, time) in steps:
+        f.pack8(op)
+        f.pack8(cond)
+        f.pack16(value)
+        f.pack32(time)
+    f.end()
+    return f
+
+
 # ########################################################################## #
 # Helpers for unpacking frames.
 #
@@ -365,3 +460,52 @@ def unpack_version_response(uframe):
     data['boot_git_hash'] = uframe.unpack_cstr()
     data['app_git_hash'] = uframe.unpack_cstr()
     return data
+
+
+def unpack_stream_start_response(uframe):
+    """
+    Returns the sample rate and decimation selected by the device, a device
+    that refused has sent the status only
+    """
+    data = {}
+    data['command'] = uframe.unpack8()
+    data['status'] = uframe.unpack8()
+    if data['status']:
+        data['sample_rate'] = uframe.unpack16()
+        data['decimation'] = uframe.unpack16()
+    return data
+
+
+def unpack_energy_response(uframe):
+    """
+    Returns the charge (uAh), energy (uWh) and runtime (ms) counters
+    """
+    data = {}
+    data['command'] = uframe.unpack8()
+    data['status'] = uframe.unpack8()
+    data['charge'] = uframe.unpack32() << 32 | uframe.unpack32()
+    data['energy'] = uframe.unpack32() << 32 | uframe.unpack32()
+    data['runtime'] = uframe.unpack32() << 32 | uframe.unpack32()
+    return data
+
+
+def unpack_stream_data(uframe):
+    """
+    Returns the batch sequence number and a list of (v_in, v_out, i_out) samples
+    """
+    data = {}
+    data['command'] = uframe.unpack8()
+    data['seq'] = uframe.unpack16()
+    sample = [uframe.unpack16(), uframe.unpack16(), uframe.unpack16()]
+    data['samples'] = [tuple(sample)]
+    while not uframe.eof():
+        for i in range(3):
+            delta = uframe.unpack8()
+            if delta == STREAM_DELTA_ESCAPE:
+                sample[i] = uframe.unpack16()
+            else:
+                if delta & 0x80:
+                    delta -= 0x100
+                sample[i] = (sample[i] + delta) & 0xffff
+        data['samples'].append(tuple(sample))
+    return data
@@ -22,6 +22,8 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 """
 
+from crc16 import crc16_add
+
 _SOF = 0x7e
 _DLE = 0x7d
 _XOR = 0x20
@@ -33,19 +35,6 @@ E_FRM = 2  # Received data has no framing
 E_CRC = 3  # CRC mismatch
 
 
-def crc16_ccitt(crc, data):
-    """
-     https://stackoverflow.com/a/30357446
-    """
-    msb = crc >> 8
-    lsb = crc & 255
-    x = data ^ msb
-    x ^= (x >> 4)
-    msb = (lsb ^ (x >> 3) ^ (x << 4)) & 255
-    lsb = (x ^ (x << 5)) & 255
-    return (msb << 8) + lsb
-
-
 class uFrame(object):
     """
     Describes a class for simple serial protocols
@@ -66,7 +55,7 @@ class uFrame(object):
         """
         byte &= 0xff
         if update_crc:
-            self._crc = crc16_ccitt(self._crc, byte)
+            self._crc = crc16_add(self._crc, byte)
         if byte in [_SOF, _DLE, _EOF]:
             self._frame.append(_DLE)
             self._frame.append(byte ^ _XOR)
@@ -155,7 +144,7 @@ class uFrame(object):
         """
         self._crc = 0
         for b in self._frame[:-2]:
-            self._crc = crc16_ccitt(self._crc, b)
+            self._crc = crc16_add(self._crc, b)
         self._crc &= 0xffff
         crc = (self._frame[-2] << 8) | self._frame[-1]
         self._valid = crc == self._crc
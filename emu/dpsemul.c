@@ -108,8 +108,9 @@ void* comm_thread(void *arg)
             printf("Error: recvfrom()\n");
         }
         printf("[Com] Received %lu bytes\n", recv_len);
-        for (int i = 0; i < recv_len; i++) {
-            if (!event_put(event_uart_rx, buf[i])) {
+        for (int i = 0; i < recv_len; i += EVENT_MAX_PAYLOAD) {
+            uint32_t length = recv_len - i < EVENT_MAX_PAYLOAD ? recv_len - i : EVENT_MAX_PAYLOAD;
+            if (!event_put_data(event_uart_rx, (uint8_t*) &buf[i], length)) {
                 dbg_printf("Error: event queue overflowed\n");
             }
         }
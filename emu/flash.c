@@ -6,7 +6,7 @@
 #include "flash.h"
 #include "past.h"
 
-#define FLASH_SIZE  (2048)
+#define FLASH_SIZE  (PAST_NUM_BLOCKS * PAST_BLOCK_SIZE)
 
 static uint8_t flash[FLASH_SIZE];
 static char *past_name;
@@ -16,8 +16,9 @@ void flash_emul_init(past_t *past, char *_past_name, bool _persistent)
 {
     past_name = _past_name;
     persistent = _persistent;
-    past->blocks[0] = 0;
-    past->blocks[1] = 1024;
+    for (uint32_t i = 0; i < PAST_NUM_BLOCKS; i++) {
+        past->blocks[i] = i * PAST_BLOCK_SIZE;
+    }
     memset(flash, 0xff, FLASH_SIZE);
     if (past_name) {
         FILE *f = fopen(past_name, "rb");
@@ -25,6 +25,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include "protocol.h"
+
+static uint32_t usart_baudrate = CONFIG_BAUDRATE;
 
 /**
   * @brief Initialize the hardware
@@ -48,6 +51,39 @@ void hw_get_adc_values(uint16_t *i_out_raw, uint16_t *v_in_raw, uint16_t *v_out_
     *v_out_raw = 0;
 }
 
+/**
+  * @brief Read the oversampled ADC measurements
+  * @param i_out filtered I_out
+  * @param v_in filtered V_in
+  * @param v_out filtered V_out
+  * @retval none
+  */
+void hw_get_adc_filtered(uint16_t *i_out, uint16_t *v_in, uint16_t *v_out)
+{
+    *i_out = 0;
+    *v_in = 0;
+    *v_out = 0;
+}
+
+/**
+  * @brief Set the oversampling filter depth
+  * @param depth log2 of the number of samples averaged
+  * @retval true if the depth was within range
+  */
+bool hw_set_adc_filter_depth(uint32_t depth)
+{
+    return depth <= 10;
+}
+
+/**
+  * @brief Get the oversampling filter depth
+  * @retval log2 of the number of samples averaged
+  */
+uint32_t hw_get_adc_filter_depth(void)
+{
+    return 0;
+}
+
 /**
   * @brief Initialize TIM4 that drives the backlight of the TFT
   * @retval None
@@ -82,6 +118,58 @@ bool hw_sel_button_pressed(void)
     return false;
 }
 
+/**
+  * @brief Queue data for transmission on USART1, frames are sent over UDP
+  *        in the emulator
+  * @retval None
+  */
+void hw_usart_send(const uint8_t *data, uint32_t length)
+{
+    (void) data;
+    (void) length;
+}
+
+/**
+  * @brief Wait for all queued USART1 data to leave the transmitter
+  * @retval None
+  */
+void hw_usart_flush(void)
+{
+}
+
+/**
+  * @brief Check if USART1 can run at a baudrate
+  * @param baudrate the baudrate
+  * @retval true if the baudrate is in range
+  */
+bool hw_baudrate_valid(uint32_t baudrate)
+{
+    return baudrate >= BAUDRATE_MIN && baudrate <= BAUDRATE_MAX;
+}
+
+/**
+  * @brief Change the USART1 baudrate, the UDP link does not care
+  * @param baudrate the new baudrate
+  * @retval false if the baudrate is not valid
+  */
+bool hw_set_baudrate(uint32_t baudrate)
+{
+    if (!hw_baudrate_valid(baudrate)) {
+        return false;
+    }
+    usart_baudrate = baudrate;
+    return true;
+}
+
+/**
+  * @brief Get the current USART1 baudrate
+  * @retval the baudrate
+  */
+uint32_t hw_get_baudrate(void)
+{
+    return usart_baudrate;
+}
+
 /**
   * @brief Set TFT backlight value
   * @retval None
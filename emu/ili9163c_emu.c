@@ -13,6 +13,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "spi_driver.h"
 
 static SDL_Window *window = NULL;
 SDL_Renderer *renderer;
@@ -277,6 +278,20 @@ void ili9163c_draw_hline(int16_t x, int16_t y, int16_t w, uint16_t color) {
   pthread_mutex_unlock(&tftSurfaceMutex);
 }
 
+uint32_t ili9163c_write_pixels(const uint16_t *pixels, uint32_t count) {
+  (void)spi_dma_transceive((uint8_t *)pixels, 2 * count, NULL, 0);
+  return 0;
+}
+
+void ili9163c_fill_pixels(uint16_t color, uint32_t count) {
+  pthread_mutex_lock(&tftSurfaceMutex);
+  SDL_FillRect(tftSurface, &curr_rect,
+               RGB565_to_SDLColor(tftSurface->format, color));
+  pthread_mutex_unlock(&tftSurfaceMutex);
+}
+
+void ili9163c_wait(uint32_t ticket) {}
+
 /**
  * @brief Emulate SPI transaction, for image data coming to the display
  *
@@ -87,9 +87,9 @@ void serial_handle_rx_char(char c)
             i--;
         }
     } else if (i >= sizeof(buffer) - 1) {
-        usart_send_blocking(USART1, '\a');
+        hw_usart_send((uint8_t*) "\a", 1);
     } else if (c == ';') {
-        usart_send_blocking(USART1, '\n');
+        hw_usart_send((uint8_t*) "\n", 1);
         if (strlen(buffer) > 0) {
             cli_run(commands, sizeof(commands) / sizeof(cli_command_t), (char*) buffer);
         }
@@ -100,7 +100,7 @@ void serial_handle_rx_char(char c)
         // Ignore other control characters
     } else {
         buffer[i++] = c;
-        usart_send_blocking(USART1, c);
+        hw_usart_send((uint8_t*) &c, 1);
     }
 }
 
@@ -126,11 +126,11 @@ static void stat_cmd(uint32_t argc, char *argv[])
 {
     (void) argc;
     (void) argv;
-    uint16_t i_out_raw, v_in_raw, v_out_raw;
-    hw_get_adc_values(&i_out_raw, &v_in_raw, &v_out_raw);
-    uint32_t v_in = pwrctl_calc_vin(v_in_raw);
-    uint32_t v_out = pwrctl_calc_vout(v_out_raw);
-    uint32_t i_out = pwrctl_calc_iout(i_out_raw);
+    uint16_t i_out_filtered, v_in_filtered, v_out_filtered;
+    hw_get_adc_filtered(&i_out_filtered, &v_in_filtered, &v_out_filtered);
+    uint32_t v_in = pwrctl_calc_vin_filtered(v_in_filtered);
+    uint32_t v_out = pwrctl_calc_vout_filtered(v_out_filtered);
+    uint32_t i_out = pwrctl_calc_iout_filtered(i_out_filtered);
     dbg_printf(" V_in  : %02u.%02u V\n", v_in/1000,  (v_in%1000)/10);
     dbg_printf(" V_out : %02u.%02u V (%s)\n", v_out/1000, (v_out%1000)/10, pwrctl_vout_enabled() ? "enabled" : "disabled");
     dbg_printf(" I_out : %02u.%03u A\n", i_out/1000, i_out%1000);
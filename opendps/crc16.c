@@ -1,4 +1,7 @@
 #include "crc16.h"
+#if CONFIG_CRC16_TABLE_BITS
+#include "crc16_table.h"
+#endif // CONFIG_CRC16_TABLE_BITS
 
 /**
   * @brief Add byte to crc
@@ -9,9 +12,18 @@
   */
 uint16_t crc16_add(uint16_t crc, uint8_t byte)
 {
+#if CONFIG_CRC16_TABLE_BITS == 8
+    crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ byte];
+#elif CONFIG_CRC16_TABLE_BITS == 4
+    /** A nibble at a time, the table is 32 bytes instead of 512 */
+    crc = (crc << 4) ^ crc16_nibble_table[(crc >> 12) ^ (byte >> 4)];
+    crc = (crc << 4) ^ crc16_nibble_table[((crc >> 12) & 0x0f) ^ (byte & 0x0f)];
+#else // CONFIG_CRC16_TABLE_BITS
+    /** The polynomial's bits folded into shifts of the top byte */
     uint8_t x = crc >> 8 ^ byte;
     x ^= x >> 4;
     crc = (crc << 8) ^ ((uint16_t)(x << 12)) ^ ((uint16_t)(x << 5)) ^ ((uint16_t)x);
+#endif // CONFIG_CRC16_TABLE_BITS
     return crc & 0xFFFF;
 }
 
@@ -23,13 +35,10 @@ uint16_t crc16_add(uint16_t crc, uint8_t byte)
   */
 uint16_t crc16(uint8_t *data, uint16_t length)
 {
-    uint8_t x;
-    uint16_t crc = 0; // 0x1d0F; // 0x1021;
-    if (data && length) {
-        while (length--){
-            x = crc >> 8 ^ *data++;
-            x ^= x >> 4;
-            crc = (crc << 8) ^ ((uint16_t)(x << 12)) ^ ((uint16_t)(x << 5)) ^ ((uint16_t)x);
+    uint16_t crc = 0;
+    if (data) {
+        while (length--) {
+            crc = crc16_add(crc, *data++);
         }
     }
     return crc;
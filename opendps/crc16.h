@@ -3,6 +3,17 @@
 
 #include <stdint.h>
 
+/** CRC-16/XMODEM, either computed with a handful of shifts
+  * (CONFIG_CRC16_TABLE_BITS=0), looked up a nibble at a time in a 32 byte
+  * table (4) or a byte at a time in a 512 byte table (8). The shifts need no
+  * table, see tests/crc16_bench.c for how the three compare. */
+#ifndef CONFIG_CRC16_TABLE_BITS
+ #define CONFIG_CRC16_TABLE_BITS  (0)
+#endif // CONFIG_CRC16_TABLE_BITS
+#if CONFIG_CRC16_TABLE_BITS != 0 && CONFIG_CRC16_TABLE_BITS != 4 && CONFIG_CRC16_TABLE_BITS != 8
+ #error "CONFIG_CRC16_TABLE_BITS must be 0, 4 or 8"
+#endif
+
 /**
   * @brief Add byte to crc
   * @param crc crc calculated so far
@@ -0,0 +1,11 @@
+/** CRC16 table generated from `../dpsctl/crc16.py -o crc16_table` */
+
+#ifndef __CRC16_TABLE_H__
+#define __CRC16_TABLE_H__
+
+#include <stdint.h>
+
+extern const uint16_t crc16_table[256];
+extern const uint16_t crc16_nibble_table[16];
+
+#endif // __CRC16_TABLE_H__
@@ -22,8 +22,10 @@
  * THE SOFTWARE.
  */
 
-#include <usart.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include "dbg_printf.h"
+#include "hw.h"
 #include "mini-printf.h"
 
 #ifndef CONFIG_DBG_PRINTF_BUFFER_SIZE
@@ -39,8 +41,7 @@ int dbg_printf(const char *fmt, ...)
     va_start(va, fmt);
     size = mini_vsnprintf(buffer, CONFIG_DBG_PRINTF_BUFFER_SIZE, fmt, va);
     va_end(va);
-    for (int i = 0; i < size; i++) {
-        usart_send_blocking(USART1, buffer[i]);
-    }
+    /** Share the transmit ring so prints and other output do not mix */
+    hw_usart_send((uint8_t*) buffer, size);
     return size;
 }
@@ -21,19 +21,111 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  * THE SOFTWARE.
  */
-
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
-#include "ringbuf.h"
 #include "event.h"
+#ifdef DPS_EMULATOR
+ #include <pthread.h>
+#else // DPS_EMULATOR
+ #include <cortex.h>
+#endif // DPS_EMULATOR
+
+/*
+ * Events are stored in single producer, single consumer rings of bytes as
+ * [event:8] [length:8] [payload]. The producer only ever writes 'head' and the
+ * consumer only 'tail', both running freely and masked when indexing, so no
+ * locking is needed between the two.
+ *
+ * Received UART data has a ring of its own fed by the USART ISR (or the
+ * emulator comms thread). All other events originate from several ISRs of
+ * the same priority and the main loop, the latter briefly masking interrupts
+ * to act as one producer.
+ */
+
+#ifndef CONFIG_EVENT_QUEUE_SIZE
+ #define CONFIG_EVENT_QUEUE_SIZE  (64)
+#endif // CONFIG_EVENT_QUEUE_SIZE
+
+#ifndef CONFIG_EVENT_UART_QUEUE_SIZE
+ #define CONFIG_EVENT_UART_QUEUE_SIZE  (128)
+#endif // CONFIG_EVENT_UART_QUEUE_SIZE
 
-#define MAX_EVENTS	(64)
+#if (CONFIG_EVENT_QUEUE_SIZE & (CONFIG_EVENT_QUEUE_SIZE - 1)) || (CONFIG_EVENT_UART_QUEUE_SIZE & (CONFIG_EVENT_UART_QUEUE_SIZE - 1))
+ #error "Event queue sizes must be powers of two"
+#endif
 
-static ringbuf_t events;
-static uint8_t buffer[2*MAX_EVENTS];
+#define EVENT_HEADER_SIZE  (2)
+
+typedef struct {
+	uint8_t *buf;
+	uint32_t mask;
+	uint32_t head; /** Written by the producer only */
+	uint32_t tail; /** Written by the consumer only */
+	uint32_t drops; /** Events lost due to the queue being full */
+} event_queue_t;
+
+static uint8_t event_buffer[CONFIG_EVENT_QUEUE_SIZE];
+static uint8_t uart_buffer[CONFIG_EVENT_UART_QUEUE_SIZE];
+static event_queue_t events = { event_buffer, CONFIG_EVENT_QUEUE_SIZE - 1, 0, 0, 0 };
+static event_queue_t uart_events = { uart_buffer, CONFIG_EVENT_UART_QUEUE_SIZE - 1, 0, 0, 0 };
+
+#ifdef DPS_EMULATOR
+/** The SDL and main threads both produce events */
+static pthread_mutex_t producer_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif // DPS_EMULATOR
+
+/**
+  * @brief Put event in queue, must only be called by the producer of the queue
+  * @param q the queue
+  * @param event event type
+  * @param data payload
+  * @param length length of payload
+  * @retval true if there was room for the event
+  */
+static bool queue_put(event_queue_t *q, event_t event, const uint8_t *data, uint32_t length)
+{
+	uint32_t head = q->head;
+	uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	if (q->mask + 1 - (head - tail) < EVENT_HEADER_SIZE + length) {
+		q->drops++;
+		return false;
+	}
+	q->buf[head++ & q->mask] = event;
+	q->buf[head++ & q->mask] = length;
+	for (uint32_t i = 0; i < length; i++) {
+		q->buf[head++ & q->mask] = data[i];
+	}
+	/** Publish the event once all of it is in place */
+	__atomic_store_n(&q->head, head, __ATOMIC_RELEASE);
+	return true;
+}
 
+/**
+  * @brief Get event from queue, must only be called by the consumer
+  * @param q the queue
+  * @param event event type
+  * @param data payload, room for EVENT_MAX_PAYLOAD bytes
+  * @param length length of payload
+  * @retval true if an event was found
+  */
+static bool queue_get(event_queue_t *q, event_t *event, uint8_t *data, uint32_t *length)
+{
+	uint32_t tail = q->tail;
+	uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	if (head == tail) {
+		return false;
+	}
+	*event = q->buf[tail++ & q->mask];
+	*length = q->buf[tail++ & q->mask];
+	for (uint32_t i = 0; i < *length; i++) {
+		data[i] = q->buf[tail++ & q->mask];
+	}
+	/** Hand the space back to the producer */
+	__atomic_store_n(&q->tail, tail, __ATOMIC_RELEASE);
+	return true;
+}
 
 /**
   * @brief Initialize the event module
@@ -41,39 +133,77 @@ static uint8_t buffer[2*MAX_EVENTS];
   */
 void event_init(void)
 {
-	ringbuf_init(&events, (uint8_t*) buffer, sizeof(buffer));
-	memset(buffer, 0, sizeof(buffer));
+	/** Discard anything queued so far, moving the tail is up to the consumer */
+	__atomic_store_n(&events.tail, __atomic_load_n(&events.head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	__atomic_store_n(&uart_events.tail, __atomic_load_n(&uart_events.head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
 }
 
 /**
   * @brief Fetch next event in queue
   * @param event the type of event received or 'event_none' if no events in queue
-  * @param data additional event data
+  * @param data additional event data, room for EVENT_MAX_PAYLOAD bytes
+  * @param length length of event data
   * @retval true if an event was found
   */
-bool event_get(event_t *event, uint8_t *data)
+bool event_get(event_t *event, uint8_t *data, uint32_t *length)
 {
-	bool got_event = true;
-	uint16_t e;
-	if (!ringbuf_get(&events, &e)) {
-		*event = event_none;
-		*data = 0;
-		got_event = false;
-	} else {
-		*event = e >> 8;
-		*data = e & 0xff;
-
+	if (queue_get(&events, event, data, length) ||
+		queue_get(&uart_events, event, data, length)) {
+		return true;
 	}
-	return got_event;
+	*event = event_none;
+	*data = 0;
+	*length = 0;
+	return false;
 }
 
 /**
   * @brief Place event in event fifo
   * @param event event type
   * @param data additional event data
-  * @retval None
+  * @retval true if there was room for the event
   */
 bool event_put(event_t event, uint8_t data)
 {
-	return ringbuf_put(&events, (uint16_t) (event << 8 | data));
+	return event_put_data(event, &data, 1);
+}
+
+/**
+  * @brief Place event with a multi byte payload in event fifo
+  * @param event event type
+  * @param data event data
+  * @param length length of data, at most EVENT_MAX_PAYLOAD
+  * @retval true if there was room for the event
+  */
+bool event_put_data(event_t event, const uint8_t *data, uint32_t length)
+{
+	bool success;
+	if (length > EVENT_MAX_PAYLOAD) {
+		return false;
+	}
+	if (event == event_uart_rx) {
+		/** Only produced by the USART ISR */
+		return queue_put(&uart_events, event, data, length);
+	}
+#ifdef DPS_EMULATOR
+	pthread_mutex_lock(&producer_mutex);
+	success = queue_put(&events, event, data, length);
+	pthread_mutex_unlock(&producer_mutex);
+#else // DPS_EMULATOR
+	/** Producing ISRs share priority and do not preempt each other, the
+	  * main loop must not be preempted half way */
+	bool masked = cm_mask_interrupts(true);
+	success = queue_put(&events, event, data, length);
+	cm_mask_interrupts(masked);
+#endif // DPS_EMULATOR
+	return success;
+}
+
+/**
+  * @brief Get number of events dropped due to full queues
+  * @retval number of dropped events since init
+  */
+uint32_t event_get_drops(void)
+{
+	return events.drops + uart_events.drops;
 }
@@ -25,6 +25,9 @@
 #ifndef __EVENT_H__
 #define __EVENT_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+
 typedef enum {
 	event_none = 0,
 	event_button_m1,
@@ -38,8 +41,8 @@ typedef enum {
   event_rot_right_set,
 	event_rot_press,
 	event_uart_rx,
-	event_ocp,
-	event_ovp
+	event_ocp, /** Payload: uint16_t sample to cut-off latency in ns */
+	event_ovp  /** Payload: uint16_t sample to cut-off latency in ns */
 } event_t;
 
 typedef enum {
@@ -47,6 +50,13 @@ typedef enum {
 	press_long,
 } button_press_t;
 
+/** Largest event payload, received UART data is batched up to this size */
+#ifndef CONFIG_EVENT_MAX_PAYLOAD
+ #define EVENT_MAX_PAYLOAD  (16)
+#else
+ #define EVENT_MAX_PAYLOAD  (CONFIG_EVENT_MAX_PAYLOAD)
+#endif
+
 
 /**
   * @brief Initialize the event module
@@ -57,17 +67,33 @@ void event_init(void);
 /**
   * @brief Fetch next event in queue
   * @param event the type of event received or 'event_none' if no events in queue
-  * @param data additional event data
+  * @param data additional event data, room for EVENT_MAX_PAYLOAD bytes
+  * @param length length of event data
   * @retval true if an event was found
   */
-bool event_get(event_t *event, uint8_t *data);
+bool event_get(event_t *event, uint8_t *data, uint32_t *length);
 
 /**
   * @brief Place event in event fifo
   * @param event event type
   * @param data additional event data
-  * @retval None
+  * @retval true if there was room for the event
   */
 bool event_put(event_t event, uint8_t data);
 
+/**
+  * @brief Place event with a multi byte payload in event fifo
+  * @param event event type
+  * @param data event data
+  * @param length length of data, at most EVENT_MAX_PAYLOAD
+  * @retval true if there was room for the event
+  */
+bool event_put_data(event_t event, const uint8_t *data, uint32_t length);
+
+/**
+  * @brief Get number of events dropped due to full queues
+  * @retval number of dropped events since init
+  */
+uint32_t event_get_drops(void);
+
 #endif // __EVENT_H__
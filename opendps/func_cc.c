@@ -52,7 +52,7 @@ static void current_changed(ui_number_t *item);
 static void cc_tick(void);
 static void past_save(past_t *past);
 static void past_restore(past_t *past);
-static set_param_status_t set_parameter(char *name, char *value);
+static set_param_status_t set_parameter(char *name, char *value, bool dry_run);
 static set_param_status_t get_parameter(char *name, char *value, uint32_t value_len);
 
 /* We need to keep copies of the user settings as the value in the UI will
@@ -150,10 +150,11 @@ ui_screen_t cc_screen = {
  *
  * @param[in]  name   name of parameter
  * @param[in]  value  value of parameter as a string - always in SI units
+ * @param[in]  dry_run  only validate the parameter, do not apply it
  *
  * @retval     set_param_status_t status code
  */
-static set_param_status_t set_parameter(char *name, char *value)
+static set_param_status_t set_parameter(char *name, char *value, bool dry_run)
 {
 
     int32_t ivalue = atoi(value);
@@ -162,6 +163,9 @@ static set_param_status_t set_parameter(char *name, char *value)
             emu_printf("[CC] Voltage %d is out of range (min:%d max:%d)\n", ivalue, cc_voltage.min, cc_voltage.max);
             return ps_range_error;
         }
+        if (dry_run) {
+            return ps_ok;
+        }
         emu_printf("[CC] Setting voltage to %d\n", ivalue);
         cc_voltage.value = ivalue;
         voltage_changed(&cc_voltage);
@@ -171,6 +175,9 @@ static set_param_status_t set_parameter(char *name, char *value)
             emu_printf("[CC] Current %d is out of range (min:%d max:%d)\n", ivalue, cc_current.min, cc_current.max);
             return ps_range_error;
         }
+        if (dry_run) {
+            return ps_ok;
+        }
         emu_printf("[CC] Setting current to %d\n", ivalue);
         cc_current.value = ivalue;
         current_changed(&cc_current);
@@ -256,10 +263,11 @@ static void current_changed(ui_number_t *item)
 static void past_save(past_t *past)
 {
     /** @todo: past bug causes corruption for units smaller than 4 bytes (#27) */
-    if (!past_write_unit(past, (SCREEN_ID << 24) | PAST_U, (void*) &saved_u, 4 /* sizeof(cc_voltage.value) */ )) {
-        /** @todo: handle past write failures */
-    }
-    if (!past_write_unit(past, (SCREEN_ID << 24) | PAST_I, (void*) &saved_i, 4 /* sizeof(cc_current.value) */ )) {
+    past_unit_t units[] = {
+        { (SCREEN_ID << 24) | PAST_U, (void*) &saved_u, 4 /* sizeof(cc_voltage.value) */ },
+        { (SCREEN_ID << 24) | PAST_I, (void*) &saved_i, 4 /* sizeof(cc_current.value) */ },
+    };
+    if (!past_write_units(past, units, sizeof(units) / sizeof(units[0]))) {
         /** @todo: handle past write failures */
     }
 }
@@ -293,12 +301,12 @@ static void past_restore(past_t *past)
  */
 static void cc_tick(void)
 {
-    uint16_t i_out_raw, v_in_raw, v_out_raw;
-    hw_get_adc_values(&i_out_raw, &v_in_raw, &v_out_raw);
+    uint16_t i_out_filtered, v_in_filtered, v_out_filtered;
+    hw_get_adc_filtered(&i_out_filtered, &v_in_filtered, &v_out_filtered);
     /** Continously update max voltage output value
       * Max output voltage = Vin / VIN_VOUT_RATIO
       * Add 0.5f to ensure correct rounding when truncated */
-    cc_voltage.max = (float) pwrctl_calc_vin(v_in_raw) / VIN_VOUT_RATIO + 0.5f;
+    cc_voltage.max = (float) pwrctl_calc_vin_filtered(v_in_filtered) / VIN_VOUT_RATIO + 0.5f;
     if (pwrctl_vout_enabled()) {
         if (cc_voltage.ui.has_focus) {
             /** If the voltage setting has focus, make sure we're displaying
@@ -309,7 +317,7 @@ static void cc_tick(void)
             }
         } else {
             /** No focus, update display if necessary */
-            int32_t new_u = pwrctl_calc_vout(v_out_raw);
+            int32_t new_u = pwrctl_calc_vout_filtered(v_out_filtered);
             if (new_u != cc_voltage.value) {
                 cc_voltage.value = new_u;
                 cc_voltage.ui.draw(&cc_voltage.ui);
@@ -325,7 +333,7 @@ static void cc_tick(void)
             }
         } else {
             /** No focus, update display if necessary */
-            int32_t new_i = pwrctl_calc_iout(i_out_raw);
+            int32_t new_i = pwrctl_calc_iout_filtered(i_out_filtered);
             if (new_i != cc_current.value) {
                 cc_current.value = new_i;
                 cc_current.ui.draw(&cc_current.ui);
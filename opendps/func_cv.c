@@ -50,7 +50,7 @@ static void current_changed(ui_number_t *item);
 static void cv_tick(void);
 static void past_save(past_t *past);
 static void past_restore(past_t *past);
-static set_param_status_t set_parameter(char *name, char *value);
+static set_param_status_t set_parameter(char *name, char *value, bool dry_run);
 static set_param_status_t get_parameter(char *name, char *value, uint32_t value_len);
 
 /* We need to keep copies of the user settings as the value in the UI will
@@ -148,10 +148,11 @@ ui_screen_t cv_screen = {
  *
  * @param[in]  name   name of parameter
  * @param[in]  value  value of parameter as a string - always in SI units
+ * @param[in]  dry_run  only validate the parameter, do not apply it
  *
  * @retval     set_param_status_t status code
  */
-static set_param_status_t set_parameter(char *name, char *value)
+static set_param_status_t set_parameter(char *name, char *value, bool dry_run)
 {
     int32_t ivalue = atoi(value);
     if (strcmp("voltage", name) == 0 || strcmp("u", name) == 0) {
@@ -159,6 +160,9 @@ static set_param_status_t set_parameter(char *name, char *value)
             emu_printf("[CV] Voltage %d is out of range (min:%d max:%d)\n", ivalue, cv_voltage.min, cv_voltage.max);
             return ps_range_error;
         }
+        if (dry_run) {
+            return ps_ok;
+        }
         emu_printf("[CV] Setting voltage to %d\n", ivalue);
         cv_voltage.value = ivalue;
         voltage_changed(&cv_voltage);
@@ -168,6 +172,9 @@ static set_param_status_t set_parameter(char *name, char *value)
             emu_printf("[CV] Current %d is out of range (min:%d max:%d)\n", ivalue, cv_current.min, cv_current.max);
             return ps_range_error;
         }
+        if (dry_run) {
+            return ps_ok;
+        }
         emu_printf("[CV] Setting current to %d\n", ivalue);
         cv_current.value = ivalue;
         current_changed(&cv_current);
@@ -255,10 +262,11 @@ static void current_changed(ui_number_t *item)
 static void past_save(past_t *past)
 {
     /** @todo: past bug causes corruption for units smaller than 4 bytes (#27) */
-    if (!past_write_unit(past, (SCREEN_ID << 24) | PAST_U, (void*) &saved_u, 4 /* sizeof(cv_voltage.value) */ )) {
-        /** @todo: handle past write failures */
-    }
-    if (!past_write_unit(past, (SCREEN_ID << 24) | PAST_I, (void*) &saved_i, 4 /* sizeof(cv_current.value) */ )) {
+    past_unit_t units[] = {
+        { (SCREEN_ID << 24) | PAST_U, (void*) &saved_u, 4 /* sizeof(cv_voltage.value) */ },
+        { (SCREEN_ID << 24) | PAST_I, (void*) &saved_i, 4 /* sizeof(cv_current.value) */ },
+    };
+    if (!past_write_units(past, units, sizeof(units) / sizeof(units[0]))) {
         /** @todo: handle past write failures */
     }
 }
@@ -292,12 +300,12 @@ static void past_restore(past_t *past)
  */
 static void cv_tick(void)
 {
-    uint16_t i_out_raw, v_in_raw, v_out_raw;
-    hw_get_adc_values(&i_out_raw, &v_in_raw, &v_out_raw);
+    uint16_t i_out_filtered, v_in_filtered, v_out_filtered;
+    hw_get_adc_filtered(&i_out_filtered, &v_in_filtered, &v_out_filtered);
     /** Continously update max voltage output value
       * Max output voltage = Vin / VIN_VOUT_RATIO
       * Add 0.5f to ensure correct rounding when truncated */
-    cv_voltage.max = (float) pwrctl_calc_vin(v_in_raw) / VIN_VOUT_RATIO + 0.5f;
+    cv_voltage.max = (float) pwrctl_calc_vin_filtered(v_in_filtered) / VIN_VOUT_RATIO + 0.5f;
     if (pwrctl_vout_enabled()) {
         if (cv_voltage.ui.has_focus) {
             /** If the voltage setting has focus, make sure we're displaying
@@ -308,7 +316,7 @@ static void cv_tick(void)
             }
         } else {
             /** No focus, update display if necessary */
-            int32_t new_u = pwrctl_calc_vout(v_out_raw);
+            int32_t new_u = pwrctl_calc_vout_filtered(v_out_filtered);
             if (new_u != cv_voltage.value) {
                 cv_voltage.value = new_u;
                 cv_voltage.ui.draw(&cv_voltage.ui);
@@ -324,7 +332,7 @@ static void cv_tick(void)
             }
         } else {
             /** No focus, update display if necessary */
-            int32_t new_i = pwrctl_calc_iout(i_out_raw);
+            int32_t new_i = pwrctl_calc_iout_filtered(i_out_filtered);
             if (new_i != cv_current.value) {
                 cv_current.value = new_i;
                 cv_current.ui.draw(&cv_current.ui);
@@ -0,0 +1,445 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Johan Kanflo (github.com/kanflo)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gfx-energy.h"
+#include "hw.h"
+#include "pwrctl.h"
+#include "func_energy.h"
+#include "uui.h"
+#include "uui_number.h"
+#include "dbg_printf.h"
+#include "mini-printf.h"
+#include "dps-model.h"
+#include "ili9163c.h"
+#include "font-full_small.h"
+
+/*
+ * This is the implementation of the energy screen, a CV supply that also
+ * shows the charge and energy delivered and for how long the output has been
+ * on, eg. for measuring what goes into a battery. The counters are integrated
+ * from every ADC sample by hw.c and restart when the output is enabled from
+ * this screen. The voltage and current items behave as in the CV screen.
+ */
+
+static void energy_enable(bool _enable);
+static void voltage_changed(ui_number_t *item);
+static void current_changed(ui_number_t *item);
+static void energy_tick(void);
+static void activated(void);
+static void deactivated(void);
+static void past_save(past_t *past);
+static void past_restore(past_t *past);
+static set_param_status_t set_parameter(char *name, char *value, bool dry_run);
+static set_param_status_t get_parameter(char *name, char *value, uint32_t value_len);
+
+/* We need to keep copies of the user settings as the value in the UI will
+ * be replaced with measurements when output is active
+ */
+static int32_t saved_u, saved_i;
+
+#define SCREEN_ID  (6)
+#define PAST_U     (0)
+#define PAST_I     (1)
+
+/** Readout positions, the text is drawn above its y position */
+#define XPOS_READOUT_LABEL  (6)
+#define XPOS_READOUT        (64)
+#define READOUT_WIDTH       (64)
+#define YPOS_CHARGE         (69 + FONT_FULL_SMALL_MAX_GLYPH_HEIGHT)
+#define YPOS_ENERGY         (83 + FONT_FULL_SMALL_MAX_GLYPH_HEIGHT)
+#define YPOS_RUNTIME        (97 + FONT_FULL_SMALL_MAX_GLYPH_HEIGHT)
+
+/** What the readouts currently show, only redrawn when changed */
+static char charge_str[12], energy_str[12], runtime_str[12];
+
+/* This is the definition of the voltage item in the UI */
+ui_number_t energy_voltage = {
+    {
+        .type = ui_item_number,
+        .id = 10,
+        .x = 120,
+        .y = 15,
+        .can_focus = true,
+    },
+    .font_size = FONT_METER_MEDIUM,
+    .alignment = ui_text_right_aligned,
+    .pad_dot = false,
+    .color = COLOR_VOLTAGE,
+    .value = 0,
+    .min = 0,
+    .max = 0, /** Set at init, continously updated in the tick callback */
+    .si_prefix = si_milli,
+    .num_digits = 2,
+    .num_decimals = 2,
+    .unit = unit_volt,
+    .changed = &voltage_changed,
+};
+
+/* This is the definition of the current item in the UI */
+ui_number_t energy_current = {
+    {
+        .type = ui_item_number,
+        .id = 11,
+        .x = 120,
+        .y = 42,
+        .can_focus = true,
+    },
+    .font_size = FONT_METER_MEDIUM,
+    .alignment = ui_text_right_aligned,
+    .pad_dot = false,
+    .color = COLOR_AMPERAGE,
+    .value = 0,
+    .min = 0,
+    .max = CONFIG_DPS_MAX_CURRENT,
+    .si_prefix = si_milli,
+    .num_digits = CURRENT_DIGITS,
+    .num_decimals = CURRENT_DECIMALS,
+    .unit = unit_ampere,
+    .changed = &current_changed,
+};
+
+/* This is the screen definition */
+ui_screen_t energy_screen = {
+    .id = SCREEN_ID,
+    .name = "energy",
+    .icon_data = (uint8_t *) gfx_energy,
+    .icon_data_len = sizeof(gfx_energy),
+    .icon_width = GFX_ENERGY_WIDTH,
+    .icon_height = GFX_ENERGY_HEIGHT,
+    .activated = &activated,
+    .deactivated = &deactivated,
+    .enable = &energy_enable,
+    .past_save = &past_save,
+    .past_restore = &past_restore,
+    .tick = &energy_tick,
+    .set_parameter = &set_parameter,
+    .get_parameter = &get_parameter,
+    .num_items = 2,
+    .parameters = {
+        {
+            .name = "voltage",
+            .unit = unit_volt,
+            .prefix = si_milli
+        },
+        {
+            .name = "current",
+            .unit = unit_ampere,
+            .prefix = si_milli
+        },
+        {
+            .name = {'\0'} /** Terminator */
+        },
+    },
+    .items = { (ui_item_t*) &energy_voltage, (ui_item_t*) &energy_current }
+};
+
+/**
+ * @brief      Set function parameter
+ *
+ * @param[in]  name   name of parameter
+ * @param[in]  value  value of parameter as a string - always in SI units
+ * @param[in]  dry_run  only validate the parameter, do not apply it
+ *
+ * @retval     set_param_status_t status code
+ */
+static set_param_status_t set_parameter(char *name, char *value, bool dry_run)
+{
+    int32_t ivalue = atoi(value);
+    if (strcmp("voltage", name) == 0 || strcmp("u", name) == 0) {
+        if (ivalue < energy_voltage.min || ivalue > energy_voltage.max) {
+            emu_printf("[Energy] Voltage %d is out of range (min:%d max:%d)\n", ivalue, energy_voltage.min, energy_voltage.max);
+            return ps_range_error;
+        }
+        if (dry_run) {
+            return ps_ok;
+        }
+        emu_printf("[Energy] Setting voltage to %d\n", ivalue);
+        energy_voltage.value = ivalue;
+        voltage_changed(&energy_voltage);
+        return ps_ok;
+    } else if (strcmp("current", name) == 0 || strcmp("i", name) == 0) {
+        if (ivalue < energy_current.min || ivalue > energy_current.max) {
+            emu_printf("[Energy] Current %d is out of range (min:%d max:%d)\n", ivalue, energy_current.min, energy_current.max);
+            return ps_range_error;
+        }
+        if (dry_run) {
+            return ps_ok;
+        }
+        emu_printf("[Energy] Setting current to %d\n", ivalue);
+        energy_current.value = ivalue;
+        current_changed(&energy_current);
+        return ps_ok;
+    }
+    return ps_unknown_name;
+}
+
+/**
+ * @brief      Get function parameter
+ *
+ * @param[in]  name       name of parameter
+ * @param[in]  value      value of parameter as a string - always in SI units
+ * @param[in]  value_len  length of value buffer
+ *
+ * @retval     set_param_status_t status code
+ */
+static set_param_status_t get_parameter(char *name, char *value, uint32_t value_len)
+{
+    if (strcmp("voltage", name) == 0 || strcmp("u", name) == 0) {
+        (void) mini_snprintf(value, value_len, "%d", (pwrctl_vout_enabled() ? saved_u : energy_voltage.value));
+        return ps_ok;
+    } else if (strcmp("current", name) == 0 || strcmp("i", name) == 0) {
+        (void) mini_snprintf(value, value_len, "%d", pwrctl_vout_enabled() ? saved_i : energy_current.value);
+        return ps_ok;
+    }
+    return ps_unknown_name;
+}
+
+/**
+ * @brief      Draw a readout if its text changed
+ *
+ * @param      shown  The text currently shown, updated
+ * @param[in]  text   The new text
+ * @param[in]  y      Bottom of the readout
+ * @param[in]  force  Draw even if the text did not change
+ */
+static void draw_readout(char *shown, const char *text, uint32_t y, bool force)
+{
+    if (force || strcmp(shown, text) != 0) {
+        strcpy(shown, text);
+        tft_fill(XPOS_READOUT, y - FONT_FULL_SMALL_MAX_GLYPH_HEIGHT, READOUT_WIDTH, FONT_FULL_SMALL_MAX_GLYPH_HEIGHT, BLACK);
+        tft_puts(FONT_FULL_SMALL, text, XPOS_READOUT, y, READOUT_WIDTH, FONT_FULL_SMALL_MAX_GLYPH_HEIGHT, WHITE, false);
+    }
+}
+
+/**
+ * @brief      Update the charge, energy and runtime readouts
+ *
+ * @param[in]  force  Redraw all readouts
+ */
+static void draw_readouts(bool force)
+{
+    hw_energy_t energy;
+    char text[sizeof(charge_str)];
+    hw_get_energy(&energy, false);
+
+    uint32_t mah = energy.charge_uah / 1000;
+    (void) mini_snprintf(text, sizeof(text), "%u.%03uAh", mah / 1000, mah % 1000);
+    draw_readout(charge_str, text, YPOS_CHARGE, force);
+
+    uint32_t mwh = energy.energy_uwh / 1000;
+    (void) mini_snprintf(text, sizeof(text), "%u.%03uWh", mwh / 1000, mwh % 1000);
+    draw_readout(energy_str, text, YPOS_ENERGY, force);
+
+    uint32_t s = energy.runtime_ms / 1000;
+    (void) mini_snprintf(text, sizeof(text), "%u:%02u:%02u", s / 3600, (s / 60) % 60, s % 60);
+    draw_readout(runtime_str, text, YPOS_RUNTIME, force);
+}
+
+/**
+ * @brief      Callback for when the function is enabled
+ *
+ * @param[in]  enabled  true when function is enabled
+ */
+static void energy_enable(bool enabled)
+{
+    emu_printf("[Energy] %s output\n", enabled ? "Enable" : "Disable");
+    if (enabled) {
+        hw_energy_t energy;
+        /** A new run, restart the counters */
+        hw_get_energy(&energy, true);
+        draw_readouts(false);
+        /** Display will now show the current values, keep the user setting saved */
+        saved_u = energy_voltage.value;
+        saved_i = energy_current.value;
+        (void) pwrctl_set_vout(energy_voltage.value);
+        (void) pwrctl_set_iout(CONFIG_DPS_MAX_CURRENT);
+        (void) pwrctl_set_ilimit(energy_current.value);
+        (void) pwrctl_set_vlimit(0xFFFF); /** Set the voltage limit to the maximum to prevent OVP (over voltage protection) firing */
+        pwrctl_enable_vout(true);
+    } else {
+        pwrctl_enable_vout(false);
+        /** Make sure we're displaying the settings and not the current
+          * measurements when the power output is switched off */
+        energy_voltage.value = saved_u;
+        energy_voltage.ui.draw(&energy_voltage.ui);
+        energy_current.value = saved_i;
+        energy_current.ui.draw(&energy_current.ui);
+    }
+}
+
+/**
+ * @brief      Callback for when value of the voltage item is changed
+ *
+ * @param      item  The voltage item
+ */
+static void voltage_changed(ui_number_t *item)
+{
+    saved_u = item->value;
+    (void) pwrctl_set_vout(item->value);
+}
+
+/**
+ * @brief      Callback for when value of the current item is changed
+ *
+ * @param      item  The current item
+ */
+static void current_changed(ui_number_t *item)
+{
+    saved_i = item->value;
+    (void) pwrctl_set_ilimit(item->value);
+}
+
+/**
+ * @brief      Draw the screen, it has more than the items
+ */
+static void activated(void)
+{
+    tft_clear();
+    for (uint32_t i = 0; i < energy_screen.num_items; i++) {
+        energy_screen.items[i]->draw(energy_screen.items[i]);
+    }
+    tft_puts(FONT_FULL_SMALL, "Charge:", XPOS_READOUT_LABEL, YPOS_CHARGE, 64, 20, WHITE, false);
+    tft_puts(FONT_FULL_SMALL, "Energy:", XPOS_READOUT_LABEL, YPOS_ENERGY, 64, 20, WHITE, false);
+    tft_puts(FONT_FULL_SMALL, "Time:", XPOS_READOUT_LABEL, YPOS_RUNTIME, 64, 20, WHITE, false);
+    draw_readouts(true);
+}
+
+/**
+ * @brief      Do any required clean up before changing away from this screen
+ */
+static void deactivated(void)
+{
+    /** Ensure the readouts have been cleared from the screen */
+    tft_clear();
+}
+
+/**
+ * @brief      Save persistent parameters
+ *
+ * @param      past  The past
+ */
+static void past_save(past_t *past)
+{
+    /** @todo: past bug causes corruption for units smaller than 4 bytes (#27) */
+    past_unit_t units[] = {
+        { (SCREEN_ID << 24) | PAST_U, (void*) &saved_u, 4 /* sizeof(energy_voltage.value) */ },
+        { (SCREEN_ID << 24) | PAST_I, (void*) &saved_i, 4 /* sizeof(energy_current.value) */ },
+    };
+    if (!past_write_units(past, units, sizeof(units) / sizeof(units[0]))) {
+        /** @todo: handle past write failures */
+    }
+}
+
+/**
+ * @brief      Restore persistent parameters
+ *
+ * @param      past  The past
+ */
+static void past_restore(past_t *past)
+{
+    uint32_t length;
+    uint32_t *p = 0;
+    if (past_read_unit(past, (SCREEN_ID << 24) | PAST_U, (const void**) &p, &length)) {
+        saved_u = energy_voltage.value = *p;
+        (void) length;
+    }
+    if (past_read_unit(past, (SCREEN_ID << 24) | PAST_I, (const void**) &p, &length)) {
+        saved_i = energy_current.value = *p;
+        (void) length;
+    }
+}
+
+/**
+ * @brief      Update the UI, the voltage and current items are handled as
+ *             in the CV screen and the readouts follow the counters.
+ */
+static void energy_tick(void)
+{
+    uint16_t i_out_filtered, v_in_filtered, v_out_filtered;
+    hw_get_adc_filtered(&i_out_filtered, &v_in_filtered, &v_out_filtered);
+    /** Continously update max voltage output value
+      * Max output voltage = Vin / VIN_VOUT_RATIO
+      * Add 0.5f to ensure correct rounding when truncated */
+    energy_voltage.max = (float) pwrctl_calc_vin_filtered(v_in_filtered) / VIN_VOUT_RATIO + 0.5f;
+    if (pwrctl_vout_enabled()) {
+        if (energy_voltage.ui.has_focus) {
+            /** If the voltage setting has focus, make sure we're displaying
+              * the desired setting and not the current output value. */
+            if (energy_voltage.value != (int32_t) pwrctl_get_vout()) {
+                energy_voltage.value = pwrctl_get_vout();
+                energy_voltage.ui.draw(&energy_voltage.ui);
+            }
+        } else {
+            /** No focus, update display if necessary */
+            int32_t new_u = pwrctl_calc_vout_filtered(v_out_filtered);
+            if (new_u != energy_voltage.value) {
+                energy_voltage.value = new_u;
+                energy_voltage.ui.draw(&energy_voltage.ui);
+            }
+        }
+
+        if (energy_current.ui.has_focus) {
+            /** If the current setting has focus, make sure we're displaying
+              * the desired setting and not the current output value. */
+            if (energy_current.value != saved_i) {
+                energy_current.value = saved_i;
+                energy_current.ui.draw(&energy_current.ui);
+            }
+        } else {
+            /** No focus, update display if necessary */
+            int32_t new_i = pwrctl_calc_iout_filtered(i_out_filtered);
+            if (new_i != energy_current.value) {
+                energy_current.value = new_i;
+                energy_current.ui.draw(&energy_current.ui);
+            }
+        }
+    }
+    draw_readouts(false);
+}
+
+/**
+ * @brief      Initialise the energy module and add its screen to the UI
+ *
+ * @param      ui    The user interface
+ */
+void func_energy_init(uui_t *ui)
+{
+    energy_voltage.value = 0; /** read from past */
+    energy_current.value = 0; /** read from past */
+    uint16_t i_out_raw, v_in_raw, v_out_raw;
+    hw_get_adc_values(&i_out_raw, &v_in_raw, &v_out_raw);
+    (void) i_out_raw;
+    (void) v_out_raw;
+    energy_voltage.max = pwrctl_calc_vin(v_in_raw);
+    number_init(&energy_voltage);
+    /** Start at the second most significant digit preventing the user from
+        accidentally cranking up the setting 10V or more */
+    energy_voltage.cur_digit = 2;
+    number_init(&energy_current);
+    uui_add_screen(ui, &energy_screen);
+}
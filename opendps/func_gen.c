@@ -29,7 +29,10 @@
 #include "gfx-sin.h"
 #include "gfx-saw.h"
 #include "gfx-square.h"
+#include "gfx-arb.h"
 #include "hw.h"
+#include "pwrctl.h"
+#include "protocol.h"
 #include "func_gen.h"
 #include "uui.h"
 #include "uui_number.h"
@@ -40,23 +43,31 @@
 #include "ili9163c.h"
 #include "font-full_small.h"
 
-/* We are reacting on the ADC's IRQ which runs at ~20kHz.
- * As such we want at least 20 points per period so the shape of the function is 
- * "clean", so we limit generation to 1kHz. 
+/* The output is produced by a DDS clocked at DDS_SAMPLE_RATE_HZ. We want at
+ * least 5 points per period so the shape of the function is recognisable,
+ * which limits generation to 10kHz. Mind that the output stage of the DPS
+ * will low pass filter the signal way before that.
  */
-#define MAX_FREQUENCY   999
+#define MAX_FREQUENCY   9999
 
-/* The basic generator function that's selected at runtime */
-typedef int32_t (*compute_func_t)(uint32_t time_in_us, uint32_t period_in_us, int32_t max);
+/* Wavetable index bits, the phase accumulator's top bits select the entry */
+#define SIN_TABLE_BITS  (8)
+#define SIN_FRAC_BITS   (32 - SIN_TABLE_BITS)
+#define WAVEFORM_BITS   (6)
+_Static_assert((1 << WAVEFORM_BITS) == WAVEFORM_POINTS, "WAVEFORM_BITS does not match WAVEFORM_POINTS");
+
+/* The basic generator function that's selected at runtime. Returns the
+ * waveform at the given phase, 0 being 0V and 0xffff being max */
+typedef uint16_t (*compute_func_t)(uint32_t phase);
 
 /*
  * This is the implementation of the function generator screen. It has three editable values,
  * voltage, frequency and function type. */
-static void    func_gen(void);
-static int16_t sin1(int16_t angle);
-static int32_t square_gen(uint32_t time_in_us, uint32_t period_in_us, int32_t max);
-static int32_t saw_gen(uint32_t time_in_us, uint32_t period_in_us, int32_t max);
-static int32_t sin_gen(uint32_t time_in_us, uint32_t period_in_us, int32_t max);
+static void     dds_refill(uint16_t *buffer, uint32_t len);
+static uint16_t square_gen(uint32_t phase);
+static uint16_t saw_gen(uint32_t phase);
+static uint16_t sin_gen(uint32_t phase);
+static uint16_t arb_gen(uint32_t phase);
 
 /* The basic generator function that's selected at runtime */
 static compute_func_t compute_func = &square_gen;
@@ -66,21 +77,32 @@ static void voltage_changed(ui_number_t *item);
 static void frequency_changed(ui_number_t *item);
 static void func_changed(ui_icon_t *item);
 static void func_gen_tick(void);
-static void compute_period_from_freq(int32_t freq);
+static void compute_step_from_freq(int32_t freq);
+static void compute_levels(int32_t voltage);
 static void activated(void);
 static void deactivated(void);
 static void past_save(past_t *past);
 static void past_restore(past_t *past);
-static set_param_status_t set_parameter(char *name, char *value);
+static set_param_status_t set_parameter(char *name, char *value, bool dry_run);
 static set_param_status_t get_parameter(char *name, char *value, uint32_t value_len);
 
-/* We need to keep copies of the period to avoid recomputing it every time. */
-static uint32_t period_us;
+/* DDS state. The phase accumulator wraps once per period and advances by
+ * dds_step for each sample. The step and the output levels are single words
+ * updated by the UI and read by the DMA ISR. */
+static uint32_t dds_phase;
+static volatile uint32_t dds_step;
+/* DAC value for 0V in the low half word, DAC span up to the voltage setting
+ * in the high half word */
+static volatile uint32_t dds_levels;
+
+/* The user waveform played by the fourth function */
+static uint8_t arb_waveform[WAVEFORM_POINTS];
 
 #define SCREEN_ID  (5)
 #define PAST_U     (0)
 #define PAST_P     (1)
 #define PAST_F     (2)
+#define PAST_W     (3)
 
 /* This is the definition of the voltage item in the UI */
 ui_number_t gen_voltage = {
@@ -122,7 +144,7 @@ ui_number_t gen_freq = {
     .min = 0,
     .max = MAX_FREQUENCY * 10, /* In dHz */
     .si_prefix = si_deci,
-    .num_digits = 3,
+    .num_digits = 4,
     .num_decimals = 1,
     .unit = unit_hertz,
     .changed = &frequency_changed,
@@ -141,9 +163,9 @@ ui_icon_t gen_func = {
     .icons_width = GFX_SQUARE_WIDTH,
     .icons_height = GFX_SQUARE_HEIGHT,
     .value = 0,
-    .num_icons = 3,
+    .num_icons = 4,
     .changed = &func_changed,
-    .icons = { gfx_square, gfx_saw, gfx_sin}
+    .icons = { gfx_square, gfx_saw, gfx_sin, gfx_arb }
 };
 
 /* This is the screen definition */
@@ -187,150 +209,149 @@ ui_screen_t gen_screen = {
 };
 
 /**
- * @brief      Compute a square signal as selected by the user
+ * One period of a sine in 256 steps, from 0 to 0xffff centered at 0x8000.
+ */
+static const uint16_t sin_table[1 << SIN_TABLE_BITS] = {
+    0x8000, 0x8324, 0x8647, 0x896a, 0x8c8b, 0x8fab, 0x92c7, 0x95e1,
+    0x98f8, 0x9c0b, 0x9f19, 0xa223, 0xa527, 0xa826, 0xab1f, 0xae10,
+    0xb0fb, 0xb3de, 0xb6b9, 0xb98c, 0xbc56, 0xbf17, 0xc1cd, 0xc47a,
+    0xc71c, 0xc9b3, 0xcc3f, 0xcebf, 0xd133, 0xd39a, 0xd5f5, 0xd842,
+    0xda82, 0xdcb3, 0xded7, 0xe0eb, 0xe2f1, 0xe4e8, 0xe6cf, 0xe8a6,
+    0xea6d, 0xec23, 0xedc9, 0xef5e, 0xf0e2, 0xf254, 0xf3b5, 0xf504,
+    0xf641, 0xf76b, 0xf884, 0xf989, 0xfa7c, 0xfb5c, 0xfc29, 0xfce3,
+    0xfd89, 0xfe1d, 0xfe9c, 0xff09, 0xff61, 0xffa6, 0xffd8, 0xfff5,
+    0xffff, 0xfff5, 0xffd8, 0xffa6, 0xff61, 0xff09, 0xfe9c, 0xfe1d,
+    0xfd89, 0xfce3, 0xfc29, 0xfb5c, 0xfa7c, 0xf989, 0xf884, 0xf76b,
+    0xf641, 0xf504, 0xf3b5, 0xf254, 0xf0e2, 0xef5e, 0xedc9, 0xec23,
+    0xea6d, 0xe8a6, 0xe6cf, 0xe4e8, 0xe2f1, 0xe0eb, 0xded7, 0xdcb3,
+    0xda82, 0xd842, 0xd5f5, 0xd39a, 0xd133, 0xcebf, 0xcc3f, 0xc9b3,
+    0xc71c, 0xc47a, 0xc1cd, 0xbf17, 0xbc56, 0xb98c, 0xb6b9, 0xb3de,
+    0xb0fb, 0xae10, 0xab1f, 0xa826, 0xa527, 0xa223, 0x9f19, 0x9c0b,
+    0x98f8, 0x95e1, 0x92c7, 0x8fab, 0x8c8b, 0x896a, 0x8647, 0x8324,
+    0x8000, 0x7cdb, 0x79b8, 0x7695, 0x7374, 0x7054, 0x6d38, 0x6a1e,
+    0x6707, 0x63f4, 0x60e6, 0x5ddc, 0x5ad8, 0x57d9, 0x54e0, 0x51ef,
+    0x4f04, 0x4c21, 0x4946, 0x4673, 0x43a9, 0x40e8, 0x3e32, 0x3b85,
+    0x38e3, 0x364c, 0x33c0, 0x3140, 0x2ecc, 0x2c65, 0x2a0a, 0x27bd,
+    0x257d, 0x234c, 0x2128, 0x1f14, 0x1d0e, 0x1b17, 0x1930, 0x1759,
+    0x1592, 0x13dc, 0x1236, 0x10a1, 0x0f1d, 0x0dab, 0x0c4a, 0x0afb,
+    0x09be, 0x0894, 0x077b, 0x0676, 0x0583, 0x04a3, 0x03d6, 0x031c,
+    0x0276, 0x01e2, 0x0163, 0x00f6, 0x009e, 0x0059, 0x0027, 0x000a,
+    0x0000, 0x000a, 0x0027, 0x0059, 0x009e, 0x00f6, 0x0163, 0x01e2,
+    0x0276, 0x031c, 0x03d6, 0x04a3, 0x0583, 0x0676, 0x077b, 0x0894,
+    0x09be, 0x0afb, 0x0c4a, 0x0dab, 0x0f1d, 0x10a1, 0x1236, 0x13dc,
+    0x1592, 0x1759, 0x1930, 0x1b17, 0x1d0e, 0x1f14, 0x2128, 0x234c,
+    0x257d, 0x27bd, 0x2a0a, 0x2c65, 0x2ecc, 0x3140, 0x33c0, 0x364c,
+    0x38e3, 0x3b85, 0x3e32, 0x40e8, 0x43a9, 0x4673, 0x4946, 0x4c21,
+    0x4f04, 0x51ef, 0x54e0, 0x57d9, 0x5ad8, 0x5ddc, 0x60e6, 0x63f4,
+    0x6707, 0x6a1e, 0x6d38, 0x7054, 0x7374, 0x7695, 0x79b8, 0x7cdb,
+};
+
+/**
+ * @brief      Compute a square signal
  *
- * @param[in]  time   the current clock in microsecond 
- * @param[in]  period period of the generated signal in microsecond (frequency in range 0 to 5KHz, period is in range 200 to 1<<31)
- * @param[in]  max    the amplitude of the voltage for this generator
+ * @param[in]  phase  the phase, 2^32 being a full period
  *
- * @retval     int32_t the voltage to apply
+ * @retval     uint16_t the output, 0 to 0xffff
  */
-static int32_t square_gen(uint32_t time_in_us, uint32_t period_in_us, int32_t max)
+static uint16_t square_gen(uint32_t phase)
 {
-    if (!period_in_us) return max;
-    /** The time is ticking at 1000000Hz so a unit is 1us. The production is 1 for t in [(t%T) ; (t%T+T/2)], 0 otherwise */
-    uint32_t t = time_in_us % period_in_us;
-    return t <= period_in_us / 2 ? max : 0;
+    return phase < 0x80000000 ? 0xffff : 0;
 }
 
 /**
- * @brief      Compute a saw signal as selected by the user
+ * @brief      Compute a saw signal
  *
- * @param[in]  time   the current clock in microsecond 
- * @param[in]  period period of the generated signal in microsecond (frequency in range 0 to 5KHz, period is in range 200 to 1<<31)
- * @param[in]  max    the amplitude of the voltage for this generator
+ * @param[in]  phase  the phase, 2^32 being a full period
  *
- * @retval     int32_t the voltage to apply
+ * @retval     uint16_t the output, 0 to 0xffff
  */
-static int32_t saw_gen(uint32_t time_in_us, uint32_t period_in_us, int32_t max)
+static uint16_t saw_gen(uint32_t phase)
 {
-    if (!period_in_us) return max;
-    /* The time is ticking at 1000000Hz so a unit is 1us. The production is (max*(t%T))/T */
-    uint64_t t = time_in_us % period_in_us;
-    /* Here, because the longest period is 10s and max is in millivolt, we can overflow an uint32_t
-       Since CortexM3 has a hw 64 bits multiply and divider, it shouldn't cost more to use it */
-    return (int32_t)((t * max) / period_in_us);
+    return phase >> 16;
 }
 
-/*
- * The number of bits of our data type: here 16 (sizeof operator returns bytes).
- */
-#define INT16_BITS  (8 * sizeof(int16_t))
-#ifndef INT16_MAX
-#define INT16_MAX   ((1<<(INT16_BITS-1))-1)
-#endif
- 
-/*
- * "5 bit" large table = 32 values. The mask: all bit belonging to the table
- * are 1, the all above 0.
- */
-#define TABLE_BITS  (5)
-#define TABLE_SIZE  (1<<TABLE_BITS)
-#define TABLE_MASK  (TABLE_SIZE-1)
- 
-/*
- * The lookup table is to 90DEG, the input can be -360 to 360 DEG, where negative
- * values are transformed to positive before further processing. We need two
- * additional bits (*4) to represent 360 DEG:
- */
-#define LOOKUP_BITS (TABLE_BITS+2)
-#define LOOKUP_MASK ((1<<LOOKUP_BITS)-1)
-#define FLIP_BIT    (1<<TABLE_BITS)
-#define NEGATE_BIT  (1<<(TABLE_BITS+1))
-#define INTERP_BITS (INT16_BITS-1-LOOKUP_BITS)
-#define INTERP_MASK ((1<<INTERP_BITS)-1)
- 
-/**
- * "5 bit" lookup table for the offsets. These are the sines for exactly
- * at 0deg, 11.25deg, 22.5deg etc. The values are from -1 to 1 in Q15.
- */
-static int16_t sin90[TABLE_SIZE+1] = {
-  0x0000,0x0647,0x0c8b,0x12c7,0x18f8,0x1f19,0x2527,0x2b1e,
-  0x30fb,0x36b9,0x3c56,0x41cd,0x471c,0x4c3f,0x5133,0x55f4,
-  0x5a81,0x5ed6,0x62f1,0x66ce,0x6a6c,0x6dc9,0x70e1,0x73b5,
-  0x7640,0x7883,0x7a7c,0x7c29,0x7d89,0x7e9c,0x7f61,0x7fd7,
-  0x7fff
-};
- 
 /**
- * Sine calculation using interpolated table lookup.
- * Instead of radiants or degrees we use "turns" here. Means this
- * sine does NOT return one phase for 0 to 2*PI, but for 0 to 1.
- * Input: -1 to 1 as int16 Q15  == -32768 to 32767.
- * Output: -1 to 1 as int16 Q15 == -32768 to 32767.
+ * @brief      Compute a sin signal by linear interpolation in the wavetable
  *
- * See the full description at www.AtWillys.de for the detailed
- * explanation.
+ * @param[in]  phase  the phase, 2^32 being a full period
  *
- * @param int16_t angle Q15
- * @return int16_t Q15
+ * @retval     uint16_t the output, 0 to 0xffff
  */
-static int16_t sin1(int16_t angle)
+static uint16_t sin_gen(uint32_t phase)
 {
-  int16_t v0, v1;
-  if(angle < 0) { angle += INT16_MAX; angle += 1; }
-  v0 = (angle >> INTERP_BITS);
-  if(v0 & FLIP_BIT) { v0 = ~v0; v1 = ~angle; } else { v1 = angle; }
-  v0 &= TABLE_MASK;
-  v1 = sin90[v0] + (int16_t) (((int32_t) (sin90[v0+1]-sin90[v0]) * (v1 & INTERP_MASK)) >> INTERP_BITS);
-  if((angle >> INTERP_BITS) & NEGATE_BIT) v1 = -v1;
-  return v1;
+    uint32_t i = phase >> SIN_FRAC_BITS;
+    int32_t v0 = sin_table[i];
+    int32_t v1 = sin_table[(i + 1) & ((1 << SIN_TABLE_BITS) - 1)];
+    /* Keep 16 bits of the fraction so the product fits an int32_t */
+    int32_t frac = (phase >> (SIN_FRAC_BITS - 16)) & 0xffff;
+    return v0 + (((v1 - v0) * frac) >> 16);
 }
 
-
 /**
- * @brief      Compute a sin signal as selected by the user
+ * @brief      Compute the user uploaded signal
  *
- * @param[in]  time   the current clock in microsecond 
- * @param[in]  period period of the generated signal in microsecond (frequency in range 0 to 5KHz, period is in range 200 to 1<<31)
- * @param[in]  max    the amplitude of the voltage for this generator
+ * @param[in]  phase  the phase, 2^32 being a full period
  *
- * @retval     int32_t the voltage to apply
+ * @retval     uint16_t the output, 0 to 0xffff
  */
-static int32_t sin_gen(uint32_t time_in_us, uint32_t period_in_us, int32_t max)
+static uint16_t arb_gen(uint32_t phase)
 {
-    if (!period_in_us) return max;
-    /** The time is ticking at 1000000Hz so a unit is 1us. The production is (max/2) * sin((t%T)/T*2*PI) + (max/2) */
-    uint64_t t = time_in_us % period_in_us;
-    
-    /* Here, because the longest period is 10s and max is in millivolt, we can overflow an uint32_t
-       Since CortexM3 has a hw 64 bits multiply and divider, it shouldn't cost more to use it.
-       There's a small error in amplitude here to avoid dividing by 32767 */
-    return (max/2) * sin1((int16_t)((t * 32768) / period_in_us)) / 32768 + max/2; 
+    return arb_waveform[phase >> (32 - WAVEFORM_BITS)] * 0x101;
 }
 
 /**
- * @brief     Get the new output to apply to the DAC.
+ * @brief     Fill a DDS buffer half with the next samples.
  *            This is called in a ISR context, so we have to be as fast as possible here.
- */ 
-static void func_gen(void)
+ *
+ * @param      buffer  the buffer to fill with DAC values
+ * @param[in]  len     number of samples
+ */
+static void dds_refill(uint16_t *buffer, uint32_t len)
 {
-    /* period_us is updated atomically (it's a word) in the UI's event code and so is max value */
-    int32_t v = (*compute_func)(cur_time_us(), period_us, gen_voltage.value);
-    (void) pwrctl_set_vout(v);
-//    pwrctl_enable_vout(v > 0);
+    /* dds_step and dds_levels are updated atomically (they're words) in the UI's event code */
+    uint32_t phase = dds_phase;
+    uint32_t step = dds_step;
+    uint32_t levels = dds_levels;
+    uint32_t low = levels & 0xffff;
+    uint32_t span = levels >> 16;
+    compute_func_t func = compute_func;
+    while (len--) {
+        *buffer++ = low + ((span * (*func)(phase)) >> 16);
+        phase += step;
+    }
+    dds_phase = phase;
 }
 
+/**
+ * @brief      Update part of the user waveform played by the fourth function
+ *
+ * @param      offset  index of the first point to update
+ * @param      points  the new points, 0 is 0V and 255 the voltage setting
+ * @param      count   number of points
+ *
+ * @retval     true if the points fit the waveform
+ */
+bool func_gen_set_waveform(uint32_t offset, const uint8_t *points, uint32_t count)
+{
+    if (offset >= WAVEFORM_POINTS || count > WAVEFORM_POINTS - offset) {
+        emu_printf("[FNCGEN] Waveform chunk %d+%d is out of range\n", offset, count);
+        return false;
+    }
+    /* Points are bytes so the ISR never sees a torn point */
+    memcpy(&arb_waveform[offset], points, count);
+    return true;
+}
 
 /**
  * @brief      Set function parameter
  *
  * @param[in]  name   name of parameter
  * @param[in]  value  value of parameter as a string - always in SI units
+ * @param[in]  dry_run  only validate the parameter, do not apply it
  *
  * @retval     set_param_status_t status code
  */
-static set_param_status_t set_parameter(char *name, char *value)
+static set_param_status_t set_parameter(char *name, char *value, bool dry_run)
 {
     int32_t ivalue = atoi(value);
     if (strcmp("voltage", name) == 0 || strcmp("u", name) == 0) {
@@ -338,6 +359,9 @@ static set_param_status_t set_parameter(char *name, char *value)
             emu_printf("[FNCGEN] Voltage %d is out of range (min:%d max:%d)\n", ivalue, gen_voltage.min, gen_voltage.max);
             return ps_range_error;
         }
+        if (dry_run) {
+            return ps_ok;
+        }
         emu_printf("[FNCGEN] Setting voltage to %d\n", ivalue);
         gen_voltage.value = ivalue;
         voltage_changed(&gen_voltage);
@@ -347,6 +371,9 @@ static set_param_status_t set_parameter(char *name, char *value)
             emu_printf("[FNCGEN] Frequency %d is out of range (min:%d max:%d)\n", ivalue, gen_freq.min, gen_freq.max);
             return ps_range_error;
         }
+        if (dry_run) {
+            return ps_ok;
+        }
         emu_printf("[FNCGEN] Setting frequency to %d\n", ivalue);
         gen_freq.value = ivalue;
         frequency_changed(&gen_freq);
@@ -356,6 +383,9 @@ static set_param_status_t set_parameter(char *name, char *value)
             emu_printf("[FNCGEN] Function %d is out of range (min:0 max:%d)\n", ivalue, gen_func.num_icons - 1);
             return ps_range_error;
         }
+        if (dry_run) {
+            return ps_ok;
+        }
         emu_printf("[FNCGEN] Setting mode to %d\n", ivalue);
         gen_func.value = ivalue;
         func_changed(&gen_func);
@@ -390,13 +420,24 @@ static set_param_status_t get_parameter(char *name, char *value, uint32_t value_
 }
 
 /**
- * @brief       Compute the period in microsecond from the given frequency 
+ * @brief       Compute the phase step per DDS sample from the given frequency
  * @param[in]   freq    Frequency in dHz
  */
-static void compute_period_from_freq(int32_t freq)
+static void compute_step_from_freq(int32_t freq)
+{
+    /* A full period is 2^32, so the step is 2^32 * f / fs (and since the frequency is in dHz, needs Hz here) */
+    dds_step = (uint32_t)(((uint64_t) freq << 32) / (10 * DDS_SAMPLE_RATE_HZ));
+}
+
+/**
+ * @brief       Compute the DAC levels spanned by the waveform
+ * @param[in]   voltage    Voltage setting in mV
+ */
+static void compute_levels(int32_t voltage)
 {
-    /* Compute the period to use in microseconds, that's 1e6/freq (and since the frequency is in dHz, needs Hz here) */
-    period_us = (uint32_t)(1000000.0 / (freq * 0.1) + .5);
+    uint32_t low = pwrctl_calc_vout_dac(0);
+    uint32_t high = pwrctl_calc_vout_dac(voltage);
+    dds_levels = ((high - low) << 16) | low;
 }
 
 /**
@@ -408,7 +449,8 @@ static void funcgen_enable(bool enabled)
 {
     emu_printf("[FNCGEN] %s output\n", enabled ? "Enable" : "Disable");
     if (enabled) {
-        compute_period_from_freq(gen_freq.value);
+        compute_step_from_freq(gen_freq.value);
+        compute_levels(gen_voltage.value);
         func_changed(&gen_func);
         /* Draw the current function to the expected position */
         tft_blit((uint16_t*) gen_func.icons[gen_func.value], gen_func.icons_width, gen_func.icons_height, XPOS_ICON, 128 - GFX_SIN_HEIGHT);
@@ -417,9 +459,10 @@ static void funcgen_enable(bool enabled)
         (void) pwrctl_set_vlimit(0xFFFF);
         (void) pwrctl_set_ilimit(0xFFFF); /** Set the current limit to the maximum to prevent OCP (over current protection) firing */
         pwrctl_enable_vout(true);
-        funcgen_tick = &func_gen;
+        dds_phase = 0;
+        hw_dds_start(&dds_refill);
     } else {
-        funcgen_tick = &fg_noop;
+        hw_dds_stop();
         (void) pwrctl_set_vout(0);
         pwrctl_enable_vout(false);
         /** Ensure the function logo has been cleared from the screen */
@@ -434,7 +477,7 @@ static void funcgen_enable(bool enabled)
  */
 static void voltage_changed(ui_number_t * item)
 {
-    (void)item;
+    compute_levels(item->value);
 }
 
 /**
@@ -444,7 +487,7 @@ static void voltage_changed(ui_number_t * item)
  */
 static void frequency_changed(ui_number_t *item)
 {
-    compute_period_from_freq(item->value);
+    compute_step_from_freq(item->value);
 }
 
 /**
@@ -454,7 +497,7 @@ static void frequency_changed(ui_number_t *item)
  */
 static void func_changed(ui_icon_t *item)
 {
-    static compute_func_t funcs[] = { &square_gen, &saw_gen, &sin_gen, 0 };
+    static compute_func_t funcs[] = { &square_gen, &saw_gen, &sin_gen, &arb_gen, 0 };
     compute_func = funcs[item->value];
 }
 
@@ -490,17 +533,17 @@ static void deactivated(void)
  */
 static void past_save(past_t *past)
 {
-    int32_t t = gen_voltage.value;
+    int32_t u = gen_voltage.value;
+    int32_t f = gen_freq.value;
+    int32_t n = gen_func.value;
     /** @todo: past bug causes corruption for units smaller than 4 bytes (#27) */
-    if (!past_write_unit(past, (SCREEN_ID << 24) | PAST_U, (void*) &t, 4 /* sizeof(gen_voltage.value) */ )) {
-        /** @todo: handle past write failures */
-    }
-    t = gen_freq.value;
-    if (!past_write_unit(past, (SCREEN_ID << 24) | PAST_P, (void*) &t, 4 /* sizeof(gen_freq.value) */ )) {
-        /** @todo: handle past write failures */
-    }
-    t = gen_func.value;
-    if (!past_write_unit(past, (SCREEN_ID << 24) | PAST_F, (void*) &t, 4 /* sizeof(gen_freq.value) */ )) {
+    past_unit_t units[] = {
+        { (SCREEN_ID << 24) | PAST_U, (void*) &u, 4 /* sizeof(gen_voltage.value) */ },
+        { (SCREEN_ID << 24) | PAST_P, (void*) &f, 4 /* sizeof(gen_freq.value) */ },
+        { (SCREEN_ID << 24) | PAST_F, (void*) &n, 4 /* sizeof(gen_func.value) */ },
+        { (SCREEN_ID << 24) | PAST_W, (void*) arb_waveform, sizeof(arb_waveform) },
+    };
+    if (!past_write_units(past, units, sizeof(units) / sizeof(units[0]))) {
         /** @todo: handle past write failures */
     }
 }
@@ -526,6 +569,11 @@ static void past_restore(past_t *past)
         gen_func.value = *p;
         (void) length;
     }
+    if (past_read_unit(past, (SCREEN_ID << 24) | PAST_W, (const void**) &p, &length)) {
+        if (length == sizeof(arb_waveform)) {
+            memcpy(arb_waveform, p, sizeof(arb_waveform));
+        }
+    }
 }
 
 /**
@@ -538,12 +586,12 @@ static void past_restore(past_t *past)
  */
 static void func_gen_tick(void)
 {
-    uint16_t i_out_raw, v_in_raw, v_out_raw;
-    hw_get_adc_values(&i_out_raw, &v_in_raw, &v_out_raw);
+    uint16_t i_out_filtered, v_in_filtered, v_out_filtered;
+    hw_get_adc_filtered(&i_out_filtered, &v_in_filtered, &v_out_filtered);
     /** Continously update max voltage output value
       * Max output voltage = Vin / VIN_VOUT_RATIO
       * Add 0.5f to ensure correct rounding when truncated */
-    gen_voltage.max = (float) pwrctl_calc_vin(v_in_raw) / VIN_VOUT_RATIO + 0.5f;
+    gen_voltage.max = (float) pwrctl_calc_vin_filtered(v_in_filtered) / VIN_VOUT_RATIO + 0.5f;
  //   if (gen_voltage.value > gen_voltage.max) 
  //       gen_voltage.value = gen_voltage.max;
 }
@@ -558,6 +606,10 @@ void func_gen_init(uui_t *ui)
     gen_voltage.value = 0; /** read from past */
     gen_freq.value = 0; /** read from past */
     gen_func.value = 0;
+    for (uint32_t i = 0; i < WAVEFORM_POINTS; i++) {
+        /** Default to a triangle until the user uploads something better */
+        arb_waveform[i] = i < WAVEFORM_POINTS / 2 ? (i * 255) / (WAVEFORM_POINTS / 2) : ((WAVEFORM_POINTS - i) * 255) / (WAVEFORM_POINTS / 2);
+    }
     uint16_t i_out_raw, v_in_raw, v_out_raw;
     hw_get_adc_values(&i_out_raw, &v_in_raw, &v_out_raw);
     (void) i_out_raw;
@@ -25,6 +25,8 @@
 #ifndef __FUNC_GEN_H__
 #define __FUNC_GEN_H__
 
+#include <stdint.h>
+#include <stdbool.h>
 #include "uui.h"
 
 /**
@@ -34,5 +36,16 @@
  */
 void func_gen_init(uui_t *ui);
 
+/**
+ * @brief      Update part of the user waveform played by the fourth function
+ *
+ * @param      offset  index of the first point to update
+ * @param      points  the new points, 0 is 0V and 255 the voltage setting
+ * @param      count   number of points
+ *
+ * @retval     true if the points fit the waveform
+ */
+bool func_gen_set_waveform(uint32_t offset, const uint8_t *points, uint32_t count);
+
 #endif // __FUNC_GEN_H__
 
@@ -0,0 +1,720 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Johan Kanflo (github.com/kanflo)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gfx-seq.h"
+#include "hw.h"
+#include "tick.h"
+#include "pwrctl.h"
+#include "protocol.h"
+#include "func_seq.h"
+#include "uui.h"
+#include "uui_number.h"
+#include "opendps.h"
+#include "dbg_printf.h"
+#include "mini-printf.h"
+#include "dps-model.h"
+#include "ili9163c.h"
+#include "font-full_small.h"
+
+/*
+ * This is the implementation of the sequencer screen. It runs a program of
+ * setpoints, ramps, dwells, loops and waits on the measured output uploaded
+ * with cmd_set_program (see protocol.h). The program is run from the systick
+ * interrupt so its timing is good to the millisecond whatever the host and
+ * the UI are up to. The voltage item caps the voltage the program may set
+ * and the current item is the current limit, as in the CV screen. While the
+ * program runs the items show the measured output and the readouts show the
+ * progress.
+ */
+
+static void seq_enable(bool _enable);
+static void voltage_changed(ui_number_t *item);
+static void current_changed(ui_number_t *item);
+static void seq_ui_tick(void);
+static void seq_tick(void);
+static void activated(void);
+static void deactivated(void);
+static void past_save(past_t *past);
+static void past_restore(past_t *past);
+static set_param_status_t set_parameter(char *name, char *value, bool dry_run);
+static set_param_status_t get_parameter(char *name, char *value, uint32_t value_len);
+
+typedef enum {
+    seq_idle = 0,
+    seq_running,
+    seq_done,
+    seq_timeout, /** A wait timed out and the output was cut */
+} seq_state_t;
+
+/* We need to keep copies of the user settings as the value in the UI will
+ * be replaced with measurements when output is active
+ */
+static int32_t saved_u, saved_i;
+
+/* The program and the number of steps before its seq_op_end */
+static seq_step_t program[SEQ_MAX_STEPS];
+static uint32_t program_length;
+
+/* Executor state. Once state is seq_running the rest is owned by the
+ * systick ISR until the UI sets any other state. */
+static volatile seq_state_t state;
+static volatile uint32_t cur_step;
+static volatile uint32_t run_ms;
+static volatile uint32_t max_v; /** Cap on the voltage setpoint */
+static volatile bool stop_pending; /** The ISR cut the output */
+static uint32_t step_ms; /** Time spent in the current step */
+static uint32_t ramp_from; /** Setpoint when the current ramp started */
+static uint32_t set_v, set_i; /** The current setpoints */
+/** Jumps taken by each loop step, restarted when the loop is done */
+static uint32_t loop_counts[SEQ_MAX_STEPS];
+
+#define SCREEN_ID  (7)
+#define PAST_U     (0)
+#define PAST_I     (1)
+#define PAST_PROG  (2)
+
+/** Readout positions, the text is drawn above its y position */
+#define XPOS_READOUT_LABEL  (6)
+#define XPOS_READOUT        (64)
+#define READOUT_WIDTH       (64)
+#define YPOS_STEP           (69 + FONT_FULL_SMALL_MAX_GLYPH_HEIGHT)
+#define YPOS_TIME           (83 + FONT_FULL_SMALL_MAX_GLYPH_HEIGHT)
+
+/** What the readouts currently show, only redrawn when changed */
+static char step_str[12], time_str[12];
+
+/* This is the definition of the voltage item in the UI */
+ui_number_t seq_voltage = {
+    {
+        .type = ui_item_number,
+        .id = 10,
+        .x = 120,
+        .y = 15,
+        .can_focus = true,
+    },
+    .font_size = FONT_METER_MEDIUM,
+    .alignment = ui_text_right_aligned,
+    .pad_dot = false,
+    .color = COLOR_VOLTAGE,
+    .value = 0,
+    .min = 0,
+    .max = 0, /** Set at init, continously updated in the tick callback */
+    .si_prefix = si_milli,
+    .num_digits = 2,
+    .num_decimals = 2,
+    .unit = unit_volt,
+    .changed = &voltage_changed,
+};
+
+/* This is the definition of the current item in the UI */
+ui_number_t seq_current = {
+    {
+        .type = ui_item_number,
+        .id = 11,
+        .x = 120,
+        .y = 42,
+        .can_focus = true,
+    },
+    .font_size = FONT_METER_MEDIUM,
+    .alignment = ui_text_right_aligned,
+    .pad_dot = false,
+    .color = COLOR_AMPERAGE,
+    .value = 0,
+    .min = 0,
+    .max = CONFIG_DPS_MAX_CURRENT,
+    .si_prefix = si_milli,
+    .num_digits = CURRENT_DIGITS,
+    .num_decimals = CURRENT_DECIMALS,
+    .unit = unit_ampere,
+    .changed = &current_changed,
+};
+
+/* This is the screen definition */
+ui_screen_t seq_screen = {
+    .id = SCREEN_ID,
+    .name = "seq",
+    .icon_data = (uint8_t *) gfx_seq,
+    .icon_data_len = sizeof(gfx_seq),
+    .icon_width = GFX_SEQ_WIDTH,
+    .icon_height = GFX_SEQ_HEIGHT,
+    .activated = &activated,
+    .deactivated = &deactivated,
+    .enable = &seq_enable,
+    .past_save = &past_save,
+    .past_restore = &past_restore,
+    .tick = &seq_ui_tick,
+    .set_parameter = &set_parameter,
+    .get_parameter = &get_parameter,
+    .num_items = 2,
+    .parameters = {
+        {
+            .name = "voltage",
+            .unit = unit_volt,
+            .prefix = si_milli
+        },
+        {
+            .name = "current",
+            .unit = unit_ampere,
+            .prefix = si_milli
+        },
+        {
+            .name = "step",
+            .unit = unit_none,
+            .prefix = si_none
+        },
+        {
+            .name = {'\0'} /** Terminator */
+        },
+    },
+    .items = { (ui_item_t*) &seq_voltage, (ui_item_t*) &seq_current }
+};
+
+/**
+ * @brief      Count the steps before the first seq_op_end
+ */
+static void update_program_length(void)
+{
+    program_length = 0;
+    while (program_length < SEQ_MAX_STEPS && program[program_length].op != seq_op_end) {
+        program_length++;
+    }
+}
+
+/**
+ * @brief      Update part of the sequencer program
+ *
+ * @param      offset  index of the first step to update
+ * @param      steps   the new steps
+ * @param      count   number of steps
+ *
+ * @retval     true if the steps are valid, fit the program and the
+ *             sequencer is not running
+ */
+bool func_seq_set_program(uint32_t offset, const seq_step_t *steps, uint32_t count)
+{
+    if (state == seq_running) {
+        emu_printf("[SEQ] Cannot change the program while it is running\n");
+        return false;
+    }
+    if (offset >= SEQ_MAX_STEPS || count > SEQ_MAX_STEPS - offset) {
+        emu_printf("[SEQ] Program chunk %d+%d is out of range\n", offset, count);
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        const seq_step_t *step = &steps[i];
+        bool is_current = step->op == seq_op_set_i || step->op == seq_op_ramp_i;
+        if (step->op >= seq_op_last ||
+            (step->op == seq_op_loop && step->value >= SEQ_MAX_STEPS) ||
+            (step->op == seq_op_wait && step->cond >= seq_cond_last) ||
+            (is_current && step->value > CONFIG_DPS_MAX_CURRENT)) {
+            emu_printf("[SEQ] Step %d is invalid\n", offset + i);
+            return false;
+        }
+    }
+    memcpy(&program[offset], steps, count * sizeof(seq_step_t));
+    update_program_length();
+    state = seq_idle;
+    return true;
+}
+
+/**
+ * @brief      Set the voltage setpoint, capped by the voltage item
+ *
+ * @param[in]  value_mv  The setpoint
+ */
+static void apply_v(uint32_t value_mv)
+{
+    set_v = value_mv < max_v ? value_mv : max_v;
+    (void) pwrctl_set_vout(set_v);
+}
+
+/**
+ * @brief      Set the current setpoint
+ *
+ * @param[in]  value_ma  The setpoint
+ */
+static void apply_i(uint32_t value_ma)
+{
+    set_i = value_ma;
+    (void) pwrctl_set_iout(set_i);
+}
+
+/**
+ * @brief      Move on to the next step of the program
+ */
+static void next_step(void)
+{
+    step_ms = 0;
+    if (++cur_step >= SEQ_MAX_STEPS) {
+        state = seq_done;
+    }
+}
+
+/**
+ * @brief      Check the condition of a wait step against the measured output
+ *
+ * @param      step  The wait step
+ *
+ * @retval     true if the condition holds
+ */
+static bool condition_met(const seq_step_t *step)
+{
+    uint16_t i_out_filtered, v_in_filtered, v_out_filtered;
+    hw_get_adc_filtered(&i_out_filtered, &v_in_filtered, &v_out_filtered);
+    (void) v_in_filtered;
+    switch (step->cond) {
+        case seq_cond_v_above:
+            return pwrctl_calc_vout_filtered(v_out_filtered) >= step->value;
+        case seq_cond_v_below:
+            return pwrctl_calc_vout_filtered(v_out_filtered) <= step->value;
+        case seq_cond_i_above:
+            return pwrctl_calc_iout_filtered(i_out_filtered) >= step->value;
+        default:
+            return pwrctl_calc_iout_filtered(i_out_filtered) <= step->value;
+    }
+}
+
+/**
+ * @brief      Run one millisecond of a ramp, dwell or wait step
+ *
+ * @param      step  The step
+ */
+static void run_timed_step(const seq_step_t *step)
+{
+    if (step_ms == 0) {
+        ramp_from = step->op == seq_op_ramp_i ? set_i : set_v;
+    }
+    step_ms++;
+    if (step->op == seq_op_wait) {
+        if (condition_met(step)) {
+            next_step();
+        } else if (step->time && step_ms >= step->time) {
+            /** Cut the output right away, the UI tick disables the screen */
+            pwrctl_cut_vout();
+            state = seq_timeout;
+            stop_pending = true;
+        }
+        return;
+    }
+    if (step->op != seq_op_dwell) {
+        /** ramp_from + (value - ramp_from) * step_ms / time, wide enough for any ramp */
+        int32_t delta = (int32_t) step->value - (int32_t) ramp_from;
+        uint32_t value = step_ms >= step->time ? step->value :
+                         ramp_from + (int32_t) ((int64_t) delta * step_ms / step->time);
+        if (step->op == seq_op_ramp_v) {
+            apply_v(value);
+        } else {
+            apply_i(value);
+        }
+    }
+    if (step_ms >= step->time) {
+        next_step();
+    }
+}
+
+/**
+ * @brief      Run the program for one millisecond, called from the systick
+ *             ISR. Set, loop and end steps take no time so they run back to
+ *             back with the step before them. Ramp, dwell and wait steps take
+ *             at least one millisecond each and start in the tick after the
+ *             one where the previous timed step ended.
+ */
+static void seq_tick(void)
+{
+    bool ticked = false;
+    if (state != seq_running) {
+        return;
+    }
+    run_ms++;
+    /** Bound the number of steps per tick in case the program loops without
+      * taking any time */
+    for (uint32_t n = 0; n < SEQ_MAX_STEPS && state == seq_running; n++) {
+        const seq_step_t *step = &program[cur_step];
+        switch (step->op) {
+            case seq_op_set_v:
+                apply_v(step->value);
+                next_step();
+                break;
+            case seq_op_set_i:
+                apply_i(step->value);
+                next_step();
+                break;
+            case seq_op_loop:
+                if (!step->time || loop_counts[cur_step] < step->time) {
+                    if (step->time) {
+                        loop_counts[cur_step]++;
+                    }
+                    cur_step = step->value;
+                    step_ms = 0;
+                } else {
+                    /** Done, restart the count in case an outer loop comes back here */
+                    loop_counts[cur_step] = 0;
+                    next_step();
+                }
+                break;
+            case seq_op_ramp_v:
+            case seq_op_ramp_i:
+            case seq_op_dwell:
+            case seq_op_wait:
+                if (ticked) {
+                    return;
+                }
+                ticked = true;
+                run_timed_step(step);
+                break;
+            default: /** seq_op_end */
+                state = seq_done;
+                break;
+        }
+    }
+}
+
+/**
+ * @brief      Set function parameter
+ *
+ * @param[in]  name   name of parameter
+ * @param[in]  value  value of parameter as a string - always in SI units
+ * @param[in]  dry_run  only validate the parameter, do not apply it
+ *
+ * @retval     set_param_status_t status code
+ */
+static set_param_status_t set_parameter(char *name, char *value, bool dry_run)
+{
+    int32_t ivalue = atoi(value);
+    if (strcmp("voltage", name) == 0 || strcmp("u", name) == 0) {
+        if (ivalue < seq_voltage.min || ivalue > seq_voltage.max) {
+            emu_printf("[SEQ] Voltage %d is out of range (min:%d max:%d)\n", ivalue, seq_voltage.min, seq_voltage.max);
+            return ps_range_error;
+        }
+        if (dry_run) {
+            return ps_ok;
+        }
+        emu_printf("[SEQ] Setting voltage to %d\n", ivalue);
+        seq_voltage.value = ivalue;
+        voltage_changed(&seq_voltage);
+        return ps_ok;
+    } else if (strcmp("current", name) == 0 || strcmp("i", name) == 0) {
+        if (ivalue < seq_current.min || ivalue > seq_current.max) {
+            emu_printf("[SEQ] Current %d is out of range (min:%d max:%d)\n", ivalue, seq_current.min, seq_current.max);
+            return ps_range_error;
+        }
+        if (dry_run) {
+            return ps_ok;
+        }
+        emu_printf("[SEQ] Setting current to %d\n", ivalue);
+        seq_current.value = ivalue;
+        current_changed(&seq_current);
+        return ps_ok;
+    } else if (strcmp("step", name) == 0) {
+        /** Progress is read only */
+        return ps_not_supported;
+    }
+    return ps_unknown_name;
+}
+
+/**
+ * @brief      Get function parameter
+ *
+ * @param[in]  name       name of parameter
+ * @param[in]  value      value of parameter as a string - always in SI units
+ * @param[in]  value_len  length of value buffer
+ *
+ * @retval     set_param_status_t status code
+ */
+static set_param_status_t get_parameter(char *name, char *value, uint32_t value_len)
+{
+    if (strcmp("voltage", name) == 0 || strcmp("u", name) == 0) {
+        (void) mini_snprintf(value, value_len, "%d", saved_u);
+        return ps_ok;
+    } else if (strcmp("current", name) == 0 || strcmp("i", name) == 0) {
+        (void) mini_snprintf(value, value_len, "%d", saved_i);
+        return ps_ok;
+    } else if (strcmp("step", name) == 0) {
+        (void) mini_snprintf(value, value_len, "%d", cur_step);
+        return ps_ok;
+    }
+    return ps_unknown_name;
+}
+
+/**
+ * @brief      Draw a readout if its text changed
+ *
+ * @param      shown  The text currently shown, updated
+ * @param[in]  text   The new text
+ * @param[in]  y      Bottom of the readout
+ * @param[in]  force  Draw even if the text did not change
+ */
+static void draw_readout(char *shown, const char *text, uint32_t y, bool force)
+{
+    if (force || strcmp(shown, text) != 0) {
+        strcpy(shown, text);
+        tft_fill(XPOS_READOUT, y - FONT_FULL_SMALL_MAX_GLYPH_HEIGHT, READOUT_WIDTH, FONT_FULL_SMALL_MAX_GLYPH_HEIGHT, BLACK);
+        tft_puts(FONT_FULL_SMALL, text, XPOS_READOUT, y, READOUT_WIDTH, FONT_FULL_SMALL_MAX_GLYPH_HEIGHT, WHITE, false);
+    }
+}
+
+/**
+ * @brief      Update the step and time readouts
+ *
+ * @param[in]  force  Redraw all readouts
+ */
+static void draw_readouts(bool force)
+{
+    char text[sizeof(step_str)];
+    uint32_t step = cur_step;
+
+    switch (state) {
+        case seq_running:
+            (void) mini_snprintf(text, sizeof(text), "%u/%u", step + 1, program_length);
+            break;
+        case seq_done:
+            (void) mini_snprintf(text, sizeof(text), "Done");
+            break;
+        case seq_timeout:
+            (void) mini_snprintf(text, sizeof(text), "Timeout");
+            break;
+        default:
+            (void) mini_snprintf(text, sizeof(text), "%u steps", program_length);
+            break;
+    }
+    draw_readout(step_str, text, YPOS_STEP, force);
+
+    uint32_t s = run_ms / 1000;
+    (void) mini_snprintf(text, sizeof(text), "%u:%02u:%02u", s / 3600, (s / 60) % 60, s % 60);
+    draw_readout(time_str, text, YPOS_TIME, force);
+}
+
+/**
+ * @brief      Callback for when the function is enabled
+ *
+ * @param[in]  enabled  true when function is enabled
+ */
+static void seq_enable(bool enabled)
+{
+    emu_printf("[SEQ] %s output\n", enabled ? "Enable" : "Disable");
+    if (enabled) {
+        /** Display will now show the current values, keep the user setting saved */
+        saved_u = seq_voltage.value;
+        saved_i = seq_current.value;
+        memset(loop_counts, 0, sizeof(loop_counts));
+        cur_step = 0;
+        step_ms = 0;
+        stop_pending = false;
+        run_ms = 0;
+        max_v = saved_u;
+        set_v = 0;
+        set_i = CONFIG_DPS_MAX_CURRENT;
+        (void) pwrctl_set_vout(set_v);
+        (void) pwrctl_set_iout(set_i);
+        (void) pwrctl_set_ilimit(saved_i);
+        (void) pwrctl_set_vlimit(0xFFFF); /** Set the voltage limit to the maximum to prevent OVP (over voltage protection) firing */
+        pwrctl_enable_vout(true);
+        /** Hand over to the systick ISR */
+        state = seq_running;
+        draw_readouts(false);
+    } else {
+        /** Take back control before touching the output */
+        if (state == seq_running) {
+            state = seq_idle;
+        }
+        pwrctl_enable_vout(false);
+        /** Make sure we're displaying the settings and not the current
+          * measurements when the power output is switched off */
+        seq_voltage.value = saved_u;
+        seq_voltage.ui.draw(&seq_voltage.ui);
+        seq_current.value = saved_i;
+        seq_current.ui.draw(&seq_current.ui);
+    }
+}
+
+/**
+ * @brief      Callback for when value of the voltage item is changed
+ *
+ * @param      item  The voltage item
+ */
+static void voltage_changed(ui_number_t *item)
+{
+    saved_u = item->value;
+    /** Applies from the next voltage step of a running program */
+    max_v = saved_u;
+}
+
+/**
+ * @brief      Callback for when value of the current item is changed
+ *
+ * @param      item  The current item
+ */
+static void current_changed(ui_number_t *item)
+{
+    saved_i = item->value;
+    (void) pwrctl_set_ilimit(item->value);
+}
+
+/**
+ * @brief      Draw the screen, it has more than the items
+ */
+static void activated(void)
+{
+    tft_clear();
+    for (uint32_t i = 0; i < seq_screen.num_items; i++) {
+        seq_screen.items[i]->draw(seq_screen.items[i]);
+    }
+    tft_puts(FONT_FULL_SMALL, "Step:", XPOS_READOUT_LABEL, YPOS_STEP, 64, 20, WHITE, false);
+    tft_puts(FONT_FULL_SMALL, "Time:", XPOS_READOUT_LABEL, YPOS_TIME, 64, 20, WHITE, false);
+    draw_readouts(true);
+}
+
+/**
+ * @brief      Do any required clean up before changing away from this screen
+ */
+static void deactivated(void)
+{
+    /** Ensure the readouts have been cleared from the screen */
+    tft_clear();
+}
+
+/**
+ * @brief      Save persistent parameters
+ *
+ * @param      past  The past
+ */
+static void past_save(past_t *past)
+{
+    /** @todo: past bug causes corruption for units smaller than 4 bytes (#27) */
+    past_unit_t units[] = {
+        { (SCREEN_ID << 24) | PAST_U, (void*) &saved_u, 4 /* sizeof(seq_voltage.value) */ },
+        { (SCREEN_ID << 24) | PAST_I, (void*) &saved_i, 4 /* sizeof(seq_current.value) */ },
+        { (SCREEN_ID << 24) | PAST_PROG, (void*) program, sizeof(program) },
+    };
+    if (!past_write_units(past, units, sizeof(units) / sizeof(units[0]))) {
+        /** @todo: handle past write failures */
+    }
+}
+
+/**
+ * @brief      Restore persistent parameters
+ *
+ * @param      past  The past
+ */
+static void past_restore(past_t *past)
+{
+    uint32_t length;
+    uint32_t *p = 0;
+    if (past_read_unit(past, (SCREEN_ID << 24) | PAST_U, (const void**) &p, &length)) {
+        saved_u = seq_voltage.value = *p;
+        (void) length;
+    }
+    if (past_read_unit(past, (SCREEN_ID << 24) | PAST_I, (const void**) &p, &length)) {
+        saved_i = seq_current.value = *p;
+        (void) length;
+    }
+    if (past_read_unit(past, (SCREEN_ID << 24) | PAST_PROG, (const void**) &p, &length)) {
+        if (length == sizeof(program)) {
+            memcpy(program, p, sizeof(program));
+            update_program_length();
+        }
+    }
+}
+
+/**
+ * @brief      Update the UI, the voltage and current items are handled as
+ *             in the CV screen and the readouts follow the program.
+ */
+static void seq_ui_tick(void)
+{
+    uint16_t i_out_filtered, v_in_filtered, v_out_filtered;
+    hw_get_adc_filtered(&i_out_filtered, &v_in_filtered, &v_out_filtered);
+    /** Continously update max voltage output value
+      * Max output voltage = Vin / VIN_VOUT_RATIO
+      * Add 0.5f to ensure correct rounding when truncated */
+    seq_voltage.max = (float) pwrctl_calc_vin_filtered(v_in_filtered) / VIN_VOUT_RATIO + 0.5f;
+    if (stop_pending) {
+        /** The ISR cut the output, switch off the screen as well */
+        stop_pending = false;
+        (void) opendps_enable_output(false);
+    }
+    if (pwrctl_vout_enabled()) {
+        if (seq_voltage.ui.has_focus) {
+            /** If the voltage setting has focus, make sure we're displaying
+              * the desired setting and not the current output value. */
+            if (seq_voltage.value != saved_u) {
+                seq_voltage.value = saved_u;
+                seq_voltage.ui.draw(&seq_voltage.ui);
+            }
+        } else {
+            /** No focus, update display if necessary */
+            int32_t new_u = pwrctl_calc_vout_filtered(v_out_filtered);
+            if (new_u != seq_voltage.value) {
+                seq_voltage.value = new_u;
+                seq_voltage.ui.draw(&seq_voltage.ui);
+            }
+        }
+
+        if (seq_current.ui.has_focus) {
+            /** If the current setting has focus, make sure we're displaying
+              * the desired setting and not the current output value. */
+            if (seq_current.value != saved_i) {
+                seq_current.value = saved_i;
+                seq_current.ui.draw(&seq_current.ui);
+            }
+        } else {
+            /** No focus, update display if necessary */
+            int32_t new_i = pwrctl_calc_iout_filtered(i_out_filtered);
+            if (new_i != seq_current.value) {
+                seq_current.value = new_i;
+                seq_current.ui.draw(&seq_current.ui);
+            }
+        }
+    }
+    draw_readouts(false);
+}
+
+/**
+ * @brief      Initialise the sequencer module and add its screen to the UI
+ *
+ * @param      ui    The user interface
+ */
+void func_seq_init(uui_t *ui)
+{
+    seq_voltage.value = 0; /** read from past */
+    seq_current.value = 0; /** read from past */
+    memset(program, 0, sizeof(program)); /** An empty program until one is uploaded or read from past */
+    update_program_length();
+    uint16_t i_out_raw, v_in_raw, v_out_raw;
+    hw_get_adc_values(&i_out_raw, &v_in_raw, &v_out_raw);
+    (void) i_out_raw;
+    (void) v_out_raw;
+    seq_voltage.max = pwrctl_calc_vin(v_in_raw);
+    number_init(&seq_voltage);
+    /** Start at the second most significant digit preventing the user from
+        accidentally cranking up the setting 10V or more */
+    seq_voltage.cur_digit = 2;
+    number_init(&seq_current);
+    uui_add_screen(ui, &seq_screen);
+    systick_set_handler(&seq_tick);
+}
@@ -0,0 +1,60 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Johan Kanflo (github.com/kanflo)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __FUNC_SEQ_H__
+#define __FUNC_SEQ_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "uui.h"
+#include "protocol.h"
+
+/** A sequencer program step, see cmd_set_program in protocol.h */
+typedef struct {
+    uint8_t op; /** seq_op_t */
+    uint8_t cond; /** seq_cond_t, for seq_op_wait */
+    uint16_t value;
+    uint32_t time;
+} seq_step_t;
+
+/**
+ * @brief      Add the sequencer to the UI
+ *
+ * @param      ui    The user interface
+ */
+void func_seq_init(uui_t *ui);
+
+/**
+ * @brief      Update part of the sequencer program
+ *
+ * @param      offset  index of the first step to update
+ * @param      steps   the new steps
+ * @param      count   number of steps
+ *
+ * @retval     true if the steps are valid, fit the program and the
+ *             sequencer is not running
+ */
+bool func_seq_set_program(uint32_t offset, const seq_step_t *steps, uint32_t count);
+
+#endif // __FUNC_SEQ_H__
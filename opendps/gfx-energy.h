@@ -0,0 +1,13 @@
+/** Gfx generated from `./gen_lookup.py -i gfx/png/energy.png -o energy` */
+
+#ifndef __GFX_ENERGY_H__
+#define __GFX_ENERGY_H__
+
+#include <stdint.h>
+
+#define GFX_ENERGY_HEIGHT (15)
+#define GFX_ENERGY_WIDTH  (16)
+
+extern const uint8_t gfx_energy[480];
+
+#endif // __GFX_ENERGY_H__
\ No newline at end of file
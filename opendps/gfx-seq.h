@@ -0,0 +1,13 @@
+/** Gfx generated from `./gen_lookup.py -i gfx/png/seq.png -o seq` */
+
+#ifndef __GFX_SEQ_H__
+#define __GFX_SEQ_H__
+
+#include <stdint.h>
+
+#define GFX_SEQ_HEIGHT (15)
+#define GFX_SEQ_WIDTH  (16)
+
+extern const uint8_t gfx_seq[480];
+
+#endif // __GFX_SEQ_H__
\ No newline at end of file
@@ -34,11 +34,15 @@
 #include <exti.h>
 #include <usart.h>
 #include <scb.h>
+#if defined(CONFIG_ADC_CAPTURE) || defined(CONFIG_FUNCGEN_ENABLE)
+#include <dma.h>
+#endif
 #include "tick.h"
 #include "spi_driver.h"
 #include "pwrctl.h"
 #include "hw.h"
 #include "event.h"
+#include "protocol.h"
 #include "dps-model.h"
 
 /** Linker file symbols */
@@ -57,11 +61,12 @@ static void exti_init(void);
 static void dac_init(void);
 static void button_irq_init(void);
 static void copy_vectors(void);
+#ifdef CONFIG_ADC_CAPTURE
+static void adc_capture_init(void);
+#endif // CONFIG_ADC_CAPTURE
 #ifdef CONFIG_FUNCGEN_ENABLE
-static void tim3_init(void);
-void (*funcgen_tick)(void) = &fg_noop;
-volatile uint16_t cur_time_hiw;
-#endif
+static void tim6_init(void);
+#endif // CONFIG_FUNCGEN_ENABLE
 
 static volatile uint16_t i_out_adc;
 static volatile uint16_t i_out_trig_adc;
@@ -70,6 +75,28 @@ static volatile uint16_t v_out_adc;
 static volatile uint16_t v_out_trig_adc;
 static volatile uint64_t last_button_down;
 
+/** Bytes received by the USART ISR, passed on as one event when the line
+  * goes idle or the burst fills up */
+static uint8_t rx_burst[EVENT_MAX_PAYLOAD];
+static uint32_t rx_burst_len;
+
+/** DMA1 channel 4 (USART1 TX) is taken by SPI2 RX so transmission is driven
+  * by the TXE interrupt from a ring filled by the main loop. A whole frame
+  * fits, the main loop only waits when sending several back to back. */
+#ifndef CONFIG_USART_TX_RING_SIZE
+ #define CONFIG_USART_TX_RING_SIZE  (MAX_FRAME_LENGTH)
+#endif // CONFIG_USART_TX_RING_SIZE
+
+#if CONFIG_USART_TX_RING_SIZE & (CONFIG_USART_TX_RING_SIZE - 1)
+ #error "CONFIG_USART_TX_RING_SIZE must be a power of two"
+#endif
+
+static uint8_t tx_ring[CONFIG_USART_TX_RING_SIZE];
+static uint32_t tx_head; /** Written by the main loop only */
+static uint32_t tx_tail; /** Written by the USART ISR only */
+
+static uint32_t usart_baudrate = CONFIG_BAUDRATE;
+
 typedef enum {
     adc_cha_i_out = 0,
     adc_cha_v_in,
@@ -81,6 +108,35 @@ _Static_assert (adc_cha_max <= 4, "Max 4 channels for injected sampling");
 
 const uint8_t channels[adc_cha_max] = { ADC_CHA_IOUT, ADC_CHA_VIN, ADC_CHA_VOUT }; /** Must have the same order as adc_channel_t */
 
+#ifdef CONFIG_ADC_CAPTURE
+/** Number of sample sets (one conversion of each channel) per capture ring
+  * half. The DMA fills one half while the main loop drains the other. */
+#ifndef CONFIG_ADC_CAPTURE_SAMPLES
+ #define CONFIG_ADC_CAPTURE_SAMPLES  (32)
+#endif
+#define ADC_CAPTURE_HALF_LEN  (CONFIG_ADC_CAPTURE_SAMPLES * adc_cha_max)
+#define ADC_CAPTURE_RING_LEN  (2 * ADC_CAPTURE_HALF_LEN)
+
+/** The capture ring, written by DMA1 channel 1 in circular mode */
+static volatile uint16_t capture_ring[ADC_CAPTURE_RING_LEN];
+/** Bit n is set when ring half n is complete and not yet drained */
+static volatile uint32_t capture_pending;
+/** Number of half buffers overwritten before they were drained */
+static volatile uint32_t capture_overruns;
+/** The next half the main loop expects to drain */
+static uint32_t capture_next;
+/** Receiver of drained half buffers, may be NULL */
+static adc_capture_handler_t capture_handler;
+#endif // CONFIG_ADC_CAPTURE
+
+#ifdef CONFIG_FUNCGEN_ENABLE
+/** The DDS sample buffer, read by DMA1 channel 3 in circular mode. The ISR
+  * refills one half while the DMA feeds the DAC from the other. */
+static uint16_t dds_buffer[2 * DDS_HALF_BUFFER_LEN];
+/** Sample producer, only valid while the DDS is running */
+static volatile dds_refill_t dds_refill;
+#endif // CONFIG_FUNCGEN_ENABLE
+
 /** Used to handle long presses */
 #define LONGPRESS_TIME_MS (1000)
 static volatile event_t longpress_event;
@@ -101,17 +157,76 @@ static volatile bool m1_and_m2_pressed = false;
   */
 #define STARTUP_SKIP_COUNT   (40)
 
-/** Once we are checking for OCP, we need 20 over currents in a row to trigger
-  * OCP. This is due to spikes in the ADC readings.
-  * @todo Investigate if the spikes are real or is a DPS issue
-  */
-#define OCP_FILTER_COUNT (20)
+/** TIM2 triggers the injected ADC sequence, one sample set every
+  * (ADC_TRIGGER_PERIOD+1) * (ADC_TRIGGER_PRESCALER+1) timer clocks */
+#define TIM2_CLOCK_MHZ         (48)
+#define ADC_TRIGGER_PERIOD     (0xFF)
+#define ADC_TRIGGER_PRESCALER  (8)
+#define ADC_SAMPLE_PERIOD_NS   ((ADC_TRIGGER_PERIOD + 1) * (ADC_TRIGGER_PRESCALER + 1) * 1000 / TIM2_CLOCK_MHZ)
 
-/** Once we are checking for OVP, we need 20 over voltages in a row to trigger
-  * OVP. This is due to spikes in the ADC readings.
+/** An over current must persist for this long before OCP cuts the output.
+  * This is due to spikes in the ADC readings. The default matches the 20
+  * samples in a row the software filter used to require.
   * @todo Investigate if the spikes are real or is a DPS issue
   */
-#define OVP_FILTER_COUNT (20)
+#ifndef CONFIG_OCP_BLANKING_US
+ #define CONFIG_OCP_BLANKING_US  (960)
+#endif // CONFIG_OCP_BLANKING_US
+
+/** An over voltage must persist for this long before OVP cuts the output */
+#ifndef CONFIG_OVP_BLANKING_US
+ #define CONFIG_OVP_BLANKING_US  (960)
+#endif // CONFIG_OVP_BLANKING_US
+
+/** Number of over limit samples in a row that trip the protection, a
+  * blanking window of 0us trips on the first sample */
+#define OCP_TRIP_SAMPLES  (1 + CONFIG_OCP_BLANKING_US * 1000 / ADC_SAMPLE_PERIOD_NS)
+#define OVP_TRIP_SAMPLES  (1 + CONFIG_OVP_BLANKING_US * 1000 / ADC_SAMPLE_PERIOD_NS)
+
+/** Tracks consecutive over limit samples for OCP and OVP */
+typedef struct {
+    uint32_t count; /** Over limit samples in a row */
+    uint32_t last_sample; /** adc_counter of the last over limit sample */
+} trip_filter_t;
+
+static trip_filter_t ocp_filter;
+static trip_filter_t ovp_filter;
+
+/** Per channel oversampling filter. The default is an exponential moving
+  * average over 2^depth samples, CONFIG_ADC_FILTER_BOXCAR selects a boxcar
+  * (first order CIC) decimator averaging blocks of 2^depth samples instead.
+  * Either way 2^4 = 16x oversampling yields ADC_FILTER_FRAC_BITS more bits. */
+#ifndef CONFIG_ADC_FILTER_DEPTH
+ #define CONFIG_ADC_FILTER_DEPTH  (4)
+#endif // CONFIG_ADC_FILTER_DEPTH
+_Static_assert(CONFIG_ADC_FILTER_DEPTH <= ADC_FILTER_MAX_DEPTH, "CONFIG_ADC_FILTER_DEPTH is too large");
+
+typedef struct {
+    uint32_t acc; /** EMA state or boxcar running sum */
+#ifdef CONFIG_ADC_FILTER_BOXCAR
+    uint32_t out; /** Last completed boxcar sum */
+#endif // CONFIG_ADC_FILTER_BOXCAR
+} adc_filter_t;
+
+static adc_filter_t adc_filter[adc_cha_max];
+/** log2 of the filter depth */
+static volatile uint32_t adc_filter_depth = CONFIG_ADC_FILTER_DEPTH;
+#ifdef CONFIG_ADC_FILTER_BOXCAR
+/** Samples summed into the current boxcar */
+static uint32_t adc_filter_count;
+#endif // CONFIG_ADC_FILTER_BOXCAR
+
+#ifdef CONFIG_ENERGY_ENABLE
+/** ADC samples in one hour */
+#define ENERGY_SAMPLES_PER_HOUR  (3600000000000ULL / ADC_SAMPLE_PERIOD_NS)
+_Static_assert(3600000000000ULL % ADC_SAMPLE_PERIOD_NS == 0, "ADC sample period does not divide an hour");
+
+/** Charge and energy integrated over every sample set taken while the output
+  * is enabled. The energy sum wraps after some 10 days at 50V 20A. */
+static uint64_t energy_charge; /** mA samples */
+static uint64_t energy_energy; /** uW samples */
+static uint64_t energy_samples;
+#endif // CONFIG_ENERGY_ENABLE
 
 #ifdef CONFIG_ADC_BENCHMARK
 static uint64_t adc_tick_start;
@@ -146,6 +261,7 @@ void hw_init(void)
     copy_vectors();
     clock_init();
     systick_init();
+    nvic_set_priority(NVIC_SYSTICK_IRQ, 2 << 4); // Below the ADC ISR
     gpio_init();
     usart_init();
     adc1_init();
@@ -154,8 +270,8 @@ void hw_init(void)
     dac_init();
     button_irq_init();
 #ifdef CONFIG_FUNCGEN_ENABLE
-    tim3_init();
-#endif
+    tim6_init();
+#endif // CONFIG_FUNCGEN_ENABLE
 
 //    AFIO_MAPR |= AFIO_MAPR_PD01_REMAP; /** @todo The original DPS FW does this, things go south if I do it... */
 }
@@ -170,10 +286,219 @@ void hw_init(void)
 void hw_get_adc_values(uint16_t *i_out_raw, uint16_t *v_in_raw, uint16_t *v_out_raw)
 {
     *i_out_raw = i_out_adc;
+#ifdef CONFIG_ADC_CAPTURE
+    /** V_in is only needed by the UI, fetch it from the capture ring rather
+      * than reading it on every injected conversion */
+    uint32_t pos = ADC_CAPTURE_RING_LEN - DMA_CNDTR(DMA1, DMA_CHANNEL1);
+    uint32_t set = pos / adc_cha_max; // Possibly partially written
+    set = (set + 2 * CONFIG_ADC_CAPTURE_SAMPLES - 1) % (2 * CONFIG_ADC_CAPTURE_SAMPLES);
+    *v_in_raw = capture_ring[set * adc_cha_max + adc_cha_v_in];
+#else // CONFIG_ADC_CAPTURE
     *v_in_raw = v_in_adc;
+#endif // CONFIG_ADC_CAPTURE
     *v_out_raw = v_out_adc;
 }
 
+/**
+  * @brief Scale a filter sum of 2^depth samples to ADC_FILTER_FRAC_BITS
+  *        fractional bits
+  * @retval the scaled value
+  */
+static uint16_t adc_filter_scale(uint32_t sum, uint32_t depth)
+{
+    if (depth >= ADC_FILTER_FRAC_BITS) {
+        return sum >> (depth - ADC_FILTER_FRAC_BITS);
+    } else {
+        return sum << (ADC_FILTER_FRAC_BITS - depth);
+    }
+}
+
+/**
+  * @brief Read the oversampled ADC measurements
+  * @param i_out filtered I_out with ADC_FILTER_FRAC_BITS fractional bits
+  * @param v_in filtered V_in with ADC_FILTER_FRAC_BITS fractional bits
+  * @param v_out filtered V_out with ADC_FILTER_FRAC_BITS fractional bits
+  * @retval none
+  */
+void hw_get_adc_filtered(uint16_t *i_out, uint16_t *v_in, uint16_t *v_out)
+{
+    uint32_t depth = adc_filter_depth;
+#ifdef CONFIG_ADC_FILTER_BOXCAR
+    *i_out = adc_filter_scale(adc_filter[adc_cha_i_out].out, depth);
+    *v_in = adc_filter_scale(adc_filter[adc_cha_v_in].out, depth);
+    *v_out = adc_filter_scale(adc_filter[adc_cha_v_out].out, depth);
+#else // CONFIG_ADC_FILTER_BOXCAR
+    *i_out = adc_filter_scale(adc_filter[adc_cha_i_out].acc, depth);
+    *v_in = adc_filter_scale(adc_filter[adc_cha_v_in].acc, depth);
+    *v_out = adc_filter_scale(adc_filter[adc_cha_v_out].acc, depth);
+#endif // CONFIG_ADC_FILTER_BOXCAR
+}
+
+/**
+  * @brief Set the oversampling filter depth
+  * @param depth log2 of the number of samples averaged, 0 disables filtering
+  * @retval true if the depth was within range
+  */
+bool hw_set_adc_filter_depth(uint32_t depth)
+{
+    if (depth > ADC_FILTER_MAX_DEPTH) {
+        return false;
+    }
+    nvic_disable_irq(NVIC_ADC1_2_IRQ);
+    for (uint32_t i = 0; i < adc_cha_max; i++) {
+#ifdef CONFIG_ADC_FILTER_BOXCAR
+        /** Restart the boxcar, keep the last output valid at the new depth */
+        adc_filter[i].out = (adc_filter[i].out >> adc_filter_depth) << depth;
+        adc_filter[i].acc = 0;
+#else // CONFIG_ADC_FILTER_BOXCAR
+        adc_filter[i].acc = (adc_filter[i].acc >> adc_filter_depth) << depth;
+#endif // CONFIG_ADC_FILTER_BOXCAR
+    }
+#ifdef CONFIG_ADC_FILTER_BOXCAR
+    adc_filter_count = 0;
+#endif // CONFIG_ADC_FILTER_BOXCAR
+    adc_filter_depth = depth;
+    nvic_enable_irq(NVIC_ADC1_2_IRQ);
+    return true;
+}
+
+/**
+  * @brief Get the oversampling filter depth
+  * @retval log2 of the number of samples averaged
+  */
+uint32_t hw_get_adc_filter_depth(void)
+{
+    return adc_filter_depth;
+}
+
+/**
+  * @brief Feed one sample set to the oversampling filter
+  * @note Called from the ADC ISR, or from hw_adc_capture_drain when
+  *       capturing, a handful of cycles per channel
+  * @retval None
+  */
+static inline void adc_filter_add(uint32_t i_out, uint32_t v_in, uint32_t v_out)
+{
+    uint32_t depth = adc_filter_depth;
+#ifdef CONFIG_ADC_FILTER_BOXCAR
+    adc_filter[adc_cha_i_out].acc += i_out;
+    adc_filter[adc_cha_v_in].acc += v_in;
+    adc_filter[adc_cha_v_out].acc += v_out;
+    if (++adc_filter_count >> depth) {
+        for (uint32_t i = 0; i < adc_cha_max; i++) {
+            adc_filter[i].out = adc_filter[i].acc;
+            adc_filter[i].acc = 0;
+        }
+        adc_filter_count = 0;
+    }
+#else // CONFIG_ADC_FILTER_BOXCAR
+    /** acc converges to 2^depth times the mean */
+    adc_filter[adc_cha_i_out].acc += i_out - (adc_filter[adc_cha_i_out].acc >> depth);
+    adc_filter[adc_cha_v_in].acc += v_in - (adc_filter[adc_cha_v_in].acc >> depth);
+    adc_filter[adc_cha_v_out].acc += v_out - (adc_filter[adc_cha_v_out].acc >> depth);
+#endif // CONFIG_ADC_FILTER_BOXCAR
+}
+
+#ifdef CONFIG_ENERGY_ENABLE
+/**
+  * @brief Read the charge and energy delivered while the output was enabled
+  * @param energy the counters, converted from the sample sums
+  * @param reset restart the counters after reading them
+  * @retval none
+  */
+void hw_get_energy(hw_energy_t *energy, bool reset)
+{
+    uint64_t charge, energy_sum, samples;
+    nvic_disable_irq(NVIC_ADC1_2_IRQ);
+    charge = energy_charge;
+    energy_sum = energy_energy;
+    samples = energy_samples;
+    if (reset) {
+        energy_charge = 0;
+        energy_energy = 0;
+        energy_samples = 0;
+    }
+    nvic_enable_irq(NVIC_ADC1_2_IRQ);
+    energy->charge_uah = charge / (ENERGY_SAMPLES_PER_HOUR / 1000);
+    energy->energy_uwh = energy_sum / ENERGY_SAMPLES_PER_HOUR;
+    energy->runtime_ms = samples * ADC_SAMPLE_PERIOD_NS / 1000000;
+}
+
+/**
+  * @brief Integrate the charge and energy of one sample set
+  * @note Called from the ADC ISR while the output is enabled
+  * @retval None
+  */
+static inline void energy_add(uint32_t i_out, uint32_t v_out)
+{
+    int32_t i_ma = (pwrctl_i_out_isr_cal.k * (int32_t) i_out + pwrctl_i_out_isr_cal.c) >> PWRCTL_ISR_Q;
+    int32_t v_mv = (pwrctl_v_out_isr_cal.k * (int32_t) v_out + pwrctl_v_out_isr_cal.c) >> PWRCTL_ISR_Q;
+    if (i_ma > 0) {
+        energy_charge += i_ma;
+        if (v_mv > 0) {
+            energy_energy += (uint32_t) v_mv * (uint32_t) i_ma;
+        }
+    }
+    energy_samples++;
+}
+#endif // CONFIG_ENERGY_ENABLE
+
+#ifdef CONFIG_ADC_CAPTURE
+/**
+  * @brief Set the receiver of captured ADC samples
+  * @param handler function called from hw_adc_capture_drain, or NULL
+  * @retval none
+  */
+void hw_adc_capture_set_handler(adc_capture_handler_t handler)
+{
+    capture_handler = handler;
+}
+
+/**
+  * @brief Drain completed capture ring halves, call from the main loop
+  * @note The oversampling filter is fed from here rather than from the ADC
+  *       ISR, halves lost to overruns are left out of it
+  * @retval number of half buffers drained
+  */
+uint32_t hw_adc_capture_drain(void)
+{
+    uint32_t count = 0;
+    while (capture_pending & (1 << capture_next)) {
+        /** The ring is only read, the DMA owns it */
+        uint16_t samples[ADC_CAPTURE_HALF_LEN];
+        const volatile uint16_t *half = &capture_ring[capture_next * ADC_CAPTURE_HALF_LEN];
+        for (uint32_t i = 0; i < ADC_CAPTURE_HALF_LEN; i++) {
+            samples[i] = half[i];
+        }
+        nvic_disable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+        capture_pending &= ~(1 << capture_next);
+        nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+        capture_next ^= 1;
+        count++;
+
+        if (!measure_i_out) {
+            for (uint32_t i = 0; i < ADC_CAPTURE_HALF_LEN; i += adc_cha_max) {
+                samples[i + adc_cha_i_out] += adc_i_offset;
+                adc_filter_add(samples[i + adc_cha_i_out], samples[i + adc_cha_v_in], samples[i + adc_cha_v_out]);
+            }
+        }
+        if (capture_handler) {
+            capture_handler(samples, CONFIG_ADC_CAPTURE_SAMPLES);
+        }
+    }
+    return count;
+}
+
+/**
+  * @brief Get number of capture ring halves lost due to slow draining
+  * @retval number of overruns since boot
+  */
+uint32_t hw_adc_capture_overruns(void)
+{
+    return capture_overruns;
+}
+#endif // CONFIG_ADC_CAPTURE
+
 /**
   * @brief Set the output voltage DAC value
   * @param v_dac the value to set to
@@ -286,46 +611,66 @@ bool hw_sel_button_pressed(void)
 }
 
 /**
-  * @brief Add some filtering to OCPs
-  * @retval None
+  * @brief Count an over limit sample against the blanking window
+  * @param filter the OCP or OVP filter
+  * @param trip_samples number of samples in a row that trip the protection
+  * @retval true if the protection should trip
   */
-static void handle_ocp(uint16_t raw)
+static bool trip_filter_hit(trip_filter_t *filter, uint32_t trip_samples)
 {
-    static uint32_t ocp_count = 0;
-    static uint32_t last_tick_counter = 0;
-    if (last_tick_counter+1 == adc_counter) {
-        ocp_count++;
-        last_tick_counter++;
-        if (ocp_count == OCP_FILTER_COUNT) {
-            i_out_trig_adc = raw;
-            pwrctl_enable_vout(false);
-            event_put(event_ocp, 0);
-        }
+    if (filter->count && filter->last_sample + 1 == adc_counter) {
+        filter->count++;
     } else {
-        ocp_count = 0;
-        last_tick_counter = adc_counter;
+        filter->count = 1;
     }
+    filter->last_sample = adc_counter;
+    return filter->count == trip_samples;
 }
 
 /**
-  * @brief Add some filtering to OVPs
+  * @brief Cut the output and report the trip
+  * @param event event_ocp or event_ovp
+  * @param trig where to store the sample that tripped the protection
+  * @param raw the sample
   * @retval None
   */
-static void handle_ovp(uint16_t raw)
+static void protection_trip(event_t event, volatile uint16_t *trig, uint16_t raw)
 {
-    static uint32_t ovp_count = 0;
-    static uint32_t last_tick_counter = 0;
-    if (last_tick_counter+1 == adc_counter) {
-        ovp_count++;
-        last_tick_counter++;
-        if (ovp_count == OVP_FILTER_COUNT) {
-            v_out_trig_adc = raw;
-            pwrctl_enable_vout(false);
-            event_put(event_ovp, 0);
+    pwrctl_cut_vout();
+    /** TIM2 restarted from 0 when it triggered the sample we acted on and
+      * this ISR is alone at the highest priority, so the count is the
+      * latency */
+    uint16_t latency_ns = TIM_CNT(TIM2) * (ADC_TRIGGER_PRESCALER + 1) * 1000 / TIM2_CLOCK_MHZ;
+    *trig = raw;
+    pwrctl_enable_vout(false);
+    (void) event_put_data(event, (uint8_t*) &latency_ns, sizeof(latency_ns));
+}
+
+/**
+  * @brief Update the analog watchdog guarding I_out from the current limit
+  *        and arm it while the output is enabled
+  * @note Called from the ADC ISR once per sample set
+  * @retval None
+  */
+static void ocp_watchdog_update(void)
+{
+    bool armed = pwrctl_i_limit_raw && pwrctl_vout_enabled() && adc_counter >= STARTUP_SKIP_COUNT;
+    if (armed) {
+        /** The watchdog compares raw readings, before the offset is added */
+        int32_t threshold = (int32_t) pwrctl_i_limit_raw - adc_i_offset;
+        if (threshold < 0) {
+            threshold = 0;
+        } else if (threshold > 0xfff) {
+            threshold = 0xfff;
+        }
+        ADC_HTR(ADC1) = threshold;
+        if (!(ADC_CR1(ADC1) & ADC_CR1_AWDIE)) {
+            /** The flag is set by out of window samples even when disarmed */
+            ADC_SR(ADC1) &= ~ADC_SR_AWD;
+            ADC_CR1(ADC1) |= ADC_CR1_AWDIE;
         }
     } else {
-        ovp_count = 0;
-        last_tick_counter = adc_counter;
+        ADC_CR1(ADC1) &= ~ADC_CR1_AWDIE;
     }
 }
 
@@ -336,6 +681,20 @@ static void handle_ovp(uint16_t raw)
   */
 void adc1_2_isr(void)
 {
+    /** The analog watchdog fires as soon as I_out is converted, before the
+      * rest of the injected sequence */
+    if ((ADC_CR1(ADC1) & ADC_CR1_AWDIE) && (ADC_SR(ADC1) & ADC_SR_AWD)) {
+        ADC_SR(ADC1) &= ~ADC_SR_AWD;
+        if (trip_filter_hit(&ocp_filter, OCP_TRIP_SAMPLES)) { /** OCP! */
+            ADC_CR1(ADC1) &= ~ADC_CR1_AWDIE;
+            protection_trip(event_ocp, &i_out_trig_adc, adc_read_injected(ADC1, adc_cha_i_out + 1) + adc_i_offset);
+        }
+    }
+
+    if (!(ADC_SR(ADC1) & ADC_SR_JEOC)) {
+        return;
+    }
+
 #ifdef CONFIG_ADC_BENCHMARK
     if (adc_counter == 0) {
         adc_tick_start = get_ticks();
@@ -359,28 +718,58 @@ void adc1_2_isr(void)
     }
     if (pwrctl_i_limit_raw) {
         if (adc_counter >= STARTUP_SKIP_COUNT) {
-            i += adc_i_offset;
-            if (i > pwrctl_i_limit_raw && pwrctl_vout_enabled()) { /** OCP! */
-                handle_ocp(i);
-            }
-            i_out_adc = i;
+            i_out_adc = i + adc_i_offset;
         }
     }
+    ocp_watchdog_update();
 
-    v_in_adc = adc_read_injected(ADC1, adc_cha_v_in + 1); // Yes, this is correct
     v_out_adc = adc_read_injected(ADC1, adc_cha_v_out + 1); // Yes, this is correct
+#ifndef CONFIG_ADC_CAPTURE
+    /** Capture builds take V_in and feed the filter from the capture ring */
+    uint32_t v_in = adc_read_injected(ADC1, adc_cha_v_in + 1); // Yes, this is correct
+    v_in_adc = v_in;
+    adc_filter_add(i_out_adc, v_in, v_out_adc);
+#endif // CONFIG_ADC_CAPTURE
+#ifdef CONFIG_VOUT_REGULATION
+    pwrctl_vout_regulate(v_out_adc);
+#endif // CONFIG_VOUT_REGULATION
+#ifdef CONFIG_ENERGY_ENABLE
+    if (pwrctl_vout_enabled()) {
+        energy_add(i_out_adc, v_out_adc);
+    }
+#endif // CONFIG_ENERGY_ENABLE
 
     /** Check to see if an over voltage limit has been triggered */
     if (pwrctl_v_limit_raw) {
-        if (v_out_adc > pwrctl_v_limit_raw && pwrctl_vout_enabled()) { /** OVP! */
-            handle_ovp(v_out_adc);
+        if (v_out_adc > pwrctl_v_limit_raw && pwrctl_vout_enabled()) {
+            if (trip_filter_hit(&ovp_filter, OVP_TRIP_SAMPLES)) { /** OVP! */
+                protection_trip(event_ovp, &v_out_trig_adc, v_out_adc);
+            }
         }
     }
+}
 
-#ifdef CONFIG_FUNCGEN_ENABLE
-    (*funcgen_tick)();
-#endif
+#ifdef CONFIG_ADC_CAPTURE
+/**
+  * @brief DMA1 channel 1 ISR, fires when either half of the capture ring is full
+  * @retval None
+  */
+void dma1_channel1_isr(void)
+{
+    uint32_t half;
+    if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_HTIF)) {
+        dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_HTIF);
+        half = 0;
+    } else {
+        dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_TCIF | DMA_GIF);
+        half = 1;
+    }
+    if (capture_pending & (1 << half)) {
+        capture_overruns++;
+    }
+    capture_pending |= 1 << half;
 }
+#endif // CONFIG_ADC_CAPTURE
 
 /**
   * @brief Handle USART1 interrupts
@@ -388,24 +777,116 @@ void adc1_2_isr(void)
   */
 void usart1_isr(void)
 {
+    uint32_t sr = USART_SR(USART1);
     if (((USART_CR1(USART1) & USART_CR1_RXNEIE) != 0) &&
-        ((USART_SR(USART1) & USART_SR_RXNE) != 0)) {
-        uint8_t ch = usart_recv(USART1);
-        event_put(event_uart_rx, ch);
+        ((sr & USART_SR_RXNE) != 0)) {
+        /** Reading DR after SR also clears IDLE */
+        rx_burst[rx_burst_len++] = usart_recv(USART1);
+        if (rx_burst_len == EVENT_MAX_PAYLOAD) {
+            (void) event_put_data(event_uart_rx, rx_burst, rx_burst_len);
+            rx_burst_len = 0;
+        }
+    } else if ((sr & USART_SR_IDLE) != 0) {
+        /** The line went quiet, pass on what we have as one event */
+        (void) USART_DR(USART1);
+        if (rx_burst_len) {
+            (void) event_put_data(event_uart_rx, rx_burst, rx_burst_len);
+            rx_burst_len = 0;
+        }
     }
 
-#ifdef TX_IRQ
     if (((USART_CR1(USART1) & USART_CR1_TXEIE) != 0) &&
-        ((USART_SR(USART1) & USART_SR_TXE) != 0)) {
-        int32_t data;
-        data = ringbuf_read_ch(&output_ring, NULL);
-        if (data == -1) {
-            USART_CR1(USART1) &= ~USART_CR1_TXEIE;
+        ((sr & USART_SR_TXE) != 0)) {
+        uint32_t tail = tx_tail;
+        if (tail == __atomic_load_n(&tx_head, __ATOMIC_ACQUIRE)) {
+            /** The main loop cannot preempt us between the check and this */
+            usart_disable_tx_interrupt(USART1);
         } else {
-            usart_send(USART1, data);
+            usart_send(USART1, tx_ring[tail % CONFIG_USART_TX_RING_SIZE]);
+            __atomic_store_n(&tx_tail, tail + 1, __ATOMIC_RELEASE);
         }
     }
-#endif // TX_IRQ
+}
+
+/**
+  * @brief Queue data for transmission on USART1, returns as soon as all data
+  *        is in the transmit ring. Only call from the main loop.
+  * @param data data to send
+  * @param length length of data
+  * @retval None
+  */
+void hw_usart_send(const uint8_t *data, uint32_t length)
+{
+    while (length) {
+        uint32_t head = tx_head;
+        uint32_t room = CONFIG_USART_TX_RING_SIZE - (head - __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE));
+        uint32_t count = length < room ? length : room;
+        for (uint32_t i = 0; i < count; i++) {
+            tx_ring[head++ % CONFIG_USART_TX_RING_SIZE] = *data++;
+        }
+        length -= count;
+        __atomic_store_n(&tx_head, head, __ATOMIC_RELEASE);
+        /** Kick the ISR, if the ring is full we spin here until it drains */
+        usart_enable_tx_interrupt(USART1);
+    }
+}
+
+/**
+  * @brief Wait for all queued USART1 data to leave the transmitter
+  * @retval None
+  */
+void hw_usart_flush(void)
+{
+    while (__atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE) != tx_head) {
+    }
+    usart_wait_send_ready(USART1);
+    while ((USART_SR(USART1) & USART_SR_TC) == 0) {
+    }
+}
+
+/**
+  * @brief Check if USART1 can run at a baudrate
+  * @param baudrate the baudrate
+  * @retval true if the baudrate is in range and can be generated within 2%
+  */
+bool hw_baudrate_valid(uint32_t baudrate)
+{
+    if (baudrate < BAUDRATE_MIN || baudrate > BAUDRATE_MAX) {
+        return false;
+    }
+    /** Same rounding as usart_set_baudrate(...) */
+    uint32_t brr = (2 * rcc_apb2_frequency + baudrate) / (2 * baudrate);
+    uint32_t actual = rcc_apb2_frequency / brr;
+    uint32_t error = actual > baudrate ? actual - baudrate : baudrate - actual;
+    return error <= baudrate / 50;
+}
+
+/**
+  * @brief Change the USART1 baudrate once all queued data has been sent
+  * @param baudrate the new baudrate
+  * @retval false if the baudrate is not valid, the baudrate is then left
+  *         unchanged
+  */
+bool hw_set_baudrate(uint32_t baudrate)
+{
+    if (!hw_baudrate_valid(baudrate)) {
+        return false;
+    }
+    hw_usart_flush();
+    usart_disable(USART1);
+    usart_set_baudrate(USART1, baudrate);
+    usart_enable(USART1);
+    usart_baudrate = baudrate;
+    return true;
+}
+
+/**
+  * @brief Get the current USART1 baudrate
+  * @retval the baudrate
+  */
+uint32_t hw_get_baudrate(void)
+{
+    return usart_baudrate;
 }
 /**
   * @brief Enable clocks
@@ -428,6 +909,7 @@ static void clock_init(void)
 static void adc1_init(void)
 {
     int i;
+    /** The only interrupt at priority 0, nothing holds off the OCP/OVP trip */
     nvic_set_priority(NVIC_ADC1_2_IRQ, 0);
     nvic_enable_irq(NVIC_ADC1_2_IRQ);
     rcc_periph_clock_enable(RCC_ADC1);
@@ -444,6 +926,15 @@ static void adc1_init(void)
     //adc_enable_temperature_sensor(); /** @todo Use internal temperature sensor for monitoring */
     adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_28DOT5CYC);
     adc_set_injected_sequence(ADC1, adc_cha_max, (uint8_t*) channels);
+    // Guard I_out with the analog watchdog, armed by the ISR once the current
+    // limit is known and the output is enabled
+    adc_enable_analog_watchdog_injected(ADC1);
+    adc_enable_analog_watchdog_on_selected_channel(ADC1, ADC_CHA_IOUT);
+    adc_set_watchdog_low_threshold(ADC1, 0);
+    adc_set_watchdog_high_threshold(ADC1, 0xfff);
+#ifdef CONFIG_ADC_CAPTURE
+    adc_capture_init();
+#endif // CONFIG_ADC_CAPTURE
     adc_power_on(ADC1);
 
     // Wait for ADC starting up.
@@ -467,6 +958,7 @@ static void usart_init(void)
     gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART1_TX);
     gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOAT, GPIO_USART1_RX);
 
+    nvic_set_priority(NVIC_USART1_IRQ, 3 << 4); // Below the ADC ISR
     nvic_enable_irq(NVIC_USART1_IRQ);
     usart_set_baudrate(USART1, CONFIG_BAUDRATE); /** Baudrate set in makefile */
     usart_set_databits(USART1, 8);
@@ -475,8 +967,8 @@ static void usart_init(void)
     usart_set_parity(USART1, USART_PARITY_NONE);
     usart_set_flow_control(USART1, USART_FLOWCONTROL_NONE);
 
-    // Enable USART1 Receive interrupt.
-    USART_CR1(USART1) |= USART_CR1_RXNEIE;
+    // Enable USART1 Receive and idle line interrupts.
+    USART_CR1(USART1) |= USART_CR1_RXNEIE | USART_CR1_IDLEIE;
 
     usart_enable(USART1);
 }
@@ -747,53 +1239,138 @@ static void common_timer_init(enum rcc_periph_clken rcc, uint32_t timer, uint32_
 
 /**
   * @brief Set up TIM2 for injected ADC1 sampling
-  * This timer fires at 20915Hz (that is 48MHz / 9 / 255)
+  * This timer fires at 20833Hz (that is 48MHz / 9 / 256)
   * @retval None
   */
 static void tim2_init(void)
 {
     uint32_t timer = TIM2;
-    common_timer_init(RCC_TIM2, timer, 0xFF, 8);
+    common_timer_init(RCC_TIM2, timer, ADC_TRIGGER_PERIOD, ADC_TRIGGER_PRESCALER);
     timer_set_master_mode(timer, TIM_CR2_MMS_UPDATE); // Generate TRGO on every update.
+#ifdef CONFIG_ADC_CAPTURE
+    // TRGO cannot trigger regular conversions, use CC2 half a period later
+    // so the regular sweep does not collide with the injected one
+    timer_set_oc_mode(timer, TIM_OC2, TIM_OCM_PWM1);
+    timer_set_oc_value(timer, TIM_OC2, 0x80);
+    timer_enable_oc_output(timer, TIM_OC2);
+#endif // CONFIG_ADC_CAPTURE
     timer_enable_counter(timer);
 }
 
+#ifdef CONFIG_ADC_CAPTURE
+/**
+  * @brief Set up regular ADC1 conversions of all channels, moved to the
+  *        capture ring by DMA1 channel 1 in circular mode
+  * @retval None
+  */
+static void adc_capture_init(void)
+{
+    rcc_periph_clock_enable(RCC_DMA1);
+    dma_channel_reset(DMA1, DMA_CHANNEL1);
+    dma_set_peripheral_address(DMA1, DMA_CHANNEL1, (uint32_t)&ADC_DR(ADC1));
+    dma_set_memory_address(DMA1, DMA_CHANNEL1, (uint32_t)capture_ring);
+    dma_set_number_of_data(DMA1, DMA_CHANNEL1, ADC_CAPTURE_RING_LEN);
+    dma_set_read_from_peripheral(DMA1, DMA_CHANNEL1);
+    dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL1);
+    dma_set_peripheral_size(DMA1, DMA_CHANNEL1, DMA_CCR_PSIZE_16BIT);
+    dma_set_memory_size(DMA1, DMA_CHANNEL1, DMA_CCR_MSIZE_16BIT);
+    dma_enable_circular_mode(DMA1, DMA_CHANNEL1);
+    dma_set_priority(DMA1, DMA_CHANNEL1, DMA_CCR_PL_HIGH);
+    dma_enable_half_transfer_interrupt(DMA1, DMA_CHANNEL1);
+    dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL1);
+    nvic_set_priority(NVIC_DMA1_CHANNEL1_IRQ, 2 << 4); // Below the ADC ISR
+    nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+    dma_enable_channel(DMA1, DMA_CHANNEL1);
+
+    // Scan mode converts the whole sequence on each TIM2 CC2 event
+    adc_set_regular_sequence(ADC1, adc_cha_max, (uint8_t*) channels);
+    adc_enable_external_trigger_regular(ADC1, ADC_CR2_EXTSEL_TIM2_CC2);
+    adc_enable_dma(ADC1);
+}
+#endif // CONFIG_ADC_CAPTURE
+
 #ifdef CONFIG_FUNCGEN_ENABLE
 /**
-  * @brief Set up TIM3 for function generator sampling
-  * This timer fires at 1000000Hz (that is 48MHz / 1 / 48) 
+  * @brief Set up TIM6 as the DDS sample clock
+  * This timer fires at 50000Hz (that is 48MHz / 1 / 960) and triggers
+  * DAC channel 1 through its TRGO output. It is left running, the DAC only
+  * listens to it while the DDS is started.
   * @retval None
   */
-static void tim3_init(void)
+static void tim6_init(void)
 {
-    uint32_t timer = TIM3;
-    common_timer_init(RCC_TIM3, timer, 0xFFFF, 47);
+    uint32_t timer = TIM6;
+    common_timer_init(RCC_TIM6, timer, (48000000 / DDS_SAMPLE_RATE_HZ) - 1, 0);
+    timer_set_master_mode(timer, TIM_CR2_MMS_UPDATE);
     timer_enable_counter(timer);
-    nvic_enable_irq(NVIC_TIM3_IRQ);
-    nvic_set_priority(NVIC_TIM3_IRQ, 1);
-    timer_enable_irq(timer, TIM_DIER_UIE); /* Update IRQ enable */
 }
 
-void tim3_isr(void) {
-  if (timer_get_flag(TIM3, TIM_DIER_UIE)) {
-      timer_clear_flag(TIM3, TIM_DIER_UIE);
-  }
-  cur_time_hiw ++;
+/**
+  * @brief DMA1 channel 3 ISR, fires when either half of the DDS buffer has
+  *        been consumed by the DAC
+  * @retval None
+  */
+void dma1_channel3_isr(void)
+{
+    uint16_t *half;
+    if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL3, DMA_HTIF)) {
+        dma_clear_interrupt_flags(DMA1, DMA_CHANNEL3, DMA_HTIF);
+        half = &dds_buffer[0];
+    } else {
+        dma_clear_interrupt_flags(DMA1, DMA_CHANNEL3, DMA_TCIF | DMA_GIF);
+        half = &dds_buffer[DDS_HALF_BUFFER_LEN];
+    }
+    if (dds_refill) {
+        dds_refill(half, DDS_HALF_BUFFER_LEN);
+    }
 }
 
-uint32_t cur_time_us(void)
+/**
+  * @brief Start clocking samples into DAC channel 1 from TIM6 via DMA
+  * @param refill function called whenever half of the buffer has been
+  *        consumed, also used to prime the buffer before starting
+  * @retval none
+  */
+void hw_dds_start(dds_refill_t refill)
 {
-    uint32_t t = timer_get_counter(TIM3);
-    t |= (cur_time_hiw << 16U);
-    return t;
+    hw_dds_stop();
+    refill(&dds_buffer[0], DDS_HALF_BUFFER_LEN);
+    refill(&dds_buffer[DDS_HALF_BUFFER_LEN], DDS_HALF_BUFFER_LEN);
+    dds_refill = refill;
+
+    rcc_periph_clock_enable(RCC_DMA1);
+    dma_channel_reset(DMA1, DMA_CHANNEL3);
+    dma_set_peripheral_address(DMA1, DMA_CHANNEL3, (uint32_t)&DAC_DHR12R1(DAC1));
+    dma_set_memory_address(DMA1, DMA_CHANNEL3, (uint32_t)dds_buffer);
+    dma_set_number_of_data(DMA1, DMA_CHANNEL3, 2 * DDS_HALF_BUFFER_LEN);
+    dma_set_read_from_memory(DMA1, DMA_CHANNEL3);
+    dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL3);
+    dma_set_peripheral_size(DMA1, DMA_CHANNEL3, DMA_CCR_PSIZE_16BIT);
+    dma_set_memory_size(DMA1, DMA_CHANNEL3, DMA_CCR_MSIZE_16BIT);
+    dma_enable_circular_mode(DMA1, DMA_CHANNEL3);
+    dma_set_priority(DMA1, DMA_CHANNEL3, DMA_CCR_PL_VERY_HIGH);
+    dma_enable_half_transfer_interrupt(DMA1, DMA_CHANNEL3);
+    dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL3);
+    nvic_set_priority(NVIC_DMA1_CHANNEL3_IRQ, 1 << 4); // Below the ADC ISR
+    nvic_enable_irq(NVIC_DMA1_CHANNEL3_IRQ);
+    dma_enable_channel(DMA1, DMA_CHANNEL3);
+
+    // TSEL1 = 000 selects TIM6 TRGO
+    DAC_CR(DAC1) |= DAC_CR_DMAEN1 | DAC_CR_TEN1;
 }
+
 /**
-  * @brief Do nothing
-  * This avoid to test a (shared) variable and branch in an isr, and instead, branch to a function in all cases
+  * @brief Stop the DDS, DAC channel 1 returns to software writes
+  * @retval none
   */
-void fg_noop(void) {
+void hw_dds_stop(void)
+{
+    DAC_CR(DAC1) &= ~(DAC_CR_DMAEN1 | DAC_CR_TEN1);
+    nvic_disable_irq(NVIC_DMA1_CHANNEL3_IRQ);
+    dma_disable_channel(DMA1, DMA_CHANNEL3);
+    dds_refill = 0;
 }
-#endif
+#endif // CONFIG_FUNCGEN_ENABLE
 
 /**
   * @brief Start a (possible) long press
@@ -998,26 +1575,31 @@ void BUTTON_ROTARY_isr(void)
   */
 static void button_irq_init(void)
 {
+    nvic_set_priority(BUTTON_SEL_NVIC, 3 << 4); // Below the ADC ISR
     nvic_enable_irq(BUTTON_SEL_NVIC);
     exti_select_source(BUTTON_SEL_EXTI, BUTTON_SEL_PORT);
     exti_set_trigger(BUTTON_SEL_EXTI, EXTI_TRIGGER_FALLING);
     exti_enable_request(BUTTON_SEL_EXTI);
 
+    nvic_set_priority(BUTTON_M1_NVIC, 3 << 4); // Below the ADC ISR
     nvic_enable_irq(BUTTON_M1_NVIC);
     exti_select_source(BUTTON_M1_EXTI, BUTTON_M1_PORT);
     exti_set_trigger(BUTTON_M1_EXTI, EXTI_TRIGGER_FALLING);
     exti_enable_request(BUTTON_M1_EXTI);
 
+    nvic_set_priority(BUTTON_M2_NVIC, 3 << 4); // Below the ADC ISR
     nvic_enable_irq(BUTTON_M2_NVIC);
     exti_select_source(BUTTON_M2_EXTI, BUTTON_M2_PORT);
     exti_set_trigger(BUTTON_M2_EXTI, EXTI_TRIGGER_FALLING);
     exti_enable_request(BUTTON_M2_EXTI);
 
+    nvic_set_priority(BUTTON_ENABLE_NVIC, 3 << 4); // Below the ADC ISR
     nvic_enable_irq(BUTTON_ENABLE_NVIC);
     exti_select_source(BUTTON_ENABLE_EXTI, BUTTON_ENABLE_PORT);
     exti_set_trigger(BUTTON_ENABLE_EXTI, EXTI_TRIGGER_FALLING);
     exti_enable_request(BUTTON_ENABLE_EXTI);
 
+    nvic_set_priority(BUTTON_ROTARY_NVIC, 3 << 4); // Below the ADC ISR
     nvic_enable_irq(BUTTON_ROTARY_NVIC);
 
     exti_select_source(BUTTON_ROT_A_EXTI, BUTTON_ROT_A_PORT);
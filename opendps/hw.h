@@ -94,6 +94,50 @@ void hw_init(void);
   */
 void hw_get_adc_values(uint16_t *i_out_raw, uint16_t *v_in_raw, uint16_t *v_out_raw);
 
+/** Fractional bits of the values returned by hw_get_adc_filtered */
+#define ADC_FILTER_FRAC_BITS  (2)
+/** Largest filter depth accepted by hw_set_adc_filter_depth */
+#define ADC_FILTER_MAX_DEPTH  (10)
+
+/**
+  * @brief Read the oversampled ADC measurements
+  * @param i_out filtered I_out with ADC_FILTER_FRAC_BITS fractional bits
+  * @param v_in filtered V_in with ADC_FILTER_FRAC_BITS fractional bits
+  * @param v_out filtered V_out with ADC_FILTER_FRAC_BITS fractional bits
+  * @retval none
+  */
+void hw_get_adc_filtered(uint16_t *i_out, uint16_t *v_in, uint16_t *v_out);
+
+/**
+  * @brief Set the oversampling filter depth
+  * @param depth log2 of the number of samples averaged, 0 disables filtering
+  * @retval true if the depth was within range
+  */
+bool hw_set_adc_filter_depth(uint32_t depth);
+
+/**
+  * @brief Get the oversampling filter depth
+  * @retval log2 of the number of samples averaged
+  */
+uint32_t hw_get_adc_filter_depth(void);
+
+#ifdef CONFIG_ENERGY_ENABLE
+/** Charge and energy delivered while the output was enabled */
+typedef struct {
+    uint64_t charge_uah;
+    uint64_t energy_uwh;
+    uint64_t runtime_ms; /** Time the output was enabled */
+} hw_energy_t;
+
+/**
+  * @brief Read the charge and energy delivered while the output was enabled
+  * @param energy the counters, converted from the sample sums
+  * @param reset restart the counters after reading them
+  * @retval none
+  */
+void hw_get_energy(hw_energy_t *energy, bool reset);
+#endif // CONFIG_ENERGY_ENABLE
+
 /**
   * @brief Set the output voltage DAC value
   * @param v_dac the value to set to
@@ -150,6 +194,74 @@ void hw_longpress_check(void);
   */
 bool hw_sel_button_pressed(void);
 
+/**
+  * @brief Queue data for transmission on USART1, returns as soon as all data
+  *        is in the transmit ring. Only call from the main loop.
+  * @param data data to send
+  * @param length length of data
+  * @retval None
+  */
+void hw_usart_send(const uint8_t *data, uint32_t length);
+
+/**
+  * @brief Wait for all queued USART1 data to leave the transmitter
+  * @retval None
+  */
+void hw_usart_flush(void);
+
+/**
+  * @brief Check if USART1 can run at a baudrate
+  * @param baudrate the baudrate
+  * @retval true if the baudrate is in range and can be generated within 2%
+  */
+bool hw_baudrate_valid(uint32_t baudrate);
+
+/**
+  * @brief Change the USART1 baudrate once all queued data has been sent
+  * @param baudrate the new baudrate
+  * @retval false if the baudrate is not valid, the baudrate is then left
+  *         unchanged
+  */
+bool hw_set_baudrate(uint32_t baudrate);
+
+/**
+  * @brief Get the current USART1 baudrate
+  * @retval the baudrate
+  */
+uint32_t hw_get_baudrate(void);
+
+#ifdef CONFIG_ADC_CAPTURE
+/** Capture rate, one sample set per TIM2 period (48MHz / 9 / 255) */
+#define ADC_CAPTURE_RATE_HZ  (20915)
+
+/**
+  * @brief Receiver of captured ADC samples
+  * @param samples sample sets of { I_out, V_in, V_out } raw values, I_out
+  *        compensated for the ADC offset
+  * @param count number of sample sets
+  */
+typedef void (*adc_capture_handler_t)(const uint16_t *samples, uint32_t count);
+
+/**
+  * @brief Set the receiver of captured ADC samples
+  * @param handler function called from hw_adc_capture_drain, or NULL
+  * @retval none
+  */
+void hw_adc_capture_set_handler(adc_capture_handler_t handler);
+
+/**
+  * @brief Drain completed capture ring halves, call from the main loop
+  * @retval number of half buffers drained
+  */
+uint32_t hw_adc_capture_drain(void);
+
+/**
+  * @brief Get number of capture ring halves lost due to slow draining
+  * @retval number of overruns since boot
+  */
+uint32_t hw_adc_capture_overruns(void);
+#endif // CONFIG_ADC_CAPTURE
+
 #ifdef CONFIG_ADC_BENCHMARK
 /**
   * @brief Print ADC speed
@@ -159,21 +271,31 @@ void hw_print_ticks(void);
 #endif // CONFIG_ADC_BENCHMARK
 
 #ifdef CONFIG_FUNCGEN_ENABLE
+/** DDS sample rate, one DAC update per TIM6 period (48MHz / 960) */
+#define DDS_SAMPLE_RATE_HZ  (50000)
+/** Number of samples in each half of the DDS DMA buffer */
+#define DDS_HALF_BUFFER_LEN  (64)
+
 /**
-  * @brief A pointer to the function generator's that's called upon each ADC update
-  * @retval none
+  * @brief Producer of DDS samples, called from the DMA ISR
+  * @param buffer the half buffer to fill with 12 bit DAC values
+  * @param len number of samples to write
   */
-extern void (*funcgen_tick)(void);
-/** 
-  * @brief An empty function. This is used to avoid testing in the ISR and branch in all cases (fixed latency)
+typedef void (*dds_refill_t)(uint16_t *buffer, uint32_t len);
+
+/**
+  * @brief Start clocking samples into DAC channel 1 from TIM6 via DMA
+  * @param refill function called whenever half of the buffer has been
+  *        consumed, also used to prime the buffer before starting
   * @retval none
-  */  
-void fg_noop(void);
+  */
+void hw_dds_start(dds_refill_t refill);
 
 /**
-  * @brief The current time in microsecond unit, updated by a timer
+  * @brief Stop the DDS, DAC channel 1 returns to software writes
+  * @retval none
   */
-uint32_t cur_time_us(void); 
-#endif
+void hw_dds_stop(void);
+#endif // CONFIG_FUNCGEN_ENABLE
 
 #endif // __HW_H__
@@ -41,6 +41,7 @@ static void chip_init(void);
 static void write_command(uint8_t c);
 static void write_data(uint8_t c);
 static void write_data16(uint16_t d);
+static void write_data16x2(uint16_t d0, uint16_t d1);
 static void color_space(uint8_t cspace);
 
 void ili9163c_init(void)
@@ -86,25 +87,29 @@ void ili9163c_get_geometry(uint16_t *width, uint16_t *height)
         *height = _GRAMHEIGH;
 }
 
+/** All writes are queued to the SPI driver and sent in the background */
 static void write_command(uint8_t c)
 {
-    gpio_clear(TFT_A0_PORT, TFT_A0_PIN);
     uint8_t tx_buf[1] = {c};
-    (void) spi_dma_transceive((uint8_t*) tx_buf, sizeof(tx_buf), 0, 0);
+    (void) spi_queue_copy(tx_buf, sizeof(tx_buf), false);
 }
 
 static void write_data(uint8_t c)
 {
-    gpio_set(TFT_A0_PORT, TFT_A0_PIN);
     uint8_t tx_buf[1] = {c};
-    (void) spi_dma_transceive((uint8_t*) tx_buf, sizeof(tx_buf), 0, 0);
+    (void) spi_queue_copy(tx_buf, sizeof(tx_buf), true);
 }
 
 static void write_data16(uint16_t d)
 {
-    gpio_set(TFT_A0_PORT, TFT_A0_PIN);
     uint8_t tx_buf[2] = {(uint8_t) (d >> 8), (uint8_t) (d & 0xff)};
-    (void) spi_dma_transceive((uint8_t*) tx_buf, sizeof(tx_buf), 0, 0);
+    (void) spi_queue_copy(tx_buf, sizeof(tx_buf), true);
+}
+
+static void write_data16x2(uint16_t d0, uint16_t d1)
+{
+    uint8_t tx_buf[4] = {(uint8_t) (d0 >> 8), (uint8_t) (d0 & 0xff), (uint8_t) (d1 >> 8), (uint8_t) (d1 & 0xff)};
+    (void) spi_queue_copy(tx_buf, sizeof(tx_buf), true);
 }
 
 static void chip_init(void)
@@ -112,6 +117,7 @@ static void chip_init(void)
     uint8_t i;
 
     write_command(CMD_SWRESET); // software reset
+    spi_queue_flush();
     delay_ms(1);
 
     write_command(CMD_SLPOUT); // exit sleep
@@ -163,12 +169,10 @@ static void chip_init(void)
     write_data(0); // 0x40
 
     write_command(CMD_CLMADRS); // Set Column Address
-    write_data16(0x00);
-    write_data16(_GRAMWIDTH);
+    write_data16x2(0x00, _GRAMWIDTH);
 
     write_command(CMD_PGEADRS); // Set Page Address
-    write_data16(0X00);
-    write_data16(_GRAMHEIGH);
+    write_data16x2(0X00, _GRAMHEIGH);
     // set scroll area (thanks Masuda)
     write_command(CMD_VSCLLDEF);
     write_data16(__OFFSET);
@@ -208,20 +212,18 @@ void ili9163c_draw_vline(int16_t x, int16_t y, int16_t h, uint16_t color)
 {
     if (ili9163c_boundary_check(x,y)) return;
     if (((y + h) - 1) >= screen_height) h = screen_height-y;
+    if (h <= 0) return;
     ili9163c_set_window(x,y,x,(y+h)-1);
-    while (h-- > 0) {
-        write_data16(color);
-    }
+    (void) spi_queue_fill(color, h);
 }
 
 void ili9163c_draw_hline(int16_t x, int16_t y, int16_t w, uint16_t color)
 {
     if (ili9163c_boundary_check(x,y)) return;
     if (((x+w) - 1) >= screen_width) w = screen_width-x;
+    if (w <= 0) return;
     ili9163c_set_window(x,y,(x+w)-1,y);
-    while (w-- > 0) {
-        write_data16(color);
-    }
+    (void) spi_queue_fill(color, w);
 }
 
 bool ili9163c_boundary_check(int16_t x,int16_t y)
@@ -232,17 +234,8 @@ bool ili9163c_boundary_check(int16_t x,int16_t y)
 
 void ili9163c_fill_screen(uint16_t color)
 {
-    uint32_t i;
-    uint8_t hi = color >> 8;
-    uint8_t lo = color & 0xff;
-    uint8_t fill[] = {hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo};
-    uint8_t dummy[sizeof(fill)];
-    gpio_clear(TFT_A0_PORT, TFT_A0_PIN);
     ili9163c_set_window(0, 0, _GRAMWIDTH+2, _GRAMHEIGH); // Note! For some reason filling WxH is results in two vertical lines to the far right...
-    gpio_set(TFT_A0_PORT, TFT_A0_PIN);
-    for (i = 0;i < ((_GRAMWIDTH+2) * _GRAMHEIGH)/(sizeof(fill)/2); i++) {
-        (void) spi_dma_transceive((uint8_t*) fill, sizeof(fill), (uint8_t*) dummy, sizeof(dummy));
-    }
+    (void) spi_queue_fill(color, (_GRAMWIDTH+2) * _GRAMHEIGH);
 }
 
 // fill a rectangle
@@ -251,13 +244,42 @@ void ili9163c_fill_rect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t col
     if (ili9163c_boundary_check(x,y)) return;
     if (((x + w) - 1) >= screen_width)  w = screen_width  - x;
     if (((y + h) - 1) >= screen_height) h = screen_height - y;
+    if (w <= 0 || h <= 0) return;
     ili9163c_set_window(x,y,(x+w)-1,(y+h)-1);
-    for (y = h;y > 0;y--) {
-        for (x = w;x > 1;x--) {
-            write_data16(color);
-        }
-        write_data16(color);
-    }
+    (void) spi_queue_fill(color, w * h);
+}
+
+/**
+  * @brief Queue pixels for the current window
+  * @param pixels pixel data in TFT byte order, must stay untouched until
+  *        the returned ticket is done
+  * @param count number of pixels
+  * @retval ticket to pass to ili9163c_wait
+  */
+uint32_t ili9163c_write_pixels(const uint16_t *pixels, uint32_t count)
+{
+    return spi_queue_write((const uint8_t*) pixels, 2 * count, true);
+}
+
+/**
+  * @brief Queue a single color for the current window
+  * @param color the color
+  * @param count number of pixels
+  * @retval none
+  */
+void ili9163c_fill_pixels(uint16_t color, uint32_t count)
+{
+    (void) spi_queue_fill(color, count);
+}
+
+/**
+  * @brief Wait for queued pixels to be sent
+  * @param ticket as returned by ili9163c_write_pixels
+  * @retval none
+  */
+void ili9163c_wait(uint32_t ticket)
+{
+    while (!spi_queue_done(ticket)) ;
 }
 
 void ili9163c_set_window(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1)
@@ -265,45 +287,37 @@ void ili9163c_set_window(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1)
     write_command(CMD_CLMADRS); // Column
     if (rotation == 3)
     {
-        write_data16(x0 + 3);
-        write_data16(x1 + 3);
+        write_data16x2(x0 + 3, x1 + 3);
     }
     else if (rotation == 2)
     {
-        write_data16(x0 + 2);
-        write_data16(x1 + 2);
+        write_data16x2(x0 + 2, x1 + 2);
     }
     else if (rotation == 1)
     {
-        write_data16(x0 + 1);
-        write_data16(x1 + 1);
+        write_data16x2(x0 + 1, x1 + 1);
     }
     else
     {
-        write_data16(x0 + 2);
-        write_data16(x1 + 2);
+        write_data16x2(x0 + 2, x1 + 2);
     }
 
     write_command(CMD_PGEADRS); // Page
     if (rotation == 3)
     {
-        write_data16(y0 + 2);
-        write_data16(y1 + 2);
+        write_data16x2(y0 + 2, y1 + 2);
     }
     else if (rotation == 2)
     {
-        write_data16(y0 + 3);
-        write_data16(y1 + 3);
+        write_data16x2(y0 + 3, y1 + 3);
     }
     else if (rotation == 1)
     {
-        write_data16(y0 + 2);
-        write_data16(y1 + 2);
+        write_data16x2(y0 + 2, y1 + 2);
     }
     else
     {
-        write_data16(y0 + 1);
-        write_data16(y1 + 1);
+        write_data16x2(y0 + 1, y1 + 1);
     }
     write_command(CMD_RAMWR); // Into RAM
 }
@@ -63,5 +63,8 @@ void ili9163c_display(bool on);
 bool ili9163c_boundary_check(int16_t x,int16_t y);
 void ili9163c_draw_vline(int16_t x, int16_t y, int16_t h, uint16_t color);
 void ili9163c_draw_hline(int16_t x, int16_t y, int16_t w, uint16_t color);
+uint32_t ili9163c_write_pixels(const uint16_t *pixels, uint32_t count);
+void ili9163c_fill_pixels(uint16_t color, uint32_t count);
+void ili9163c_wait(uint32_t ticket);
 
 #endif // _ILI9163C_H_
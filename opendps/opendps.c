@@ -78,6 +78,12 @@
 #ifdef CONFIG_FUNCGEN_ENABLE
 #include "func_gen.h"
 #endif // CONFIG_FUNCGEN_ENABLE
+#ifdef CONFIG_ENERGY_ENABLE
+#include "func_energy.h"
+#endif // CONFIG_ENERGY_ENABLE
+#ifdef CONFIG_SEQ_ENABLE
+#include "func_seq.h"
+#endif // CONFIG_SEQ_ENABLE
 
 #ifdef DPS_EMULATOR
 #include "dpsemul.h"
@@ -167,6 +173,24 @@ static past_t g_past = {
     .blocks = {0x0800f800, 0x0800fc00}
 };
 
+#ifndef CONFIG_PAST_WRITE_DELAY_MS
+/** Delay before parameters set by the host are written to past, a sweep of
+    setpoints will restart the timer and end up as a single write */
+ #define CONFIG_PAST_WRITE_DELAY_MS  (2000)
+#endif // CONFIG_PAST_WRITE_DELAY_MS
+
+/** Screen with parameters waiting to be written to past */
+static ui_screen_t *past_save_screen;
+static uint64_t past_save_deadline;
+
+/** A baudrate switch waiting for the host to ping at the new baudrate */
+static uint64_t baudrate_deadline;
+static uint32_t baudrate_fallback;
+static bool baudrate_persist;
+
+/** Sample to cut-off latency reported with the last OCP/OVP */
+static uint16_t trip_latency_ns;
+
 /** The function UI displaying the current active function */
 #define FUNC_UI_ID (0)
 static uui_t func_ui;
@@ -302,23 +326,38 @@ bool opendps_get_curr_function_param_value(char *name, char *value, uint32_t val
 }
 
 /**
- * @brief      Set parameter to value
+ * @brief      Set a batch of parameters. All parameters are validated before
+ *             any of them is applied so either all or none take effect. The
+ *             new settings are written to past once the host has been quiet
+ *             for CONFIG_PAST_WRITE_DELAY_MS.
  *
- * @param      name   Name of parameter
- * @param      value  Value as a string
+ * @param      names   Names of parameters
+ * @param      values  Values as strings
+ * @param[in]  count   Number of parameters
+ * @param      stats   Output vector holding the status of each parameter
  *
- * @return     Status of the operation
+ * @return     True if the batch was applied
  */
-set_param_status_t opendps_set_parameter(char *name, char *value)
+bool opendps_set_parameters(char *names[], char *values[], uint32_t count, set_param_status_t stats[])
 {
-    set_param_status_t status = ps_not_supported;
-    if (current_ui->screens[current_ui->cur_screen]->set_parameter) {
-        status = current_ui->screens[current_ui->cur_screen]->set_parameter(name, value);
-        if (status == ps_ok) {
-            uui_refresh(current_ui, true);
-        }
+    ui_screen_t *screen = current_ui->screens[current_ui->cur_screen];
+    bool valid = true;
+    for (uint32_t i = 0; i < count; i++) {
+        stats[i] = screen->set_parameter ? screen->set_parameter(names[i], values[i], true) : ps_not_supported;
+        valid &= stats[i] == ps_ok;
+    }
+    if (!valid || !count) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        stats[i] = screen->set_parameter(names[i], values[i], false);
+    }
+    uui_refresh(current_ui, true);
+    if (screen->past_save) {
+        past_save_screen = screen;
+        past_save_deadline = get_ticks() + CONFIG_PAST_WRITE_DELAY_MS;
     }
-    return status;
+    return true;
 }
 
 /**
@@ -426,13 +465,13 @@ bool opendps_enable_function_idx(uint32_t index)
  */
 static void main_ui_tick(void)
 {
-    uint16_t i_out_raw, v_in_raw, v_out_raw;
-    hw_get_adc_values(&i_out_raw, &v_in_raw, &v_out_raw);
-    (void) i_out_raw;
-    (void) v_out_raw;
+    uint16_t i_out_filtered, v_in_filtered, v_out_filtered;
+    hw_get_adc_filtered(&i_out_filtered, &v_in_filtered, &v_out_filtered);
+    (void) i_out_filtered;
+    (void) v_out_filtered;
 
     // update input voltage value
-    input_voltage.value = pwrctl_calc_vin(v_in_raw);
+    input_voltage.value = pwrctl_calc_vin_filtered(v_in_filtered);
     input_voltage.ui.draw(&input_voltage.ui);
 
     // Update power button
@@ -463,6 +502,12 @@ static void ui_init(void)
 #ifdef CONFIG_FUNCGEN_ENABLE
     func_gen_init(&func_ui);
 #endif // CONFIG_FUNCGEN_ENABLE
+#ifdef CONFIG_ENERGY_ENABLE
+    func_energy_init(&func_ui);
+#endif // CONFIG_ENERGY_ENABLE
+#ifdef CONFIG_SEQ_ENABLE
+    func_seq_init(&func_ui);
+#endif // CONFIG_SEQ_ENABLE
 
 
     /** Initialise the settings screens */
@@ -527,7 +572,7 @@ static void ui_handle_event(event_t event, uint8_t data)
                 (void) v_in_raw;
                 (void) v_out_raw;
                 uint16_t trig = hw_get_itrig_ma();
-                dbg_printf("%10u OCP: trig:%umA limit:%umA cur:%umA\n", (uint32_t) (get_ticks()), pwrctl_calc_iout(trig), pwrctl_calc_iout(pwrctl_i_limit_raw), pwrctl_calc_iout(i_out_raw));
+                dbg_printf("%10u OCP: trig:%umA limit:%umA cur:%umA latency:%uns\n", (uint32_t) (get_ticks()), pwrctl_calc_iout(trig), pwrctl_calc_iout(pwrctl_i_limit_raw), pwrctl_calc_iout(i_out_raw), trip_latency_ns);
 #endif // CONFIG_OCP_DEBUGGING
                 ui_flash(); /** @todo When OCP kicks in, show last I_out on screen */
                 opendps_update_power_status(false);
@@ -542,7 +587,7 @@ static void ui_handle_event(event_t event, uint8_t data)
                 (void) i_out_raw;
                 (void) v_in_raw;
                 uint16_t trig = hw_get_vtrig_mv();
-                dbg_printf("%10u OVP: trig:%umV limit:%umV cur:%umV\n", (uint32_t) (get_ticks()), pwrctl_calc_iout(trig), pwrctl_calc_vout(pwrctl_v_limit_raw), pwrctl_calc_vout(v_out_raw));
+                dbg_printf("%10u OVP: trig:%umV limit:%umV cur:%umV latency:%uns\n", (uint32_t) (get_ticks()), pwrctl_calc_iout(trig), pwrctl_calc_vout(pwrctl_v_limit_raw), pwrctl_calc_vout(v_out_raw), trip_latency_ns);
 #endif // CONFIG_OVP_DEBUGGING
                 ui_flash(); /** @todo When OVP kicks in, show last V_out on screen */
                 opendps_update_power_status(false);
@@ -643,6 +688,11 @@ static void ui_tick(void)
     uui_tick(current_ui);
     uui_tick(&main_ui);
 
+    if (past_save_screen && get_ticks() >= past_save_deadline) {
+        past_save_screen->past_save(&g_past);
+        past_save_screen = 0;
+    }
+
 #ifndef CONFIG_SPLASH_SCREEN
     {
         // Light up the display now that the UI has been drawn
@@ -694,6 +744,12 @@ static void ui_tick(void)
     if (wifi_status == wifi_connecting && get_ticks() > WIFI_CONNECT_TIMEOUT) {
         opendps_update_wifi_status(wifi_off);
     }
+
+    if (baudrate_deadline && get_ticks() >= baudrate_deadline) {
+        /** The host never made it to the new baudrate */
+        baudrate_deadline = 0;
+        (void) hw_set_baudrate(baudrate_fallback);
+    }
 }
 
 /**
@@ -703,6 +759,41 @@ static void ui_tick(void)
 void opendps_handle_ping(void)
 {
     ui_flash();
+    if (baudrate_deadline) {
+        /** The host made it to the new baudrate */
+        baudrate_deadline = 0;
+        if (baudrate_persist) {
+            uint32_t setting = hw_get_baudrate();
+            if (setting == CONFIG_BAUDRATE) {
+                (void) past_erase_unit(&g_past, past_baudrate);
+            } else if (!past_write_unit(&g_past, past_baudrate, (void*) &setting, sizeof(setting))) {
+                /** @todo Handle past write errors */
+                dbg_printf("Error: past write baudrate failed!\n");
+            }
+        }
+    }
+}
+
+/**
+  * @brief Switch baudrate, falling back to the current one unless pinged
+  *        within BAUDRATE_SWITCH_TIMEOUT_MS
+  * @param baudrate the new baudrate
+  * @param persist write the baudrate to past once pinged
+  * @retval false if the baudrate is not supported
+  */
+bool opendps_set_baudrate(uint32_t baudrate, bool persist)
+{
+    uint32_t current = hw_get_baudrate();
+    if (!hw_set_baudrate(baudrate)) {
+        return false;
+    }
+    /** If the host tries again before pinging, fall back to where it started */
+    if (!baudrate_deadline) {
+        baudrate_fallback = current;
+    }
+    baudrate_persist = persist;
+    baudrate_deadline = get_ticks() + BAUDRATE_SWITCH_TIMEOUT_MS;
+    return true;
 }
 
 /**
@@ -816,6 +907,7 @@ void opendps_upgrade_start(void)
 {
     /** Bootloader does not know how to garbage collect past, perform if needed */
     (void) past_gc_check(&g_past);
+    hw_usart_flush(); /** Let queued responses out before dpsboot takes over */
     scb_reset_system();
 }
 
@@ -889,6 +981,11 @@ static void read_past_settings(void)
     }
     hw_set_backlight(last_tft_brightness);
 
+    if (past_read_unit(&g_past, past_baudrate, (const void**) &p, &length)) {
+        if (p && length == sizeof(uint32_t)) {
+            (void) hw_set_baudrate(*p);
+        }
+    }
 
 #ifdef GIT_VERSION
     /** Update app git hash in past if needed */
@@ -961,27 +1058,39 @@ static void event_handler(void)
 {
     while(1) {
         event_t event;
-        uint8_t data = 0;
-        if (!event_get(&event, &data)) {
+        uint8_t data[EVENT_MAX_PAYLOAD];
+        uint32_t length;
+#ifdef CONFIG_ADC_CAPTURE
+        (void) hw_adc_capture_drain();
+#endif // CONFIG_ADC_CAPTURE
+        if (!event_get(&event, data, &length)) {
             hw_longpress_check();
             ui_tick();
         } else {
             if (event) {
-                emu_printf(" Event %d 0x%02x\n", event, data);
+                emu_printf(" Event %d 0x%02x (%u bytes)\n", event, data[0], length);
             }
             switch(event) {
                 case event_none:
                     dbg_printf("Weird, should not receive 'none events'\n");
                     break;
                 case event_uart_rx:
-                    serial_handle_rx_char(data);
+                    /** A burst of received bytes */
+                    for (uint32_t i = 0; i < length; i++) {
+                        serial_handle_rx_char(data[i]);
+                    }
                     break;
                 case event_ocp:
+                case event_ovp:
+                    /** Measured by the protection ISR */
+                    if (length == sizeof(trip_latency_ns)) {
+                        memcpy(&trip_latency_ns, data, sizeof(trip_latency_ns));
+                    }
                     break;
                 default:
                     break;
             }
-            ui_handle_event(event, data);
+            ui_handle_event(event, data[0]);
         }
 
 #ifdef CONFIG_WDOG
@@ -1011,8 +1120,9 @@ int main(int argc, char const *argv[])
 #else // DPS_EMULATOR
     (void) argc;
     (void) argv;
-    g_past.blocks[0] = 0x0800f800;
-    g_past.blocks[1] = 0x0800fc00;
+    for (uint32_t i = 0; i < PAST_NUM_BLOCKS; i++) {
+        g_past.blocks[i] = 0x0800f800 + i * PAST_BLOCK_SIZE;
+    }
 #endif // DPS_EMULATOR
     if (!past_init(&g_past)) {
         dbg_printf("Error: past init failed!\n");
@@ -93,14 +93,19 @@ uint32_t opendps_get_curr_function_params(ui_parameter_t **parameters);
 bool opendps_get_curr_function_param_value(char *name, char *value, uint32_t value_len);
 
 /**
- * @brief      Set parameter to value
+ * @brief      Set a batch of parameters. All parameters are validated before
+ *             any of them is applied so either all or none take effect. The
+ *             new settings are written to past once the host has been quiet
+ *             for CONFIG_PAST_WRITE_DELAY_MS.
  *
- * @param      name   Name of parameter
- * @param      value  Value as a string
+ * @param      names   Names of parameters
+ * @param      values  Values as strings
+ * @param[in]  count   Number of parameters
+ * @param      stats   Output vector holding the status of each parameter
  *
- * @return     Status of the operation
+ * @return     True if the batch was applied
  */
-set_param_status_t opendps_set_parameter(char *name, char *value);
+bool opendps_set_parameters(char *names[], char *values[], uint32_t count, set_param_status_t stats[]);
 
 /**
  * @brief      Sets Calibration Data
@@ -148,6 +153,15 @@ void opendps_update_wifi_status(wifi_status_t status);
   */
 void opendps_handle_ping(void);
 
+/**
+  * @brief Switch baudrate, falling back to the current one unless pinged
+  *        within BAUDRATE_SWITCH_TIMEOUT_MS
+  * @param baudrate the new baudrate
+  * @param persist write the baudrate to past once pinged
+  * @retval false if the baudrate is not supported
+  */
+bool opendps_set_baudrate(uint32_t baudrate, bool persist);
+
 /**
   * @brief Lock or unlock the UI
   * @param lock true for lock, false for unlock
@@ -55,7 +55,7 @@
  *    .
  * [ 0xffffffff ] [ 0xffffffff ]
  *
- * Each of the two Past blocks begin with the Past magic, followed by a past
+ * Each of the Past blocks begin with the Past magic, followed by a past
  * counter which is increased by one for each garbage collection. The counter is
  * never expected to wrap as the number of erase cycles is far less than a 32
  * bit ingeter...
@@ -66,9 +66,11 @@
  * (MWU) on the STM32F100, for which this module is targeted. It adapting this
  * module for eg. STM32F4s, that need to change because of the MWU of 8 bytes.
  *
- * Past uses two blocks. When one block is full (it gets filled as parameters
- * are added (obviously) and rewritten) the block is compacted and rewritten
- * into the other Past block.
+ * Past uses PAST_NUM_BLOCKS blocks (two by default). When one block is full (it
+ * gets filled as parameters are added (obviously) and rewritten) the block is
+ * compacted and rewritten into the next Past block, round robin. The old block
+ * is left as is and will be erased when its turn comes again, so each block
+ * sees one erase per PAST_NUM_BLOCKS garbage collections.
  *
  * * Writing a unit *
  * When writing a unit, the unit data is written first. Secondly, the size and
@@ -90,10 +92,18 @@
  * When reading a unit, a pointer to the data in flash is returned along with
  * the size. The data is read only.
  *
+ * * Unit index *
+ * To avoid walking the block for every lookup, Past keeps an open addressed
+ * hash table in RAM holding the offset of each unit. The unit id is not stored
+ * in RAM, it is read back from flash when probing. An erased unit has its id
+ * zeroed and thus turns into a tombstone without touching the index. The index
+ * is rebuilt at init and after each garbage collection. Should it overflow,
+ * Past falls back to linear scanning until the next rebuild.
+ *
  * * Past startup *
  * When the module is initialized, the integrity of the Past data is checked.
  * First, the module selects the current data block based on the Past counters
- * at offset 4 (assuming the Past magics are in place). Next the data is checked
+ * at offset 4 (the highest counter of the blocks with a Past magic in place). Next the data is checked
  * for consistency. It should be possible to reach the end marker unit
  * (0xffffffff) while parsing the data. If so, the resto of the block is checked
  * for erased data. If none erased data is found following the end marker, we
@@ -103,7 +113,7 @@
  * * Garbage collection *
  * As units get rewritten, Past will be filled with old unit data an at some
  * point it will be full. At this point it will perform a garbage collection,
- * copying all units to the other flash block. It will first erase that block
+ * copying all units to the next flash block. It will first erase that block
  * and then copy the valid data from the old block. When completed it will
  * update the block counter att offset 4 and at the very last write the past
  * magic at offset 0.
@@ -116,8 +126,6 @@
 /** The 'end' unit is the first chunk of unwritten flash */
 #define PAST_UNIT_ID_END      (0xffffffff)
 
-#define PAST_BLOCK_SIZE     (1024)  //STM32F100
-
 #define HEADER_COUNTER_OFFSET     (4)
 #define HEADER_FIRST_UNIT_OFFSET  (8)
 
@@ -127,6 +135,12 @@
 #define PAST_GC_LIMIT    (32)
 
 static int32_t past_find_unit(past_t *past, past_id_t id);
+static int32_t past_scan_unit(past_t *past, past_id_t id);
+static void past_index_rebuild(past_t *past);
+static void past_index_set(past_t *past, past_id_t id, uint32_t address);
+static bool past_append_unit(past_t *past, past_unit_t *unit);
+static bool past_unit_unchanged(past_t *past, past_unit_t *unit);
+static uint32_t unit_word(past_unit_t *unit, uint32_t wi);
 static bool past_erase_unit_at(uint32_t address);
 static bool past_garbage_collect(past_t *past);
 static inline bool flash_write32(uint32_t address, uint32_t data);
@@ -147,34 +161,34 @@ bool past_init(past_t *past)
     bool success = false;
     if (past) {
         /** Check which block is the current one */
-        uint32_t magic_1 = flash_read32(past->blocks[0]);
-        uint32_t magic_2 = flash_read32(past->blocks[1]);
-        uint32_t counter_1 = flash_read32(past->blocks[0] + HEADER_COUNTER_OFFSET);
-        uint32_t counter_2 = flash_read32(past->blocks[1] + HEADER_COUNTER_OFFSET);
+        bool found = false;
+        past->_valid = false;
+        past->_index_valid = false;
+        for (uint32_t i = 0; i < PAST_NUM_BLOCKS; i++) {
+            uint32_t magic = flash_read32(past->blocks[i]);
+            uint32_t counter = flash_read32(past->blocks[i] + HEADER_COUNTER_OFFSET);
+            if (PAST_MAGIC == magic && (!found || counter > past->_counter)) {
+                past->_cur_block = i;
+                past->_counter = counter;
+                found = true;
+            }
+        }
         success = true;
-        if (PAST_MAGIC == magic_1 && PAST_MAGIC == magic_2) {
-            past->_cur_block = counter_2 > counter_1 ? 1 : 0;
-            past->_counter = counter_2 > counter_1 ? counter_2 : counter_1;
-        } else if (PAST_MAGIC == magic_2) {
-            past->_cur_block = 1;
-            past->_counter = counter_2;
-        } else if (PAST_MAGIC == magic_1) {
-            past->_cur_block = 0;
-            past->_counter = counter_1;
-        } else {
-            /** No valid Past in either block */
+        if (!found) {
+            /** No valid Past in any block */
             past->_cur_block = 0;
             past->_counter = 0;
             success &= past_format(past);
         }
         if (success) {
-            int32_t addr = past_find_unit(past, PAST_UNIT_ID_END);
+            int32_t addr = past_scan_unit(past, PAST_UNIT_ID_END);
             if (addr < 0) {
                 /** Past is full as current block contains no erased space */
                 past->_valid = success = past_garbage_collect(past);
             } else {
                 past->_end_addr = (uint32_t) addr;
                 past->_valid = true;
+                past_index_rebuild(past);
             }
             /** Now check all space following the end address is erased space.
               * If not we have a half completed write operation we need to clear
@@ -231,100 +245,159 @@ bool past_read_unit(past_t *past, past_id_t id, const void **data, uint32_t *len
   */
 bool past_write_unit(past_t *past, past_id_t id, void *data, uint32_t length)
 {
-    if (length < 4) {
-        return false; /** https://github.com/kanflo/opendps/issues/27 */
-    }
-    if (!past || !past->_valid || !data || !length || id == PAST_UNIT_ID_INVALID || id == PAST_UNIT_ID_END) {
-#ifdef DPS_EMULATOR
-        if (!past) {
-            emu_printf("Past is NULL\n");
-        }
-        if (!past->_valid) {
-            emu_printf("Past is invalid\n");
-        }
-        if (!data) {
-            emu_printf("Data is NULL\n");
-        }
-        if (!length) {
-            emu_printf("length is zero\n");
+    past_unit_t unit = {
+        .id = id,
+        .data = data,
+        .length = length
+    };
+    return past_write_units(past, &unit, 1);
+}
+
+/**
+  * @brief Write several units to past, garbage collecting at most once. Units
+  *        whose content is already stored are skipped.
+  * @param past An initialized past structure
+  * @param units Units to write
+  * @param count Number of units
+  * @retval true if all units were written
+  *         false if writing failed or the past was full, in the latter case
+  *         nothing was written
+  */
+bool past_write_units(past_t *past, past_unit_t *units, uint32_t count)
+{
+    uint32_t needed = 0;
+    bool success = true;
+    for (uint32_t i = 0; i < count; i++) {
+        past_id_t id = units[i].id;
+        uint32_t length = units[i].length;
+        if (length < 4) {
+            return false; /** https://github.com/kanflo/opendps/issues/27 */
         }
-        if (id == PAST_UNIT_ID_INVALID) {
-            emu_printf("Id is invalid\n");
+        if (!past || !past->_valid || !units[i].data || id == PAST_UNIT_ID_INVALID || id == PAST_UNIT_ID_END) {
+#ifdef DPS_EMULATOR
+            if (!past) {
+                emu_printf("Past is NULL\n");
+            } else if (!past->_valid) {
+                emu_printf("Past is invalid\n");
+            }
+            if (!units[i].data) {
+                emu_printf("Data is NULL\n");
+            }
+            if (id == PAST_UNIT_ID_INVALID) {
+                emu_printf("Id is invalid\n");
+            }
+            if (id == PAST_UNIT_ID_END) {
+                emu_printf("Id is equal to end\n");
+            }
+#endif // DPS_EMULATOR
+            return false;
         }
-        if (id == PAST_UNIT_ID_END) {
-            emu_printf("Id is equal to end\n");
+        if (!past_unit_unchanged(past, &units[i])) {
+            needed += UNIT_DATA_OFFSET + 4 * ((length + 3) / 4);
         }
-#endif // DPS_EMULATOR
-        return false;
     }
-    uint32_t end_address;
-    uint32_t wi = 0; /** word index */
-    uint32_t temp;
-    bool success = false;
-    unlock_flash();
+    if (needed == 0) {
+        return true; /** Nothing new, save the flash */
+    }
 
-    if (past_remaining_size(past) < UNIT_DATA_OFFSET + length) {
+    if (past_remaining_size(past) < needed) {
         if (!past_garbage_collect(past)) {
             return false;
         }
     }
-    if (past_remaining_size(past) < UNIT_DATA_OFFSET + length) {
+    if (past_remaining_size(past) < needed) {
         return false;
     }
-    end_address = past->_end_addr;
-    do {
-        /** Check if there is an old version of the unit */
-        int32_t old_addr = past_find_unit(past, id);
-        /** Write the new unit */
-        if (!flash_write32(end_address+UNIT_SIZE_OFFSET, length)) {
-            break;
-        }
-        while(4*wi < length) {
-            temp = ((uint32_t*)(data))[wi];
-            if (!flash_write32(end_address+UNIT_DATA_OFFSET+4*wi, temp)) {
-                break;
-            }
-            wi++;
-            if (length % 4 && 4*(wi+1) >= length) {
-                /** Data not even multiple of 4, reading one more word would
-                  * cause an out of bound buffer read */
-                break;
-            }
-        }
-        if (length % 4) { /** Write remaining 1..3 bytes */
-            temp = 0;
-            for (uint32_t i = 0; i < length % 4; i++) {
-                uint8_t b = ((uint8_t*)(data))[4*wi + i];
-                temp |= b << (8*i);
-            }
-            if (!flash_write32(end_address+UNIT_DATA_OFFSET+4*wi, temp)) {
-                break;
-            }
-        }
-        if (!flash_write32(end_address, id)) {
-            break;
-        }
-        /** Update end addres of the past struct */
-        end_address += UNIT_DATA_OFFSET + length;
-        if (end_address % 4) {
-            end_address += 4 - (end_address % 4); // Word align
-        }
-        past->_end_addr = end_address;
-
-        /** If existing, erase the old version */
-        if (old_addr >= 0) {
-            if (!past_erase_unit_at(old_addr)) {
-                break;
-            }
+    unlock_flash();
+    for (uint32_t i = 0; i < count && success; i++) {
+        if (!past_unit_unchanged(past, &units[i])) {
+            success = past_append_unit(past, &units[i]);
         }
-        success = true;
-    } while(0);
+    }
     lock_flash();
     /** This serves as a workaround for #53 */
     (void) past_gc_check(past);
     return success;
 }
 
+/**
+  * @brief Append unit at the end of the current block and erase the old
+  *        version, if any. The caller is responsible for making room.
+  * @param past An initialized past structure
+  * @param unit Unit to write
+  * @retval true if the unit was written
+  */
+static bool past_append_unit(past_t *past, past_unit_t *unit)
+{
+    uint32_t end_address = past->_end_addr;
+    uint32_t length = unit->length;
+    /** Check if there is an old version of the unit */
+    int32_t old_addr = past_find_unit(past, unit->id);
+    /** Write the new unit */
+    if (!flash_write32(end_address+UNIT_SIZE_OFFSET, length)) {
+        return false;
+    }
+    for (uint32_t wi = 0; 4*wi < length; wi++) {
+        if (!flash_write32(end_address+UNIT_DATA_OFFSET+4*wi, unit_word(unit, wi))) {
+            return false;
+        }
+    }
+    if (!flash_write32(end_address, unit->id)) {
+        return false;
+    }
+    past_index_set(past, unit->id, end_address);
+    /** Update end addres of the past struct */
+    end_address += UNIT_DATA_OFFSET + length;
+    if (end_address % 4) {
+        end_address += 4 - (end_address % 4); // Word align
+    }
+    past->_end_addr = end_address;
+
+    /** If existing, erase the old version */
+    if (old_addr >= 0) {
+        if (!past_erase_unit_at(old_addr)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+  * @brief Check if a unit is stored with identical content
+  * @param past An initialized past structure
+  * @param unit Unit to compare
+  * @retval true if the stored unit matches
+  */
+static bool past_unit_unchanged(past_t *past, past_unit_t *unit)
+{
+    int32_t address = past_find_unit(past, unit->id);
+    if (address <= 0 || flash_read32(address + UNIT_SIZE_OFFSET) != unit->length) {
+        return false;
+    }
+    for (uint32_t wi = 0; 4*wi < unit->length; wi++) {
+        if (flash_read32(address + UNIT_DATA_OFFSET + 4*wi) != unit_word(unit, wi)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+  * @brief Get a data word of a unit as stored in flash, the last word of a unit
+  *        not an even multiple of 4 bytes is zero padded
+  * @param unit Unit
+  * @param wi Word index
+  * @retval data word
+  */
+static uint32_t unit_word(past_unit_t *unit, uint32_t wi)
+{
+    uint32_t temp = 0;
+    uint32_t left = unit->length - 4*wi;
+    /** Reading a whole last word would cause an out of bound buffer read */
+    memcpy(&temp, &((uint8_t*)(unit->data))[4*wi], left < 4 ? left : 4);
+    return temp;
+}
+
 /**
   * @brief Erase unit
   * @param past An initialized past structure
@@ -340,10 +413,8 @@ bool past_erase_unit(past_t *past, past_id_t id)
     bool success = false;
     do {
         int32_t address = past_find_unit(past, id);
-        if (address == 0) {
+        if (address <= 0) {
             break;
-        } else if (address < 0) {
-            /** @todo: format past */
         }
         if (!past_erase_unit_at((uint32_t) address)) {
             break;
@@ -353,6 +424,20 @@ bool past_erase_unit(past_t *past, past_id_t id)
     return success;
 }
 
+/**
+  * @brief Get the room left for new units before a garbage collection is
+  *        needed, which never comes with CONFIG_PAST_NO_GC
+  * @param past An initialized past structure
+  * @retval free bytes in the current block, unit headers included
+  */
+uint32_t past_free_space(past_t *past)
+{
+    if (!past || !past->_valid) {
+        return 0;
+    }
+    return past_remaining_size(past);
+}
+
 /**
   * @brief Format the past area (both blocks) and initialize the first one
   * @param past pointer to an initialized past structure
@@ -362,23 +447,26 @@ bool past_erase_unit(past_t *past, past_id_t id)
 bool past_format(past_t *past)
 {
     bool success = false;
-    if (!past || /* !past->blocks[0] || */ !past->blocks[1]) {
+    if (!past || /* !past->blocks[0] || */ !past->blocks[PAST_NUM_BLOCKS-1]) {
         return success;
     }
     unlock_flash();
     do {
         uint32_t cur_base;
-        flash_erase_page(past->blocks[0]);
-        if (!(FLASH_SR_EOP & flash_get_status_flags())) {
-            break;
+        uint32_t i;
+        for (i = 0; i < PAST_NUM_BLOCKS; i++) {
+            flash_erase_page(past->blocks[i]);
+            if (!(FLASH_SR_EOP & flash_get_status_flags())) {
+                break;
+            }
         }
-        flash_erase_page(past->blocks[1]);
-        if (!(FLASH_SR_EOP & flash_get_status_flags())) {
+        if (i < PAST_NUM_BLOCKS) {
             break;
         }
         past->_cur_block = 0;
         past->_counter = 0;
         past->_end_addr = past->blocks[0] + HEADER_FIRST_UNIT_OFFSET;
+        past_index_rebuild(past);
         cur_base = past->blocks[past->_cur_block];
         if (!flash_write32(cur_base + HEADER_COUNTER_OFFSET, past->_counter)) {
             break;
@@ -434,6 +522,97 @@ static bool past_erase_unit_at(uint32_t address)
     return success;
 }
 
+#ifndef CONFIG_PAST_NO_INDEX
+/**
+  * @brief Hash a unit id into the RAM index
+  * @param id unit id
+  * @retval first slot to probe
+  */
+static inline uint32_t past_index_hash(past_id_t id)
+{
+    /** Unit ids are small numbers, optionally with a screen id in the top
+      * byte, so fold the top byte in */
+    return (id ^ (id >> 21)) % PAST_INDEX_SIZE;
+}
+
+/**
+  * @brief Rebuild the RAM index from the current block
+  * @param past pointer to an initialized past structure
+  */
+static void past_index_rebuild(past_t *past)
+{
+    uint32_t base = past->blocks[past->_cur_block];
+    uint32_t cur_address = base + HEADER_FIRST_UNIT_OFFSET;
+    memset(past->_index, 0, sizeof(past->_index));
+    past->_index_valid = true;
+    while (cur_address < base + PAST_BLOCK_SIZE) {
+        uint32_t cur_id = flash_read32(cur_address);
+        uint32_t cur_size = flash_read32(cur_address + UNIT_SIZE_OFFSET);
+        if (cur_id == PAST_UNIT_ID_END || cur_size == 0 || cur_size == 0xffffffff) {
+            break;
+        }
+        if (cur_id != PAST_UNIT_ID_INVALID) {
+            past_index_set(past, cur_id, cur_address);
+        }
+        if (cur_size % 4) {
+            cur_size += 4 - (cur_size % 4); // Word align
+        }
+        cur_address += UNIT_DATA_OFFSET + cur_size;
+    }
+}
+
+/**
+  * @brief Point the index entry of a unit to a new address, adding the unit
+  *        if needed. Slots of erased units (id 0 in flash) are reused.
+  * @param past pointer to an initialized past structure
+  * @param id id of unit
+  * @param address address of the unit in the current block
+  */
+static void past_index_set(past_t *past, past_id_t id, uint32_t address)
+{
+    uint32_t base = past->blocks[past->_cur_block];
+    uint32_t slot = past_index_hash(id);
+    int32_t free_slot = -1;
+    if (!past->_index_valid) {
+        return;
+    }
+    for (uint32_t i = 0; i < PAST_INDEX_SIZE; i++) {
+        uint16_t offset = past->_index[slot];
+        if (offset == 0) {
+            if (free_slot < 0) {
+                free_slot = slot;
+            }
+            break;
+        }
+        uint32_t slot_id = flash_read32(base + offset);
+        if (slot_id == id) {
+            free_slot = slot; /** Replace the old version */
+            break;
+        } else if (slot_id == PAST_UNIT_ID_INVALID && free_slot < 0) {
+            free_slot = slot; /** Reuse, unless the unit is further down */
+        }
+        slot = (slot + 1) % PAST_INDEX_SIZE;
+    }
+    if (free_slot < 0) {
+        past->_index_valid = false; /** Full, fall back to scanning */
+    } else {
+        past->_index[free_slot] = (uint16_t) (address - base);
+    }
+}
+#else // CONFIG_PAST_NO_INDEX
+static void past_index_rebuild(past_t *past)
+{
+    (void) past;
+}
+
+static void past_index_set(past_t *past, past_id_t id, uint32_t address)
+{
+    (void) past;
+    (void) id;
+    (void) address;
+}
+#endif // CONFIG_PAST_NO_INDEX
+
 /**
   * @brief Find unit and return address
   * @param past pointer to an initialized past structure
@@ -441,6 +620,36 @@ static bool past_erase_unit_at(uint32_t address)
   * @retval address of unit or -1 if not found or an error occured
   */
 static int32_t past_find_unit(past_t *past, past_id_t id)
+{
+#ifdef CONFIG_PAST_NO_INDEX
+    return past_scan_unit(past, id);
+#else // CONFIG_PAST_NO_INDEX
+    if (!past->_index_valid) {
+        return past_scan_unit(past, id);
+    }
+    uint32_t base = past->blocks[past->_cur_block];
+    uint32_t slot = past_index_hash(id);
+    for (uint32_t i = 0; i < PAST_INDEX_SIZE; i++) {
+        uint16_t offset = past->_index[slot];
+        if (offset == 0) {
+            break;
+        }
+        if (flash_read32(base + offset) == id) {
+            return (int32_t) (base + offset);
+        }
+        slot = (slot + 1) % PAST_INDEX_SIZE;
+    }
+    return -1;
+#endif // CONFIG_PAST_NO_INDEX
+}
+
+/**
+  * @brief Find unit by walking the current block
+  * @param past pointer to an initialized past structure
+  * @param id id of unit to search for
+  * @retval address of unit or -1 if not found or an error occured
+  */
+static int32_t past_scan_unit(past_t *past, past_id_t id)
 {
     uint32_t base = past->blocks[past->_cur_block];
     uint32_t cur_address = base + HEADER_FIRST_UNIT_OFFSET;
@@ -489,8 +698,9 @@ static bool past_garbage_collect(past_t *past)
     bool success = false;
     unlock_flash();
     do {
-        /** Format the new block */
-        uint32_t new_block = past->blocks[past->_cur_block ? 0 : 1];
+        /** Format the next block */
+        uint32_t new_index = (past->_cur_block + 1) % PAST_NUM_BLOCKS;
+        uint32_t new_block = past->blocks[new_index];
         uint32_t old_block = past->blocks[past->_cur_block];
         flash_erase_page(new_block);
         if (!(FLASH_SR_EOP & flash_get_status_flags())) {
@@ -507,13 +717,11 @@ static bool past_garbage_collect(past_t *past)
             break;
         }
 
-        flash_erase_page(old_block);
-        if (!(FLASH_SR_EOP & flash_get_status_flags())) {
-            break;
-        }
-
+        /** The old block is left behind with a lower counter and gets erased
+          * when it is next in turn */
         past->_counter++;
-        past->_cur_block = past->_cur_block ? 0 : 1;
+        past->_cur_block = new_index;
+        past_index_rebuild(past);
         success = true;
         /** Past is now ready for writing */
     } while(0);
@@ -30,18 +30,50 @@
 
 typedef uint32_t past_id_t;
 
+/** Size of one Past block, equal to the flash page size of the STM32F100 */
+#define PAST_BLOCK_SIZE     (1024)
+
+/** Number of flash blocks used round robin by Past. Must match past_size in
+  * the app and bootloader linker scripts (PAST_NUM_BLOCKS * PAST_BLOCK_SIZE) */
+#ifndef CONFIG_PAST_NUM_BLOCKS
+ #define PAST_NUM_BLOCKS    (2)
+#else
+ #define PAST_NUM_BLOCKS    (CONFIG_PAST_NUM_BLOCKS)
+#endif
+
+/** Number of slots in the RAM index mapping unit ids to flash offsets. Should
+  * comfortably exceed the number of units in use, if it fills up Past falls
+  * back to scanning flash until the next garbage collection. Builds defining
+  * CONFIG_PAST_NO_INDEX always scan. */
+#ifndef CONFIG_PAST_INDEX_SIZE
+ #define PAST_INDEX_SIZE    (48)
+#else
+ #define PAST_INDEX_SIZE    (CONFIG_PAST_INDEX_SIZE)
+#endif
+
 /** A structure describing a past instace. The user is expected to fill out the
   * blocks array before calling past_init(...). The other fields must not be
   * touched.
   */
 typedef struct {
-    uint32_t blocks[2];
+    uint32_t blocks[PAST_NUM_BLOCKS];
     uint32_t _cur_block;
     uint32_t _counter;
     uint32_t _end_addr;
     bool _valid;
+    bool _index_valid;
+#ifndef CONFIG_PAST_NO_INDEX
+    uint16_t _index[PAST_INDEX_SIZE]; /** Unit offsets from block start, 0 = free slot */
+#endif // CONFIG_PAST_NO_INDEX
 } past_t;
 
+/** A unit to be written by past_write_units(...) */
+typedef struct {
+    past_id_t id;
+    void *data;
+    uint32_t length;
+} past_unit_t;
+
 /**
   * @brief Initialize the past, format or garbage collect if needed
   * @param past A past structure with the block[] vector initialized
@@ -72,6 +104,18 @@ bool past_read_unit(past_t *past, past_id_t id, const void **data, uint32_t *len
   */
 bool past_write_unit(past_t *past, past_id_t id, void *data, uint32_t length);
 
+/**
+  * @brief Write several units to past, garbage collecting at most once. Units
+  *        whose content is already stored are skipped.
+  * @param past An initialized past structure
+  * @param units Units to write
+  * @param count Number of units
+  * @retval true if all units were written
+  *         false if writing failed or the past was full, in the latter case
+  *         nothing was written
+  */
+bool past_write_units(past_t *past, past_unit_t *units, uint32_t count);
+
 /**
   * @brief Erase unit
   * @param past An initialized past structure
@@ -82,7 +126,15 @@ bool past_write_unit(past_t *past, past_id_t id, void *data, uint32_t length);
 bool past_erase_unit(past_t *past, past_id_t id);
 
 /**
-  * @brief Format the past area (both blocks) and initialize the first one
+  * @brief Get the room left for new units before a garbage collection is
+  *        needed, which never comes with CONFIG_PAST_NO_GC
+  * @param past An initialized past structure
+  * @retval free bytes in the current block, unit headers included
+  */
+uint32_t past_free_space(past_t *past);
+
+/**
+  * @brief Format the past area (all blocks) and initialize the first one
   * @param past pointer to an initialized past structure
   * @retval True if formatting was successful
   *         False in case of unrecoverable errors
@@ -46,6 +46,10 @@ typedef enum {
     past_VIN_ADC_K,
     past_VIN_ADC_C,
     past_tft_brightness,
+    /** stored as uint32_t, only present if the user chose to persist a
+        baudrate. WARN: Moving past_baudrate requires a recompile and flash of
+        DPSBoot! */
+    past_baudrate,
     /** A past unit who's precense indicates we have a non finished upgrade and
     must not boot */
     past_upgrade_started = 0xff
@@ -74,77 +74,76 @@ void protocol_create_ocp(frame_t *frame, uint16_t i_cut)
 	end_frame(frame);
 }
 
-bool protocol_unpack_response(frame_t *frame, command_t *cmd, uint8_t *success)
+bool protocol_unpack_response(payload_t *payload, command_t *cmd, uint8_t *success)
 {
-	start_frame_unpacking(frame);
-	UNPACK8(frame, cmd);
-	UNPACK8(frame, success);
-	return frame->length == 0;
+	uint8_t c;
+
+	PAYLOAD_UNPACK8(payload, &c);
+	PAYLOAD_UNPACK8(payload, success);
+	*cmd = c;
+
+	return payload->length == 0;
 }
 
-bool protocol_unpack_query_response(frame_t *frame, uint16_t *v_in, uint16_t *v_out_setting, uint16_t *v_out, uint16_t *i_out, uint16_t *i_limit, uint8_t *power_enabled)
+bool protocol_unpack_query_response(payload_t *payload, uint16_t *v_in, uint16_t *v_out_setting, uint16_t *v_out, uint16_t *i_out, uint16_t *i_limit, uint8_t *power_enabled)
 {
 	uint8_t cmd;
 	uint8_t status;
 
-	start_frame_unpacking(frame);
-	UNPACK8(frame, &cmd);
-	UNPACK8(frame, &status);
-	UNPACK16(frame, v_in);
-	UNPACK16(frame, v_out_setting);
-	UNPACK16(frame, v_out);
-	UNPACK16(frame, i_out);
-	UNPACK16(frame, i_limit);
-	UNPACK8(frame, power_enabled);
+	PAYLOAD_UNPACK8(payload, &cmd);
+	PAYLOAD_UNPACK8(payload, &status);
+	PAYLOAD_UNPACK16(payload, v_in);
+	PAYLOAD_UNPACK16(payload, v_out_setting);
+	PAYLOAD_UNPACK16(payload, v_out);
+	PAYLOAD_UNPACK16(payload, i_out);
+	PAYLOAD_UNPACK16(payload, i_limit);
+	PAYLOAD_UNPACK8(payload, power_enabled);
 	*power_enabled = !!(*power_enabled);
 	(void) status;
 
-	return frame->length == 0 && cmd == (cmd_response | cmd_query);
+	return payload->length == 0 && cmd == (cmd_response | cmd_query);
 }
 
-bool protocol_unpack_wifi_status(frame_t *frame, wifi_status_t *status)
+bool protocol_unpack_wifi_status(payload_t *payload, wifi_status_t *status)
 {
-	uint8_t cmd;
+	uint8_t cmd, s;
 
-	start_frame_unpacking(frame);
-	UNPACK8(frame, &cmd);
-	UNPACK8(frame, status);
+	PAYLOAD_UNPACK8(payload, &cmd);
+	PAYLOAD_UNPACK8(payload, &s);
+	*status = s;
 
-	return frame->length == 0 && cmd == cmd_wifi_status;
+	return payload->length == 0 && cmd == cmd_wifi_status;
 }
 
-bool protocol_unpack_lock(frame_t *frame, uint8_t *locked)
+bool protocol_unpack_lock(payload_t *payload, uint8_t *locked)
 {
 	uint8_t cmd;
 
-	start_frame_unpacking(frame);
-	UNPACK8(frame, &cmd);
-	UNPACK8(frame, locked);
+	PAYLOAD_UNPACK8(payload, &cmd);
+	PAYLOAD_UNPACK8(payload, locked);
 	*locked = !!(*locked);
 
-	return frame->length == 0 && cmd == cmd_lock;
+	return payload->length == 0 && cmd == cmd_lock;
 }
 
-bool protocol_unpack_upgrade_start(frame_t *frame, uint16_t *chunk_size, uint16_t *crc)
+bool protocol_unpack_upgrade_start(payload_t *payload, uint16_t *chunk_size, uint16_t *crc)
 {
 	uint8_t cmd;
 
-	start_frame_unpacking(frame);
-	UNPACK8(frame, &cmd);
-	UNPACK16(frame, chunk_size);
-	UNPACK16(frame, crc);
+	PAYLOAD_UNPACK8(payload, &cmd);
+	PAYLOAD_UNPACK16(payload, chunk_size);
+	PAYLOAD_UNPACK16(payload, crc);
 
-	return frame->length == 0 && cmd == cmd_upgrade_start;
+	return payload->length == 0 && cmd == cmd_upgrade_start;
 }
 
-bool protocol_unpack_ocp(frame_t *frame, uint16_t *i_cut)
+bool protocol_unpack_ocp(payload_t *payload, uint16_t *i_cut)
 {
 	uint8_t cmd;
 
-	start_frame_unpacking(frame);
-	UNPACK8(frame, &cmd);
-	UNPACK16(frame, i_cut);
+	PAYLOAD_UNPACK8(payload, &cmd);
+	PAYLOAD_UNPACK16(payload, i_cut);
 
-	return frame->length == 0 && cmd == cmd_ocp_event;
+	return payload->length == 0 && cmd == cmd_ocp_event;
 }
 
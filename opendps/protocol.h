@@ -60,6 +60,14 @@ typedef enum {
     cmd_clear_calibration,
     cmd_change_screen,
     cmd_set_brightness,
+    cmd_stream_start,
+    cmd_stream_stop,
+    cmd_stream_data,
+    cmd_set_waveform,
+    cmd_set_adc_filter,
+    cmd_energy,
+    cmd_set_baudrate,
+    cmd_set_program,
     cmd_response = 0x80
 } command_t;
 
@@ -101,6 +109,48 @@ typedef enum {
 
 #define INVALID_TEMPERATURE (0xffff)
 
+/** Marks an absolute value in place of a delta in cmd_stream_data frames */
+#define STREAM_DELTA_ESCAPE (0x80)
+
+/** Range of rates accepted by cmd_set_baudrate */
+#define BAUDRATE_MIN (1200)
+#define BAUDRATE_MAX (1000000)
+/** The device falls back to its previous baudrate unless pinged this soon
+    after switching */
+#define BAUDRATE_SWITCH_TIMEOUT_MS (1000)
+
+/** Number of points in the function generator's user waveform */
+#define WAVEFORM_POINTS (64)
+/** Max number of waveform points in one cmd_set_waveform frame */
+#define WAVEFORM_CHUNK_SIZE (32)
+
+/** Number of steps in a sequencer program */
+#define SEQ_MAX_STEPS (24)
+/** Max number of steps in one cmd_set_program frame */
+#define SEQ_CHUNK_STEPS (4)
+
+/** Operations of a sequencer program step, see cmd_set_program */
+typedef enum {
+    seq_op_end = 0, /** the program is done, the output keeps the last setpoints */
+    seq_op_set_v, /** set V_out to <value> mV */
+    seq_op_set_i, /** set I_out to <value> mA */
+    seq_op_ramp_v, /** ramp V_out linearly to <value> mV in <time> ms */
+    seq_op_ramp_i, /** ramp I_out linearly to <value> mA in <time> ms */
+    seq_op_dwell, /** keep the setpoints for <time> ms */
+    seq_op_loop, /** jump to step <value>, <time> times (0 forever) */
+    seq_op_wait, /** wait until the output meets <cond> for <value>, cut it after <time> ms (0 never) */
+    seq_op_last
+} seq_op_t;
+
+/** Conditions on the measured output for seq_op_wait */
+typedef enum {
+    seq_cond_v_above = 0, /** V_out >= <value> mV */
+    seq_cond_v_below, /** V_out <= <value> mV */
+    seq_cond_i_above, /** I_out >= <value> mA */
+    seq_cond_i_below, /** I_out <= <value> mA */
+    seq_cond_last
+} seq_cond_t;
+
 /*
  * Helpers for creating frames.
  *
@@ -126,16 +176,18 @@ void protocol_create_ocp(frame_t *frame, uint16_t i_cut);
  * These functions will unpack the content of the unframed payload and return
  * true. If the command byte of the frame does not match the expectation or the
  * frame is too short to unpack the expected payload, false will be returned.
+ * The payload is expected to be unpacked from its first byte, see
+ * uframe_rx_payload(...).
  */
-bool protocol_unpack_response(frame_t *frame, command_t *cmd, uint8_t *success);
-bool protocol_unpack_power_enable(frame_t *frame, uint8_t *enable);
-bool protocol_unpack_vout(frame_t *frame, uint16_t *vout_mv);
-bool protocol_unpack_ilimit(frame_t *frame, uint16_t *ilimit_ma);
-bool protocol_unpack_query_response(frame_t *frame, uint16_t *v_in, uint16_t *v_out_setting, uint16_t *v_out, uint16_t *i_out, uint16_t *i_limit, uint8_t *power_enabled);
-bool protocol_unpack_wifi_status(frame_t *frame, wifi_status_t *status);
-bool protocol_unpack_lock(frame_t *frame, uint8_t *locked);
-bool protocol_unpack_ocp(frame_t *frame, uint16_t *i_cut);
-bool protocol_unpack_upgrade_start(frame_t *frame, uint16_t *chunk_size, uint16_t *crc);
+bool protocol_unpack_response(payload_t *payload, command_t *cmd, uint8_t *success);
+bool protocol_unpack_power_enable(payload_t *payload, uint8_t *enable);
+bool protocol_unpack_vout(payload_t *payload, uint16_t *vout_mv);
+bool protocol_unpack_ilimit(payload_t *payload, uint16_t *ilimit_ma);
+bool protocol_unpack_query_response(payload_t *payload, uint16_t *v_in, uint16_t *v_out_setting, uint16_t *v_out, uint16_t *i_out, uint16_t *i_limit, uint8_t *power_enabled);
+bool protocol_unpack_wifi_status(payload_t *payload, wifi_status_t *status);
+bool protocol_unpack_lock(payload_t *payload, uint8_t *locked);
+bool protocol_unpack_ocp(payload_t *payload, uint16_t *i_cut);
+bool protocol_unpack_upgrade_start(payload_t *payload, uint16_t *chunk_size, uint16_t *crc);
 
 
 /*
@@ -188,9 +240,13 @@ bool protocol_unpack_upgrade_start(frame_t *frame, uint16_t *chunk_size, uint16_
  * or did not exist at all. The notation of named parametes decouples dpsctl
  * from the OpenDPS device; you may add any functions and parameters without
  * the need for updating dpsctl.
+ * The parameters are set as a transaction: all of them are validated first
+ * and if any one fails, none is applied and the status is 0. Settings are
+ * written to flash once the host has stopped sending for a moment, so sweeping
+ * setpoints does not wear the flash.
  *
  *  HOST:   [cmd_set_parameters <param 1> \0 <value 1> \0 <param 2> \0 <value 2> ... ]
- *  DPS:    [cmd_response | cmd_set_parameters] <param 1 > <set_parameter_status_t 1> <param 2> <set_parameter_status_t 2> ...
+ *  DPS:    [cmd_response | cmd_set_parameters] <status> <set_parameter_status_t 1> <set_parameter_status_t 2> ...
  *
  *
  * === Listing function parameters ===
@@ -275,6 +331,84 @@ bool protocol_unpack_upgrade_start(frame_t *frame, uint16_t *chunk_size, uint16_
  *  HOST:   [cmd_upgrade_data] [<payload>]+
  *  DPS BL: [cmd_response | cmd_upgrade_data] [<upgrade_status_t>]
  *
+ *
+ * === Streaming measurements ===
+ * The host can ask the DPS to push V_in, V_out and I_out continuously. The
+ * ADC sample stream is averaged over <decimation> samples and the averages
+ * (in mV and mA) are sent in batches. The DPS may raise the decimation if the
+ * requested rate would not fit the serial link and reports the sample rate
+ * and the decimation actually used. Status is 0 if streaming is not supported.
+ *
+ *  HOST:   [cmd_stream_start] [<decimation:16>]
+ *  DPS:    [cmd_response | cmd_stream_start] [<status>] [<sample_rate_hz:16>] [<decimation:16>]
+ *
+ * Each batch starts with absolute values followed by zero or more sample sets
+ * coded as signed 8 bit deltas from the previous set. A delta that does not
+ * fit is sent as STREAM_DELTA_ESCAPE followed by the absolute 16 bit value.
+ * The sequence number increments for each batch allowing the host to detect
+ * lost frames.
+ *
+ *  DPS:    [cmd_stream_data] [<seq:16>] [V_in:16] [V_out:16] [I_out:16] ([<dV_in>] [<dV_out>] [<dI_out>])*
+ *  HOST:   none
+ *
+ *  HOST:   [cmd_stream_stop]
+ *  DPS:    [cmd_response | cmd_stream_stop] [1]
+ *
+ * === Uploading a function generator waveform ===
+ * The fourth function of the function generator plays a user defined period
+ * of WAVEFORM_POINTS points, 0 being 0V and 255 being the voltage setting.
+ * The waveform is uploaded in chunks of at most WAVEFORM_CHUNK_SIZE points
+ * starting at <offset>. Status is 0 if the function generator is not
+ * available or the chunk does not fit the waveform.
+ *
+ *  HOST:   [cmd_set_waveform] [<offset>] [<point>]+
+ *  DPS:    [cmd_response | cmd_set_waveform] [<status>]
+ *
+ * === Uploading a sequencer program ===
+ * The sequencer function runs a program of at most SEQ_MAX_STEPS steps with
+ * millisecond timing once its output is enabled, see seq_op_t. The program
+ * is uploaded in chunks of at most SEQ_CHUNK_STEPS steps starting at step
+ * <offset> and ends at the first seq_op_end. <cond> is only used by
+ * seq_op_wait. Status is 0 if the sequencer is not available or running, or
+ * if the chunk does not fit the program or holds an invalid step.
+ *
+ *  HOST:   [cmd_set_program] [<offset>] ([<op>] [<cond>] [<value:16>] [<time:32>])+
+ *  DPS:    [cmd_response | cmd_set_program] [<status>]
+ *
+ * === Setting the measurement filter ===
+ * The measurements shown on the display and returned by cmd_query are
+ * averaged over 2^<depth> ADC samples, 0 turning averaging off. Status is 0
+ * if <depth> is larger than ADC_FILTER_MAX_DEPTH.
+ *
+ *  HOST:   [cmd_set_adc_filter] [<depth>]
+ *  DPS:    [cmd_response | cmd_set_adc_filter] [<status>]
+ *
+ * === Reading the energy counters ===
+ * The DPS integrates the charge (in uAh) and energy (in uWh) delivered while
+ * the output is enabled along with for how long (in ms) it was enabled. The
+ * counters are restarted after reading them if <reset> is non zero. Status is
+ * 0 if the counters are not supported.
+ *
+ *  HOST:   [cmd_energy] [<reset>]
+ *  DPS:    [cmd_response | cmd_energy] [<status>] [<charge:64>] [<energy:64>] [<runtime:64>]
+ *
+ * === Changing the baudrate ===
+ * The app can switch to another baudrate. The response is sent at the current
+ * baudrate, after which the DPS switches.
+ * The host then has BAUDRATE_SWITCH_TIMEOUT_MS to send cmd_ping at the new
+ * baudrate, the DPS falls back to the previous baudrate if no ping arrives.
+ * Status is 0 if the baudrate is outside BAUDRATE_MIN..BAUDRATE_MAX or cannot
+ * be generated within 2%, and the baudrate is then left unchanged.
+ *
+ * If <persist> is non zero the baudrate is written to past once the ping has
+ * arrived, both the app and the bootloader will use it from then on. A master
+ * reset (holding SEL at power on) restores the compile time baudrate, as does
+ * forcing the bootloader into upgrade mode. The bootloader answers
+ * cmd_set_baudrate with status 0, it only follows the baudrate in past.
+ *
+ *  HOST:   [cmd_set_baudrate] [<baudrate:32>] [<persist>]
+ *  DPS:    [cmd_response | cmd_set_baudrate] [<status>]
+ *
  */
 
 #endif // __PROTOCOL_H__
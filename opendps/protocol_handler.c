@@ -40,6 +40,15 @@
 #include "bootcom.h"
 #include "uframe.h"
 #include "opendps.h"
+#ifdef CONFIG_STREAM_ENABLE
+#include "tick.h"
+#endif // CONFIG_STREAM_ENABLE
+#ifdef CONFIG_FUNCGEN_ENABLE
+#include "func_gen.h"
+#endif // CONFIG_FUNCGEN_ENABLE
+#ifdef CONFIG_SEQ_ENABLE
+#include "func_seq.h"
+#endif // CONFIG_SEQ_ENABLE
 
 #ifdef DPS_EMULATOR
  extern void dps_emul_send_frame(frame_t *frame);
@@ -51,9 +60,29 @@ typedef enum {
     cmd_success_but_i_actually_sent_my_own_status_thank_you_very_much,
 } command_status_t;
 
-static uint8_t frame_buffer[MAX_FRAME_LENGTH];
-static uint32_t rx_idx = 0;
-static bool receiving_frame = false;
+/** Received payloads are unescaped into this buffer as they arrive */
+static uint8_t rx_buffer[UFRAME_RX_SIZE(MAX_FRAME_LENGTH)];
+static frame_rx_t frame_rx = { .buffer = rx_buffer, .size = sizeof(rx_buffer) };
+
+#ifdef CONFIG_STREAM_ENABLE
+/** Number of decimated sample sets collected before a batch is sent */
+#define STREAM_BATCH_SIZE  (16)
+/** Batches are sent at least this often, even if not full */
+#define STREAM_FLUSH_MS  (250)
+/** A batch costs at most ~6 bytes per set on the wire, keep within the baudrate */
+#define STREAM_MIN_DECIMATION  ((ADC_CAPTURE_RATE_HZ * 60) / hw_get_baudrate() + 1)
+/** Worst case size of one delta coded sample set, stuffed, plus crc and EOF */
+#define STREAM_SET_MAX_LEN  (3 * 2 * 3 + 5)
+
+static bool streaming;
+static uint16_t stream_decimation;
+static uint16_t stream_seq;
+static uint32_t stream_acc[3];
+static uint32_t stream_acc_count;
+static uint16_t stream_batch[STREAM_BATCH_SIZE][3];
+static uint32_t stream_batch_len;
+static uint64_t stream_batch_start;
+#endif // CONFIG_STREAM_ENABLE
 
 /**
   * @brief Send a frame on the uart
@@ -68,11 +97,145 @@ static void send_frame(const frame_t *frame)
     dps_emul_send_frame(frame);
     #endif
 #else // DPS_EMULATOR
-    for (uint32_t i = 0; i < frame->length; ++i)
-        usart_send_blocking(USART1, frame->buffer[i]);
+    /** Queued, the USART ISR sends it while we get on with things */
+    hw_usart_send(frame->buffer, frame->length);
 #endif // DPS_EMULATOR
 }
 
+#ifdef CONFIG_STREAM_ENABLE
+/**
+  * @brief Pack one delta coded stream value
+  * @param frame the frame to pack into
+  * @param prev previous value
+  * @param cur current value
+  * @retval None
+  */
+static void stream_pack_delta(frame_t *frame, uint16_t prev, uint16_t cur)
+{
+    int32_t delta = (int32_t) cur - (int32_t) prev;
+    if (delta > -128 && delta < 128) {
+        pack8(frame, (uint8_t) (int8_t) delta);
+    } else {
+        pack8(frame, STREAM_DELTA_ESCAPE);
+        pack16(frame, cur);
+    }
+}
+
+/**
+  * @brief Send the collected batch, split into several frames if needed
+  * @retval None
+  */
+static void stream_flush(void)
+{
+    uint32_t i = 0;
+    while (i < stream_batch_len) {
+        frame_t frame;
+        set_frame_header(&frame);
+        pack8(&frame, cmd_stream_data);
+        pack16(&frame, stream_seq++);
+        pack16(&frame, stream_batch[i][0]);
+        pack16(&frame, stream_batch[i][1]);
+        pack16(&frame, stream_batch[i][2]);
+        for (i++; i < stream_batch_len && frame.length + STREAM_SET_MAX_LEN < MAX_FRAME_LENGTH; i++) {
+            for (uint32_t j = 0; j < 3; j++) {
+                stream_pack_delta(&frame, stream_batch[i - 1][j], stream_batch[i][j]);
+            }
+        }
+        end_frame(&frame);
+        send_frame(&frame);
+    }
+    stream_batch_len = 0;
+    stream_batch_start = get_ticks();
+}
+
+/**
+  * @brief Receive captured ADC samples, decimate and batch them
+  * @param samples sample sets of { I_out, V_in, V_out } raw values
+  * @param count number of sample sets
+  * @retval None
+  */
+static void stream_capture_handler(const uint16_t *samples, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++, samples += 3) {
+        stream_acc[0] += samples[1]; // V_in
+        stream_acc[1] += samples[2]; // V_out
+        stream_acc[2] += samples[0]; // I_out
+        if (++stream_acc_count == stream_decimation) {
+            uint16_t *set = stream_batch[stream_batch_len++];
+            set[0] = pwrctl_calc_vin(stream_acc[0] / stream_decimation);
+            set[1] = pwrctl_calc_vout(stream_acc[1] / stream_decimation);
+            set[2] = pwrctl_calc_iout(stream_acc[2] / stream_decimation);
+            stream_acc[0] = stream_acc[1] = stream_acc[2] = 0;
+            stream_acc_count = 0;
+            if (stream_batch_len == STREAM_BATCH_SIZE) {
+                stream_flush();
+            }
+        }
+    }
+    if (stream_batch_len && get_ticks() - stream_batch_start >= STREAM_FLUSH_MS) {
+        stream_flush();
+    }
+}
+
+/**
+  * @brief Handle a stream start command
+  * @param payload payload of the received frame
+  * @retval command_status_t failed, success or "I sent my own frame"
+  */
+static command_status_t handle_stream_start(payload_t *payload)
+{
+    emu_printf("%s\n", __FUNCTION__);
+    uint8_t cmd;
+    uint16_t decimation;
+    payload_unpack8(payload, &cmd);
+    (void) cmd;
+    if (!payload_unpack16(payload, &decimation)) {
+        return cmd_failed;
+    }
+    if (decimation < STREAM_MIN_DECIMATION) {
+        decimation = STREAM_MIN_DECIMATION;
+    }
+
+    hw_adc_capture_set_handler(NULL);
+    stream_decimation = decimation;
+    stream_seq = 0;
+    stream_acc[0] = stream_acc[1] = stream_acc[2] = 0;
+    stream_acc_count = 0;
+    stream_batch_len = 0;
+    stream_batch_start = get_ticks();
+    streaming = true;
+
+    {
+        frame_t frame_resp;
+        set_frame_header(&frame_resp);
+        pack8(&frame_resp, cmd_response | cmd_stream_start);
+        pack8(&frame_resp, 1);
+        pack16(&frame_resp, ADC_CAPTURE_RATE_HZ);
+        pack16(&frame_resp, decimation);
+        end_frame(&frame_resp);
+        send_frame(&frame_resp);
+    }
+    /** Install the handler after the response so no data precedes it */
+    hw_adc_capture_set_handler(&stream_capture_handler);
+    return cmd_success_but_i_actually_sent_my_own_status_thank_you_very_much;
+}
+
+/**
+  * @brief Handle a stream stop command, pending samples are sent first
+  * @retval command_status_t failed, success or "I sent my own frame"
+  */
+static command_status_t handle_stream_stop(void)
+{
+    emu_printf("%s\n", __FUNCTION__);
+    hw_adc_capture_set_handler(NULL);
+    if (streaming && stream_batch_len) {
+        stream_flush();
+    }
+    streaming = false;
+    return cmd_success;
+}
+#endif // CONFIG_STREAM_ENABLE
+
 /**
   * @brief Handle a query command
  * @retval command_status_t failed, success or "I sent my own frame"
@@ -86,11 +249,11 @@ static command_status_t handle_query(void)
     
     const char* curr_func = opendps_get_curr_function_name();
 
-    uint16_t i_out_raw, v_in_raw, v_out_raw;
-    hw_get_adc_values(&i_out_raw, &v_in_raw, &v_out_raw);
-    uint16_t v_in = pwrctl_calc_vin(v_in_raw);
-    uint16_t v_out = pwrctl_calc_vout(v_out_raw);
-    uint16_t i_out = pwrctl_calc_iout(i_out_raw);
+    uint16_t i_out_filtered, v_in_filtered, v_out_filtered;
+    hw_get_adc_filtered(&i_out_filtered, &v_in_filtered, &v_out_filtered);
+    uint16_t v_in = pwrctl_calc_vin_filtered(v_in_filtered);
+    uint16_t v_out = pwrctl_calc_vout_filtered(v_out_filtered);
+    uint16_t i_out = pwrctl_calc_iout_filtered(i_out_filtered);
     uint8_t output_enabled = pwrctl_vout_enabled();  
     int16_t temp1 = INVALID_TEMPERATURE, temp2 = INVALID_TEMPERATURE;
     bool temp_shutdown = 0;
@@ -131,27 +294,21 @@ static command_status_t handle_query(void)
     return cmd_success_but_i_actually_sent_my_own_status_thank_you_very_much;
 }
 
-static command_status_t handle_set_function(frame_t *frame)
+static command_status_t handle_set_function(payload_t *payload)
 {
     emu_printf("%s\n", __FUNCTION__);
     uint32_t i = 0;
-    char func_name[32];
+    const char *func_name;
     bool success = false;
-    uint8_t ch;
-    memset(func_name, 0, sizeof(func_name));
     {
         command_t cmd;
-        start_frame_unpacking(frame);
-        unpack8(frame, &cmd);
+        PAYLOAD_UNPACK8(payload, &cmd);
         (void) cmd;
-        do {
-            unpack8(frame, &ch);
-            func_name[i++] = ch;
-        } while(i < sizeof(func_name) - 1 && ch && frame->length);
+        func_name = payload_unpack_cstr(payload);
 
         char *names[8];
         uint32_t num_funcs = opendps_get_function_names(names, 8);
-        for (i = 0; i < num_funcs; i++) {
+        for (i = 0; func_name && i < num_funcs; i++) {
             if (strcmp(names[i], func_name) == 0) {
                 success = true;
                 break;
@@ -162,7 +319,7 @@ static command_status_t handle_set_function(frame_t *frame)
         emu_printf("Changing to function %s\n", func_name);
         success = opendps_enable_function_idx(i);
     } else {
-        emu_printf("Function %s not available\n", func_name);
+        emu_printf("Function %s not available\n", func_name ? func_name : "");
     }
     
     {
@@ -195,38 +352,38 @@ static command_status_t handle_list_functions(void)
     return cmd_success_but_i_actually_sent_my_own_status_thank_you_very_much;
 }
 
-static command_status_t handle_set_parameters(frame_t *frame)
+static command_status_t handle_set_parameters(payload_t *payload)
 {
     emu_printf("%s\n", __FUNCTION__);
-    char *name = 0, *value = 0;
+    const char *name, *value;
+    char *names[OPENDPS_MAX_PARAMETERS], *values[OPENDPS_MAX_PARAMETERS];
     command_t cmd;
     set_param_status_t stats[OPENDPS_MAX_PARAMETERS];
     uint32_t status_index = 0;
+    bool applied;
     {
-        start_frame_unpacking(frame);
-        unpack8(frame, &cmd);
+        PAYLOAD_UNPACK8(payload, &cmd);
         (void) cmd;
         do {
-            /** Extract all occurences of <name>=<value>\0 ... */
-            name = value = 0;
-            /** This is quite ugly, please don't look */
-            name = (char*) &frame->buffer[frame->unpack_pos];
-            frame->unpack_pos += strlen(name) + 1;
-            frame->length -= strlen(name) + 1;
-            value = (char*) &frame->buffer[frame->unpack_pos];
-            frame->unpack_pos += strlen(value) + 1;
-            frame->length -= strlen(value) + 1;
-            if (name && value) {
-                stats[status_index++] = opendps_set_parameter(name, value);
+            /** Extract all occurences of <name>\0<value>\0 ... */
+            name = payload_unpack_cstr(payload);
+            value = payload_unpack_cstr(payload);
+            if (!name || !value) {
+                break;
             }
-        } while(frame->length && status_index < OPENDPS_MAX_PARAMETERS);
+            /** The strings are only read, the screens just don't know it */
+            names[status_index] = (char*) name;
+            values[status_index++] = (char*) value;
+        } while(payload->length && status_index < OPENDPS_MAX_PARAMETERS);
+        /** The whole batch is validated before anything is applied */
+        applied = opendps_set_parameters(names, values, status_index, stats);
     }
 
     {
         frame_t frame_resp;
         set_frame_header(&frame_resp);
         pack8(&frame_resp, cmd_response | cmd_set_parameters);
-        pack8(&frame_resp, 1); // Always success
+        pack8(&frame_resp, applied); // 0 if the batch was rejected
         for (uint32_t i = 0; i < status_index; i++) {
             pack8(&frame_resp, stats[i]);
         }
@@ -236,32 +393,29 @@ static command_status_t handle_set_parameters(frame_t *frame)
     return cmd_success_but_i_actually_sent_my_own_status_thank_you_very_much;
 }
 
-static command_status_t handle_set_calibration(frame_t *frame)
+static command_status_t handle_set_calibration(payload_t *payload)
 {
     emu_printf("%s\n", __FUNCTION__);
-    char *name = 0;
-    float *value = 0;
+    const char *name;
+    const uint8_t *raw;
+    float value;
     command_t cmd;
     set_param_status_t stats[OPENDPS_MAX_PARAMETERS];
     uint32_t status_index = 0;
     {
-        start_frame_unpacking(frame);
-        unpack8(frame, &cmd);
+        PAYLOAD_UNPACK8(payload, &cmd);
         (void) cmd;
         do {
-            /** Extract all occurences of <name>=<value> ... */
-            name = 0;
-            /** This is quite ugly (again), please don't look */
-            name = (char*) &frame->buffer[frame->unpack_pos];
-            frame->unpack_pos += strlen(name) + sizeof(char);
-            frame->length -= strlen(name) + sizeof(char);
-            value = (float*) &frame->buffer[frame->unpack_pos];
-            frame->unpack_pos += sizeof(float);
-            frame->length -= sizeof(float);
-            if (name && value) {
-                stats[status_index++] = opendps_set_calibration(name, value);
+            /** Extract all occurences of <name>\0<float> ... */
+            name = payload_unpack_cstr(payload);
+            raw = payload_unpack_bytes(payload, sizeof(value));
+            if (!name || !raw) {
+                break;
             }
-        } while(frame->length && status_index < OPENDPS_MAX_PARAMETERS);
+            /** The float is not necessarily aligned in the payload */
+            memcpy(&value, raw, sizeof(value));
+            stats[status_index++] = opendps_set_calibration((char*) name, &value);
+        } while(payload->length && status_index < OPENDPS_MAX_PARAMETERS);
     }
 
     {
@@ -304,15 +458,14 @@ static command_status_t handle_list_parameters(void)
     return cmd_success_but_i_actually_sent_my_own_status_thank_you_very_much;
 }
 
-static command_status_t handle_enable_output(frame_t *frame)
+static command_status_t handle_enable_output(payload_t *payload)
 {
     emu_printf("%s\n", __FUNCTION__);
     uint8_t cmd;
     uint8_t enable_byte;
-    start_frame_unpacking(frame);
-    unpack8(frame, &cmd);
+    payload_unpack8(payload, &cmd);
     (void) cmd;
-    unpack8(frame, &enable_byte);
+    payload_unpack8(payload, &enable_byte);
     bool enable = !!enable_byte;
     if (opendps_enable_output(enable)) {
         return cmd_success;
@@ -321,30 +474,143 @@ static command_status_t handle_enable_output(frame_t *frame)
     }
 }
 
-static command_status_t handle_set_brightness(frame_t *frame)
+static command_status_t handle_set_brightness(payload_t *payload)
 {
     emu_printf("%s\n", __FUNCTION__);
     uint8_t cmd;
     uint8_t brightness_pct;
-    start_frame_unpacking(frame);
-    unpack8(frame, &cmd);
+    payload_unpack8(payload, &cmd);
     (void) cmd;
-    unpack8(frame, &brightness_pct);
+    payload_unpack8(payload, &brightness_pct);
     hw_set_backlight(brightness_pct);
     return cmd_success;
 }
 
+static command_status_t handle_set_adc_filter(payload_t *payload)
+{
+    emu_printf("%s\n", __FUNCTION__);
+    uint8_t cmd;
+    uint8_t depth;
+    payload_unpack8(payload, &cmd);
+    (void) cmd;
+    payload_unpack8(payload, &depth);
+    return hw_set_adc_filter_depth(depth) ? cmd_success : cmd_failed;
+}
+
+/**
+  * @brief Handle a baudrate change, the response goes out at the current
+  *        baudrate before switching
+  * @retval command_status_t failed, success or "I sent my own frame"
+  */
+static command_status_t handle_set_baudrate(payload_t *payload)
+{
+    emu_printf("%s\n", __FUNCTION__);
+    uint8_t cmd;
+    uint32_t baudrate;
+    uint8_t persist;
+    payload_unpack8(payload, &cmd);
+    (void) cmd;
+    payload_unpack32(payload, &baudrate);
+    if (!payload_unpack8(payload, &persist) || !hw_baudrate_valid(baudrate)) {
+        return cmd_failed;
+    }
+
+    frame_t frame_resp;
+    protocol_create_response(&frame_resp, cmd_set_baudrate, 1);
+    send_frame(&frame_resp);
+    (void) opendps_set_baudrate(baudrate, persist != 0);
+    return cmd_success_but_i_actually_sent_my_own_status_thank_you_very_much;
+}
+
+#ifdef CONFIG_ENERGY_ENABLE
+/**
+  * @brief Handle reading the energy counters
+  * @retval command_status_t failed, success or "I sent my own frame"
+  */
+static command_status_t handle_energy(payload_t *payload)
+{
+    emu_printf("%s\n", __FUNCTION__);
+    uint8_t cmd;
+    uint8_t reset;
+    hw_energy_t energy;
+    payload_unpack8(payload, &cmd);
+    (void) cmd;
+    payload_unpack8(payload, &reset);
+    hw_get_energy(&energy, reset != 0);
+
+    frame_t resp;
+    set_frame_header(&resp);
+    pack8(&resp, cmd_response | cmd_energy);
+    pack8(&resp, 1);
+    pack32(&resp, energy.charge_uah >> 32);
+    pack32(&resp, energy.charge_uah);
+    pack32(&resp, energy.energy_uwh >> 32);
+    pack32(&resp, energy.energy_uwh);
+    pack32(&resp, energy.runtime_ms >> 32);
+    pack32(&resp, energy.runtime_ms);
+    end_frame(&resp);
+
+    send_frame(&resp);
+    return cmd_success_but_i_actually_sent_my_own_status_thank_you_very_much;
+}
+#endif // CONFIG_ENERGY_ENABLE
+
+#ifdef CONFIG_FUNCGEN_ENABLE
+static command_status_t handle_set_waveform(payload_t *payload)
+{
+    emu_printf("%s\n", __FUNCTION__);
+    uint8_t cmd;
+    uint8_t offset;
+    uint8_t points[WAVEFORM_CHUNK_SIZE];
+    uint32_t count = 0;
+    payload_unpack8(payload, &cmd);
+    (void) cmd;
+    payload_unpack8(payload, &offset);
+    while (payload->length && count < WAVEFORM_CHUNK_SIZE) {
+        payload_unpack8(payload, &points[count++]);
+    }
+    if (payload->length || !func_gen_set_waveform(offset, points, count)) {
+        return cmd_failed;
+    }
+    return cmd_success;
+}
+#endif // CONFIG_FUNCGEN_ENABLE
+
+#ifdef CONFIG_SEQ_ENABLE
+static command_status_t handle_set_program(payload_t *payload)
+{
+    emu_printf("%s\n", __FUNCTION__);
+    uint8_t cmd;
+    uint8_t offset;
+    seq_step_t steps[SEQ_CHUNK_STEPS];
+    uint32_t count = 0;
+    payload_unpack8(payload, &cmd);
+    (void) cmd;
+    payload_unpack8(payload, &offset);
+    while (payload->length >= 8 && count < SEQ_CHUNK_STEPS) {
+        seq_step_t *step = &steps[count++];
+        payload_unpack8(payload, &step->op);
+        payload_unpack8(payload, &step->cond);
+        payload_unpack16(payload, &step->value);
+        payload_unpack32(payload, &step->time);
+    }
+    if (payload->length || !count || !func_seq_set_program(offset, steps, count)) {
+        return cmd_failed;
+    }
+    return cmd_success;
+}
+#endif // CONFIG_SEQ_ENABLE
+
 #ifdef CONFIG_THERMAL_LOCKOUT
-static command_status_t handle_temperature(frame_t *frame)
+static command_status_t handle_temperature(payload_t *payload)
 {
     emu_printf("%s\n", __FUNCTION__);
     command_t cmd;
     int16_t temp1, temp2;
-    start_frame_unpacking(frame);
-    unpack8(frame, &cmd);
+    PAYLOAD_UNPACK8(payload, &cmd);
     (void) cmd;
-    unpack16(frame, (uint16_t*) &temp1);
-    unpack16(frame, (uint16_t*) &temp2);
+    payload_unpack16(payload, (uint16_t*) &temp1);
+    payload_unpack16(payload, (uint16_t*) &temp2);
     opendps_set_temperature(temp1, temp2);
     return cmd_success;
 }
@@ -433,12 +699,12 @@ static command_status_t handle_clear_calibration(void)
   * @param payload_len length of payload
  * @retval command_status_t failed, success or "I sent my own frame"
   */
-static command_status_t handle_wifi_status(frame_t *frame)
+static command_status_t handle_wifi_status(payload_t *payload)
 {
     emu_printf("%s\n", __FUNCTION__);
     command_status_t success = cmd_failed;
     wifi_status_t status;
-    if (protocol_unpack_wifi_status(frame, &status)) {
+    if (protocol_unpack_wifi_status(payload, &status)) {
         success = cmd_success;
         opendps_update_wifi_status(status);
     }
@@ -451,12 +717,12 @@ static command_status_t handle_wifi_status(frame_t *frame)
   * @param payload_len length of payload
  * @retval command_status_t failed, success or "I sent my own frame"
   */
-static command_status_t handle_lock(frame_t *frame)
+static command_status_t handle_lock(payload_t *payload)
 {
     emu_printf("%s\n", __FUNCTION__);
     command_status_t success = cmd_failed;
     uint8_t status;
-    if (protocol_unpack_lock(frame, &status)) {
+    if (protocol_unpack_lock(payload, &status)) {
         success = cmd_success;
         opendps_lock(status);
     }
@@ -469,12 +735,12 @@ static command_status_t handle_lock(frame_t *frame)
   * @param payload_len length of payload
   * @retval false in case of errors, if successful the device reboots
   */
-static command_status_t handle_upgrade_start(frame_t *frame)
+static command_status_t handle_upgrade_start(payload_t *payload)
 {
     emu_printf("%s\n", __FUNCTION__);
     command_status_t success = cmd_failed;
     uint16_t chunk_size, crc;
-    if (protocol_unpack_upgrade_start(frame, &chunk_size, &crc)) {
+    if (protocol_unpack_upgrade_start(payload, &chunk_size, &crc)) {
         bootcom_put(0xfedebeda, (chunk_size << 16) | crc);
         opendps_upgrade_start();
     }
@@ -487,14 +753,13 @@ static command_status_t handle_upgrade_start(frame_t *frame)
   * @param payload_len length of payload
   * @retval false in case of errors, if successful the device reboots
   */
-static command_status_t handle_change_screen(frame_t *frame)
+static command_status_t handle_change_screen(payload_t *payload)
 {
     emu_printf("%s\n", __FUNCTION__);
     uint8_t cmd, screen_id;
-    start_frame_unpacking(frame);
-    unpack8(frame, &cmd);
+    payload_unpack8(payload, &cmd);
     (void) cmd;
-    unpack8(frame, &screen_id);
+    payload_unpack8(payload, &screen_id);
     if (opendps_change_screen(screen_id)) {
         return cmd_success;
     } else {
@@ -504,23 +769,16 @@ static command_status_t handle_change_screen(frame_t *frame)
 
 /**
   * @brief Handle a receved frame
-  * @param frame the received frame
-  * @param length length of frame
+  * @param payload payload of the received frame, the command comes first
   * @retval None
   */
-static void handle_frame(uint8_t *data, uint32_t length)
+static void handle_frame(payload_t *payload)
 {
     command_status_t success = cmd_failed;
     command_t cmd = cmd_response;
 
-    frame_t frame;
-
-    int32_t payload_len = uframe_extract_payload(&frame, data, length);
-
-    if (payload_len <= 0) {
-        dbg_printf("Frame error %ld\n", payload_len);
-    } else {
-        cmd = frame.buffer[0];
+    if (payload->length > 0) {
+        cmd = payload->data[0];
         switch(cmd) {
             case cmd_ping:
                 success = 1; // Response will be sent below
@@ -528,13 +786,13 @@ static void handle_frame(uint8_t *data, uint32_t length)
                 opendps_handle_ping();
                 break;
             case cmd_set_function:
-                success = handle_set_function(&frame);
+                success = handle_set_function(payload);
                 break;
             case cmd_list_functions:
                 success = handle_list_functions();
                 break;
             case cmd_set_parameters:
-                success = handle_set_parameters(&frame);
+                success = handle_set_parameters(payload);
                 break;
             case cmd_list_parameters:
                 success = handle_list_parameters();
@@ -543,20 +801,20 @@ static void handle_frame(uint8_t *data, uint32_t length)
                 success = handle_query();
                 break;
             case cmd_wifi_status:
-                success = handle_wifi_status(&frame);
+                success = handle_wifi_status(payload);
                 break;
             case cmd_lock:
-                success = handle_lock(&frame);
+                success = handle_lock(payload);
                 break;
             case cmd_upgrade_start:
-                success = handle_upgrade_start(&frame);
+                success = handle_upgrade_start(payload);
                 break;
             case cmd_enable_output:
-                success = handle_enable_output(&frame);
+                success = handle_enable_output(payload);
                 break;
 #ifdef CONFIG_THERMAL_LOCKOUT
             case cmd_temperature_report:
-                success = handle_temperature(&frame);
+                success = handle_temperature(payload);
                 break;
 #endif // CONFIG_THERMAL_LOCKOUT
             case cmd_version:
@@ -566,17 +824,46 @@ static void handle_frame(uint8_t *data, uint32_t length)
                 success = handle_cal_report();
                 break;
             case cmd_set_calibration:
-                success = handle_set_calibration(&frame);
+                success = handle_set_calibration(payload);
                 break;
             case cmd_clear_calibration:
                 success = handle_clear_calibration();
                 break;
             case cmd_change_screen:
-                success = handle_change_screen(&frame);
+                success = handle_change_screen(payload);
                 break;
             case cmd_set_brightness:
-                success = handle_set_brightness(&frame);
+                success = handle_set_brightness(payload);
+                break;
+            case cmd_set_adc_filter:
+                success = handle_set_adc_filter(payload);
+                break;
+            case cmd_set_baudrate:
+                success = handle_set_baudrate(payload);
                 break;
+#ifdef CONFIG_ENERGY_ENABLE
+            case cmd_energy:
+                success = handle_energy(payload);
+                break;
+#endif // CONFIG_ENERGY_ENABLE
+#ifdef CONFIG_STREAM_ENABLE
+            case cmd_stream_start:
+                success = handle_stream_start(payload);
+                break;
+            case cmd_stream_stop:
+                success = handle_stream_stop();
+                break;
+#endif // CONFIG_STREAM_ENABLE
+#ifdef CONFIG_FUNCGEN_ENABLE
+            case cmd_set_waveform:
+                success = handle_set_waveform(payload);
+                break;
+#endif // CONFIG_FUNCGEN_ENABLE
+#ifdef CONFIG_SEQ_ENABLE
+            case cmd_set_program:
+                success = handle_set_program(payload);
+                break;
+#endif // CONFIG_SEQ_ENABLE
             default:
                 emu_printf("Got unknown command %d (0x%02x)\n", cmd, cmd);
                 break;
@@ -598,20 +885,12 @@ static void handle_frame(uint8_t *data, uint32_t length)
   */
 void serial_handle_rx_char(char c)
 {
-    uint8_t b = (uint8_t) c;
-    if (b == _SOF) {
-        receiving_frame = true;
-        rx_idx = 0;
-    }
-    if (receiving_frame) {
-        if (rx_idx < sizeof(frame_buffer)) {
-            frame_buffer[rx_idx++] = b;
-            if (b == _EOF) {
-                handle_frame(frame_buffer, rx_idx);
-                receiving_frame = false;
-            }
-        } else {
-            dbg_printf("Error: RX buffer overflow!\n");
-        }
+    int32_t payload_len = uframe_rx_add(&frame_rx, (uint8_t) c);
+    if (payload_len > 0) {
+        payload_t payload;
+        uframe_rx_payload(&payload, &frame_rx, payload_len);
+        handle_frame(&payload);
+    } else if (payload_len < 0) {
+        dbg_printf("Frame error %ld\n", payload_len);
     }
 }
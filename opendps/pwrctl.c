@@ -25,8 +25,10 @@
 #include "pwrctl.h"
 #include "dps-model.h"
 #include "pastunits.h"
+#include "hw.h"
 #include <gpio.h>
 #include <dac.h>
+#include <nvic.h>
 
 /** This module handles voltage and current calculations
   * Calculations based on measurements found at
@@ -47,9 +49,148 @@ float v_dac_c_coef = V_DAC_C;
 float vin_adc_k_coef = VIN_ADC_K;
 float vin_adc_c_coef = VIN_ADC_C;
 
+/** The calibration coefficients are converted to fixed point whenever they
+  * change so the conversions below need no soft float math. A conversion is
+  * y = (k * x + c) >> CAL_Q rounded to nearest, k with 11 integer bits.
+  */
+#define CAL_Q     (20)
+#define CAL_ONE   ((int64_t) 1 << CAL_Q)
+#define CAL_HALF  ((int64_t) 1 << (CAL_Q - 1))
+
+typedef struct {
+    int32_t k;
+    int64_t c;
+} cal_fixed_t;
+
+static cal_fixed_t a_adc_fix, a_dac_fix, v_adc_fix, v_dac_fix, vin_adc_fix;
+/** Inverses of the ADC conversions, used for the I and V limits */
+static cal_fixed_t a_limit_fix, v_limit_fix;
+
 /** not static as it is referred to from hw.c for performance reasons */
 uint32_t pwrctl_i_limit_raw;
 uint32_t pwrctl_v_limit_raw;
+/** I_out and V_out conversions for the energy integration in the ADC ISR */
+pwrctl_isr_cal_t pwrctl_i_out_isr_cal;
+pwrctl_isr_cal_t pwrctl_v_out_isr_cal;
+
+#ifdef CONFIG_VOUT_REGULATION
+/** The regulation trims the V_out DAC setting with a PI loop run once every
+  * 2^VOUT_REG_SHIFT ADC samples, on the sum of the V_out samples. The
+  * correction has VOUT_REG_Q fractional bits and is limited to VOUT_REG_MAX
+  * DAC LSB as the loop is there to take out calibration errors and drift,
+  * not to replace the analog regulation.
+  */
+#define VOUT_REG_SHIFT     (5)  /** 32 samples, about 650 Hz */
+#define VOUT_REG_Q         (8)
+#define VOUT_REG_KP_SHIFT  (2)  /** Kp = 1/4 */
+#define VOUT_REG_KI_SHIFT  (4)  /** Ki = 1/16 per step */
+#define VOUT_REG_MAX       (64 << VOUT_REG_Q)
+/** Larger errors are the output settling or CC mode, hold the correction */
+#define VOUT_REG_WINDOW    (64 << VOUT_REG_Q)
+/** Largest change of the correction per step, 1 DAC LSB */
+#define VOUT_REG_SLEW      (1 << VOUT_REG_Q)
+
+/** Inverse of the V_out ADC conversion for the regulation target */
+static cal_fixed_t v_target_fix;
+/** DAC LSB per ADC LSB of V_out with 16 fractional bits */
+static int32_t reg_gain;
+/** Open loop DAC setting and expected sum of V_out samples for v_out */
+static volatile uint32_t reg_dac, reg_target;
+static int32_t reg_integral, reg_correction;
+static uint32_t reg_sum, reg_count;
+#endif // CONFIG_VOUT_REGULATION
+
+/**
+  * @brief Convert a float to fixed point with CAL_Q fractional bits
+  * @param value the value to convert
+  * @param max saturation limit of the magnitude
+  * @retval value in fixed point, rounded to nearest
+  */
+static int64_t to_fixed(float value, float max)
+{
+    if (value > max)
+        value = max;
+    else if (value < -max)
+        value = -max;
+    value *= CAL_ONE;
+    return (int64_t) (value < 0 ? value - 0.5f : value + 0.5f);
+}
+
+/**
+  * @brief Set up a fixed point conversion y = k * x + c
+  * @param cal the conversion to set up
+  * @param k scale
+  * @param c offset
+  * @retval none
+  */
+static void set_fixed(cal_fixed_t *cal, float k, float c)
+{
+    cal->k = to_fixed(k, (float) (INT32_MAX >> CAL_Q));
+    cal->c = to_fixed(c, (float) (INT32_MAX >> 1));
+}
+
+/**
+  * @brief Set up an ISR conversion from a fixed point conversion
+  * @param isr_cal the ISR conversion to set up
+  * @param cal the fixed point conversion
+  * @retval none
+  */
+static void set_isr_cal(pwrctl_isr_cal_t *isr_cal, const cal_fixed_t *cal)
+{
+    isr_cal->k = (cal->k + (1 << (CAL_Q - PWRCTL_ISR_Q - 1))) >> (CAL_Q - PWRCTL_ISR_Q);
+    /** CAL_HALF turns the truncating shift in the ISR into rounding */
+    isr_cal->c = (cal->c + CAL_HALF + (1 << (CAL_Q - PWRCTL_ISR_Q - 1))) >> (CAL_Q - PWRCTL_ISR_Q);
+}
+
+/**
+  * @brief Recalculate the fixed point coefficients from the float ones
+  * @retval none
+  */
+static void calc_fixed_coefs(void)
+{
+    set_fixed(&a_adc_fix, a_adc_k_coef, a_adc_c_coef);
+    set_fixed(&a_dac_fix, a_dac_k_coef, a_dac_c_coef);
+    set_fixed(&v_adc_fix, v_adc_k_coef, v_adc_c_coef);
+    set_fixed(&v_dac_fix, v_dac_k_coef, v_dac_c_coef);
+    set_fixed(&vin_adc_fix, vin_adc_k_coef, vin_adc_c_coef);
+    /** raw = (x - c) / k + 1 = x / k + (1 - c / k) */
+    set_fixed(&a_limit_fix, 1 / a_adc_k_coef, 1 - a_adc_c_coef / a_adc_k_coef);
+    set_fixed(&v_limit_fix, 1 / v_adc_k_coef, 1 - v_adc_c_coef / v_adc_k_coef);
+    set_isr_cal(&pwrctl_i_out_isr_cal, &a_adc_fix);
+    set_isr_cal(&pwrctl_v_out_isr_cal, &v_adc_fix);
+#ifdef CONFIG_VOUT_REGULATION
+    /** raw = (x - c) / k */
+    set_fixed(&v_target_fix, 1 / v_adc_k_coef, -v_adc_c_coef / v_adc_k_coef);
+    reg_gain = to_fixed(v_adc_k_coef * v_dac_k_coef, 255) >> (CAL_Q - 16);
+#endif // CONFIG_VOUT_REGULATION
+}
+
+/**
+  * @brief Apply a fixed point conversion to a value with fractional bits
+  * @param cal the conversion
+  * @param x the value to convert
+  * @param frac_bits number of fractional bits in x
+  * @retval k * x + c rounded to nearest, 0 if negative
+  */
+static uint32_t calc_fixed_frac(const cal_fixed_t *cal, uint32_t x, uint32_t frac_bits)
+{
+    int64_t value = (int64_t) cal->k * x + cal->c * ((int64_t) 1 << frac_bits);
+    if (value <= 0)
+        return 0;
+    else
+        return (value + (CAL_HALF << frac_bits)) >> (CAL_Q + frac_bits);
+}
+
+/**
+  * @brief Apply a fixed point conversion
+  * @param cal the conversion
+  * @param x the value to convert
+  * @retval k * x + c rounded to nearest, 0 if negative
+  */
+static uint32_t calc_fixed(const cal_fixed_t *cal, uint32_t x)
+{
+    return calc_fixed_frac(cal, x, 0);
+}
 
 /**
   * @brief Initialize the power control module
@@ -94,6 +235,7 @@ void pwrctl_init(past_t *past)
     if (past_read_unit(past, past_VIN_ADC_C, (const void**) &p, &length))
         vin_adc_c_coef = *p;
 
+    calc_fixed_coefs();
     pwrctl_enable_vout(false);
 }
 
@@ -106,12 +248,30 @@ bool pwrctl_set_vout(uint32_t value_mv)
 {
     /** @todo Check with max Vout, currently filtered by ui.c */
     v_out = value_mv;
+#ifdef CONFIG_VOUT_REGULATION
+    int64_t target = (int64_t) v_target_fix.k * v_out + v_target_fix.c;
+    uint32_t dac_base = pwrctl_calc_vout_dac(v_out);
+    target = target <= 0 ? 0 : target >> (CAL_Q - VOUT_REG_SHIFT);
+    /** The ADC ISR must not run the regulator on a mix of the old and new
+      * setpoint, nor write the DAC until we have */
+    nvic_disable_irq(NVIC_ADC1_2_IRQ);
+    reg_dac = dac_base;
+    reg_target = target;
+#endif // CONFIG_VOUT_REGULATION
     if (v_out_enabled) {
         /** Needed for the DPS5005 "communications version" (the one with BT/USB) */
+#ifdef CONFIG_VOUT_REGULATION
+        int32_t dac = reg_dac + ((reg_correction + (1 << (VOUT_REG_Q - 1))) >> VOUT_REG_Q);
+        DAC_DHR12R1(DAC1) = dac < 0 ? 0 : dac > 0xfff ? 0xfff : dac;
+#else
         DAC_DHR12R1(DAC1) = pwrctl_calc_vout_dac(v_out);
+#endif // CONFIG_VOUT_REGULATION
     } else {
         DAC_DHR12R1(DAC1) = 0;
     }
+#ifdef CONFIG_VOUT_REGULATION
+    nvic_enable_irq(NVIC_ADC1_2_IRQ);
+#endif // CONFIG_VOUT_REGULATION
     return true;
 }
 
@@ -212,17 +372,86 @@ void pwrctl_enable_vout(bool enable)
         gpio_clear(GPIOB, GPIO11);  // B11 is power control on '5005
 #endif
     } else {
+        pwrctl_cut_vout();
+      (void) pwrctl_set_vout(v_out);
+      (void) pwrctl_set_iout(i_out);
+    }
+}
+
+/**
+  * @brief Switch off the output stage and nothing else, for use by the
+  *        OCP/OVP interrupt where every cycle until cut-off counts
+  * @retval none
+  */
+void pwrctl_cut_vout(void)
+{
 #if defined(DPS5015) || defined(DPS5020)
-        //gpio_set(GPIOA, GPIO9);    // gpio_set(GPIOB, GPIO11);
-        gpio_clear(GPIOB, GPIO11); // B11 is fan control on '5015
-        gpio_set(GPIOC, GPIO13);   // C13 is power control on '5015
+    //gpio_set(GPIOA, GPIO9);    // gpio_set(GPIOB, GPIO11);
+    gpio_clear(GPIOB, GPIO11); // B11 is fan control on '5015
+    gpio_set(GPIOC, GPIO13);   // C13 is power control on '5015
 #else
-        gpio_set(GPIOB, GPIO11);  // B11 is power control on '5005
+    gpio_set(GPIOB, GPIO11);  // B11 is power control on '5005
 #endif
-      (void) pwrctl_set_vout(v_out);
-      (void) pwrctl_set_iout(i_out);
+    v_out_enabled = false;
+}
+
+#ifdef CONFIG_VOUT_REGULATION
+/**
+  * @brief Limit a value to +/- max
+  * @param value the value to limit
+  * @param max the limit
+  * @retval the limited value
+  */
+static inline int32_t reg_clamp(int32_t value, int32_t max)
+{
+    return value > max ? max : value < -max ? -max : value;
+}
+
+/**
+  * @brief Run the V_out regulation, called from the ADC ISR with every V_out
+  *        sample
+  * @param v_out_raw raw V_out ADC sample
+  * @retval none
+  */
+void pwrctl_vout_regulate(uint16_t v_out_raw)
+{
+    reg_sum += v_out_raw;
+    if (++reg_count < (1 << VOUT_REG_SHIFT))
+        return;
+    int32_t error = (int32_t) reg_target - (int32_t) reg_sum;
+    reg_sum = 0;
+    reg_count = 0;
+
+    /** Nothing to regulate when off, and the function generator owns the DAC
+      * when it is fed by DMA */
+    if (!v_out_enabled || (DAC_CR(DAC1) & DAC_CR_DMAEN1)) {
+        reg_integral = 0;
+        reg_correction = 0;
+        return;
+    }
+
+    /** Error in DAC LSB */
+    int32_t e = ((int64_t) error * reg_gain) >> (16 + VOUT_REG_SHIFT - VOUT_REG_Q);
+    if (e > VOUT_REG_WINDOW || e < -VOUT_REG_WINDOW)
+        return;
+
+    int32_t integral = reg_clamp(reg_integral + (e >> VOUT_REG_KI_SHIFT), VOUT_REG_MAX);
+    int32_t correction = reg_clamp(integral + (e >> VOUT_REG_KP_SHIFT), VOUT_REG_MAX);
+    correction = reg_correction + reg_clamp(correction - reg_correction, VOUT_REG_SLEW);
+
+    int32_t dac = reg_dac + ((correction + (1 << (VOUT_REG_Q - 1))) >> VOUT_REG_Q);
+    if (dac < 0) {
+        dac = 0;
+    } else if (dac > 0xfff) {
+        dac = 0xfff;
+    } else {
+        /** Only integrate while the DAC can follow */
+        reg_integral = integral;
     }
+    reg_correction = correction;
+    DAC_DHR12R1(DAC1) = dac;
 }
+#endif // CONFIG_VOUT_REGULATION
 
 /**
   * @brief Return power output status
@@ -240,11 +469,7 @@ bool pwrctl_vout_enabled(void)
   */
 uint32_t pwrctl_calc_vin(uint16_t raw)
 {
-    float value = vin_adc_k_coef * raw + vin_adc_c_coef;
-    if (value <= 0)
-        return 0;
-    else
-        return value + 0.5f; /** Add 0.5f to value so it is correctly rounded when it is truncated */
+    return calc_fixed(&vin_adc_fix, raw);
 }
 
 /**
@@ -254,11 +479,37 @@ uint32_t pwrctl_calc_vin(uint16_t raw)
   */
 uint32_t pwrctl_calc_vout(uint16_t raw)
 {
-    float value = v_adc_k_coef * raw + v_adc_c_coef;
-    if (value <= 0)
-        return 0;
-    else
-        return value + 0.5f; /** Add 0.5f to value so it is correctly rounded when it is truncated */
+    return calc_fixed(&v_adc_fix, raw);
+}
+
+/**
+  * @brief Calculate V_in based on filtered ADC measurement
+  * @param filtered value from hw_get_adc_filtered
+  * @retval corresponding voltage in milli volt
+  */
+uint32_t pwrctl_calc_vin_filtered(uint16_t filtered)
+{
+    return calc_fixed_frac(&vin_adc_fix, filtered, ADC_FILTER_FRAC_BITS);
+}
+
+/**
+  * @brief Calculate V_out based on filtered ADC measurement
+  * @param filtered value from hw_get_adc_filtered
+  * @retval corresponding voltage in milli volt
+  */
+uint32_t pwrctl_calc_vout_filtered(uint16_t filtered)
+{
+    return calc_fixed_frac(&v_adc_fix, filtered, ADC_FILTER_FRAC_BITS);
+}
+
+/**
+  * @brief Calculate I_out based on filtered ADC measurement
+  * @param filtered value from hw_get_adc_filtered
+  * @retval corresponding current in milliampere
+  */
+uint32_t pwrctl_calc_iout_filtered(uint16_t filtered)
+{
+    return calc_fixed_frac(&a_adc_fix, filtered, ADC_FILTER_FRAC_BITS);
 }
 
 /**
@@ -268,13 +519,8 @@ uint32_t pwrctl_calc_vout(uint16_t raw)
   */
 uint16_t pwrctl_calc_vout_dac(uint32_t v_out_mv)
 {
-    float value = v_dac_k_coef * v_out_mv + v_dac_c_coef;
-    if (value <= 0)
-        return 0;
-    else if (value >= 0xfff)
-        return 0xfff; /** 12 bits */
-    else
-        return value + 0.5f; /** Add 0.5f to value so correct rounding is done when truncated */
+    uint32_t value = calc_fixed(&v_dac_fix, v_out_mv);
+    return value >= 0xfff ? 0xfff : value; /** 12 bits */
 }
 
 /**
@@ -284,11 +530,7 @@ uint16_t pwrctl_calc_vout_dac(uint32_t v_out_mv)
   */
 uint32_t pwrctl_calc_iout(uint16_t raw)
 {
-    float value = a_adc_k_coef * raw + a_adc_c_coef;
-    if (value <= 0)
-        return 0;
-    else
-        return value + 0.5f; /** Add 0.5f to value so correct rounding is done when truncated */
+    return calc_fixed(&a_adc_fix, raw);
 }
 
 /**
@@ -298,11 +540,7 @@ uint32_t pwrctl_calc_iout(uint16_t raw)
   */
 uint32_t pwrctl_calc_ilimit_adc(uint16_t i_limit_ma)
 {
-    float value = (i_limit_ma - a_adc_c_coef) / a_adc_k_coef + 1;
-    if (value <= 0)
-        return 0;
-    else
-        return value + 0.5f; // Add 0.5 so it is correctly rounded when it is truncated
+    return calc_fixed(&a_limit_fix, i_limit_ma);
 }
 
 /**
@@ -312,11 +550,7 @@ uint32_t pwrctl_calc_ilimit_adc(uint16_t i_limit_ma)
   */
 uint32_t pwrctl_calc_vlimit_adc(uint16_t v_limit_mv)
 {
-    float value = (v_limit_mv - v_adc_c_coef) / v_adc_k_coef + 1;
-    if (value <= 0)
-        return 0;
-    else
-        return value + 0.5f; // Add 0.5 so it is correctly rounded when it is truncated
+    return calc_fixed(&v_limit_fix, v_limit_mv);
 }
 
 /**
@@ -328,11 +562,6 @@ uint32_t pwrctl_calc_vlimit_adc(uint16_t v_limit_mv)
   */
 uint16_t pwrctl_calc_iout_dac(uint32_t i_out_ma)
 {
-    float value = a_dac_k_coef * i_out_ma + a_dac_c_coef;
-    if (value <= 0)
-        return 0;
-    else if (value >= 0xfff)
-        return 0xfff; /** 12 bits */
-    else
-        return value + 0.5f; /** Add 0.5f to value so correct rounding is done when truncated */
+    uint32_t value = calc_fixed(&a_dac_fix, i_out_ma);
+    return value >= 0xfff ? 0xfff : value; /** 12 bits */
 }
@@ -31,6 +31,19 @@
 
 extern uint32_t pwrctl_i_limit_raw;
 extern uint32_t pwrctl_v_limit_raw;
+
+/** Fractional bits of the ADC conversions used by the ADC ISR */
+#define PWRCTL_ISR_Q  (12)
+
+/** An ADC conversion y = (k * x + c) >> PWRCTL_ISR_Q cheap enough to run
+  * on every sample, c includes the rounding */
+typedef struct {
+    int32_t k;
+    int32_t c;
+} pwrctl_isr_cal_t;
+
+extern pwrctl_isr_cal_t pwrctl_i_out_isr_cal;
+extern pwrctl_isr_cal_t pwrctl_v_out_isr_cal;
 extern float a_adc_k_coef;
 extern float a_adc_c_coef;
 extern float a_dac_k_coef;
@@ -107,6 +120,22 @@ uint32_t pwrctl_get_vlimit(void);
   */
 void pwrctl_enable_vout(bool enable);
 
+/**
+  * @brief Switch off the output stage without touching the DACs
+  * @retval none
+  */
+void pwrctl_cut_vout(void);
+
+#ifdef CONFIG_VOUT_REGULATION
+/**
+  * @brief Run the closed loop V_out regulation, trimming the V_out DAC
+  *        until the measured V_out matches the setting
+  * @param v_out_raw raw V_out ADC sample, to be called for every sample
+  * @retval none
+  */
+void pwrctl_vout_regulate(uint16_t v_out_raw);
+#endif // CONFIG_VOUT_REGULATION
+
 /**
   * @brief Return power output status
   * @retval true if power output is enabled
@@ -127,6 +156,27 @@ uint32_t pwrctl_calc_vin(uint16_t raw);
   */
 uint32_t pwrctl_calc_vout(uint16_t raw);
 
+/**
+  * @brief Calculate V_in based on filtered ADC measurement
+  * @param filtered value from hw_get_adc_filtered
+  * @retval corresponding voltage in millivolt
+  */
+uint32_t pwrctl_calc_vin_filtered(uint16_t filtered);
+
+/**
+  * @brief Calculate V_out based on filtered ADC measurement
+  * @param filtered value from hw_get_adc_filtered
+  * @retval corresponding voltage in millivolt
+  */
+uint32_t pwrctl_calc_vout_filtered(uint16_t filtered);
+
+/**
+  * @brief Calculate I_out based on filtered ADC measurement
+  * @param filtered value from hw_get_adc_filtered
+  * @retval corresponding current in milliampere
+  */
+uint32_t pwrctl_calc_iout_filtered(uint16_t filtered);
+
 /**
   * @brief Calculate DAC setting for requested V_out
   * @param v_out_mv requested output voltage
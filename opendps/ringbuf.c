@@ -37,9 +37,6 @@ void ringbuf_init(ringbuf_t *ring, uint8_t *buf, uint32_t size)
 	ring->size = size/2;
 	ring->read = 0;
 	ring->write = 0;
-#ifdef DPS_EMULATOR
-	pthread_mutex_init(&ring->mutex, NULL);
-#endif // DPS_EMULATOR
 }
 
 /**
@@ -51,17 +48,11 @@ void ringbuf_init(ringbuf_t *ring, uint8_t *buf, uint32_t size)
 bool ringbuf_put(ringbuf_t *ring, uint16_t word)
 {
     bool success = false;
-#ifdef DPS_EMULATOR
-	pthread_mutex_lock(&ring->mutex);
-#endif // DPS_EMULATOR
 	if (((ring->write + 1) % ring->size) != ring->read) {
 		ring->buf[ring->write++] = word;
 		ring->write %= ring->size;
 		success = true;
 	}
-#ifdef DPS_EMULATOR
-	pthread_mutex_unlock(&ring->mutex);
-#endif // DPS_EMULATOR
 	return success;
 }
 
@@ -74,16 +65,10 @@ bool ringbuf_put(ringbuf_t *ring, uint16_t word)
 bool ringbuf_get(ringbuf_t *ring, uint16_t *word)
 {
     bool success = false;
-#ifdef DPS_EMULATOR
-	pthread_mutex_lock(&ring->mutex);
-#endif // DPS_EMULATOR
 	if (ring->read != ring->write) {
 		*word = ring->buf[ring->read++];
 		ring->read %= ring->size;
 		success = true;
 	}
-#ifdef DPS_EMULATOR
-	pthread_mutex_unlock(&ring->mutex);
-#endif // DPS_EMULATOR
 	return success;
 }
@@ -52,7 +52,7 @@ static void calibration_tick(void);
 static void activated(void);
 static void past_save(past_t *past);
 static void past_restore(past_t *past);
-static set_param_status_t set_parameter(char *name, char *value);
+static set_param_status_t set_parameter(char *name, char *value, bool dry_run);
 static set_param_status_t get_parameter(char *name, char *value, uint32_t value_len);
 
 #define SCREEN_ID  (3)
@@ -216,10 +216,11 @@ ui_screen_t calibration_screen = {
  *
  * @param[in]  name   name of parameter
  * @param[in]  value  value of parameter as a string - always in SI units
+ * @param[in]  dry_run  only validate the parameter, do not apply it
  *
  * @retval     set_param_status_t status code
  */
-static set_param_status_t set_parameter(char *name, char *value)
+static set_param_status_t set_parameter(char *name, char *value, bool dry_run)
 {
     int32_t ivalue = atoi(value);
     if (strcmp("V_DAC", name) == 0) {
@@ -227,6 +228,9 @@ static set_param_status_t set_parameter(char *name, char *value)
             emu_printf("[Calibration] V_DAC %d is out of range (min:%d max:%d)\n", ivalue, calibration_v_dac.min, calibration_v_dac.max);
             return ps_range_error;
         }
+        if (dry_run) {
+            return ps_ok;
+        }
         emu_printf("[Calibration] Setting V_DAC to %d\n", ivalue);
         calibration_v_dac.value = ivalue;
         v_dac_changed(&calibration_v_dac);
@@ -236,6 +240,9 @@ static set_param_status_t set_parameter(char *name, char *value)
             emu_printf("[Calibration] A_DAC %d is out of range (min:%d max:%d)\n", ivalue, calibration_a_dac.min, calibration_a_dac.max);
             return ps_range_error;
         }
+        if (dry_run) {
+            return ps_ok;
+        }
         emu_printf("[Calibration] Setting A_DAC to %d\n", ivalue);
         calibration_a_dac.value = ivalue;
         a_dac_changed(&calibration_a_dac);
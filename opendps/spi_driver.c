@@ -28,6 +28,7 @@
 #include <nvic.h>
 #include <spi.h>
 #include <errno.h>
+#include <string.h>
 #include "spi_driver.h"
 #include "hw.h"
 
@@ -43,6 +44,49 @@ static volatile spi_status_t dma_status;
 /** The DPS5005 has NSS grounded meaning we do not have to toggle it */
 #define SPI_NSS_GROUNDED
 
+/** Number of queued transfers, must be a power of two. A window setup is
+  * five transfers and the pixels or fill going into it one more. The next
+  * glyph waits for its blit buffer anyway, so anything beyond one window
+  * only lets a run of fills get further ahead of the DMA. */
+#ifndef CONFIG_SPI_QUEUE_LEN
+ #define CONFIG_SPI_QUEUE_LEN  (8)
+#endif
+#define SPI_QUEUE_MASK  (CONFIG_SPI_QUEUE_LEN - 1)
+_Static_assert((CONFIG_SPI_QUEUE_LEN & SPI_QUEUE_MASK) == 0, "CONFIG_SPI_QUEUE_LEN must be a power of two");
+
+/** Max length of a single DMA transfer */
+#define SPI_MAX_DMA_LEN  (0xffff)
+
+/** The display interrupts run below the ADC ISR */
+#define SPI_IRQ_PRIORITY  (3 << 4)
+
+/** A queued transfer */
+typedef struct {
+    const uint8_t *buf; /** Next byte to send, points to inline_data for copied transfers */
+    uint32_t len; /** Bytes left to send, or 16 bit words left for fills */
+    uint8_t inline_data[SPI_QUEUE_INLINE_LEN];
+    bool data; /** Level of the TFT A0 (data/command) line */
+    bool fill; /** Repeat fill_value in 16 bit frames */
+    uint16_t fill_value;
+} spi_op_t;
+
+static spi_op_t queue[CONFIG_SPI_QUEUE_LEN];
+/** Number of transfers queued, only written by the main loop */
+static volatile uint32_t queue_head;
+/** Number of transfers completed, only written by the DMA ISR */
+static volatile uint32_t queue_tail;
+/** True while the DMA is working its way through the queue */
+static volatile bool queue_running;
+/** Length of the DMA transfer currently running */
+static uint32_t segment_len;
+/** Current level of the TFT A0 line */
+static bool a0_level;
+/** True while the SPI is in 16 bit frame mode */
+static bool frame_16bit;
+/** Source for fill transfers, the DMA reads it without incrementing.
+    Only one transfer is in flight at any time */
+static uint16_t fill_word;
+
 /**
   * @brief Initialize the SPI driver
   * @retval None
@@ -50,6 +94,9 @@ static volatile spi_status_t dma_status;
 void spi_init(void)
 {
     dma_status = spi_idle;
+    queue_head = queue_tail = 0;
+    queue_running = false;
+    frame_16bit = false;
 
     rcc_periph_clock_enable(RCC_SPI2);
     rcc_periph_clock_enable(RCC_DMA1);
@@ -60,10 +107,240 @@ void spi_init(void)
     spi_enable_software_slave_management(SPI2);
     spi_set_nss_high(SPI2);
     spi_enable(SPI2);
-    nvic_set_priority(NVIC_DMA1_CHANNEL4_IRQ, 0);
+    nvic_set_priority(NVIC_DMA1_CHANNEL4_IRQ, SPI_IRQ_PRIORITY);
     nvic_enable_irq(NVIC_DMA1_CHANNEL4_IRQ);
-    nvic_set_priority(NVIC_DMA1_CHANNEL5_IRQ, 0);
+    nvic_set_priority(NVIC_DMA1_CHANNEL5_IRQ, SPI_IRQ_PRIORITY);
+    nvic_enable_irq(NVIC_DMA1_CHANNEL5_IRQ);
+    nvic_set_priority(NVIC_SPI2_IRQ, SPI_IRQ_PRIORITY);
+    nvic_enable_irq(NVIC_SPI2_IRQ);
+}
+
+/**
+  * @brief Mask the interrupts advancing the transfer queue
+  * @retval None
+  */
+static void queue_irq_disable(void)
+{
+    nvic_disable_irq(NVIC_DMA1_CHANNEL5_IRQ);
+    nvic_disable_irq(NVIC_SPI2_IRQ);
+}
+
+/**
+  * @brief Unmask the interrupts advancing the transfer queue
+  * @retval None
+  */
+static void queue_irq_enable(void)
+{
     nvic_enable_irq(NVIC_DMA1_CHANNEL5_IRQ);
+    nvic_enable_irq(NVIC_SPI2_IRQ);
+}
+
+/**
+  * @brief Wait for the last byte to leave the shift register
+  *        in accordance with RM0008 (r16) p.713
+  * @retval None
+  */
+static void wait_spi_idle(void)
+{
+    while (!(SPI_SR(SPI2) & SPI_SR_TXE)) ;
+    while (SPI_SR(SPI2) & SPI_SR_BSY) ;
+}
+
+/**
+  * @brief Switch the SPI between 8 and 16 bit frames
+  * @note DFF may only be changed with the SPI disabled and idle, the caller
+  *       makes sure it is
+  * @param enable true for 16 bit frames
+  * @retval None
+  */
+static void set_frame_16bit(bool enable)
+{
+    if (enable == frame_16bit) {
+        return;
+    }
+    spi_disable(SPI2);
+    if (enable) {
+        spi_set_dff_16bit(SPI2);
+    } else {
+        spi_set_dff_8bit(SPI2);
+    }
+    spi_enable(SPI2);
+    frame_16bit = enable;
+}
+
+/**
+  * @brief Start the next DMA transfer of the transfer at the queue tail
+  * @note Fills send one 16 bit word per DMA transfer from a fixed address,
+  *       so a whole rectangle is a single DMA transfer of up to 65535 pixels
+  * @retval None
+  */
+static void start_segment(spi_op_t *op)
+{
+    segment_len = op->len < SPI_MAX_DMA_LEN ? op->len : SPI_MAX_DMA_LEN;
+    if (op->fill) {
+        dma_set_peripheral_size(DMA1, DMA_CHANNEL5, DMA_CCR_PSIZE_16BIT);
+        dma_set_memory_size(DMA1, DMA_CHANNEL5, DMA_CCR_MSIZE_16BIT);
+        dma_disable_memory_increment_mode(DMA1, DMA_CHANNEL5);
+        dma_set_memory_address(DMA1, DMA_CHANNEL5, (uint32_t) &fill_word);
+    } else {
+        dma_set_peripheral_size(DMA1, DMA_CHANNEL5, DMA_CCR_PSIZE_8BIT);
+        dma_set_memory_size(DMA1, DMA_CHANNEL5, DMA_CCR_MSIZE_8BIT);
+        dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL5);
+        dma_set_memory_address(DMA1, DMA_CHANNEL5, (uint32_t) op->buf);
+    }
+    dma_set_number_of_data(DMA1, DMA_CHANNEL5, segment_len);
+    dma_enable_channel(DMA1, DMA_CHANNEL5);
+    spi_enable_tx_dma(SPI2);
+}
+
+/**
+  * @brief Start the transfer at the queue tail, or stop if the queue is empty
+  * @note Called with the queue IRQs masked or from their ISRs. Changing A0 or
+  *       the frame size or stopping needs the previous transfer to be on the
+  *       wire, if the bus is not known to be idle the SPI interrupt calls back
+  *       once it is.
+  * @param idle true if the bus is idle
+  * @retval None
+  */
+static void start_next(bool idle)
+{
+    if (queue_tail == queue_head) {
+        if (!idle) {
+            spi_enable_tx_buffer_empty_interrupt(SPI2);
+            return;
+        }
+        /** spi_dma_transceive expects 8 bit frames */
+        set_frame_16bit(false);
+#ifdef TFT_CSN_PORT
+        gpio_set(TFT_CSN_PORT, TFT_CSN_PIN);
+#endif
+        queue_running = false;
+        return;
+    }
+
+    spi_op_t *op = &queue[queue_tail & SPI_QUEUE_MASK];
+    if (op->data != a0_level || op->fill != frame_16bit) {
+        if (!idle) {
+            spi_enable_tx_buffer_empty_interrupt(SPI2);
+            return;
+        }
+        a0_level = op->data;
+        if (a0_level) {
+            gpio_set(TFT_A0_PORT, TFT_A0_PIN);
+        } else {
+            gpio_clear(TFT_A0_PORT, TFT_A0_PIN);
+        }
+        set_frame_16bit(op->fill);
+    }
+    if (op->fill) {
+        fill_word = op->fill_value;
+    }
+    start_segment(op);
+}
+
+/**
+  * @brief Add a transfer to the queue, starting the DMA if it is idle
+  * @retval ticket of the transfer
+  */
+static uint32_t queue_push(const uint8_t *buf, uint32_t len, bool data, bool fill)
+{
+    /** Only block if the queue is full */
+    while (queue_head - queue_tail >= CONFIG_SPI_QUEUE_LEN) ;
+
+    spi_op_t *op = &queue[queue_head & SPI_QUEUE_MASK];
+    op->buf = buf ? buf : op->inline_data;
+    op->len = len;
+    op->data = data;
+    op->fill = fill;
+
+    queue_irq_disable();
+    queue_head++;
+    if (!queue_running) {
+        queue_running = true;
+        dma_channel_reset(DMA1, DMA_CHANNEL5);
+        dma_set_peripheral_address(DMA1, DMA_CHANNEL5, (uint32_t)&SPI2_DR);
+        dma_set_read_from_memory(DMA1, DMA_CHANNEL5);
+        dma_set_priority(DMA1, DMA_CHANNEL5, DMA_CCR_PL_HIGH);
+        dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL5);
+        a0_level = gpio_get(TFT_A0_PORT, TFT_A0_PIN) != 0;
+#ifdef TFT_CSN_PORT
+        gpio_clear(TFT_CSN_PORT, TFT_CSN_PIN);
+#endif
+        /** The queue only stops once the bus is idle */
+        start_next(true);
+    }
+    queue_irq_enable();
+    return queue_head;
+}
+
+/**
+  * @brief Queue a transfer, the buffer is sent in place
+  * @param buf transmit buffer, must stay untouched until the ticket is done
+  * @param len transmit buffer size
+  * @param data true to send with TFT A0 high (data), false for low (command)
+  * @retval ticket of the transfer
+  */
+uint32_t spi_queue_write(const uint8_t *buf, uint32_t len, bool data)
+{
+    if (!len) {
+        return queue_head;
+    }
+    return queue_push(buf, len, data, false);
+}
+
+/**
+  * @brief Queue a short transfer, the buffer is copied
+  * @param buf transmit buffer
+  * @param len transmit buffer size, at most SPI_QUEUE_INLINE_LEN
+  * @param data true to send with TFT A0 high (data), false for low (command)
+  * @retval ticket of the transfer
+  */
+uint32_t spi_queue_copy(const uint8_t *buf, uint32_t len, bool data)
+{
+    if (!len || len > SPI_QUEUE_INLINE_LEN) {
+        return queue_head;
+    }
+    /** The slot is free once there is room in the queue */
+    while (queue_head - queue_tail >= CONFIG_SPI_QUEUE_LEN) ;
+    memcpy(queue[queue_head & SPI_QUEUE_MASK].inline_data, buf, len);
+    return queue_push(0, len, data, false);
+}
+
+/**
+  * @brief Queue sending the same 16 bit value, MSB first, with TFT A0 high
+  * @note The value is sent in 16 bit SPI frames from a single word without
+  *       memory increment, counts above 65535 are chained in the DMA ISR
+  * @param value the value
+  * @param count number of times to send it
+  * @retval ticket of the transfer
+  */
+uint32_t spi_queue_fill(uint16_t value, uint32_t count)
+{
+    if (!count) {
+        return queue_head;
+    }
+    while (queue_head - queue_tail >= CONFIG_SPI_QUEUE_LEN) ;
+    queue[queue_head & SPI_QUEUE_MASK].fill_value = value;
+    return queue_push(0, count, true, true);
+}
+
+/**
+  * @brief Check if a queued transfer has been sent
+  * @param ticket the ticket returned when the transfer was queued
+  * @retval true if the transfer is done
+  */
+bool spi_queue_done(uint32_t ticket)
+{
+    return (int32_t) (queue_tail - ticket) >= 0;
+}
+
+/**
+  * @brief Wait for all queued transfers to be sent
+  * @retval None
+  */
+void spi_queue_flush(void)
+{
+    while (queue_running) ;
 }
 
 /**
@@ -81,6 +358,9 @@ bool spi_dma_transceive(uint8_t *tx_buf, uint32_t tx_len, uint8_t *rx_buf, uint3
         return false;
     }
 
+    /** Queued transfers go first */
+    spi_queue_flush();
+
     dma_channel_reset(DMA1, DMA_CHANNEL4);
     dma_channel_reset(DMA1, DMA_CHANNEL5);
 
@@ -138,8 +418,7 @@ bool spi_dma_transceive(uint8_t *tx_buf, uint32_t tx_len, uint8_t *rx_buf, uint3
     // Wait until DMA completed in accordance with RM0008 (r16) p.713
     /** @todo Add timeout for SPI transmission */
     while (dma_status != spi_idle) ;
-    while (!(SPI_SR(SPI2) & SPI_SR_TXE)) ;
-    while (SPI_SR(SPI2) & SPI_SR_BSY) ;
+    wait_spi_idle();
 
 #ifdef TFT_CSN_PORT
     gpio_set(TFT_CSN_PORT, TFT_CSN_PIN);
@@ -158,9 +437,7 @@ bool spi_dma_transceive(uint8_t *tx_buf, uint32_t tx_len, uint8_t *rx_buf, uint3
   */
 void dma1_channel4_isr(void)
 {
-    if ((DMA1_ISR &DMA_ISR_TCIF2) != 0) {
-        DMA1_IFCR |= DMA_IFCR_CTCIF2;
-    }
+    dma_clear_interrupt_flags(DMA1, DMA_CHANNEL4, DMA_TCIF | DMA_GIF);
     dma_disable_transfer_complete_interrupt(DMA1, DMA_CHANNEL4);
     spi_disable_rx_dma(SPI2);
     dma_disable_channel(DMA1, DMA_CHANNEL4);
@@ -168,16 +445,53 @@ void dma1_channel4_isr(void)
 }
 
 /**
-  * @brief SPI TX DMA handler
+  * @brief SPI TX DMA handler, advances the transfer queue
   * @retval None
   */
 void dma1_channel5_isr(void)
 {
-    if ((DMA1_ISR &DMA_ISR_TCIF3) != 0) {
-        DMA1_IFCR |= DMA_IFCR_CTCIF3;
-    }
-    dma_disable_transfer_complete_interrupt(DMA1, DMA_CHANNEL5);
+    dma_clear_interrupt_flags(DMA1, DMA_CHANNEL5, DMA_TCIF | DMA_GIF);
     spi_disable_tx_dma(SPI2);
     dma_disable_channel(DMA1, DMA_CHANNEL5);
-    dma_status &= ~spi_tx_running;
+
+    if (!queue_running) {
+        /** A synchronous spi_dma_transceive */
+        dma_disable_transfer_complete_interrupt(DMA1, DMA_CHANNEL5);
+        dma_status &= ~spi_tx_running;
+        return;
+    }
+
+    spi_op_t *op = &queue[queue_tail & SPI_QUEUE_MASK];
+    op->len -= segment_len;
+    if (op->len) {
+        if (!op->fill) {
+            op->buf += segment_len;
+        }
+        start_segment(op);
+    } else {
+        queue_tail++;
+        start_next(false);
+    }
+}
+
+/**
+  * @brief SPI interrupt, waits out the last frames of the queue transfer
+  *        that just completed without spinning
+  * @note TXE is enabled first, then RXNE which is set as each frame leaves
+  *       the shift register. Nothing reads the received data, so reading DR
+  *       and SR clears the RXNE and OVR left behind by earlier frames.
+  * @retval None
+  */
+void spi2_isr(void)
+{
+    spi_disable_tx_buffer_empty_interrupt(SPI2);
+    (void) SPI_DR(SPI2);
+    (void) SPI_SR(SPI2);
+    if ((SPI_SR(SPI2) & (SPI_SR_TXE | SPI_SR_BSY)) != SPI_SR_TXE) {
+        /** Frames are still on the wire, RXNE comes once the next one is out */
+        spi_enable_rx_buffer_not_empty_interrupt(SPI2);
+        return;
+    }
+    spi_disable_rx_buffer_not_empty_interrupt(SPI2);
+    start_next(true);
 }
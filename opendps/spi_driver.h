@@ -25,8 +25,12 @@
 #ifndef __SPI_DRIVER_H__
 #define __SPI_DRIVER_H__
 
+#include <stdint.h>
 #include <stdbool.h>
 
+/** Max number of bytes spi_queue_copy accepts */
+#define SPI_QUEUE_INLINE_LEN  (4)
+
 /**
   * @brief Initialize the SPI driver
   * @retval None
@@ -44,4 +48,52 @@ void spi_init(void);
   */
 bool spi_dma_transceive(uint8_t *tx_buf, uint32_t tx_len, uint8_t *rx_buf, uint32_t rx_len);
 
+/*
+ * The transfer queue lets the TFT driver hand over transfers without waiting
+ * for the SPI bus. Transfers are sent in order by the TX DMA and the queue is
+ * advanced from its ISR, or from the SPI ISR once the bus is idle when A0 or
+ * the frame size is to change. The caller only blocks when the queue is full. Each transfer sets
+ * the TFT A0 line, so commands and data may be mixed freely.
+ */
+
+/**
+  * @brief Queue a transfer, the buffer is sent in place
+  * @param buf transmit buffer, must stay untouched until the ticket is done
+  * @param len transmit buffer size
+  * @param data true to send with TFT A0 high (data), false for low (command)
+  * @retval ticket of the transfer
+  */
+uint32_t spi_queue_write(const uint8_t *buf, uint32_t len, bool data);
+
+/**
+  * @brief Queue a short transfer, the buffer is copied
+  * @param buf transmit buffer
+  * @param len transmit buffer size, at most SPI_QUEUE_INLINE_LEN
+  * @param data true to send with TFT A0 high (data), false for low (command)
+  * @retval ticket of the transfer
+  */
+uint32_t spi_queue_copy(const uint8_t *buf, uint32_t len, bool data);
+
+/**
+  * @brief Queue sending the same 16 bit value, MSB first, with TFT A0 high
+  * @note Costs one DMA transfer per 65535 values regardless of size
+  * @param value the value
+  * @param count number of times to send it
+  * @retval ticket of the transfer
+  */
+uint32_t spi_queue_fill(uint16_t value, uint32_t count);
+
+/**
+  * @brief Check if a queued transfer has been sent
+  * @param ticket the ticket returned when the transfer was queued
+  * @retval true if the transfer is done
+  */
+bool spi_queue_done(uint32_t ticket);
+
+/**
+  * @brief Wait for all queued transfers to be sent
+  * @retval None
+  */
+void spi_queue_flush(void);
+
 #endif // __SPI_DRIVER_H__
@@ -0,0 +1,127 @@
+/** Benchmarks the CONFIG_CRC16_TABLE_BITS variants of crc16.c against each
+  * other on the host and checks they agree. Mind that these
+  * are host cycles, a superscalar CPU hides the extra shifts that the M3 has to
+  * execute one by one.
+  */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+ #include <x86intrin.h>
+#endif
+
+#define BENCH_LENGTH  (60 * 1024) /** About the size of an application image */
+#define BENCH_ROUNDS  (20)
+
+/** Include crc16.c once per variant with the functions renamed */
+#define CONFIG_CRC16_TABLE_BITS  0
+#define crc16_add  crc16_add_shift
+#define crc16      crc16_shift
+#include "../crc16.c"
+#undef crc16_add
+#undef crc16
+#undef CONFIG_CRC16_TABLE_BITS
+
+#define CONFIG_CRC16_TABLE_BITS  8
+#define crc16_add  crc16_add_table
+#define crc16      crc16_table_lookup
+#include "../crc16.c"
+#undef crc16_add
+#undef crc16
+#undef CONFIG_CRC16_TABLE_BITS
+
+#define CONFIG_CRC16_TABLE_BITS  4
+#define crc16_add  crc16_add_nibble
+#define crc16      crc16_nibble
+#include "../crc16.c"
+#undef crc16_add
+#undef crc16
+#undef CONFIG_CRC16_TABLE_BITS
+
+uint32_t g_num_fail, g_num_pass;
+
+typedef struct {
+    const char *name;
+    uint16_t (*crc)(uint8_t *data, uint16_t length);
+    uint16_t (*add)(uint16_t crc, uint8_t byte);
+} variant_t;
+
+static const variant_t variants[] = {
+    { "shift/xor", &crc16_shift, &crc16_add_shift },
+    { "table", &crc16_table_lookup, &crc16_add_table },
+    { "nibble", &crc16_nibble, &crc16_add_nibble },
+};
+
+static uint8_t buffer[BENCH_LENGTH];
+
+static void check(const char *what, const char *name, uint16_t crc, uint16_t expected)
+{
+    if (crc == expected) {
+        g_num_pass++;
+    } else {
+        g_num_fail++;
+        printf("%s %s: got 0x%04x, expected 0x%04x\n", name, what, crc, expected);
+    }
+}
+
+/** Cycles where available, otherwise nanoseconds */
+static uint64_t now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+int main(int argc, char const *argv[])
+{
+    (void) argc;
+    (void) argv;
+    uint8_t check_string[] = "123456789";
+    uint16_t reference;
+
+    srand(1);
+    for (uint32_t i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = rand();
+    }
+    reference = crc16_shift(buffer, sizeof(buffer));
+
+    for (uint32_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        const variant_t *variant = &variants[v];
+        uint16_t crc = 0;
+
+        /** The CRC-16/XMODEM check value */
+        check("check", variant->name, variant->crc(check_string, 9), 0x31c3);
+        check("buffer", variant->name, variant->crc(buffer, sizeof(buffer)), reference);
+        for (uint32_t i = 0; i < sizeof(buffer); i++) {
+            crc = variant->add(crc, buffer[i]);
+        }
+        check("streaming", variant->name, crc, reference);
+
+        /** Best of a number of rounds to keep other processes out of it */
+        uint64_t best = UINT64_MAX;
+        for (uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+            uint64_t start = now();
+            crc = variant->crc(buffer, sizeof(buffer));
+            uint64_t elapsed = now() - start;
+            check("round", variant->name, crc, reference);
+            if (elapsed < best) {
+                best = elapsed;
+            }
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        printf("%-12s : %5.2f cycles/byte\n", variant->name, (double) best / sizeof(buffer));
+#else
+        printf("%-12s : %5.2f ns/byte\n", variant->name, (double) best / sizeof(buffer));
+#endif
+    }
+
+    printf("%u tests passed\n", g_num_pass);
+    printf("%u tests failed\n", g_num_fail);
+    return g_num_fail ? 1 : 0;
+}
@@ -0,0 +1,15 @@
+#ifndef __DAC_H__
+#define __DAC_H__
+
+#include <stdint.h>
+
+#define DAC1 (0)
+
+extern uint32_t dac_dhr12r1, dac_dhr12r2, dac_cr;
+
+#define DAC_DHR12R1(dac) dac_dhr12r1
+#define DAC_DHR12R2(dac) dac_dhr12r2
+#define DAC_CR(dac) dac_cr
+#define DAC_CR_DMAEN1 (1 << 12)
+
+#endif // __DAC_H__
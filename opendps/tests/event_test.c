@@ -0,0 +1,113 @@
+/** Exercises the event queues in event.c with a producer thread standing in
+  * for the USART ISR while the main thread consumes, as in the emulator.
+  */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include "event.h"
+
+#define NUM_BURSTS  (100000)
+
+uint32_t g_num_fail, g_num_pass;
+
+static volatile bool producer_done;
+static uint32_t num_put;
+
+/** Sends bursts of 1..EVENT_MAX_PAYLOAD bytes counting up from 0 */
+static void *producer(void *arg)
+{
+    uint8_t burst[EVENT_MAX_PAYLOAD];
+    uint8_t next = 0;
+    (void) arg;
+    for (uint32_t i = 0; i < NUM_BURSTS; i++) {
+        uint32_t length = 1 + i % EVENT_MAX_PAYLOAD;
+        for (uint32_t j = 0; j < length; j++) {
+            burst[j] = next + j;
+        }
+        while (!event_put_data(event_uart_rx, burst, length)) {
+            sched_yield(); /** Full, let the consumer catch up */
+        }
+        next += length;
+        num_put++;
+    }
+    producer_done = true;
+    return NULL;
+}
+
+int main(int argc, char const *argv[])
+{
+    (void) argc;
+    (void) argv;
+    pthread_t th;
+    event_t event;
+    uint8_t data[EVENT_MAX_PAYLOAD];
+    uint32_t length, num_got = 0;
+    uint8_t expected = 0;
+    bool in_order = true;
+
+    event_init();
+
+    /** Payload round trip */
+    if (event_put(event_button_m1, press_long) && event_get(&event, data, &length) &&
+        event == event_button_m1 && length == 1 && data[0] == press_long) {
+        g_num_pass++;
+    } else {
+        g_num_fail++;
+    }
+
+    /** Empty queue */
+    if (!event_get(&event, data, &length) && event == event_none) {
+        g_num_pass++;
+    } else {
+        g_num_fail++;
+    }
+
+    /** Overflow is counted and the queue recovers */
+    uint32_t drops = event_get_drops();
+    while (event_put(event_rot_left, 0)) {
+    }
+    if (event_get_drops() == drops + 1) {
+        g_num_pass++;
+    } else {
+        g_num_fail++;
+    }
+    while (event_get(&event, data, &length)) {
+    }
+    if (event_put(event_rot_left, 0) && event_get(&event, data, &length) && event == event_rot_left) {
+        g_num_pass++;
+    } else {
+        g_num_fail++;
+    }
+
+    /** Concurrent producer and consumer */
+    pthread_create(&th, NULL, producer, NULL);
+    while (!producer_done || num_got < num_put) {
+        if (event_get(&event, data, &length)) {
+            if (event != event_uart_rx || length != 1 + num_got % EVENT_MAX_PAYLOAD) {
+                in_order = false;
+            }
+            for (uint32_t j = 0; j < length; j++) {
+                if (data[j] != expected++) {
+                    in_order = false;
+                }
+            }
+            num_got++;
+        } else {
+            sched_yield();
+        }
+    }
+    pthread_join(th, NULL);
+    if (in_order && num_got == NUM_BURSTS) {
+        g_num_pass++;
+    } else {
+        printf("Got %u of %u bursts, %s\n", num_got, NUM_BURSTS, in_order ? "in order" : "out of order");
+        g_num_fail++;
+    }
+
+    printf("%u tests passed\n", g_num_pass);
+    printf("%u tests failed\n", g_num_fail);
+    return g_num_fail ? 1 : 0;
+}
@@ -0,0 +1,225 @@
+/** Runs sequencer programs through the executor in func_seq.c one simulated
+  * millisecond at a time and checks the setpoints it applies, along with the
+  * validation of uploaded programs.
+  */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../func_seq.c"
+
+uint32_t g_num_fail, g_num_pass;
+
+#define CHECK(cond) \
+    do { \
+        if (cond) { \
+            g_num_pass++; \
+        } else { \
+            g_num_fail++; \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while(0)
+
+/** What the executor did to the output stage */
+static uint32_t vout, iout, vout_writes;
+static bool vout_enabled, output_disabled;
+/** The measured output, in mV and mA */
+static uint16_t meas_v, meas_i;
+
+bool pwrctl_set_vout(uint32_t value_mv) { vout = value_mv; vout_writes++; return true; }
+bool pwrctl_set_iout(uint32_t value_ma) { iout = value_ma; return true; }
+bool pwrctl_set_ilimit(uint32_t value_ma) { (void) value_ma; return true; }
+bool pwrctl_set_vlimit(uint32_t value_mv) { (void) value_mv; return true; }
+void pwrctl_enable_vout(bool enable) { vout_enabled = enable; }
+void pwrctl_cut_vout(void) { vout_enabled = false; }
+bool pwrctl_vout_enabled(void) { return vout_enabled; }
+uint32_t pwrctl_calc_vin(uint16_t raw) { return raw; }
+uint32_t pwrctl_calc_vin_filtered(uint16_t filtered) { return filtered; }
+uint32_t pwrctl_calc_vout_filtered(uint16_t filtered) { return filtered; }
+uint32_t pwrctl_calc_iout_filtered(uint16_t filtered) { return filtered; }
+void hw_get_adc_values(uint16_t *i_out_raw, uint16_t *v_in_raw, uint16_t *v_out_raw) { *i_out_raw = 0; *v_in_raw = 30000; *v_out_raw = 0; }
+void hw_get_adc_filtered(uint16_t *i_out, uint16_t *v_in, uint16_t *v_out) { *i_out = meas_i; *v_in = 30000; *v_out = meas_v; }
+bool opendps_enable_output(bool enable) { output_disabled = !enable; return true; }
+void systick_set_handler(tick_handler_t handler) { (void) handler; }
+void number_init(ui_number_t *item) { item->ui.draw = 0; }
+void uui_add_screen(uui_t *ui, ui_screen_t *screen) { (void) ui; (void) screen; }
+bool past_read_unit(past_t *past, past_id_t id, const void **data, uint32_t *length) { (void) past; (void) id; (void) data; (void) length; return false; }
+bool past_write_units(past_t *past, past_unit_t *units, uint32_t count) { (void) past; (void) units; (void) count; return true; }
+void tft_clear(void) {}
+void tft_fill(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint16_t color) { (void) x; (void) y; (void) w; (void) h; (void) color; }
+uint16_t tft_puts(tft_font_size_t size, const char *str, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint16_t color, bool invert)
+{
+    (void) size; (void) str; (void) x; (void) y; (void) w; (void) h; (void) color; (void) invert;
+    return 0;
+}
+static void draw(ui_item_t *item) { (void) item; }
+
+/** Upload a program and start it with the voltage item at max_mv */
+static void start(const seq_step_t *steps, uint32_t count, uint32_t max_mv)
+{
+    CHECK(func_seq_set_program(0, steps, count));
+    seq_voltage.value = max_mv;
+    seq_screen.enable(true);
+    CHECK(state == seq_running && vout_enabled);
+}
+
+static void tick(uint32_t ms)
+{
+    while (ms--) {
+        seq_tick();
+    }
+}
+
+static void test_ramp(void)
+{
+    const seq_step_t steps[] = {
+        { seq_op_set_i, 0, 1000, 0 },
+        { seq_op_ramp_v, 0, 10000, 100 },
+        { seq_op_dwell, 0, 0, 50 },
+        { seq_op_set_v, 0, 0, 0 },
+        { seq_op_end, 0, 0, 0 },
+    };
+    start(steps, 5, 20000);
+    bool linear = true;
+    for (uint32_t ms = 1; ms <= 100; ms++) {
+        tick(1);
+        linear &= vout == 100 * ms;
+    }
+    CHECK(linear);
+    CHECK(iout == 1000);
+    tick(49);
+    CHECK(vout == 10000 && state == seq_running);
+    tick(1);
+    CHECK(vout == 0 && state == seq_done && run_ms == 150);
+    /** The output stays on when the program is done */
+    tick(10);
+    CHECK(vout_enabled && run_ms == 150);
+    seq_screen.enable(false);
+    CHECK(!vout_enabled && state == seq_done);
+}
+
+static void test_ramp_down_and_cap(void)
+{
+    const seq_step_t steps[] = {
+        { seq_op_set_v, 0, 30000, 0 },
+        { seq_op_ramp_v, 0, 2000, 4 },
+        { seq_op_end, 0, 0, 0 },
+    };
+    start(steps, 3, 12000);
+    tick(1);
+    /** Capped at the voltage item, the ramp starts from the capped setpoint */
+    CHECK(vout == 9500);
+    tick(3);
+    CHECK(vout == 2000 && state == seq_done);
+    seq_screen.enable(false);
+}
+
+static void test_loops(void)
+{
+    const seq_step_t steps[] = {
+        { seq_op_set_v, 0, 1000, 0 },
+        { seq_op_dwell, 0, 0, 10 },
+        { seq_op_set_v, 0, 2000, 0 },
+        { seq_op_dwell, 0, 0, 5 },
+        { seq_op_loop, 0, 2, 1 }, /** inner: steps 2-3 twice */
+        { seq_op_loop, 0, 0, 2 }, /** outer: everything three times */
+        { seq_op_end, 0, 0, 0 },
+    };
+    start(steps, 7, 20000);
+    vout_writes = 0;
+    tick(1000);
+    CHECK(state == seq_done);
+    /** 3 * (10 + 2 * 5) ms with three writes per pass */
+    CHECK(run_ms == 60);
+    CHECK(vout_writes == 9);
+    seq_screen.enable(false);
+
+    /** A loop taking no time runs a bounded number of steps per tick */
+    const seq_step_t forever[] = {
+        { seq_op_set_v, 0, 1000, 0 },
+        { seq_op_loop, 0, 0, 0 },
+    };
+    start(forever, 2, 20000);
+    vout_writes = 0;
+    tick(10);
+    CHECK(state == seq_running && vout_writes == 10 * SEQ_MAX_STEPS / 2);
+    seq_screen.enable(false);
+    CHECK(state == seq_idle);
+}
+
+static void test_wait(void)
+{
+    const seq_step_t steps[] = {
+        { seq_op_set_v, 0, 5000, 0 },
+        { seq_op_wait, seq_cond_v_above, 4900, 20 },
+        { seq_op_set_v, 0, 6000, 0 },
+        { seq_op_wait, seq_cond_i_below, 100, 0 },
+        { seq_op_end, 0, 0, 0 },
+    };
+    meas_v = 0;
+    meas_i = 500;
+    start(steps, 5, 20000);
+    tick(5);
+    CHECK(vout == 5000 && cur_step == 1);
+    meas_v = 4950;
+    tick(1);
+    CHECK(vout == 6000 && cur_step == 3);
+    /** No timeout */
+    tick(10000);
+    CHECK(state == seq_running);
+    meas_i = 50;
+    tick(1);
+    CHECK(state == seq_done);
+    seq_screen.enable(false);
+
+    /** Timing out cuts the output and has the UI switch off the screen */
+    meas_v = 0;
+    output_disabled = false;
+    start(steps, 5, 20000);
+    tick(19);
+    CHECK(state == seq_running && vout_enabled);
+    tick(1);
+    CHECK(state == seq_timeout && !vout_enabled && stop_pending);
+    seq_ui_tick();
+    CHECK(output_disabled && !stop_pending);
+    seq_screen.enable(false);
+}
+
+static void test_upload(void)
+{
+    const seq_step_t bad_op[] = { { seq_op_last, 0, 0, 0 } };
+    const seq_step_t bad_loop[] = { { seq_op_loop, 0, SEQ_MAX_STEPS, 1 } };
+    const seq_step_t bad_cond[] = { { seq_op_wait, seq_cond_last, 0, 0 } };
+    const seq_step_t bad_current[] = { { seq_op_ramp_i, 0, CONFIG_DPS_MAX_CURRENT + 1, 10 } };
+    const seq_step_t ok[] = { { seq_op_dwell, 0, 0, 10 }, { seq_op_end, 0, 0, 0 } };
+    CHECK(!func_seq_set_program(0, bad_op, 1));
+    CHECK(!func_seq_set_program(0, bad_loop, 1));
+    CHECK(!func_seq_set_program(0, bad_cond, 1));
+    CHECK(!func_seq_set_program(0, bad_current, 1));
+    CHECK(!func_seq_set_program(SEQ_MAX_STEPS - 1, ok, 2));
+    CHECK(func_seq_set_program(SEQ_MAX_STEPS - 2, ok, 2));
+    CHECK(program[SEQ_MAX_STEPS - 1].op == seq_op_end);
+    start(ok, 2, 20000);
+    CHECK(program_length == 1);
+    /** Not while running */
+    CHECK(!func_seq_set_program(0, ok, 2));
+    seq_screen.enable(false);
+    CHECK(func_seq_set_program(0, ok, 2));
+}
+
+int main(int argc, char const *argv[])
+{
+    (void) argc;
+    (void) argv;
+    func_seq_init(0);
+    seq_voltage.ui.draw = seq_current.ui.draw = &draw;
+    test_ramp();
+    test_ramp_down_and_cap();
+    test_loops();
+    test_wait();
+    test_upload();
+    printf("%u tests passed\n", g_num_pass);
+    printf("%u tests failed\n", g_num_fail);
+    return g_num_fail ? 1 : 0;
+}
@@ -0,0 +1,14 @@
+#ifndef __GPIO_H__
+#define __GPIO_H__
+
+#include <stdint.h>
+
+#define GPIOB   (1)
+#define GPIOC   (2)
+#define GPIO11  (1 << 11)
+#define GPIO13  (1 << 13)
+
+void gpio_set(uint32_t gpioport, uint16_t gpios);
+void gpio_clear(uint32_t gpioport, uint16_t gpios);
+
+#endif // __GPIO_H__
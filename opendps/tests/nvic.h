@@ -0,0 +1,11 @@
+#ifndef __NVIC_H__
+#define __NVIC_H__
+
+#include <stdint.h>
+
+#define NVIC_ADC1_2_IRQ (18)
+
+void nvic_enable_irq(uint8_t irqn);
+void nvic_disable_irq(uint8_t irqn);
+
+#endif // __NVIC_H__
@@ -2,14 +2,18 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include "past.h"
 #include "flash.h"
 
 uint32_t g_num_fail, g_num_pass;
 
 
-uint8_t past_block1[1024];
-uint8_t past_block2[1024];
+uint8_t past_blocks[PAST_NUM_BLOCKS][PAST_BLOCK_SIZE];
+
+/** Flash operation counters for the stress benchmark */
+uint32_t g_num_programs;
+uint32_t g_num_erases[PAST_NUM_BLOCKS];
 
 void lock_flash(void) {}
 void unlock_flash(void) {}
@@ -18,12 +22,14 @@ past_t past;
 
 void flash_erase_page(uint32_t address)
 {
-    memset((char*) address, 0xff, 1024);
+    g_num_erases[(address - (uint32_t) past_blocks[0]) / PAST_BLOCK_SIZE]++;
+    memset((char*) address, 0xff, PAST_BLOCK_SIZE);
 }
 
 void flash_program_word(uint32_t address, uint32_t data)
 {
 //    printf("[0x%08x] = 0x%08x\n", address, data);
+    g_num_programs++;
     *((uint32_t*) address) = data;
 }
 
@@ -83,17 +89,84 @@ static void hexdump(char *desc, void *addr, int len)
 }
 #endif // VERBOSE_ERRORS
 
+#define STRESS_NUM_UNITS   (24)
+#define STRESS_NUM_WRITES  (20000)
+
+/**
+  * @brief Rewrite a set of units the way the UI does (screen id in the top
+  *        byte) and report flash operations per write and erase distribution
+  * @retval true if all units read back correctly, also after a re-init
+  */
+static bool past_stress(void)
+{
+    bool success = true;
+    uint32_t erases = 0, min_erases = 0xffffffff, max_erases = 0;
+    clock_t start;
+    double write_us, read_us;
+
+    memset(past_blocks, 0xcd, sizeof(past_blocks));
+    memset(g_num_erases, 0, sizeof(g_num_erases));
+    if (!past_init(&past)) {
+        return false;
+    }
+    g_num_programs = 0;
+    memset(g_num_erases, 0, sizeof(g_num_erases));
+
+    start = clock();
+    for (uint32_t i = 0; i < STRESS_NUM_WRITES && success; i++) {
+        uint32_t unit = i % STRESS_NUM_UNITS;
+        uint32_t value[2] = {i, ~i};
+        success &= past_write_unit(&past, ((unit / 4) << 24) | (unit + 1), (void*) value, sizeof(value));
+    }
+    write_us = 1e6 * (clock() - start) / CLOCKS_PER_SEC / STRESS_NUM_WRITES;
+
+    start = clock();
+    for (uint32_t i = 0; i < STRESS_NUM_WRITES && success; i++) {
+        uint32_t unit = i % STRESS_NUM_UNITS;
+        uint32_t *p, length;
+        success &= past_read_unit(&past, ((unit / 4) << 24) | (unit + 1), (const void**) &p, &length);
+    }
+    read_us = 1e6 * (clock() - start) / CLOCKS_PER_SEC / STRESS_NUM_WRITES;
+
+    for (uint32_t pass = 0; pass < 2 && success; pass++) {
+        for (uint32_t unit = 0; unit < STRESS_NUM_UNITS; unit++) {
+            uint32_t i = (STRESS_NUM_WRITES - 1 - unit) / STRESS_NUM_UNITS * STRESS_NUM_UNITS + unit;
+            uint32_t *p, length;
+            if (!past_read_unit(&past, ((unit / 4) << 24) | (unit + 1), (const void**) &p, &length) ||
+                length != 8 || p[0] != i || p[1] != ~i) {
+                printf("Stress: unit %d corrupt after %s\n", unit + 1, pass ? "re-init" : "writes");
+                success = false;
+                break;
+            }
+        }
+        // Simulate a reboot, the index is rebuilt from flash
+        success &= past_init(&past);
+    }
+
+    for (uint32_t i = 0; i < PAST_NUM_BLOCKS; i++) {
+        erases += g_num_erases[i];
+        min_erases = g_num_erases[i] < min_erases ? g_num_erases[i] : min_erases;
+        max_erases = g_num_erases[i] > max_erases ? g_num_erases[i] : max_erases;
+    }
+    printf("Stress: %d writes of %d units over %d blocks\n", STRESS_NUM_WRITES, STRESS_NUM_UNITS, PAST_NUM_BLOCKS);
+    printf("  %.2f word programs/write, %.4f page erases/write (%d..%d per block)\n",
+           (double) g_num_programs / STRESS_NUM_WRITES, (double) erases / STRESS_NUM_WRITES, min_erases, max_erases);
+    printf("  %.3f us/write, %.3f us/read\n", write_us, read_us);
+    /** Round robin should spread erases evenly */
+    return success && max_erases - min_erases <= 1;
+}
+
 int main(int argc, char const *argv[])
 {
     uint32_t itest = 0x11223344;
     char *stest1 = "Hello World!!";
     char *stest2 = "Hello World again!!";
 
-    memset((void*) &past_block1, 0xcd, sizeof(past_block1));
-    memset((void*) &past_block2, 0xcd, sizeof(past_block2));
+    memset((void*) &past_blocks, 0xcd, sizeof(past_blocks));
 
-    past.blocks[0] = (uint32_t) past_block1;
-    past.blocks[1] = (uint32_t) past_block2;
+    for (uint32_t i = 0; i < PAST_NUM_BLOCKS; i++) {
+        past.blocks[i] = (uint32_t) past_blocks[i];
+    }
     if (past_init(&past)) {
         g_num_pass++;
     } else {
@@ -207,8 +280,33 @@ int main(int argc, char const *argv[])
     }
 
 
-//    hexdump("block 1", past_block1, sizeof(past_block1));
-//    hexdump("block 2", past_block2, sizeof(past_block2));
+    // Batch write, rewriting the same content must not touch the flash
+    uint32_t u = 12000, i = 500;
+    past_unit_t units[] = {
+        { 0x02000000, (void*) &u, sizeof(u) },
+        { 0x02000001, (void*) &i, sizeof(i) },
+    };
+    if (past_write_units(&past, units, 2) && past_read_unit(&past, 0x02000001, (const void**) &p1, &length1) && *p1 == i) {
+        g_num_pass++;
+    } else {
+        g_num_fail++;
+    }
+
+    g_num_programs = 0;
+    if (past_write_units(&past, units, 2) && g_num_programs == 0) {
+        g_num_pass++;
+    } else {
+        g_num_fail++;
+    }
+
+    if (past_stress()) {
+        g_num_pass++;
+    } else {
+        g_num_fail++;
+    }
+
+//    hexdump("block 1", past_blocks[0], PAST_BLOCK_SIZE);
+//    hexdump("block 2", past_blocks[1], PAST_BLOCK_SIZE);
 
     if (g_num_fail == 0) {
         printf("All tests passed\n");
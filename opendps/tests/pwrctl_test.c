@@ -0,0 +1,233 @@
+/** Checks that the fixed point conversions in pwrctl.c stay within 1 LSB of
+  * the float calculations they replace, for the default calibration and a
+  * set of odd calibrations that may come out of dpsctl --calibrate. Also runs
+  * the V_out regulation against a simulated output stage that is off from
+  * the calibration.
+  */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "pwrctl.h"
+#include "hw.h"
+#include "pastunits.h"
+#include "dac.h"
+#include "nvic.h"
+
+uint32_t g_num_fail, g_num_pass;
+
+uint32_t dac_dhr12r1, dac_dhr12r2, dac_cr;
+void gpio_set(uint32_t gpioport, uint16_t gpios) { (void) gpioport; (void) gpios; }
+void gpio_clear(uint32_t gpioport, uint16_t gpios) { (void) gpioport; (void) gpios; }
+
+/** Times the ADC IRQ was masked and whether it still is */
+static uint32_t adc_irq_masked_count;
+static bool adc_irq_masked;
+void nvic_disable_irq(uint8_t irqn) { if (irqn == NVIC_ADC1_2_IRQ) { adc_irq_masked = true; adc_irq_masked_count++; } }
+void nvic_enable_irq(uint8_t irqn) { if (irqn == NVIC_ADC1_2_IRQ) adc_irq_masked = false; }
+
+/** Calibration "stored in past", NaN means not stored */
+static float cal_units[past_VIN_ADC_C + 1];
+
+bool past_read_unit(past_t *past, past_id_t id, const void **data, uint32_t *length)
+{
+    (void) past;
+    if (id > past_VIN_ADC_C || cal_units[id] != cal_units[id])
+        return false;
+    *data = &cal_units[id];
+    *length = sizeof(float);
+    return true;
+}
+
+/** The float conversions as they were before going fixed point */
+static uint32_t ref_calc(float k, float c, uint32_t x)
+{
+    float value = k * x + c;
+    if (value <= 0)
+        return 0;
+    else
+        return value + 0.5f;
+}
+
+/** Filtered readings have ADC_FILTER_FRAC_BITS fractional bits */
+static uint32_t ref_calc_filtered(float k, float c, uint32_t x)
+{
+    float value = k * x / (1 << ADC_FILTER_FRAC_BITS) + c;
+    if (value <= 0)
+        return 0;
+    else
+        return value + 0.5f;
+}
+
+static uint32_t ref_calc_dac(float k, float c, uint32_t x)
+{
+    float value = k * x + c;
+    if (value <= 0)
+        return 0;
+    else if (value >= 0xfff)
+        return 0xfff;
+    else
+        return value + 0.5f;
+}
+
+static uint32_t ref_calc_limit(float k, float c, uint32_t x)
+{
+    float value = (x - c) / k + 1;
+    if (value <= 0)
+        return 0;
+    else
+        return value + 0.5f;
+}
+
+/** The per sample conversions used by the ADC ISR, 0 if negative */
+static uint32_t isr_calc(const pwrctl_isr_cal_t *cal, uint32_t x)
+{
+    int32_t value = (cal->k * (int32_t) x + cal->c) >> PWRCTL_ISR_Q;
+    return value > 0 ? value : 0;
+}
+
+static void check(const char *what, uint32_t x, uint32_t fixed, uint32_t ref)
+{
+    if (abs((int32_t) fixed - (int32_t) ref) <= 1) {
+        g_num_pass++;
+    } else {
+        g_num_fail++;
+        printf("%s(%u): got %u, expected %u\n", what, x, fixed, ref);
+    }
+}
+
+static void check_all(void)
+{
+    for (uint32_t raw = 0; raw <= 0xfff; raw++) {
+        check("vin", raw, pwrctl_calc_vin(raw), ref_calc(vin_adc_k_coef, vin_adc_c_coef, raw));
+        check("vout", raw, pwrctl_calc_vout(raw), ref_calc(v_adc_k_coef, v_adc_c_coef, raw));
+        check("iout", raw, pwrctl_calc_iout(raw), ref_calc(a_adc_k_coef, a_adc_c_coef, raw));
+        check("vout_isr", raw, isr_calc(&pwrctl_v_out_isr_cal, raw), ref_calc(v_adc_k_coef, v_adc_c_coef, raw));
+        check("iout_isr", raw, isr_calc(&pwrctl_i_out_isr_cal, raw), ref_calc(a_adc_k_coef, a_adc_c_coef, raw));
+    }
+    for (uint32_t filtered = 0; filtered < (0x1000 << ADC_FILTER_FRAC_BITS); filtered++) {
+        check("vin_filtered", filtered, pwrctl_calc_vin_filtered(filtered), ref_calc_filtered(vin_adc_k_coef, vin_adc_c_coef, filtered));
+        check("vout_filtered", filtered, pwrctl_calc_vout_filtered(filtered), ref_calc_filtered(v_adc_k_coef, v_adc_c_coef, filtered));
+        check("iout_filtered", filtered, pwrctl_calc_iout_filtered(filtered), ref_calc_filtered(a_adc_k_coef, a_adc_c_coef, filtered));
+    }
+    for (uint32_t x = 0; x <= 0xffff; x++) {
+        check("vout_dac", x, pwrctl_calc_vout_dac(x), ref_calc_dac(v_dac_k_coef, v_dac_c_coef, x));
+        check("iout_dac", x, pwrctl_calc_iout_dac(x), ref_calc_dac(a_dac_k_coef, a_dac_c_coef, x));
+        check("ilimit", x, pwrctl_calc_ilimit_adc(x), ref_calc_limit(a_adc_k_coef, a_adc_c_coef, x));
+        check("vlimit", x, pwrctl_calc_vlimit_adc(x), ref_calc_limit(v_adc_k_coef, v_adc_c_coef, x));
+    }
+}
+
+/** The output stage, V_out in ADC LSB for a V_out DAC setting. Gain and
+  * offset errors plus a current limit that pulls V_out down in CC mode. */
+static float plant_gain = 1.03f, plant_offset = -12.0f, plant_cc_raw = 1e9f;
+
+static uint16_t plant(void)
+{
+    float v_out_raw = ((dac_dhr12r1 - v_dac_c_coef) / v_dac_k_coef - v_adc_c_coef) / v_adc_k_coef;
+    v_out_raw = v_out_raw * plant_gain + plant_offset;
+    if (v_out_raw > plant_cc_raw)
+        v_out_raw = plant_cc_raw;
+    return v_out_raw <= 0 ? 0 : v_out_raw + 0.5f;
+}
+
+/** Run the regulation for a number of samples, returns the largest DAC
+  * change between two samples */
+static uint32_t regulate(uint32_t samples)
+{
+    uint32_t max_step = 0;
+    for (uint32_t i = 0; i < samples; i++) {
+        uint32_t dac = dac_dhr12r1;
+        pwrctl_vout_regulate(plant());
+        uint32_t step = abs((int32_t) dac_dhr12r1 - (int32_t) dac);
+        if (step > max_step)
+            max_step = step;
+    }
+    return max_step;
+}
+
+static void check_regulation(void)
+{
+    uint32_t target = 0;
+    uint32_t samples = 20915; /** One second */
+
+    pwrctl_set_vout(12000);
+    pwrctl_enable_vout(true);
+    uint32_t open_loop = dac_dhr12r1;
+    /** Slew limited to 1 DAC LSB per regulation step */
+    check("slew", 12000, regulate(samples) <= 1, 1);
+    /** V_out converges to within 1 ADC LSB */
+    for (target = 0; pwrctl_calc_vout(target) < 12000; target++)
+        ;
+    check("regulate", 12000, plant(), target);
+
+    /** A new setpoint keeps the correction and is published with the ADC
+      * ISR masked */
+    uint32_t masked_count = adc_irq_masked_count;
+    pwrctl_set_vout(5000);
+    if (adc_irq_masked_count == masked_count + 1 && !adc_irq_masked) {
+        g_num_pass++;
+    } else {
+        g_num_fail++;
+        printf("setpoint not published with the ADC IRQ masked\n");
+    }
+    regulate(samples);
+    for (target = 0; pwrctl_calc_vout(target) < 5000; target++)
+        ;
+    check("regulate", 5000, plant(), target);
+
+    /** CC mode, the correction is held */
+    pwrctl_set_vout(12000);
+    regulate(samples);
+    uint32_t dac = dac_dhr12r1;
+    plant_cc_raw = target;
+    regulate(samples);
+    check("cc", 12000, dac_dhr12r1, dac);
+    plant_cc_raw = 1e9f;
+
+    /** Hands off the DAC while the function generator feeds it */
+    dac_cr = DAC_CR_DMAEN1;
+    dac_dhr12r1 = 1234;
+    regulate(samples);
+    check("dma", 0, dac_dhr12r1, 1234);
+    dac_cr = 0;
+
+    /** The correction is dropped with the output */
+    pwrctl_enable_vout(false);
+    check("off", 0, dac_dhr12r1, 0);
+    regulate(samples);
+    check("off", 0, dac_dhr12r1, 0);
+    pwrctl_enable_vout(true);
+    check("on", 12000, dac_dhr12r1, open_loop);
+    pwrctl_enable_vout(false);
+}
+
+int main(int argc, char const *argv[])
+{
+    (void) argc;
+    (void) argv;
+    past_t past;
+
+    /** Default calibration */
+    for (uint32_t i = 0; i < sizeof(cal_units) / sizeof(cal_units[0]); i++)
+        cal_units[i] = 0.0f / 0.0f;
+    pwrctl_init(&past);
+    check_all();
+    check_regulation();
+
+    /** Random calibrations, as pwrctl_init is run when calibration changes */
+    srand(1);
+    for (uint32_t run = 0; run < 20; run++) {
+        for (uint32_t id = past_A_ADC_K; id <= past_VIN_ADC_C; id += 2) {
+            cal_units[id] = 0.01f + 20.0f * rand() / RAND_MAX;
+            cal_units[id + 1] = -500.0f + 1000.0f * rand() / RAND_MAX;
+        }
+        pwrctl_init(&past);
+        check_all();
+    }
+
+    printf("%u tests passed\n", g_num_pass);
+    printf("%u tests failed\n", g_num_fail);
+    return g_num_fail ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+/** Checks that the incremental frame receiver in uframe.c unescapes and crc
+  * checks frames built with pack*(...), resyncs on broken frames and that the
+  * payload accessors never read past the payload.
+  */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "uframe.h"
+
+uint32_t g_num_fail, g_num_pass;
+
+#define CHECK(cond) \
+    do { \
+        if (cond) { \
+            g_num_pass++; \
+        } else { \
+            g_num_fail++; \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while(0)
+
+static uint8_t rx_buffer[UFRAME_RX_SIZE(16)];
+static frame_rx_t rx;
+
+/** Feed bytes to the receiver, returns the last non zero status */
+static int32_t feed(const uint8_t *data, uint32_t length)
+{
+    int32_t status = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        int32_t s = uframe_rx_add(&rx, data[i]);
+        if (s) {
+            status = s;
+        }
+    }
+    return status;
+}
+
+static void test_roundtrip(void)
+{
+    /** Every byte that needs stuffing, plus some that do not */
+    const uint8_t data[] = { 0x42, _SOF, _DLE, _EOF, _XOR, 0x00, 0xff };
+    frame_t frame;
+    payload_t payload;
+
+    set_frame_header(&frame);
+    for (uint32_t i = 0; i < sizeof(data); i++) {
+        pack8(&frame, data[i]);
+    }
+    end_frame(&frame);
+
+    uframe_rx_init(&rx, rx_buffer, sizeof(rx_buffer));
+    CHECK(feed(frame.buffer, frame.length) == sizeof(data));
+    uframe_rx_payload(&payload, &rx, sizeof(data));
+    CHECK(memcmp(payload.data, data, sizeof(data)) == 0);
+
+    /** Noise before the frame is ignored and a frame can follow directly */
+    const uint8_t noise[] = { 0x12, _EOF, 0x34 };
+    CHECK(feed(noise, sizeof(noise)) == 0);
+    CHECK(feed(frame.buffer, frame.length) == sizeof(data));
+    CHECK(feed(frame.buffer, frame.length) == sizeof(data));
+}
+
+static void test_crc_in_data(void)
+{
+    /** Crc bytes that need stuffing must be unstuffed too */
+    for (uint32_t i = 0; i < 256; i++) {
+        frame_t frame;
+        set_frame_header(&frame);
+        pack8(&frame, 0x01);
+        pack8(&frame, i);
+        end_frame(&frame);
+        uframe_rx_init(&rx, rx_buffer, sizeof(rx_buffer));
+        CHECK(feed(frame.buffer, frame.length) == 2);
+        CHECK(rx_buffer[0] == 0x01 && rx_buffer[1] == i);
+    }
+}
+
+static void test_errors(void)
+{
+    frame_t frame;
+    set_frame_header(&frame);
+    pack16(&frame, 0x1234);
+    end_frame(&frame);
+
+    /** Corrupt each byte between _SOF and _EOF in turn */
+    for (uint32_t i = 1; i < frame.length - 1; i++) {
+        uint8_t corrupt[MAX_FRAME_LENGTH];
+        memcpy(corrupt, frame.buffer, frame.length);
+        corrupt[i] ^= 0x01;
+        uframe_rx_init(&rx, rx_buffer, sizeof(rx_buffer));
+        CHECK(feed(corrupt, frame.length) == -E_CRC);
+    }
+
+    /** Too short */
+    const uint8_t empty[] = { _SOF, 0x00, 0x00, _EOF };
+    uframe_rx_init(&rx, rx_buffer, sizeof(rx_buffer));
+    CHECK(feed(empty, sizeof(empty)) == -E_LEN);
+
+    /** Too long for the buffer, and the receiver recovers */
+    set_frame_header(&frame);
+    for (uint32_t i = 0; i < sizeof(rx_buffer); i++) {
+        pack8(&frame, i);
+    }
+    end_frame(&frame);
+    uframe_rx_init(&rx, rx_buffer, sizeof(rx_buffer));
+    CHECK(feed(frame.buffer, frame.length) == -E_LEN);
+    set_frame_header(&frame);
+    pack8(&frame, 0x55);
+    end_frame(&frame);
+    CHECK(feed(frame.buffer, frame.length) == 1);
+
+    /** A frame cut short by a new _SOF is dropped */
+    uint8_t cut[MAX_FRAME_LENGTH * 2];
+    memcpy(cut, frame.buffer, frame.length - 2);
+    memcpy(&cut[frame.length - 2], frame.buffer, frame.length);
+    uframe_rx_init(&rx, rx_buffer, sizeof(rx_buffer));
+    CHECK(feed(cut, 2 * frame.length - 2) == 1);
+}
+
+static void test_payload(void)
+{
+    const uint8_t data[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 'a', 'b', '\0', 'c' };
+    payload_t payload = { .data = data, .length = sizeof(data), .unpack_pos = 0 };
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+    const char *str;
+
+    CHECK(payload_unpack8(&payload, &u8) == 1 && u8 == 0x01);
+    CHECK(payload_unpack16(&payload, &u16) == 2 && u16 == 0x0203);
+    CHECK(payload_unpack32(&payload, &u32) == 4 && u32 == 0x04050607);
+    str = payload_unpack_cstr(&payload);
+    CHECK(str && strcmp(str, "ab") == 0);
+    /** Not terminated within the payload */
+    CHECK(payload_unpack_cstr(&payload) == 0);
+    CHECK(payload_unpack_bytes(&payload, 2) == 0);
+    CHECK(payload.length == 1);
+    CHECK(payload_unpack16(&payload, &u16) == 1 && u16 == ('c' << 8));
+    CHECK(payload.length == 0);
+    CHECK(payload_unpack8(&payload, &u8) == 0 && u8 == 0);
+    CHECK(payload_unpack_bytes(&payload, 0) != 0);
+}
+
+int main(int argc, char const *argv[])
+{
+    (void) argc;
+    (void) argv;
+    test_roundtrip();
+    test_crc_in_data();
+    test_errors();
+    test_payload();
+    printf("%u tests passed\n", g_num_pass);
+    printf("%u tests failed\n", g_num_fail);
+    return g_num_fail ? 1 : 0;
+}
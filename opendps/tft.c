@@ -45,6 +45,9 @@
 #include "gfx_lookup.h"
 
 static bool is_inverted;
+/** Number of times the screen was cleared or inverted, lets UI items know
+  * their cached glyphs are gone */
+static uint32_t clear_count;
 
 #define ILI9163C_COLORSPACE_TWIDDLE(color) \
         (((COLORSPACE) == 0) \
@@ -55,9 +58,54 @@ static bool is_inverted;
     ((ILI9163C_COLORSPACE_TWIDDLE(color) & 0xFF) << 8) | \
     ((ILI9163C_COLORSPACE_TWIDDLE(color) >> 8) & 0xFF) )
 
-/** Buffers for speeding up drawing */
+/** Buffers for speeding up drawing. Together they hold the largest glyph,
+  * which is decoded and sent in as many bands as there are buffers. The next
+  * band is decoded while the previous one is being sent to the TFT. */
+#ifndef CONFIG_TFT_BLIT_BUFFERS
+ #define CONFIG_TFT_BLIT_BUFFERS (2)
+#endif
 
-static uint16_t blit_buffer[((4*FONT_METER_LARGE_MAX_GLYPH_WIDTH*FONT_METER_LARGE_MAX_GLYPH_HEIGHT)+3)/4]; // Alignment for being able to lay down uint64_t in one go, without dealing with padding
+/** Pixels per buffer, whole glyph bytes of 4 pixels each */
+#define BLIT_GLYPH_PIXELS (FONT_METER_LARGE_MAX_GLYPH_WIDTH*FONT_METER_LARGE_MAX_GLYPH_HEIGHT)
+#define BLIT_BUFFER_PIXELS (4*((BLIT_GLYPH_PIXELS+4*CONFIG_TFT_BLIT_BUFFERS-1)/(4*CONFIG_TFT_BLIT_BUFFERS)))
+
+static uint16_t blit_buffers[CONFIG_TFT_BLIT_BUFFERS][BLIT_BUFFER_PIXELS] __attribute__((aligned(4)));
+static uint32_t blit_tickets[CONFIG_TFT_BLIT_BUFFERS]; /** Transfer using each buffer */
+static uint32_t cur_blit; /** The buffer glyphs are decoded into */
+#define blit_buffer (blit_buffers[cur_blit])
+
+/**
+  * @brief Decode a glyph and queue it for the given window, one blit buffer
+  *        at a time
+  * @param pixdata the input bytes from the font definition
+  * @param nbytes number of bytes in the source glyph array
+  * @param x,y top left corner
+  * @param w,h width and height
+  * @param invert whether to invert the glyph
+  * @param color color mask to use when decoding
+  * @retval none
+  */
+static void blit_glyph(const uint8_t *pixdata, size_t nbytes, uint32_t x, uint32_t y, uint32_t w, uint32_t h, bool invert, uint16_t color)
+{
+    uint32_t remaining = w * h;
+    ili9163c_set_window(x, y, x + w-1, y + h-1);
+    if (nbytes == 0) { /* we're attempting to draw a space */
+        ili9163c_fill_pixels(invert ? WHITE : BLACK, remaining);
+        return;
+    }
+    /** The TFT keeps writing the window as long as no command comes in
+      * between, so the bands go out back to back */
+    while (remaining > 0 && nbytes > 0) {
+        size_t chunk = nbytes < BLIT_BUFFER_PIXELS / 4 ? nbytes : BLIT_BUFFER_PIXELS / 4;
+        uint32_t count = 4 * chunk < remaining ? 4 * chunk : remaining;
+        tft_decode_glyph(pixdata, chunk, invert, color);
+        blit_tickets[cur_blit] = ili9163c_write_pixels(blit_buffer, count);
+        cur_blit = (cur_blit + 1) % CONFIG_TFT_BLIT_BUFFERS;
+        pixdata += chunk;
+        nbytes -= chunk;
+        remaining -= count;
+    }
+}
 
 /**
   * @brief Initialize the TFT module
@@ -77,18 +125,31 @@ void tft_init(void)
 void tft_clear(void)
 {
     ili9163c_fill_screen(BLACK);
+    clear_count++;
+}
+
+/**
+  * @brief Get the number of times the TFT has been cleared or inverted
+  * @retval clear count
+  */
+uint32_t tft_get_clear_count(void)
+{
+    return clear_count;
 }
 
 /**
   * @brief Decode 2bpp glyph to TFT-native bgr565 format into the tft's blit_buffer
   * @param pixdata the input bytes from the font definition
-  * @param nbytes number of bytes in the source glyph array
+  * @param nbytes number of bytes in the source glyph array, at most one
+  *        blit buffer's worth
   * @param invert whether to invert the glyph
   * @param color color mask to use when decoding
   * @retval none
   */
 void tft_decode_glyph(const uint8_t *pixdata, size_t nbytes, bool invert, uint16_t color)
 {
+    /** Wait for the buffer to be sent if it is still in use */
+    ili9163c_wait(blit_tickets[cur_blit]);
     if(nbytes == 0) { /* we're attempting to draw a space */
         /** Wipe out the target buffer if we're drawing a space */
         memset(blit_buffer, (invert ? WHITE : BLACK) & 0xFF, sizeof(blit_buffer));
@@ -135,8 +196,7 @@ void tft_decode_glyph(const uint8_t *pixdata, size_t nbytes, bool invert, uint16
 void tft_blit(uint16_t *bits, uint32_t width, uint32_t height, uint32_t x, uint32_t y)
 {
     ili9163c_set_window(x, y, x + width-1, y + height-1);
-    gpio_set(TFT_A0_PORT, TFT_A0_PIN);
-    (void) spi_dma_transceive((uint8_t*) bits, 2*width*height, 0, 0);
+    (void) ili9163c_write_pixels(bits, width*height);
 }
 
 /**
@@ -255,18 +315,13 @@ uint8_t tft_putch(tft_font_size_t size, char ch, uint32_t x, uint32_t y, uint32_
         return 0;
     }
 
-    /** Get the glyph data and decode it to the native TFT format */
-    tft_get_glyph_pixdata(size, ch, &glyph_pixdata, &glyph_size);
-    tft_decode_glyph(glyph_pixdata, glyph_size, invert, color);
-
     /** Position glyph in center of region */
     xpos = x+(w-glyph_width)/2;
     ypos = y+(h-glyph_height)/2;
 
-    /** Draw the glyph */
-    ili9163c_set_window(xpos, ypos, xpos + glyph_width-1, ypos + glyph_height-1);
-    gpio_set(TFT_A0_PORT, TFT_A0_PIN);
-    (void) spi_dma_transceive((uint8_t*) blit_buffer, sizeof(uint16_t) * glyph_width * glyph_height, 0, 0);
+    /** Get the glyph data, decode it to the native TFT format and draw it */
+    tft_get_glyph_pixdata(size, ch, &glyph_pixdata, &glyph_size);
+    blit_glyph(glyph_pixdata, glyph_size, xpos, ypos, glyph_width, glyph_height, invert, color);
 
     /** If our glyph hasn't filled the entire region fill the remainder in with black or white depending on if we're inverting */
     uint16_t fill_color = invert ? WHITE : BLACK;
@@ -367,14 +422,9 @@ uint16_t tft_puts(tft_font_size_t size, const char *str, uint32_t x, uint32_t y,
             return xpos - x;
         }
 
-        /** Get the glyph data and decode it to the native TFT format */
+        /** Get the glyph data, decode it to the native TFT format and draw it */
         tft_get_glyph_pixdata(size, *str, &glyph_pixdata, &glyph_size);
-        tft_decode_glyph(glyph_pixdata, glyph_size, invert, color);
-
-        /** Draw the glyph */
-        ili9163c_set_window(xpos, ypos, xpos + glyph_width-1, ypos + glyph_height-1);
-        gpio_set(TFT_A0_PORT, TFT_A0_PIN);
-        (void) spi_dma_transceive((uint8_t*) blit_buffer, sizeof(uint16_t) * glyph_width * glyph_height, 0, 0);
+        blit_glyph(glyph_pixdata, glyph_size, xpos, ypos, glyph_width, glyph_height, invert, color);
 
         xpos += glyph_width;
 
@@ -396,13 +446,15 @@ uint16_t tft_puts(tft_font_size_t size, const char *str, uint32_t x, uint32_t y,
 void tft_fill_pattern(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2, uint8_t *fill, uint32_t fill_size)
 {
     uint32_t count = 2*(x2-x1+1)*(y2-y1+1);
+    uint32_t ticket = 0;
     ili9163c_set_window(x1, y1, x2, y2);
-    gpio_set(TFT_A0_PORT, TFT_A0_PIN);
     while(count) {
         uint32_t c = count < fill_size ? count : fill_size;
-        (void) spi_dma_transceive((uint8_t*) fill, c, 0, 0);
+        ticket = ili9163c_write_pixels((uint16_t*) fill, c / 2);
         count -= c;
     }
+    /** The caller owns the fill buffer */
+    ili9163c_wait(ticket);
 }
 
 /**
@@ -415,17 +467,11 @@ void tft_fill_pattern(uint32_t x1, uint32_t y1, uint32_t x2, uint32_t y2, uint8_
   */
 void tft_fill(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint16_t color)
 {
-    uint8_t hi = color >> 8;
-    uint8_t lo = color & 0xff;
-    int32_t count = 2 * w * h;
-    uint8_t fill[] = {hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo, hi, lo};
-    ili9163c_set_window(x, y, x+w-1, y+h-1);
-    gpio_set(TFT_A0_PORT, TFT_A0_PIN);
-    while (count > 0) {
-        uint32_t len = (uint32_t) count > sizeof(fill) ? sizeof(fill) : (uint32_t) count;
-        (void) spi_dma_transceive((uint8_t*) fill, len, 0, 0);
-        count -= len;
+    if (!w || !h) {
+        return;
     }
+    ili9163c_set_window(x, y, x+w-1, y+h-1);
+    ili9163c_fill_pixels(color, w * h);
 }
 
 /**
@@ -452,7 +498,11 @@ void tft_rect(uint32_t xpos, uint32_t ypos, uint32_t width, uint32_t height, uin
 void tft_invert(bool invert)
 {
     ili9163c_invert_display(invert);
-    is_inverted = invert;
+    if (invert != is_inverted) {
+        /** Glyphs are drawn in the inverted colours from now on */
+        is_inverted = invert;
+        clear_count++;
+    }
 }
 
 /**
@@ -45,6 +45,12 @@ void tft_init(void);
   */
 void tft_clear(void);
 
+/**
+  * @brief Get the number of times the TFT has been cleared or inverted
+  * @retval clear count, anything drawn before a change is gone
+  */
+uint32_t tft_get_clear_count(void);
+
 /**
   * @brief Determine glyph spacing given the font size
   * @param size font size
@@ -75,7 +81,8 @@ void tft_get_glyph_pixdata(tft_font_size_t size, char ch, const uint8_t **glyph_
 /**
   * @brief Decode 2bpp glyph to TFT-native bgr565 format into the tft's blit_buffer
   * @param pixdata the input bytes from the font definition
-  * @param nbytes number of bytes in the source glyph array
+  * @param nbytes number of bytes in the source glyph array, at most one
+  *        blit buffer's worth
   * @param invert whether to invert the glyph
   * @param color color mask to use when decoding
   * @retval none
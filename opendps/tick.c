@@ -29,6 +29,7 @@
 
 static volatile uint32_t ticks_lower;
 static volatile uint32_t ticks_upper;
+static volatile tick_handler_t tick_handler;
 
 /**
   * @brief Initialize the systick module
@@ -72,6 +73,16 @@ uint64_t get_ticks(void)
     return ticks;
 }
 
+/**
+  * @brief Set a handler called from the systick interrupt every millisecond
+  * @param handler the handler, or NULL
+  * @retval none
+  */
+void systick_set_handler(tick_handler_t handler)
+{
+    tick_handler = handler;
+}
+
 /**
   * @brief STM32 systick handler
   * @retval none
@@ -81,5 +92,8 @@ void sys_tick_handler(void)
     ticks_lower++;
     if (ticks_lower == 0) // If an overflow has occured
         ticks_upper++;
+    tick_handler_t handler = tick_handler;
+    if (handler)
+        handler();
 }
 
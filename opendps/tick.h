@@ -27,6 +27,11 @@
 
 #include <stdint.h>
 
+/**
+  * @brief Handler called from the systick interrupt every millisecond
+  */
+typedef void (*tick_handler_t)(void);
+
 /**
   * @brief Initialize the systick module
   * @retval none
@@ -46,4 +51,11 @@ void delay_ms(uint32_t delay);
   */
 uint64_t get_ticks(void);
 
+/**
+  * @brief Set a handler called from the systick interrupt every millisecond
+  * @param handler the handler, or NULL
+  * @retval none
+  */
+void systick_set_handler(tick_handler_t handler);
+
 #endif // __TICK_H__
@@ -179,63 +179,133 @@ uint32_t unpack32(frame_t *frame, uint32_t *data)
     return bytes_read;
 }
 
-/**
-  * @brief Extract payload from frame following deframing, unescaping and
-  *       crc checking.
-  * @note The frame is processed 'in place', when exiting the payload will be
-  *       the first byte of 'frame'. If the frame contains two valid frames,
-  *       -E_CRC will be returned.
-  * @param frame the frame to process, payload on exit
-  * @param length length of frame
-  * @retval length of payload or -E_* in case of errors (see uframe.h)
-  */
-int32_t uframe_extract_payload(frame_t *frame, uint8_t *data, uint32_t length)
-{
-    int32_t status = -1;
-    bool seen_dle = false;
-    uint16_t frame_crc, calc_crc = 0;
-
-    frame->length = 0;
-
-    do {
-        if (length < 5) { // _SOF CRC16 _EOF is no usable frame
-            status = -E_LEN;
-            break;
-        }
-        if (data[0] != _SOF || data[length-1] != _EOF) {
-            status = -E_FRM;
-            break;
-        }
+void uframe_rx_init(frame_rx_t *rx, uint8_t *buffer, uint32_t size)
+{
+    rx->buffer = buffer;
+    rx->size = size;
+    rx->length = 0;
+    rx->crc = 0;
+    rx->receiving = false;
+    rx->seen_dle = false;
+    rx->overflow = false;
+}
 
-        // First unescape the frame
-        uint32_t w = 0;
-        for (uint32_t r = 1; r < length-1; r++) {
-            if (seen_dle) {
-                seen_dle = false;
-                data[w++] = data[r] ^_XOR;
-            } else if (data[r] == _DLE) {
-                seen_dle = true;
+int32_t uframe_rx_add(frame_rx_t *rx, uint8_t b)
+{
+    int32_t status = 0;
+
+    if (b == _SOF) {
+        rx->receiving = true;
+        rx->seen_dle = false;
+        rx->overflow = false;
+        rx->length = 0;
+        rx->crc = 0;
+    } else if (!rx->receiving) {
+        /** Line noise between frames */
+    } else if (b == _EOF) {
+        rx->receiving = false;
+        if (rx->overflow || rx->length < 3) { // Payload needs at least the command
+            status = -E_LEN;
+        } else {
+            uint16_t frame_crc = (uint16_t) ((rx->buffer[rx->length-2] << 8) | rx->buffer[rx->length-1]);
+            if (frame_crc == rx->crc) {
+                status = (int32_t) rx->length - 2; // omit crc from returned length
             } else {
-                data[w++] = data[r];
+                status = -E_CRC;
             }
         }
+    } else if (b == _DLE && !rx->seen_dle) {
+        rx->seen_dle = true;
+    } else if (rx->length >= rx->size) {
+        rx->overflow = true;
+    } else {
+        if (rx->seen_dle) {
+            rx->seen_dle = false;
+            b ^= _XOR;
+        }
+        /** The last two bytes are the crc until proven otherwise */
+        if (rx->length >= 2) {
+            rx->crc = crc16_add(rx->crc, rx->buffer[rx->length-2]);
+        }
+        rx->buffer[rx->length++] = b;
+    }
 
-        // Then calculate CRC
-        calc_crc = crc16((uint8_t*) data, w - 2);
+    return status;
+}
 
-        frame_crc = (uint16_t) ((data[w-2] << 8) | data[w-1]);
-        if (calc_crc == frame_crc) {
-            status = (int32_t) w - 2; // omit crc from returned length
-        } else {
-            status = -E_CRC;
-        }
-    } while(0);
+void uframe_rx_payload(payload_t *payload, const frame_rx_t *rx, uint32_t length)
+{
+    payload->data = rx->buffer;
+    payload->length = length;
+    payload->unpack_pos = 0;
+}
 
-    if (status >= 0)
-    {
-        memcpy(frame->buffer, data, status);
-        frame->length = status;
+uint32_t payload_unpack8(payload_t *payload, uint8_t *data)
+{
+    if (payload->length >= 1) {
+        payload->length--;
+        *data = payload->data[payload->unpack_pos++];
+        return 1;
     }
 
-    return status;
+    *data = 0;
+    return 0;
+}
+
+uint32_t payload_unpack16(payload_t *payload, uint16_t *data)
+{
+    uint32_t bytes_read;
+    uint8_t u8;
+
+    bytes_read = payload_unpack8(payload, &u8);
+    *data = ((uint16_t) u8) << 8;
+
+    bytes_read += payload_unpack8(payload, &u8);
+    *data |= ((uint16_t) u8);
+
+    return bytes_read;
+}
+
+uint32_t payload_unpack32(payload_t *payload, uint32_t *data)
+{
+    uint32_t bytes_read;
+    uint8_t u8;
+
+    bytes_read = payload_unpack8(payload, &u8);
+    *data = ((uint32_t) u8) << 24;
+
+    bytes_read += payload_unpack8(payload, &u8);
+    *data |= ((uint32_t) u8) << 16;
+
+    bytes_read += payload_unpack8(payload, &u8);
+    *data |= ((uint32_t) u8) << 8;
+
+    bytes_read += payload_unpack8(payload, &u8);
+    *data |= ((uint32_t) u8);
+
+    return bytes_read;
+}
+
+const uint8_t *payload_unpack_bytes(payload_t *payload, uint32_t length)
+{
+    const uint8_t *data = 0;
+    if (payload->length >= length) {
+        data = &payload->data[payload->unpack_pos];
+        payload->unpack_pos += length;
+        payload->length -= length;
+    }
+    return data;
+}
+
+const char *payload_unpack_cstr(payload_t *payload)
+{
+    const char *str = (const char*) &payload->data[payload->unpack_pos];
+    for (uint32_t i = 0; i < payload->length; i++) {
+        if (str[i] == '\0') {
+            payload->unpack_pos += i + 1;
+            payload->length -= i + 1;
+            return str;
+        }
+    }
+    return 0;
 }
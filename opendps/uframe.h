@@ -25,6 +25,8 @@
 #ifndef __UFRAME_H__
 #define __UFRAME_H__
 
+#include <stdint.h>
+#include <stdbool.h>
 #include "dbg_printf.h"
 
 #define _SOF 0x7e
@@ -48,6 +50,31 @@ typedef struct
     uint32_t unpack_pos;
 } frame_t;
 
+/** Room needed to receive a payload of 'size' bytes, the crc is received into
+ *  the buffer too */
+#define UFRAME_RX_SIZE(size) ((size) + 2)
+
+/** Incremental frame receiver. Bytes are unescaped and crc checked as they
+ *  arrive and the payload ends up in 'buffer' without any further copying */
+typedef struct
+{
+    uint8_t *buffer;
+    uint32_t size;
+    uint32_t length; // Unescaped bytes received, including the crc
+    uint16_t crc; // Running crc, lags two bytes behind as those might be the crc
+    bool receiving;
+    bool seen_dle;
+    bool overflow;
+} frame_rx_t;
+
+/** Read only view of a received payload */
+typedef struct
+{
+    const uint8_t *data;
+    uint32_t length; // Bytes left to unpack
+    uint32_t unpack_pos;
+} payload_t;
+
 void set_frame_header(frame_t *frame);
 void end_frame(frame_t *frame);
 void start_frame_unpacking(frame_t *frame);
@@ -69,16 +96,46 @@ uint32_t unpack32(frame_t *frame, uint32_t *data);
 #define UNPACK32(frame, data) unpack32(frame, (uint32_t*) data)
 
 /**
-  * @brief Extract payload from frame following deframing, unescaping and
-  *       crc checking.
-  * @note The frame is processed 'in place', when exiting the payload will be
-  *       the first byte of 'frame'. If the frame contains two valid frames,
-  *       -E_CRC will be returned.
-  * @param frame  the returned processed frame
-  * @param data   the raw data to be processed
-  * @param length length of frame
-  * @retval length of payload or -E_* in case of errors (see uframe.h)
+  * @brief Initialize a frame receiver
+  * @param rx the receiver
+  * @param buffer where received payloads are stored
+  * @param size size of buffer, see UFRAME_RX_SIZE(...)
+  * @retval None
+  */
+void uframe_rx_init(frame_rx_t *rx, uint8_t *buffer, uint32_t size);
+
+/**
+  * @brief Feed a received byte to the frame receiver
+  * @note The payload stays valid in the receiver's buffer until the next byte
+  *       is added.
+  * @param rx the receiver
+  * @param b the received byte
+  * @retval length of payload when a valid frame has been received, 0 while
+  *         receiving or -E_* when a broken frame ended (see uframe.h)
   */
-int32_t uframe_extract_payload(frame_t *frame, uint8_t *data, uint32_t length);
+int32_t uframe_rx_add(frame_rx_t *rx, uint8_t b);
+
+/**
+  * @brief Set up a view of the payload last received by 'rx'
+  * @param payload the view
+  * @param rx the receiver
+  * @param length length of payload as returned by uframe_rx_add(...)
+  * @retval None
+  */
+void uframe_rx_payload(payload_t *payload, const frame_rx_t *rx, uint32_t length);
+
+/** Bounds checked unpacking of received payloads. The value is zero and the
+ *  return value is the number of bytes actually read if the payload is too short */
+uint32_t payload_unpack8(payload_t *payload, uint8_t *data);
+uint32_t payload_unpack16(payload_t *payload, uint16_t *data);
+uint32_t payload_unpack32(payload_t *payload, uint32_t *data);
+/** Returns NULL unless there are 'length' bytes left */
+const uint8_t *payload_unpack_bytes(payload_t *payload, uint32_t length);
+/** Returns NULL unless there is a null terminated string left */
+const char *payload_unpack_cstr(payload_t *payload);
+
+#define PAYLOAD_UNPACK8(payload, data) payload_unpack8(payload, (uint8_t*) data)
+#define PAYLOAD_UNPACK16(payload, data) payload_unpack16(payload, (uint16_t*) data)
+#define PAYLOAD_UNPACK32(payload, data) payload_unpack32(payload, (uint32_t*) data)
 
 #endif // __UFRAME_H__
@@ -169,7 +169,7 @@ struct ui_screen {
     void (*tick)(void); /** Called periodically allowing the UI to do house keeping */
     void (*past_save)(past_t *past);
     void (*past_restore)(past_t *past);
-    set_param_status_t (*set_parameter)(char *name, char *value);
+    set_param_status_t (*set_parameter)(char *name, char *value, bool dry_run); /** Validates only if dry_run is set */
     set_param_status_t (*get_parameter)(char *name, char *value, uint32_t value_len);
     ui_item_t *items[];
 };
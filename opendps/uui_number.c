@@ -24,6 +24,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include "my_assert.h"
 #include "uui_number.h"
 #include "tft.h"
@@ -35,6 +36,9 @@
 
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+/** Marks a highlighted glyph in the damage cache, glyphs are 7 bit ASCII */
+#define CELL_HIGHLIGHT  (0x80)
+
 /** @todo: why is pow missing from my -lm ? */
 static uint32_t my_pow(uint32_t a, uint32_t b)
 {
@@ -186,6 +190,27 @@ static uint32_t number_get_value(ui_item_t *_item)
     return item->value;
 }
 
+/**
+ * @brief      Check if a cell needs to be drawn and remember its new content
+ *
+ * @param      item       The item
+ * @param[in]  cell       The cell index, counted from the left
+ * @param[in]  glyph      The character to draw, ' ' for blank
+ * @param[in]  highlight  True if the cell is highlighted
+ *
+ * @return     true if the cell content differs from what is on screen
+ */
+static bool cell_damaged(ui_number_t *item, uint32_t cell, char glyph, bool highlight)
+{
+    uint8_t drawn = (uint8_t) glyph | (highlight ? CELL_HIGHLIGHT : 0);
+    assert(cell < UI_NUMBER_MAX_CELLS);
+    if (item->drawn_cells[cell] == drawn) {
+        return false;
+    }
+    item->drawn_cells[cell] = drawn;
+    return true;
+}
+
 static void number_draw(ui_item_t *_item)
 {
     ui_number_t *item = (ui_number_t*) _item;
@@ -227,12 +252,21 @@ static void number_draw(ui_item_t *_item)
 
     uint32_t xpos = _item->x;
     uint16_t color = item->color;
+    uint32_t cell = 0;
     uint32_t cur_digit = item->num_digits + item->num_decimals - 1; /** Which digit are we currently drawing? 0 is the right most digit */
 
     /** Adjust drawing position if right aligned */
     if (item->alignment == ui_text_right_aligned)
         xpos -= number_draw_width(_item);
 
+    /** Everything needs drawing if the screen was cleared or inverted or the
+      * colour changed */
+    if (item->drawn_color != color || item->drawn_clear_count != tft_get_clear_count()) {
+        memset(item->drawn_cells, 0, sizeof(item->drawn_cells)); /** 0 never matches a glyph */
+        item->drawn_color = color;
+        item->drawn_clear_count = tft_get_clear_count();
+    }
+
     /** Start printing from left to right */
     for (uint8_t place = item->num_digits; place > 0; place--) {
         /* Example value of 1000 with 5,2:
@@ -252,33 +286,41 @@ static void number_draw(ui_item_t *_item)
         // digit selected
         bool highlight = _item->has_focus && item->cur_digit == cur_digit;
 
-        // Draw background either black, or a highlighted box
-        if (spacing > 1) {
-            if (highlight) {
-                tft_rect(xpos-1, _item->y-1, digit_w+1, h+1, WHITE);
-            } else {
-                tft_rect(xpos-1, _item->y-1, digit_w+1, h+1, BLACK);
-            }
-        }
-
         // Draw the digit, Only if:
         //   value >= this place's min value (ie. digit's power)
         //   in one's place (ensuring 0.xxx has leading 0)
         //   or item has focus (ensures all digits are drawn when focused)
-        if (item->value >= power || place == 1 || _item->has_focus) {
-            // ASCII '0' plus digit value for digit ascii offset
-            tft_putch(item->font_size, '0' + digit, xpos, _item->y, digit_w, h, color, highlight);
-        } else {
-            tft_fill(xpos, _item->y, digit_w, h, BLACK);
+        // ASCII '0' plus digit value for digit ascii offset
+        char glyph = (item->value >= power || place == 1 || _item->has_focus) ? '0' + digit : ' ';
+
+        if (cell_damaged(item, cell, glyph, highlight)) {
+            // Draw background either black, or a highlighted box
+            if (spacing > 1) {
+                if (highlight) {
+                    tft_rect(xpos-1, _item->y-1, digit_w+1, h+1, WHITE);
+                } else {
+                    tft_rect(xpos-1, _item->y-1, digit_w+1, h+1, BLACK);
+                }
+            }
+
+            if (glyph != ' ') {
+                tft_putch(item->font_size, glyph, xpos, _item->y, digit_w, h, color, highlight);
+            } else {
+                tft_fill(xpos, _item->y, digit_w, h, BLACK);
+            }
         }
 
         // next digit position
+        cell++;
         xpos += digit_w + spacing;
     }
 
     /** Draw the decimal point if there are decimal places */
     if (item->num_decimals) {
-        tft_putch(item->font_size, '.', xpos, _item->y, dot_width, h, color, false);
+        if (cell_damaged(item, cell, '.', false)) {
+            tft_putch(item->font_size, '.', xpos, _item->y, dot_width, h, color, false);
+        }
+        cell++;
         xpos += dot_width + spacing;
     }
 
@@ -287,19 +329,25 @@ static void number_draw(ui_item_t *_item)
     for (uint32_t i = 0; i < item->num_decimals; ++i) {
         bool highlight = _item->has_focus && item->cur_digit == cur_digit;
         uint8_t digit = item->value / my_pow(10, (item->si_prefix * -1) -1 - i) % 10;
-        if (spacing > 1) /** Dont frame tiny fonts */
-        {
-            if (highlight) /** Draw an extra pixel wide border around the highlighted item */
-                tft_rect(xpos-1, _item->y-1, digit_w+1, h+1, WHITE);
-            else
-                tft_rect(xpos-1, _item->y-1, digit_w+1, h+1, BLACK);
+        if (cell_damaged(item, cell, '0' + digit, highlight)) {
+            if (spacing > 1) /** Dont frame tiny fonts */
+            {
+                if (highlight) /** Draw an extra pixel wide border around the highlighted item */
+                    tft_rect(xpos-1, _item->y-1, digit_w+1, h+1, WHITE);
+                else
+                    tft_rect(xpos-1, _item->y-1, digit_w+1, h+1, BLACK);
+            }
+            tft_putch(item->font_size, '0' + digit, xpos, _item->y, digit_w, h, color, highlight);
         }
-        tft_putch(item->font_size, '0' + digit, xpos, _item->y, digit_w, h, color, highlight);
         cur_digit--;
+        cell++;
         xpos += digit_w + spacing;
     }
 
-    /** The unit */
+    /** The unit never changes, it only needs drawing when the cache was reset */
+    if (!cell_damaged(item, cell, 'U', false)) {
+        return;
+    }
     switch(item->unit) {
         case unit_none:
             break;
@@ -331,4 +379,7 @@ void number_init(ui_number_t *item)
     item->ui.draw = &number_draw;
     item->cur_digit = item->num_digits + item->num_decimals - 1; /** Most signinficant digit */
     item->ui.needs_redraw = true;
+    /** Digits, decimal point and unit */
+    assert(item->num_digits + item->num_decimals + 2 <= UI_NUMBER_MAX_CELLS);
+    memset(item->drawn_cells, 0, sizeof(item->drawn_cells));
 }
@@ -31,6 +31,9 @@
 #include "tft.h"
 #include "uui.h"
 
+/** Max number of character cells (digits, decimal point and unit) in a number */
+#define UI_NUMBER_MAX_CELLS  (10)
+
 /**
  * A UI item describing an editable number formatted as <num_digits>.<num_decimals>
  * The number has a min and max value and cur_digit keeps track of which digit
@@ -52,6 +55,11 @@ typedef struct ui_number_t {
     int32_t min;
     int32_t max;
     void (*changed)(struct ui_number_t *item);
+    /** Damage tracking, what was last drawn in each cell. Redrawing skips
+      * cells that are unchanged since the last draw. */
+    uint8_t drawn_cells[UI_NUMBER_MAX_CELLS];
+    uint16_t drawn_color;
+    uint32_t drawn_clear_count; /** Cells are lost when the TFT is cleared or inverted */
 } ui_number_t;
 
 /**